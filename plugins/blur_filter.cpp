@@ -1,3 +1,4 @@
+#include "pixel_format.hpp"
 #include "plugin_base.hpp"
 #include "thirdparty/nhlog.h"
 #include <algorithm>
@@ -26,59 +27,67 @@ static PluginInfo plugin_info = {
 
 extern "C" EXPORT PluginInfo *const GET_PLUGIN_INFO() { return &plugin_info; }
 
-extern "C" EXPORT void PLUGIN_REPLACE_IMAGE(EditorState es, Image img,
-                                            void *data) {
-  size_t img_buffer_size =
-      sizeof(uint8_t) * img.width * img.height * img.channels;
-  uint8_t *copy_img_buffer = (uint8_t *)malloc(img_buffer_size);
-  memcpy(copy_img_buffer, img.data, img_buffer_size);
+extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION() {
+  return PLUGIN_ABI_VERSION;
+}
 
+extern "C" EXPORT PluginRegionInfo PLUGIN_REGION_INFO(EditorState es,
+                                                      void *data) {
   int32_t box_size = *(int *)data;
-  for (size_t x = 0; x < img.width; x++) {
-    for (size_t y = 0; y < img.height; y++) {
+  return PluginRegionInfo{.halo = std::max(0, box_size), .thread_safe = true};
+}
 
-      size_t current_index =
-          (static_cast<size_t>(y) * static_cast<size_t>(img.width) +
-           static_cast<size_t>(x)) *
-          static_cast<size_t>(img.channels);
+/*
+ * Box blurs `dst` out of `src`, for one pixel format.
+ */
+template <typename Format>
+static void box_blur(ImageView src, ImageView dst, int32_t box_size) {
+  using T = typename Format::Sample;
+  using Traits = typename Format::Traits;
+  constexpr size_t channels = Format::channels;
+  for (int32_t y = dst.y; y < dst.y + dst.height; y++) {
+    T *dst_pixel = reinterpret_cast<T *>(image_view_pixel(dst, dst.x, y));
+    for (int32_t x = dst.x; x < dst.x + dst.width; x++) {
 
-      // get approximation of neighboring pixels
-      LColor color = {.r = 0, .g = 0, .b = 0, .a = 0};
-      uint8_t count = 0; // number of pixels present in THIS box.
-      int32_t min_x = std::max(0, (int32_t)(x - box_size));
-      int32_t max_x = std::min(img.width, (int32_t)(x + box_size + 1));
-      int32_t min_y = std::max(0, (int32_t)(y - box_size));
-      int32_t max_y = std::min(img.height, (int32_t)(y + box_size + 1));
-      for (int32_t nx = min_x; nx < max_x; nx++) {
-        for (int32_t ny = min_y; ny < max_y; ny++) {
+      // get approximation of neighboring pixels, src only covers the halo
+      // that lies inside the image.
+      typename Traits::Sum sums[channels] = {};
+      uint32_t count = 0; // number of pixels present in THIS box.
+      int32_t min_x = std::max(src.x, x - box_size);
+      int32_t max_x = std::min(src.x + src.width, x + box_size + 1);
+      int32_t min_y = std::max(src.y, y - box_size);
+      int32_t max_y = std::min(src.y + src.height, y + box_size + 1);
+      for (int32_t ny = min_y; ny < max_y; ny++) {
+        const T *src_pixel =
+            reinterpret_cast<const T *>(image_view_pixel(src, min_x, ny));
+        for (int32_t nx = min_x; nx < max_x; nx++) {
           count++;
-          size_t neighboring_index =
-              (static_cast<size_t>(ny) * static_cast<size_t>(img.width) +
-               static_cast<size_t>(nx)) *
-              static_cast<size_t>(img.channels);
-
-          color.r += copy_img_buffer[neighboring_index];
-          color.g += copy_img_buffer[neighboring_index + 1];
-          color.b += copy_img_buffer[neighboring_index + 2];
-          color.a += copy_img_buffer[neighboring_index + 3];
+          for_each_channel<channels>(
+              [&](size_t c) { sums[c] += src_pixel[c]; });
+          src_pixel += channels;
         }
       }
 
       // minimum value of  count should be atleast 1 for division.
-      count = std::max((uint8_t)1, count);
+      count = std::max((uint32_t)1, count);
 
-      Color final_color = {
-          .r = static_cast<uint8_t>(color.r / count),
-          .g = static_cast<uint8_t>(color.g / count),
-          .b = static_cast<uint8_t>(color.b / count),
-          .a = static_cast<uint8_t>(color.a / count),
-      };
-      img.data[current_index] = final_color.r;
-      img.data[current_index + 1] = final_color.g;
-      img.data[current_index + 2] = final_color.b;
-      img.data[current_index + 3] = final_color.a;
+      for_each_channel<channels>(
+          [&](size_t c) { dst_pixel[c] = Traits::from_sum(sums[c], count); });
+      dst_pixel += channels;
     }
   }
+}
+
+extern "C" EXPORT void PLUGIN_REPLACE_REGION(EditorState es, ImageView src,
+                                             ImageView dst, void *data) {
+  int32_t box_size = *(int *)data;
+  dispatch_pixel_format(dst.sample_type, dst.channels,
+                        [&]<typename Format>(Format) {
+                          box_blur<Format>(src, dst, box_size);
+                        });
+}
 
-  free(copy_img_buffer);
+extern "C" EXPORT uint32_t PLUGIN_SAMPLE_TYPES() {
+  return (1u << SAMPLE_TYPE_U8) | (1u << SAMPLE_TYPE_U16) |
+         (1u << SAMPLE_TYPE_F32);
 }
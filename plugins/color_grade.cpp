@@ -0,0 +1,49 @@
+#include "plugin_base.hpp"
+#include <cstdint>
+
+static const uint8_t vars_len = 3;
+
+// names double as the shader's uniforms.
+static VariableMeta vars[vars_len] = {
+    {.name = "exposure",
+     .description = "Brightness in stops",
+     .type = VariableMetaType::TYPE_FLOAT,
+     .default_value = {.default_float = 0.0f},
+     .range = {.min = -4.0f, .max = 4.0f, .step = 0.1f}},
+    {.name = "contrast",
+     .description = "Contrast around middle gray, 1 keeps it",
+     .type = VariableMetaType::TYPE_FLOAT,
+     .default_value = {.default_float = 1.0f},
+     .range = {.min = 0.0f, .max = 4.0f, .step = 0.05f}},
+    {.name = "saturation",
+     .description = "Color saturation, 0 is grayscale",
+     .type = VariableMetaType::TYPE_FLOAT,
+     .default_value = {.default_float = 1.0f},
+     .range = {.min = 0.0f, .max = 4.0f, .step = 0.05f}}};
+
+static PluginInfo plugin_info = {
+    .name = "Color grade",
+    .description = "Exposure, contrast and saturation, on the GPU",
+    .plugin_type = PluginType::PLUGIN_TYPE_SHADER,
+    .vars = vars,
+    .vars_len = vars_len,
+    .icon = {{0}},
+};
+
+static const char *shader_source =
+    "void main() {\n"
+    "  vec4 pixel = texture(image, uv);\n"
+    "  vec3 rgb = pixel.rgb * exp2(exposure);\n"
+    "  rgb = (rgb - 0.5) * contrast + 0.5;\n"
+    "  float luma = dot(rgb, vec3(0.2126, 0.7152, 0.0722));\n"
+    "  rgb = mix(vec3(luma), rgb, saturation);\n"
+    "  color = vec4(clamp(rgb, 0.0, 1.0), pixel.a);\n"
+    "}\n";
+
+extern "C" EXPORT PluginInfo *const GET_PLUGIN_INFO() { return &plugin_info; }
+
+extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION() {
+  return PLUGIN_ABI_VERSION;
+}
+
+extern "C" EXPORT const char *PLUGIN_SHADER_SOURCE() { return shader_source; }
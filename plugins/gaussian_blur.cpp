@@ -0,0 +1,295 @@
+/*
+ * Gaussian blur filter
+ *
+ * Uses the Young / van Vliet recursive (IIR) approximation of the gaussian,
+ * a causal + anti-causal 3rd order filter run along rows and then columns.
+ * Cost per pixel is constant, it does not grow with sigma.
+ *
+ * I. T. Young, L. J. van Vliet, "Recursive implementation of the Gaussian
+ * filter", Signal Processing 44 (1995).
+ * B. Triggs, M. Sdika, "Boundary conditions for Young-van Vliet recursive
+ * filtering", IEEE Trans. Signal Processing 54 (2006).
+ */
+
+#include "pixel_format.hpp"
+#include "plugin_base.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// smallest sigma the recursive coefficients are valid for.
+#define GAUSSIAN_MIN_SIGMA 0.5f
+
+// number of floats processed together by one task in the column pass.
+#define GAUSSIAN_COLUMN_STRIP 64
+
+static const uint8_t vars_len = 1;
+
+static VariableMeta vars[vars_len] = {
+    {.name = "Sigma",
+     .description = "Standard deviation of the gaussian kernel in pixels",
+     .type = VariableMetaType::TYPE_FLOAT,
+     .default_value = {.default_float = 2.0f},
+     .range = {.min = GAUSSIAN_MIN_SIGMA, .max = 500.0f, .step = 0.5f}}};
+
+static const HostServices *host = nullptr;
+
+static PluginInfo plugin_info = {
+    .name = "Gaussian Blur",
+    .description = "Gaussian blur filter, fast for any sigma",
+    .plugin_type = PluginType::PLUGIN_TYPE_REPLACE_IMAGE,
+    .vars = vars,
+    .vars_len = vars_len,
+    .icon = {{0}},
+};
+
+/*
+ * Recursive filter coefficients, normalized by b0, along with the
+ * Triggs-Sdika matrix used to start the backward pass.
+ */
+struct Coefficients {
+  float B, b1, b2, b3;
+  float M[9];
+};
+
+static Coefficients calc_coefficients(float sigma) {
+  double s = static_cast<double>(sigma);
+  double q = s >= 2.5 ? 0.98711 * s - 0.96330
+                      : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * s);
+  double q2 = q * q;
+  double q3 = q2 * q;
+
+  double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+  double b2 = -(1.4281 * q2 + 1.26661 * q3);
+  double b3 = 0.422205 * q3;
+
+  double a1 = b1 / b0, a2 = b2 / b0, a3 = b3 / b0;
+  double scale = 1.0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) *
+                        (1.0 + a2 + (a1 - a3) * a3));
+  double M[9] = {
+      scale * (-a3 * a1 + 1.0 - a3 * a3 - a2),
+      scale * (a3 + a1) * (a2 + a3 * a1),
+      scale * a3 * (a1 + a3 * a2),
+      scale * (a1 + a3 * a2),
+      -scale * (a2 - 1.0) * (a2 + a3 * a1),
+      -scale * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0),
+      scale * (a3 * a1 + a2 + a1 * a1 - a2 * a2),
+      scale * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 -
+               a3 * a2 + a3),
+      scale * a3 * (a1 + a3 * a2),
+  };
+
+  Coefficients c = {
+      .B = static_cast<float>(1.0 - a1 - a2 - a3),
+      .b1 = static_cast<float>(a1),
+      .b2 = static_cast<float>(a2),
+      .b3 = static_cast<float>(a3),
+      .M = {0},
+  };
+  for (size_t i = 0; i < 9; i++) {
+    c.M[i] = static_cast<float>(M[i]);
+  }
+  return c;
+}
+
+/*
+ * Backward pass history past the end of the signal for a constant extension
+ * of the last input sample `last`, given the last three forward outputs.
+ * Writes y[n - 1], y[n] and y[n + 1].
+ */
+static inline void triggs_history(const Coefficients &c, float last, float w0,
+                                  float w1, float w2, float out[3]) {
+  float d0 = w0 - last, d1 = w1 - last, d2 = w2 - last;
+  for (size_t k = 0; k < 3; k++) {
+    out[k] = c.B * (c.M[k * 3] * d0 + c.M[k * 3 + 1] * d1 +
+                    c.M[k * 3 + 2] * d2) +
+             last;
+  }
+}
+
+/*
+ * Runs the forward and backward passes over `n` samples spaced `step` floats
+ * apart, in place. The signal is treated as extended with its edge samples.
+ */
+static void filter_line(float *line, size_t n, size_t step,
+                        const Coefficients &c) {
+  if (n < 2) {
+    return;
+  }
+  const float last = line[(n - 1) * step];
+
+  // forward (causal) pass, a constant history of the first sample is a
+  // fixed point of the normalized filter.
+  float w1 = line[0], w2 = line[0], w3 = line[0];
+  for (size_t i = 0; i < n; i++) {
+    float w = c.B * line[i * step] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+    line[i * step] = w;
+    w3 = w2;
+    w2 = w1;
+    w1 = w;
+  }
+
+  // backward (anti causal) pass
+  float history[3];
+  triggs_history(c, last, w1, w2, w3, history);
+  line[(n - 1) * step] = history[0];
+  float y1 = history[0], y2 = history[1], y3 = history[2];
+  for (size_t i = n - 1; i-- > 0;) {
+    float y = c.B * line[i * step] + c.b1 * y1 + c.b2 * y2 + c.b3 * y3;
+    line[i * step] = y;
+    y3 = y2;
+    y2 = y1;
+    y1 = y;
+  }
+}
+
+/*
+ * Runs the vertical passes over a strip of `strip` contiguous floats of every
+ * row. Whole rows of the strip are updated at once so the inner loop walks
+ * memory linearly and can be vectorized.
+ */
+static void filter_column_strip(float *buffer, size_t rows, size_t row_len,
+                                size_t strip, const Coefficients &c) {
+  if (rows < 2) {
+    return;
+  }
+  float last[GAUSSIAN_COLUMN_STRIP];
+  float past_end[2][GAUSSIAN_COLUMN_STRIP];
+  const float *bottom = buffer + (rows - 1) * row_len;
+  std::copy(bottom, bottom + strip, last);
+
+  // forward (causal) pass, clamped taps read the unchanged first row.
+  for (size_t y = 1; y < rows; y++) {
+    float *cur = buffer + y * row_len;
+    const float *w1 = buffer + (y - 1) * row_len;
+    const float *w2 = buffer + (y >= 2 ? y - 2 : 0) * row_len;
+    const float *w3 = buffer + (y >= 3 ? y - 3 : 0) * row_len;
+    for (size_t i = 0; i < strip; i++) {
+      cur[i] = c.B * cur[i] + c.b1 * w1[i] + c.b2 * w2[i] + c.b3 * w3[i];
+    }
+  }
+
+  // backward (anti causal) pass
+  float *end = buffer + (rows - 1) * row_len;
+  const float *end1 = buffer + (rows >= 2 ? rows - 2 : 0) * row_len;
+  const float *end2 = buffer + (rows >= 3 ? rows - 3 : 0) * row_len;
+  for (size_t i = 0; i < strip; i++) {
+    float history[3];
+    triggs_history(c, last[i], end[i], end1[i], end2[i], history);
+    end[i] = history[0];
+    past_end[0][i] = history[1];
+    past_end[1][i] = history[2];
+  }
+
+  for (size_t y = rows - 1; y-- > 0;) {
+    float *cur = buffer + y * row_len;
+    const float *y1 = buffer + (y + 1) * row_len;
+    const float *y2 =
+        y + 2 < rows ? buffer + (y + 2) * row_len : past_end[0];
+    const float *y3 = y + 3 < rows ? buffer + (y + 3) * row_len
+                                   : past_end[y + 3 - rows];
+    for (size_t i = 0; i < strip; i++) {
+      cur[i] = c.B * cur[i] + c.b1 * y1[i] + c.b2 * y2[i] + c.b3 * y3[i];
+    }
+  }
+}
+
+extern "C" EXPORT PluginInfo *const GET_PLUGIN_INFO() { return &plugin_info; }
+
+extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION() {
+  return PLUGIN_ABI_VERSION;
+}
+
+extern "C" EXPORT void PLUGIN_SET_HOST_SERVICES(const HostServices *services) {
+  host = services;
+}
+
+/*
+ * Rounds a filtered value back to a sample, clamped to the sample range.
+ */
+template <typename T> static inline T to_sample(float v) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return v;
+  } else {
+    return static_cast<T>(
+        std::clamp(v + 0.5f, 0.0f, static_cast<float>(SampleTraits<T>::max)));
+  }
+}
+
+extern "C" EXPORT void PLUGIN_REPLACE_IMAGE(EditorState es, Image img,
+                                            void *data) {
+  float sigma = *(float *)data;
+  if (nullptr == host || !(sigma >= GAUSSIAN_MIN_SIGMA) || img.width <= 0 ||
+      img.height <= 0 || img.channels <= 0) {
+    return;
+  }
+
+  const Coefficients coefficients = calc_coefficients(sigma);
+  const size_t width = static_cast<size_t>(img.width);
+  const size_t height = static_cast<size_t>(img.height);
+  const size_t channels = static_cast<size_t>(img.channels);
+  const size_t row_len = width * channels;
+
+  float *buffer =
+      (float *)host->scratch_alloc(sizeof(float) * row_len * height);
+  if (nullptr == buffer) {
+    host->log(PLUGIN_LOG_ERROR, "out of memory for a %dx%d image", img.width,
+              img.height);
+    return;
+  }
+
+  // horizontal pass, rows are independent of each other.
+  auto filter_row = [&](size_t y) {
+    if (host->is_cancelled()) {
+      return;
+    }
+    float *row = buffer + y * row_len;
+    auto load = [&]<typename T>(std::type_identity<T>) {
+      const T *src = reinterpret_cast<const T *>(img.data) + y * row_len;
+      for (size_t i = 0; i < row_len; i++) {
+        row[i] = static_cast<float>(src[i]);
+      }
+    };
+    dispatch_sample_type(img.sample_type, load);
+    for (size_t c = 0; c < channels; c++) {
+      filter_line(row + c, width, channels, coefficients);
+    }
+  };
+  host_parallel_for(host, height, filter_row);
+  host->report_progress(0.5f);
+  if (host->is_cancelled()) {
+    return;
+  }
+
+  // vertical pass, split into strips of columns.
+  size_t strips = (row_len + GAUSSIAN_COLUMN_STRIP - 1) / GAUSSIAN_COLUMN_STRIP;
+  auto filter_strip = [&](size_t s) {
+    if (host->is_cancelled()) {
+      return;
+    }
+    size_t offset = s * GAUSSIAN_COLUMN_STRIP;
+    size_t strip = std::min(static_cast<size_t>(GAUSSIAN_COLUMN_STRIP),
+                            row_len - offset);
+    filter_column_strip(buffer + offset, height, row_len, strip, coefficients);
+
+    auto store = [&]<typename T>(std::type_identity<T>) {
+      for (size_t y = 0; y < height; y++) {
+        const float *src = buffer + y * row_len + offset;
+        T *dst = reinterpret_cast<T *>(img.data) + y * row_len + offset;
+        for (size_t i = 0; i < strip; i++) {
+          dst[i] = to_sample<T>(src[i]);
+        }
+      }
+    };
+    dispatch_sample_type(img.sample_type, store);
+  };
+  host_parallel_for(host, strips, filter_strip);
+  host->report_progress(1.0f);
+}
+
+extern "C" EXPORT uint32_t PLUGIN_SAMPLE_TYPES() {
+  return (1u << SAMPLE_TYPE_U8) | (1u << SAMPLE_TYPE_U16) |
+         (1u << SAMPLE_TYPE_F32);
+}
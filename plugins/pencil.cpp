@@ -146,3 +146,14 @@ extern "C" EXPORT PluginInfo *const GET_PLUGIN_INFO() { return &plugin_info; }
 extern "C" EXPORT Color PLUGIN_PUT_PIXEL(EditorState es, ZUVec2 pos) {
   return es.primary_selected_color;
 }
+
+extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION() {
+  return PLUGIN_ABI_VERSION;
+}
+
+extern "C" EXPORT void PLUGIN_PUT_PIXEL_SPAN(EditorState es, PixelSpan span,
+                                             Color *out) {
+  for (int32_t i = 0; i < span.length; i++) {
+    out[i] = es.primary_selected_color;
+  }
+}
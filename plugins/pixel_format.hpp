@@ -0,0 +1,296 @@
+/*
+ * Pixel layouts known at compile time, for plugins and the host alike.
+ *
+ * Loops over pixels are written once as templates on a PixelFormat and
+ * instantiated for every layout, dispatch_pixel_format picks the one
+ * matching an image at runtime. Inside the loops the number of channels and
+ * the sample type are constants, so strides are fixed and the compiler can
+ * unroll and vectorize them.
+ */
+
+#pragma once
+
+#include "plugin_base.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Range and conversions of each sample type. `Sum` holds the sum of a few
+ * thousand samples, `max` is full intensity. Unit values are in [0, 1],
+ * from_unit clamps, NaN to 0, and rounds to nearest. Integer samples are
+ * sRGB encoded, float ones `linear` light and unbounded.
+ */
+template <typename T> struct SampleTraits;
+
+template <> struct SampleTraits<uint8_t> {
+  using Sum = uint32_t;
+  static constexpr SampleType type = SAMPLE_TYPE_U8;
+  static constexpr bool linear = false;
+  static constexpr uint8_t max = 255;
+  static constexpr uint8_t from_u8(uint8_t v) { return v; }
+  static constexpr uint8_t to_u8(uint8_t v) { return v; }
+  static constexpr uint8_t from_sum(Sum sum, uint32_t count) {
+    return static_cast<uint8_t>(sum / count);
+  }
+  static constexpr float to_unit(uint8_t v) { return v / 255.0f; }
+  static constexpr uint8_t from_unit(float v) {
+    float clamped = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+    return static_cast<uint8_t>(clamped * 255.0f + 0.5f);
+  }
+};
+
+template <> struct SampleTraits<uint16_t> {
+  using Sum = uint64_t;
+  static constexpr SampleType type = SAMPLE_TYPE_U16;
+  static constexpr bool linear = false;
+  static constexpr uint16_t max = 65535;
+  // 257 maps 255 onto 65535 exactly.
+  static constexpr uint16_t from_u8(uint8_t v) {
+    return static_cast<uint16_t>(v * 257);
+  }
+  static constexpr uint8_t to_u8(uint16_t v) {
+    return static_cast<uint8_t>((v * 255u + 32895u) / 65535u);
+  }
+  static constexpr uint16_t from_sum(Sum sum, uint32_t count) {
+    return static_cast<uint16_t>(sum / count);
+  }
+  static constexpr float to_unit(uint16_t v) { return v / 65535.0f; }
+  static constexpr uint16_t from_unit(float v) {
+    float clamped = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+    return static_cast<uint16_t>(clamped * 65535.0f + 0.5f);
+  }
+};
+
+template <> struct SampleTraits<float> {
+  using Sum = float;
+  static constexpr SampleType type = SAMPLE_TYPE_F32;
+  static constexpr bool linear = true;
+  static constexpr float max = 1.0f;
+  static constexpr float from_u8(uint8_t v) { return v / 255.0f; }
+  static constexpr uint8_t to_u8(float v) {
+    float clamped = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+    return static_cast<uint8_t>(clamped * 255.0f + 0.5f);
+  }
+  static constexpr float from_sum(Sum sum, uint32_t count) {
+    return sum / static_cast<float>(count);
+  }
+  static constexpr float to_unit(float v) { return v; }
+  static constexpr float from_unit(float v) { return v; }
+};
+
+/*
+ * Converts one sample between types, exactly between 8 and 16 bit.
+ */
+template <typename To, typename From>
+static constexpr To convert_sample(From v) {
+  if constexpr (std::is_same_v<To, From>) {
+    return v;
+  } else if constexpr (std::is_same_v<From, uint8_t>) {
+    return SampleTraits<To>::from_u8(v);
+  } else if constexpr (std::is_same_v<To, uint8_t>) {
+    return SampleTraits<From>::to_u8(v);
+  } else {
+    return SampleTraits<To>::from_unit(SampleTraits<From>::to_unit(v));
+  }
+}
+
+/*
+ * sRGB transfer function, from encoded values in [0, 1] to linear light.
+ */
+static inline float srgb_to_linear(float v) {
+  return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+/*
+ * Inverse of srgb_to_linear, values outside [0, 1] are clamped.
+ */
+static inline float linear_to_srgb(float v) {
+  if (!(0.0031308f < v)) {
+    return 0.0f < v ? v * 12.92f : 0.0f;
+  }
+  return v < 1.0f ? 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f : 1.0f;
+}
+
+/*
+ * convert_sample for color samples, which cross the transfer function
+ * between integer and float types. Alpha is linear everywhere and never
+ * does.
+ */
+template <typename To, typename From> static inline To convert_color(From v) {
+  if constexpr (SampleTraits<To>::linear == SampleTraits<From>::linear) {
+    return convert_sample<To>(v);
+  } else if constexpr (SampleTraits<To>::linear) {
+    return srgb_to_linear(SampleTraits<From>::to_unit(v));
+  } else {
+    return SampleTraits<To>::from_unit(linear_to_srgb(v));
+  }
+}
+
+/*
+ * Converts sample `c` of a pixel of `channels` samples, by convert_color
+ * or, for alpha, convert_sample.
+ */
+template <typename To, typename From>
+static inline To convert_channel(From v, size_t c, size_t channels) {
+  bool alpha = 0 == channels % 2 && channels - 1 == c;
+  return alpha ? convert_sample<To>(v) : convert_color<To>(v);
+}
+
+/*
+ * Calls `fn(c)` for every channel c in [0, C), unrolled, so per channel
+ * accumulators stay in registers at any optimization level.
+ */
+template <size_t C, typename F> static inline void for_each_channel(F &&fn) {
+  [&]<size_t... c>(std::index_sequence<c...>) {
+    (fn(c), ...);
+  }(std::make_index_sequence<C>{});
+}
+
+/*
+ * Interleaved pixels of `C` samples of type `T`: 1 is grey, 2 grey and
+ * alpha, 3 RGB and 4 RGBA.
+ */
+template <typename T, size_t C> struct PixelFormat {
+  using Sample = T;
+  using Traits = SampleTraits<T>;
+  static constexpr size_t channels = C;
+  static constexpr bool has_alpha = 0 == C % 2;
+  // channels holding color, every one but alpha.
+  static constexpr size_t color_channels = has_alpha ? C - 1 : C;
+
+  /*
+   * Reads one pixel as 8 bit RGBA, grey spread to RGB and missing alpha
+   * opaque.
+   */
+  static inline Color load(const T *p) {
+    uint8_t r = convert_color<uint8_t>(p[0]), g = r, b = r, a = 255;
+    if constexpr (3 <= C) {
+      g = convert_color<uint8_t>(p[1]);
+      b = convert_color<uint8_t>(p[2]);
+    }
+    if constexpr (has_alpha) {
+      a = Traits::to_u8(p[C - 1]);
+    }
+    return {.r = r, .g = g, .b = b, .a = a};
+  }
+
+  /*
+   * Writes the color channels of an 8 bit RGBA color into one pixel, grey
+   * by luma. Alpha is written too if `with_alpha`.
+   */
+  static inline void store(T *p, Color color, bool with_alpha) {
+    if constexpr (3 <= C) {
+      p[0] = convert_color<T>(color.r);
+      p[1] = convert_color<T>(color.g);
+      p[2] = convert_color<T>(color.b);
+    } else {
+      p[0] = convert_color<T>(static_cast<uint8_t>(
+          (77 * color.r + 150 * color.g + 29 * color.b + 128) >> 8));
+    }
+    if constexpr (has_alpha) {
+      if (with_alpha) {
+        p[C - 1] = Traits::from_u8(color.a);
+      }
+    }
+  }
+
+  /*
+   * Blends the color channels of an 8 bit color over one pixel with
+   * `alpha` in [0, 1], in place of the color's own alpha. Integer samples
+   * mix as they are encoded, unless `linear`. Source-over, the pixel's
+   * colors count by its alpha and the mix is divided by the alpha the two
+   * make together.
+   */
+  static inline void blend(T *p, Color color, float alpha, bool linear) {
+    float kept = 1.0f - alpha;
+    if constexpr (has_alpha) {
+      kept *= Traits::to_unit(p[C - 1]);
+    }
+    float covered = alpha + kept;
+    if (covered <= 0.0f) {
+      return;
+    }
+    float rest = kept / covered;
+    if constexpr (has_alpha) {
+      p[C - 1] = Traits::from_unit(covered);
+    }
+    alpha /= covered;
+    auto mix = [&](T &sample, uint8_t value) {
+      float to = Traits::to_unit(convert_color<T>(value));
+      float from = Traits::to_unit(sample);
+      if constexpr (!Traits::linear) {
+        if (linear) {
+          to = srgb_to_linear(to);
+          from = srgb_to_linear(from);
+          sample = Traits::from_unit(linear_to_srgb(to * alpha + from * rest));
+          return;
+        }
+      }
+      sample = Traits::from_unit(to * alpha + from * rest);
+    };
+    if constexpr (3 <= C) {
+      mix(p[0], color.r);
+      mix(p[1], color.g);
+      mix(p[2], color.b);
+    } else {
+      mix(p[0], static_cast<uint8_t>(
+                    (77 * color.r + 150 * color.g + 29 * color.b + 128) >> 8));
+    }
+  }
+};
+
+/*
+ * Calls `fn(std::type_identity<T>{})` with the sample type T matching
+ * `type`.
+ * @returns false, without calling fn, for unknown types
+ */
+template <typename F>
+static inline bool dispatch_sample_type(SampleType type, F &&fn) {
+  switch (type) {
+  case SAMPLE_TYPE_U8:
+    fn(std::type_identity<uint8_t>{});
+    return true;
+  case SAMPLE_TYPE_U16:
+    fn(std::type_identity<uint16_t>{});
+    return true;
+  case SAMPLE_TYPE_F32:
+    fn(std::type_identity<float>{});
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Calls `fn(PixelFormat<T, C>{})` with the format matching the given sample
+ * type and channel count, the one runtime switch in front of a templated
+ * loop.
+ * @returns false, without calling fn, for layouts there is no format for
+ */
+template <typename F>
+static inline bool dispatch_pixel_format(SampleType type, int32_t channels,
+                                         F &&fn) {
+  bool called = false;
+  dispatch_sample_type(type, [&]<typename T>(std::type_identity<T>) {
+    called = true;
+    switch (channels) {
+    case 1:
+      fn(PixelFormat<T, 1>{});
+      break;
+    case 2:
+      fn(PixelFormat<T, 2>{});
+      break;
+    case 3:
+      fn(PixelFormat<T, 3>{});
+      break;
+    case 4:
+      fn(PixelFormat<T, 4>{});
+      break;
+    default:
+      called = false;
+    }
+  });
+  return called;
+}
@@ -5,10 +5,18 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #define ICON_SIZE 32
 
+// Version of the versioned entry points described at the end of this file.
+// Bumped whenever any of their signatures or structs change.
+#define PLUGIN_ABI_VERSION 6
+
+// Halo value for plugins which need the entire image for every output pixel.
+#define PLUGIN_HALO_UNBOUNDED -1
+
 #if defined(_WIN32) || defined(__CYGWIN__)
 #define EXPORT __declspec(dllexport)
 #else
@@ -37,12 +45,80 @@ struct ZUVec2 {
 };
 
 /*
- * Image
+ * Type of one sample, one channel of one pixel.
+ */
+enum SampleType {
+  SAMPLE_TYPE_U8 = 0,
+  SAMPLE_TYPE_U16 = 1,
+  SAMPLE_TYPE_F32 = 2,
+};
+
+/*
+ * Size in bytes of one sample of the given type.
+ */
+static inline size_t sample_size(SampleType type) {
+  switch (type) {
+  case SAMPLE_TYPE_U16:
+    return sizeof(uint16_t);
+  case SAMPLE_TYPE_F32:
+    return sizeof(float);
+  default:
+    return sizeof(uint8_t);
+  }
+}
+
+/*
+ * Image, `data` holds `channels` samples of `sample_type` per pixel.
  */
 struct Image {
   uint8_t *data;
   int32_t width, height, channels;
   const int32_t components_per_pixel = 4;
+  SampleType sample_type = SAMPLE_TYPE_U8;
+};
+
+/*
+ * Rectangle in image pixel coordinates.
+ */
+struct Rect {
+  int32_t x, y, width, height;
+};
+
+/*
+ * View into the pixels of a rectangle of an image, without owning them.
+ * `x`, `y` are the position of the view's first pixel in the full image and
+ * `stride` is the number of bytes from the start of one row to the next.
+ */
+struct ImageView {
+  uint8_t *data;
+  int32_t x, y;
+  int32_t width, height, channels;
+  size_t stride;
+  SampleType sample_type;
+};
+
+/*
+ * Pointer to the pixel at full image coordinates (x, y), which must lie
+ * inside the view.
+ */
+static inline uint8_t *image_view_pixel(ImageView view, int32_t x, int32_t y) {
+  return view.data + static_cast<size_t>(y - view.y) * view.stride +
+         static_cast<size_t>(x - view.x) *
+             static_cast<size_t>(view.channels) * sample_size(view.sample_type);
+}
+
+/*
+ * A horizontal run of pixels covered by one brush dab.
+ */
+struct PixelSpan {
+  // first pixel of the run, in image coordinates.
+  int32_t x, y;
+  // number of pixels in the run.
+  int32_t length;
+  // center and radius of the dab the run belongs to.
+  int32_t center_x, center_y, radius;
+  // current colors of the `length` pixels of the run.
+  const Color *existing;
 };
 
 /*
@@ -50,10 +126,60 @@ struct Image {
  */
 struct EditorState {
   Color primary_selected_color;
+  // brush opacity in percent, 0 to 100.
   uint8_t opacity;
   int32_t put_pixel_size;
 };
 
+/*
+ * Log levels for `HostServices::log`.
+ */
+enum PluginLogLevel {
+  PLUGIN_LOG_DEBUG = 0,
+  PLUGIN_LOG_INFO,
+  PLUGIN_LOG_WARN,
+  PLUGIN_LOG_ERROR,
+};
+
+/*
+ * Functions the editor provides to plugins, see `PLUGIN_SET_HOST_SERVICES`.
+ * All of them can be called from any thread during a plugin call.
+ */
+struct HostServices {
+  // Allocates `size` bytes of 64 byte aligned scratch memory, valid until the
+  // entry point or parallel_for task which allocated it returns. Backed by a
+  // per thread arena which is reused across calls, so nothing has to be freed
+  // and repeated calls don't allocate. Returns nullptr if out of memory.
+  void *(*scratch_alloc)(size_t size);
+
+  // Runs `fn(index, user)` for every index in [0, count) on the editor's
+  // worker threads, returns once all of them have finished.
+  void (*parallel_for)(size_t count, void (*fn)(size_t index, void *user),
+                       void *user);
+
+  // Reports how much of the current call is done, from 0 to 1.
+  void (*report_progress)(float done);
+
+  // Whether the user asked to cancel the current call. Long running plugins
+  // should check this regularly and return early once it is set.
+  bool (*is_cancelled)();
+
+  // printf style logging through the editor's log.
+  void (*log)(PluginLogLevel level, const char *fmt, ...);
+};
+
+/*
+ * Calls `fn(index)` for every index in [0, count) through
+ * `HostServices::parallel_for`, for any callable `fn`.
+ */
+template <typename F>
+static inline void host_parallel_for(const HostServices *host, size_t count,
+                                     F &fn) {
+  host->parallel_for(
+      count, [](size_t index, void *user) { (*static_cast<F *>(user))(index); },
+      &fn);
+}
+
 /*
  * Types a plugin can be.
  */
@@ -67,6 +193,11 @@ enum PluginType {
   // Like a blur filter. You will need to define a function named
   // `PLUGIN_REPLACE_IMAGE` if the type if set to this.
   PLUGIN_TYPE_REPLACE_IMAGE,
+
+  // This is a type of plugin which runs a GLSL fragment shader over the
+  // entire image on the GPU. Like a color grade. You will need to define a
+  // function named `PLUGIN_SHADER_SOURCE` if the type is set to this.
+  PLUGIN_TYPE_SHADER,
 };
 
 /*
@@ -106,6 +237,20 @@ struct VariableMeta {
   FloatRange range;
 };
 
+/*
+ * Describes how a `PLUGIN_REPLACE_REGION` call reads its source.
+ */
+struct PluginRegionInfo {
+  // Number of pixels around the output region which are read from the
+  // source, or PLUGIN_HALO_UNBOUNDED if every output pixel can depend on the
+  // whole image.
+  int32_t halo;
+
+  // Whether `PLUGIN_REPLACE_REGION` may be called from multiple threads at
+  // the same time for disjoint regions.
+  bool thread_safe;
+};
+
 /*
  * This struct contains the info regarding a single plugin.
  */
@@ -119,7 +264,8 @@ struct PluginInfo {
   // Plugin type
   PluginType plugin_type;
 
-  // this required ONLY for plugin_type::PLUGIN_TYPE_REPLACE_IMAGE
+  // this required ONLY for plugin_type::PLUGIN_TYPE_REPLACE_IMAGE and
+  // plugin_type::PLUGIN_TYPE_SHADER
   // exposes a array of meta data is requires AND wants to render on the ui.
   VariableMeta *vars;
   uint8_t vars_len = 0;
@@ -139,7 +285,8 @@ struct PluginInfo {
 /*
  * if the type of the plugin is `PLUGIN_PUT_PIXEL`, this function will be called
  *  whenever the plugin is used over the image.
- *  The color returned from this will override the pixel color.
+ *  The color returned from this is blended over the pixels of the dab, by its
+ *  alpha, the brush opacity and how much of each pixel the dab covers.
  *
  * extern "C" EXPORT Color PLUGIN_PUT_PIXEL(EditorState es, ZUVec2 pos);
  */
@@ -151,3 +298,77 @@ struct PluginInfo {
  * extern "C" EXPORT void PLUGIN_REPLACE_IMAGE(EditorState es, Image img, void*
  * data);
  */
+
+/*
+ * Versioned entry points.
+ * A plugin exporting any of these must also export
+ *
+ * extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION();
+ *
+ * returning `PLUGIN_ABI_VERSION`, otherwise they are ignored.
+ */
+
+/*
+ * Optional for `PLUGIN_REPLACE_IMAGE` type plugins, and used instead of
+ * `PLUGIN_REPLACE_IMAGE` when present. Writes every pixel of `dst`, reading
+ * from `src`. `src` must not be written to, it covers the same rect as `dst`
+ * grown by the plugin's halo and clamped to the image bounds, and holds the
+ * image as it was before the call. The editor splits the image into regions
+ * and calls this for each of them, in parallel if the plugin is thread safe.
+ *
+ * extern "C" EXPORT void PLUGIN_REPLACE_REGION(EditorState es, ImageView src,
+ * ImageView dst, void *data);
+ */
+
+/*
+ * Required along with `PLUGIN_REPLACE_REGION`. Called before every apply with
+ * the current vars, so the halo can depend on them.
+ *
+ * extern "C" EXPORT PluginRegionInfo PLUGIN_REGION_INFO(EditorState es,
+ * void *data);
+ */
+
+/*
+ * Optional for all plugin types. Called once right after the plugin is
+ * loaded, `services` stays valid until the plugin is unloaded.
+ *
+ * extern "C" EXPORT void PLUGIN_SET_HOST_SERVICES(
+ * const HostServices *services);
+ */
+
+/*
+ * Optional for `PLUGIN_REPLACE_IMAGE` type plugins. Returns the sample types
+ * `PLUGIN_REPLACE_IMAGE` and `PLUGIN_REPLACE_REGION` work on, as a mask of
+ * `1 << SampleType`. Images of any other type are handed to the plugin as
+ * an 8 bit copy, so plugins without it only ever see SAMPLE_TYPE_U8.
+ *
+ * extern "C" EXPORT uint32_t PLUGIN_SAMPLE_TYPES();
+ */
+
+/*
+ * Optional for `PLUGIN_PUT_PIXEL` type plugins, and used instead of
+ * `PLUGIN_PUT_PIXEL` when present. Called once for every row of pixels a dab
+ * covers, and writes the color of each of the `span.length` pixels into
+ * `out`, so brushes can vary per pixel. The colors are blended over the
+ * existing ones like the one `PLUGIN_PUT_PIXEL` returns, alpha 0 leaves a
+ * pixel as it is.
+ *
+ * extern "C" EXPORT void PLUGIN_PUT_PIXEL_SPAN(EditorState es, PixelSpan span,
+ * Color *out);
+ */
+
+/*
+ * Required for `PLUGIN_TYPE_SHADER` type plugins. Returns the body of a GLSL
+ * 1.30 fragment shader, which must define `void main()`. The editor puts the
+ * `#version` line and these declarations in front of it
+ *
+ *   uniform sampler2D image; // the image, row 0 at uv.y = 0
+ *   uniform vec2 image_size; // in pixels
+ *   in vec2 uv;              // where the pixel being written is
+ *   out vec4 color;          // its new value
+ *
+ * along with a uniform for every var, named after the var and of type float,
+ * int or bool by the var's type. Var names must be valid GLSL identifiers.
+ *
+ * extern "C" EXPORT const char *PLUGIN_SHADER_SOURCE();
+ */
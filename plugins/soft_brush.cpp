@@ -0,0 +1,63 @@
+/*
+ * Soft brush, paints the selected color fading out from the center of the
+ * dab to nothing at its edge.
+ */
+
+#include "plugin_base.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+static PluginInfo plugin_info = {
+    .name = "Soft Brush",
+    .description = "Draw with soft edges",
+    .plugin_type = PluginType::PLUGIN_TYPE_PUT_PIXEL,
+    .vars = NULL,
+    .vars_len = 0,
+    .icon = {{0}},
+};
+
+/*
+ * Filled circle for the icon.
+ */
+static void fill_icon() {
+  const int32_t center = ICON_SIZE / 2;
+  const int32_t radius = ICON_SIZE / 2 - 2;
+  for (int32_t y = 0; y < ICON_SIZE; y++) {
+    for (int32_t x = 0; x < ICON_SIZE; x++) {
+      int32_t dx = x - center, dy = y - center;
+      plugin_info.icon[y][x] = dx * dx + dy * dy <= radius * radius;
+    }
+  }
+}
+
+extern "C" EXPORT PluginInfo *const GET_PLUGIN_INFO() {
+  static bool icon_filled = false;
+  if (!icon_filled) {
+    fill_icon();
+    icon_filled = true;
+  }
+  return &plugin_info;
+}
+
+extern "C" EXPORT uint32_t GET_PLUGIN_ABI_VERSION() {
+  return PLUGIN_ABI_VERSION;
+}
+
+extern "C" EXPORT void PLUGIN_PUT_PIXEL_SPAN(EditorState es, PixelSpan span,
+                                             Color *out) {
+  const Color color = es.primary_selected_color;
+  const float radius = static_cast<float>(std::max(1, span.radius));
+  const float dy = static_cast<float>(span.y - span.center_y);
+
+  for (int32_t i = 0; i < span.length; i++) {
+    float dx = static_cast<float>(span.x + i - span.center_x);
+    float dist = std::min(1.0f, std::sqrt(dx * dx + dy * dy) / radius);
+    // smoothstep falloff, 1 at the center and 0 at the edge.
+    float t = 1.0f - dist * dist * (3.0f - 2.0f * dist);
+
+    // the editor blends it over the existing color by alpha.
+    out[i] = color;
+    out[i].a = static_cast<uint8_t>(static_cast<float>(color.a) * t + 0.5f);
+  }
+}
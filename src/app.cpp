@@ -1,5 +1,6 @@
 #include "app.hpp"
 #include "src/editor.hpp"
+#include "src/config.hpp"
 #include "src/plugins_manager.hpp"
 #include <cstdlib>
 
@@ -8,10 +9,15 @@ App *App::global_app_context = nullptr;
 /*
  * Initializes all components of the application.
  */
-App::App() : ui(UI()), editor(Editor()), plugins_manager(PluginManager()) {
+App::App()
+    : thread_pool(THREAD_POOL_THREADS), ui(UI()), editor(Editor()),
+      plugins_manager(PluginManager()) {
   if (nullptr == global_app_context) {
     global_app_context = this;
   }
+  if (nullptr == ThreadPool::shared) {
+    ThreadPool::shared = &this->thread_pool;
+  }
 }
 
 /*
@@ -25,6 +31,8 @@ App::~App() {}
  */
 const std::int32_t App::run() {
   while (!ui.should_close()) {
+    plugins_manager.poll_reload();
+    editor.poll_job();
     ui.update();
   }
   return EXIT_SUCCESS;
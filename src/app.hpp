@@ -2,11 +2,14 @@
 
 #include "src/editor.hpp"
 #include "src/plugins_manager.hpp"
+#include "src/thread_pool.hpp"
 #include "src/ui.hpp"
 #include <cstdint>
 
 class App {
 public:
+  // first, so it outlives everything queueing work on it.
+  ThreadPool thread_pool;
   UI ui;
   Editor editor;
   PluginManager plugins_manager;
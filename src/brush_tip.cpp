@@ -0,0 +1,123 @@
+#include "src/brush_tip.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Builds the mask, see BrushTipCache::get.
+ */
+static std::shared_ptr<const BrushTip> build_tip(int32_t radius,
+                                                 int32_t hardness,
+                                                 int32_t sub_x, int32_t sub_y,
+                                                 bool antialias) {
+  auto tip = std::make_shared<BrushTip>();
+  tip->radius = radius;
+  tip->size = 2 * radius + 3;
+  size_t size = static_cast<size_t>(tip->size);
+  tip->coverage.assign(size * size, 0);
+  tip->row_first.assign(size, 0);
+  tip->row_end.assign(size, 0);
+
+  const float r = static_cast<float>(radius);
+  const float inner = r * static_cast<float>(hardness) / 100.0f;
+  // center relative to the middle of its pixel.
+  const float steps = static_cast<float>(BRUSH_TIP_SUBPIXEL_STEPS);
+  const float cx = static_cast<float>(sub_x) / steps - 0.5f;
+  const float cy = static_cast<float>(sub_y) / steps - 0.5f;
+  for (int32_t y = 0; y < tip->size; y++) {
+    float dy = static_cast<float>(y - radius - 1) - cy;
+    int32_t first = tip->size, end = 0;
+    for (int32_t x = 0; x < tip->size; x++) {
+      float dx = static_cast<float>(x - radius - 1) - cx;
+      float d = std::sqrt(dx * dx + dy * dy);
+      // hard dabs end at the radius, soft ones fade out over one more
+      // pixel.
+      float edge = antialias ? std::clamp(r + 1.0f - d, 0.0f, 1.0f)
+                             : (d <= r ? 1.0f : 0.0f);
+      float falloff = 1.0f;
+      if (inner < d && inner < r) {
+        // smoothstep, 1 at `inner` and 0 at the radius.
+        float t = std::min(1.0f, (d - inner) / (r - inner));
+        falloff = 1.0f - t * t * (3.0f - 2.0f * t);
+      }
+      auto value = static_cast<uint8_t>(edge * falloff * 255.0f + 0.5f);
+      tip->coverage[static_cast<size_t>(y) * size + static_cast<size_t>(x)] =
+          value;
+      if (0 != value) {
+        first = std::min(first, x);
+        end = x + 1;
+      }
+    }
+    tip->row_first[static_cast<size_t>(y)] = std::min(first, end);
+    tip->row_end[static_cast<size_t>(y)] = end;
+  }
+  return tip;
+}
+
+/*
+ * Constructor, empty.
+ */
+BrushTipCache::BrushTipCache() : bytes(0) {}
+
+/*
+ * Mask of a dab, see BrushTip.
+ * @param hardness - percent of the radius fully covered, the rest falls off
+ * smoothly
+ * @param sub_x, sub_y - where in its pixel the center lies, in steps of
+ * 1 / BRUSH_TIP_SUBPIXEL_STEPS
+ * @param antialias - whether the edge is soft, or pixels are either in or
+ * out
+ */
+std::shared_ptr<const BrushTip> BrushTipCache::get(int32_t radius,
+                                                   int32_t hardness,
+                                                   int32_t sub_x,
+                                                   int32_t sub_y,
+                                                   bool antialias) {
+  radius = std::max(0, radius);
+  hardness = std::clamp(hardness, 0, 100);
+  sub_x = std::clamp(sub_x, 0, BRUSH_TIP_SUBPIXEL_STEPS - 1);
+  sub_y = std::clamp(sub_y, 0, BRUSH_TIP_SUBPIXEL_STEPS - 1);
+  uint64_t key = static_cast<uint64_t>(radius) << 32 |
+                 static_cast<uint64_t>(hardness) << 24 |
+                 static_cast<uint64_t>(sub_x) << 16 |
+                 static_cast<uint64_t>(sub_y) << 8 |
+                 static_cast<uint64_t>(antialias);
+
+  auto found = this->index.find(key);
+  if (this->index.end() != found) {
+    this->entries.splice(this->entries.begin(), this->entries, found->second);
+    return found->second->tip;
+  }
+
+  auto tip = build_tip(radius, hardness, sub_x, sub_y, antialias);
+  this->entries.push_front(Entry{.key = key, .tip = tip});
+  this->index[key] = this->entries.begin();
+  this->bytes += tip->coverage.size();
+  // the newest mask stays, however large.
+  while (BRUSH_TIP_CACHE_BYTES < this->bytes && 1 < this->entries.size()) {
+    const Entry &oldest = this->entries.back();
+    this->bytes -= oldest.tip->coverage.size();
+    this->index.erase(oldest.key);
+    this->entries.pop_back();
+  }
+  nhlog_trace("BrushTipCache: built radius %d hardness %d at %d, %d, %zu "
+              "masks take %zu bytes",
+              radius, hardness, sub_x, sub_y, this->entries.size(),
+              this->bytes);
+  return tip;
+}
+
+/*
+ * Drops every mask.
+ */
+void BrushTipCache::clear() {
+  this->entries.clear();
+  this->index.clear();
+  this->bytes = 0;
+}
+
+/*
+ * Bytes the cached masks take.
+ */
+size_t BrushTipCache::size() const { return this->bytes; }
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Coverage of the pixels around a dab, out of 255.
+ *
+ * The mask is `size` pixels square. Its top left pixel sits `radius + 1`
+ * pixels up and left of the pixel the dab's center lies in, so it holds
+ * the soft rim one pixel past the radius too.
+ */
+struct BrushTip {
+  int32_t radius;
+  int32_t size;
+  std::vector<uint8_t> coverage;
+  // first and one past the last column of each row with any coverage,
+  // equal for empty rows.
+  std::vector<int32_t> row_first, row_end;
+};
+
+/*
+ * Brush tip masks by radius, hardness and where in its pixel the dab's
+ * center lies, built on first use and shared by every dab after.
+ *
+ * Offsets within the pixel are rounded to BRUSH_TIP_SUBPIXEL_STEPS steps
+ * either way. The least recently used masks are dropped once they take
+ * more than BRUSH_TIP_CACHE_BYTES.
+ */
+class BrushTipCache {
+private:
+  struct Entry {
+    uint64_t key;
+    std::shared_ptr<const BrushTip> tip;
+  };
+  // most recently used first.
+  std::list<Entry> entries;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+  size_t bytes;
+
+public:
+  /*
+   * Constructor, empty.
+   */
+  BrushTipCache();
+
+  /*
+   * Mask of a dab, see BrushTip.
+   * @param hardness - percent of the radius fully covered, the rest falls
+   * off smoothly
+   * @param sub_x, sub_y - where in its pixel the center lies, in steps of
+   * 1 / BRUSH_TIP_SUBPIXEL_STEPS
+   * @param antialias - whether the edge is soft, or pixels are either in or
+   * out
+   */
+  std::shared_ptr<const BrushTip> get(int32_t radius, int32_t hardness,
+                                      int32_t sub_x, int32_t sub_y,
+                                      bool antialias);
+
+  /*
+   * Drops every mask.
+   */
+  void clear();
+
+  /*
+   * Bytes the cached masks take.
+   */
+  size_t size() const;
+};
@@ -1,7 +1,13 @@
 #include "common.hpp"
 #include "glad/glad.h"
 #include "imgui.h"
+#include "pixel_format.hpp"
+#include "src/pixel_kernels.hpp"
+#include "src/thread_pool.hpp"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
 ImVec4 ColorToImVec4(Color c) {
@@ -17,27 +23,172 @@ Color ImVec4ToColor(ImVec4 c) {
                .a = static_cast<uint8_t>(c.w * 255.0)};
 }
 
-[[nodiscard]] std::vector<Vec2<std::int32_t>>
-get_surrounding_pixels(Vec2<std::int32_t> &center_pos,
-                       int32_t surround_circle_radius, Image &img) {
+void parallel_for(size_t count, const std::function<void(size_t)> &fn) {
+  // inline until a pool is set up.
+  if (nullptr == ThreadPool::shared) {
+    for (size_t i = 0; i < count; i++) {
+      fn(i);
+    }
+    return;
+  }
+  ThreadPool::shared->parallel_for(count, fn);
+}
+
+[[nodiscard]] std::vector<Rect> split_into_tiles(Rect rect, int32_t tile_size) {
+  std::vector<Rect> tiles;
+  for (int32_t y = rect.y; y < rect.y + rect.height; y += tile_size) {
+    for (int32_t x = rect.x; x < rect.x + rect.width; x += tile_size) {
+      tiles.push_back(Rect{
+          .x = x,
+          .y = y,
+          .width = std::min(tile_size, rect.x + rect.width - x),
+          .height = std::min(tile_size, rect.y + rect.height - y),
+      });
+    }
+  }
+  return tiles;
+}
 
-  std::int32_t radius_sqr = surround_circle_radius * surround_circle_radius;
-  std::vector<Vec2<std::int32_t>> vec;
-  auto min_x = std::max(center_pos.x - surround_circle_radius, 0);
-  auto max_x = std::min(center_pos.x + surround_circle_radius, img.width - 1);
+[[nodiscard]] ImageView image_view(Image &img, Rect rect) {
+  ImageView view = {
+      .data = nullptr,
+      .x = rect.x,
+      .y = rect.y,
+      .width = rect.width,
+      .height = rect.height,
+      .channels = img.channels,
+      .stride = static_cast<size_t>(img.width) * pixel_size(img),
+      .sample_type = img.sample_type,
+  };
+  view.data = img.data + static_cast<size_t>(rect.y) * view.stride +
+              static_cast<size_t>(rect.x) * pixel_size(img);
+  return view;
+}
 
-  auto min_y = std::max(center_pos.y - surround_circle_radius, 0);
-  auto max_y = std::max(center_pos.y + surround_circle_radius, img.width - 1);
+[[nodiscard]] ImageView sub_view(ImageView view, Rect rect) {
+  ImageView sub = view;
+  sub.data = image_view_pixel(view, rect.x, rect.y);
+  sub.x = rect.x;
+  sub.y = rect.y;
+  sub.width = rect.width;
+  sub.height = rect.height;
+  return sub;
+}
 
-  for (std::int32_t y = min_y; y <= max_y; ++y) {
-    for (std::int32_t x = min_x; x <= max_x; ++x) {
-      std::int32_t dx = x - center_pos.x;
-      std::int32_t dy = y - center_pos.y;
-      if (dx * dx + dy * dy <= radius_sqr) {
-        vec.push_back(Vec2(x, y));
+void copy_view(ImageView src, ImageView dst) {
+  size_t row_size = static_cast<size_t>(src.width) *
+                    static_cast<size_t>(src.channels) *
+                    sample_size(src.sample_type);
+  for (int32_t y = 0; y < src.height; y++) {
+    memcpy(dst.data + static_cast<size_t>(y) * dst.stride,
+           src.data + static_cast<size_t>(y) * src.stride, row_size);
+  }
+}
+
+/*
+ * Converts every sample of `src` into `dst`, of the given types.
+ */
+template <typename S, typename D>
+static void convert_samples(ImageView src, ImageView dst) {
+  size_t channels = static_cast<size_t>(src.channels);
+  size_t count = static_cast<size_t>(src.width) * channels;
+  parallel_for(static_cast<size_t>(src.height), [&](size_t y) {
+    const S *in = reinterpret_cast<const S *>(src.data + y * src.stride);
+    D *out = reinterpret_cast<D *>(dst.data + y * dst.stride);
+    // 8 bit to float and back are common enough for their own kernels.
+    if constexpr (std::is_same_v<S, uint8_t> && std::is_same_v<D, float>) {
+      pixel_kernels().decode_srgb(in, out, channels,
+                                  static_cast<size_t>(src.width));
+    } else if constexpr (std::is_same_v<S, float> &&
+                         std::is_same_v<D, uint8_t>) {
+      pixel_kernels().encode_srgb(in, out, channels,
+                                  static_cast<size_t>(src.width));
+    } else if constexpr (SampleTraits<S>::linear ==
+                         SampleTraits<D>::linear) {
+      for (size_t i = 0; i < count; i++) {
+        out[i] = convert_sample<D>(in[i]);
+      }
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        out[i] = convert_channel<D>(in[i], i % channels, channels);
       }
     }
+  });
+}
+
+void convert_view(ImageView src, ImageView dst) {
+  if (src.sample_type == dst.sample_type) {
+    copy_view(src, dst);
+    return;
   }
+  dispatch_sample_type(src.sample_type, [&](auto src_type) {
+    dispatch_sample_type(dst.sample_type, [&](auto dst_type) {
+      convert_samples<typename decltype(src_type)::type,
+                      typename decltype(dst_type)::type>(src, dst);
+    });
+  });
+}
+
+[[nodiscard]] size_t pixel_size(const Image &img) {
+  return static_cast<size_t>(img.channels) * sample_size(img.sample_type);
+}
+
+[[nodiscard]] size_t image_size(const Image &img) {
+  return static_cast<size_t>(img.width) * static_cast<size_t>(img.height) *
+         pixel_size(img);
+}
+
+[[nodiscard]] TextureFormat texture_format(int32_t channels,
+                                           SampleType sample_type) {
+  static const GLint internal_formats[][4] = {
+      {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8},
+      {GL_R16, GL_RG16, GL_RGB16, GL_RGBA16},
+      {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F},
+  };
+  static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  static const GLenum types[] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT,
+                                 GL_FLOAT};
+  size_t c = static_cast<size_t>(std::clamp(channels, 1, 4) - 1);
+  size_t t = static_cast<size_t>(sample_type);
+  return TextureFormat{.internal_format = internal_formats[t][c],
+                       .format = formats[c],
+                       .type = types[t]};
+}
+
+void set_texture_swizzle(int32_t channels) {
+  GLint grey_alpha[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+  GLint grey[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+  GLint rgba[] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                   1 == channels   ? grey
+                   : 2 == channels ? grey_alpha
+                                   : rgba);
+}
 
-  return vec;
+[[nodiscard]] Rect grow_rect(Rect rect, int32_t by, Rect bounds) {
+  int32_t min_x = std::max(rect.x - by, bounds.x);
+  int32_t min_y = std::max(rect.y - by, bounds.y);
+  int32_t max_x = std::min(rect.x + rect.width + by, bounds.x + bounds.width);
+  int32_t max_y = std::min(rect.y + rect.height + by, bounds.y + bounds.height);
+  return Rect{.x = min_x,
+              .y = min_y,
+              .width = std::max(0, max_x - min_x),
+              .height = std::max(0, max_y - min_y)};
+}
+
+[[nodiscard]] Rect union_rect(Rect a, Rect b) {
+  if (a.width <= 0 || a.height <= 0) {
+    return b;
+  }
+  if (b.width <= 0 || b.height <= 0) {
+    return a;
+  }
+  int32_t min_x = std::min(a.x, b.x);
+  int32_t min_y = std::min(a.y, b.y);
+  int32_t max_x = std::max(a.x + a.width, b.x + b.width);
+  int32_t max_y = std::max(a.y + a.height, b.y + b.height);
+  return Rect{.x = min_x,
+              .y = min_y,
+              .width = max_x - min_x,
+              .height = max_y - min_y};
 }
@@ -4,6 +4,8 @@
 #include "imgui.h"
 #include "plugin_base.hpp"
 #include <cmath>
+#include <cstddef>
+#include <functional>
 #include <vector>
 
 #ifndef BREAKPOINT
@@ -66,6 +68,80 @@ public:
   ImVec2 to_imvec2() { return ImVec2((float)this->x, (float)this->y); }
 };
 
-[[nodiscard]] std::vector<Vec2<std::int32_t>>
-get_surrounding_pixels(Vec2<std::int32_t> &center_pos,
-                       int32_t surround_circle_radius, Image &img);
+/*
+ * A horizontal run of pixels.
+ */
+struct RowSpan {
+  std::int32_t x, y, length;
+};
+
+/*
+ * Runs `fn(i)` for every i in [0, count), spread across the shared thread
+ * pool, see ThreadPool. Returns once all of them have finished.
+ */
+void parallel_for(size_t count, const std::function<void(size_t)> &fn);
+
+/*
+ * Splits the given rect into tiles of at most tile_size x tile_size pixels.
+ */
+[[nodiscard]] std::vector<Rect> split_into_tiles(Rect rect, int32_t tile_size);
+
+/*
+ * View of the given rect of the image.
+ */
+[[nodiscard]] ImageView image_view(Image &img, Rect rect);
+
+/*
+ * View of the given rect of another view, in full image coordinates.
+ */
+[[nodiscard]] ImageView sub_view(ImageView view, Rect rect);
+
+/*
+ * Copies the pixels of one view into another of the same size.
+ */
+void copy_view(ImageView src, ImageView dst);
+
+/*
+ * Same as above, converting the samples when the views differ in type.
+ */
+void convert_view(ImageView src, ImageView dst);
+
+/*
+ * Bytes per pixel of the image.
+ */
+[[nodiscard]] size_t pixel_size(const Image &img);
+
+/*
+ * Bytes of all the pixels of the image.
+ */
+[[nodiscard]] size_t image_size(const Image &img);
+
+/*
+ * How pixels of the given layout are passed to and stored by GL.
+ */
+struct TextureFormat {
+  GLint internal_format;
+  GLenum format, type;
+};
+
+/*
+ * Texture format for pixels of `channels` samples of `sample_type`. Grey
+ * uses the red and green channels, see set_texture_swizzle.
+ */
+[[nodiscard]] TextureFormat texture_format(int32_t channels,
+                                           SampleType sample_type);
+
+/*
+ * Makes the bound texture show grey pixels as grey, no-op for RGB(A).
+ */
+void set_texture_swizzle(int32_t channels);
+
+/*
+ * Grows the rect by `by` pixels on every side, clamped to `bounds`.
+ */
+[[nodiscard]] Rect grow_rect(Rect rect, int32_t by, Rect bounds);
+
+/*
+ * Smallest rect covering both, empty rects cover nothing.
+ */
+[[nodiscard]] Rect union_rect(Rect a, Rect b);
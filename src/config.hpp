@@ -19,6 +19,7 @@
 #define UI_IMAGE_MIN_SCALE 0.15f
 #define UI_IMAGE_SCROLL_RATE                                                   \
   10.0f / 100.0f // % of image to move when scrolled horizontally or vertically
+#define UI_DEFAULT_EXPRESSION "r = g * 0.5 + b * 0.5"
 
 #define UI_SWATCH_1 1.0f, 1.0f, 1.0f, 1.0f
 #define UI_SWATCH_2 0.0f, 0.0f, 0.0f, 1.0f
@@ -38,6 +39,8 @@
 #define PATH_RESOURCES_DIR "../resources"
 #define PATH_FONT_FILE PATH_RESOURCES_DIR PATH_SEPERATOR "Cousine-Regular.ttf"
 #define PATH_PLUGINS_DIR "./plugins"
+#define PATH_PLUGIN_MANIFEST_FILE                                              \
+  PATH_PLUGINS_DIR PATH_SEPERATOR "manifest.cache" // cached plugin infos
 
 // Colors
 #define COLOR_PRIMARY_BACKGROUND                                               \
@@ -57,3 +60,29 @@
 #define EDITOR_LERP_STEP_SPACING_PERCENT                                       \
   95.0 // higher value = better performance but worse results
 #define EDITOR_PUT_PIXEL_DELAY_MS 50
+#define EDITOR_TILE_SIZE 256 // size of tiles region plugins are run over
+#define PNG_WRITER_COMPRESSION 8 // zlib level of saved 16 bit images
+#define EXPRESSION_BLOCK_SIZE 256 // pixels an expression register holds
+#define EXPRESSION_MAX_REGISTERS 64
+#define EXPRESSION_MAX_LENGTH 1024 // of the expression text box
+#define PREVIEW_DEBOUNCE_MS 30 // least time between cancelling preview runs
+#define PREVIEW_PROXY_MAX_PIXELS (512 * 512) // first, quick preview pass
+#define PREVIEW_FULL_MAX_PIXELS                                                \
+  (2048 * 2048) // larger views are previewed downsampled
+#define TONE_MAP_TILE_SIZE 256 // float images are mapped for display by tile
+#define TONE_MAP_WHITE 4.0f // linear value, after exposure, shown as white
+#define TONE_MAP_MAX_STOPS 10.0f // exposure range, either way
+#define BRUSH_TIP_SUBPIXEL_STEPS 4 // dab positions within a pixel, each way
+#define BRUSH_TIP_CACHE_BYTES (32 << 20) // masks kept for reuse
+#define LAYER_TILE_SIZE 256 // layers are flattened for display by tile
+#define FILTER_CHAIN_TILE_SIZE 128 // adjustments run fused by tile, in cache
+#define FILTER_CHAIN_MAX_HALO 4 // overlap fused chunks may recompute, each way
+#define SELECTION_SUBSAMPLES 4 // rows sampled per pixel at selection edges
+
+// Threads
+#define THREAD_POOL_THREADS 0 // workers of the shared pool, 0 picks for you
+
+// Plugins
+#define PLUGIN_RELOAD_DEBOUNCE_MS 250 // wait for changed plugin files to settle
+#define ICON_ATLAS_COLUMNS 8 // icons per row of the plugin icon atlas
+#define PLUGIN_SANDBOX_TIMEOUT_MS 30000 // isolated calls taking longer fail
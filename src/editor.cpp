@@ -2,7 +2,17 @@
 #include "imgui.h"
 #include "internal.h"
 #include "nhlog.h"
+#include "pixel_format.hpp"
+#include "src/config.hpp"
+#include "src/pixel_kernels.hpp"
+#include "src/png_writer.hpp"
+#include "src/thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <filesystem>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -11,7 +21,15 @@
 /*
  * Constructor
  */
-Editor::Editor() {
+Editor::Editor()
+    : brush_hardness(100), brush_antialias(true), brush_linear_light(false),
+      shader_preview(false), texture_generation(0),
+      display_rect({.x = 0, .y = 0, .width = 0, .height = 0}),
+      dabs_rect({.x = 0, .y = 0, .width = 0, .height = 0}), job_finished(false),
+      job_data(nullptr),
+      job_read({.x = 0, .y = 0, .width = 0, .height = 0}),
+      job_area({.x = 0, .y = 0, .width = 0, .height = 0}),
+      job_succeeded(false) {
   nhlog_debug("Editor: init");
   this->img.data = nullptr;
   this->img.width = this->img.height = this->img.channels = 0;
@@ -26,6 +44,7 @@ Editor::Editor() {
  */
 Editor::~Editor() {
   nhlog_info("Editor: destroying");
+  this->stop_job();
   this->unload_image();
 }
 
@@ -37,17 +56,37 @@ Editor::~Editor() {
 bool Editor::load_image(const char *const path) {
   nhlog_debug("Editor: load_image(path = %s)", path);
   this->unload_image();
-  this->img.data = stbi_load(path, &this->img.width, &this->img.height,
-                             &this->img.channels, 0);
+  // Radiance files are kept as linear float, shown through the tone map.
+  // 16 bit files are kept at 16 bit, and saved that way.
+  if (stbi_is_hdr(path)) {
+    this->img.data = reinterpret_cast<uint8_t *>(
+        stbi_loadf(path, &this->img.width, &this->img.height,
+                   &this->img.channels, 0));
+    this->img.sample_type = SAMPLE_TYPE_F32;
+    this->tone_map.set_exposure(0.0f);
+  } else if (stbi_is_16_bit(path)) {
+    this->img.data = reinterpret_cast<uint8_t *>(
+        stbi_load_16(path, &this->img.width, &this->img.height,
+                     &this->img.channels, 0));
+    this->img.sample_type = SAMPLE_TYPE_U16;
+  } else {
+    this->img.data = stbi_load(path, &this->img.width, &this->img.height,
+                               &this->img.channels, 0);
+    this->img.sample_type = SAMPLE_TYPE_U8;
+  }
 
   if (nullptr == this->img.data) {
     return false;
   }
+  // stb allocates with malloc, the layers free with free.
+  this->layers.reset(this->img);
+  this->selection.reset(this->img.width, this->img.height);
+  this->show_active_layer();
 
   nhlog_debug("Editor: loaded image = %s, width = %d, height = %d, channels = "
-              "%d, components_per_pixel = %d",
+              "%d, bytes per sample = %zu",
               path, this->img.width, this->img.height, this->img.channels,
-              this->img.components_per_pixel);
+              sample_size(this->img.sample_type));
 
   this->regen_texture();
   return true;
@@ -57,11 +96,16 @@ bool Editor::load_image(const char *const path) {
  * Unloads the current loaded image.
  */
 void Editor::unload_image() {
+  this->stop_job();
+  this->filter_preview.stop();
   if (nullptr != this->img.data) {
     nhlog_debug("Editor: unloading existing image data.");
-    stbi_image_free(this->img.data);
+    this->adjustments.clear();
+    this->layers.clear();
+    this->selection.reset(0, 0);
     this->img.data = nullptr;
     glDeleteTextures(1, &this->texture.texture_id);
+    this->tone_map.clear();
   }
 }
 
@@ -71,10 +115,54 @@ void Editor::unload_image() {
 void Editor::save_image(const char *const path) {
   nhlog_debug("Editor: saving image");
 
-  if (!stbi_write_png(path, static_cast<int>(this->img.width),
-                      static_cast<int>(this->img.height),
-                      static_cast<int>(this->img.channels), this->img.data,
-                      0)) {
+  // float images keep their float pixels in Radiance files, anything else
+  // gets them as shown.
+  SampleType sample_type = this->img.sample_type;
+  bool hdr = SAMPLE_TYPE_F32 == sample_type &&
+             ".hdr" == std::filesystem::path(path).extension();
+  if (SAMPLE_TYPE_F32 == sample_type && !hdr) {
+    sample_type = SAMPLE_TYPE_U8;
+  }
+
+  // save what is shown, the layers adjusted and flattened. The preview
+  // only exists on the GPU.
+  this->evaluate_adjustments(this->bounds(), true);
+  this->layers.flatten(this->bounds());
+  const uint8_t *data = this->layers.composite().data;
+  std::vector<uint8_t> preview;
+  if (this->shader_preview) {
+    preview.resize(static_cast<size_t>(this->img.width) *
+                   static_cast<size_t>(this->img.height) *
+                   static_cast<size_t>(this->img.channels) *
+                   sample_size(sample_type));
+    this->shader_filter.read_back(preview.data(), this->img.channels,
+                                  sample_type);
+    data = preview.data();
+  } else if (sample_type != this->img.sample_type) {
+    this->refresh_display(this->bounds());
+    data = this->tone_map.view().data;
+  }
+
+  bool saved = false;
+  switch (sample_type) {
+  case SAMPLE_TYPE_U8:
+    saved = 0 != stbi_write_png(path, static_cast<int>(this->img.width),
+                                static_cast<int>(this->img.height),
+                                static_cast<int>(this->img.channels), data, 0);
+    break;
+  case SAMPLE_TYPE_U16:
+    saved = write_png_16(path, this->img.width, this->img.height,
+                         this->img.channels,
+                         reinterpret_cast<const uint16_t *>(data));
+    break;
+  case SAMPLE_TYPE_F32:
+    saved = 0 != stbi_write_hdr(path, static_cast<int>(this->img.width),
+                                static_cast<int>(this->img.height),
+                                static_cast<int>(this->img.channels),
+                                reinterpret_cast<const float *>(data));
+    break;
+  }
+  if (!saved) {
     // app_notify(NOTIF_ERROR, "Failed to save image.");
   } else {
     // app_notify(NOTIF_SUCCESS, "Save image");
@@ -86,6 +174,7 @@ void Editor::save_image(const char *const path) {
  * @returns true if succeeded, false if failed.
  */
 void Editor::regen_texture() {
+  this->texture_generation++;
   glDeleteTextures(1, &this->texture.texture_id);
   glGenTextures(1, &this->texture.texture_id);
   glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
@@ -94,61 +183,1202 @@ void Editor::regen_texture() {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  // upload pixels into texture
+  // upload the flattened layers into texture, 16 bit images into a 16 bit
+  // texture. Layers are flattened and float images tone mapped as far as
+  // shown, the rest once it is.
+  this->invalidate_active(this->bounds());
+  Image composite = this->layers.composite();
+  ImageView pixels = image_view(composite, this->bounds());
+  if (SAMPLE_TYPE_F32 == this->img.sample_type) {
+    this->tone_map.reset(composite);
+    pixels = this->tone_map.view();
+  }
   glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-  GLint format = this->img.channels == 4 ? GL_RGBA : GL_RGB;
-  glTexImage2D(GL_TEXTURE_2D, 0, format, (int)this->img.width,
-               (int)this->img.height, 0, (GLuint)format, GL_UNSIGNED_BYTE,
-               this->img.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  TextureFormat format = texture_format(pixels.channels, pixels.sample_type);
+  glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, (int)this->img.width,
+               (int)this->img.height, 0, format.format, format.type,
+               pixels.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  set_texture_swizzle(this->img.channels);
+  this->refresh_display(this->display_rect);
+}
+
+/*
+ * Copies `rect` of `img` into `snapshot` and returns a view of it.
+ */
+static ImageView take_snapshot(Image img, Rect rect,
+                               std::vector<uint8_t> &snapshot) {
+  size_t stride = static_cast<size_t>(rect.width) * pixel_size(img);
+  snapshot.resize(stride * static_cast<size_t>(rect.height));
+  ImageView view = {
+      .data = snapshot.data(),
+      .x = rect.x,
+      .y = rect.y,
+      .width = rect.width,
+      .height = rect.height,
+      .channels = img.channels,
+      .stride = stride,
+      .sample_type = img.sample_type,
+  };
+  copy_view(image_view(img, rect), view);
+  return view;
+}
+
+/*
+ * Runs the given expression over every selected pixel of the image.
+ * @param error - why the expression doesn't compile, if failed
+ * @returns true if succeeded, false if failed
+ */
+bool Editor::apply_expression(const std::string &source, std::string &error) {
+  if (nullptr == this->img.data) {
+    nhlog_warn("Editor: no image loaded, skipping apply_expression");
+    return false;
+  }
+  if (this->is_job_running()) {
+    error = "wait for the running filter to finish";
+    return false;
+  }
+  if (!this->expression.compile(source, error)) {
+    nhlog_error("Editor: invalid expression: %s", error.c_str());
+    return false;
+  }
+  if (!this->selection.is_active()) {
+    this->expression.run(image_view(this->img, this->bounds()),
+                         this->img.width, this->img.height);
+    this->regen_texture();
+    return true;
+  }
+
+  // it is per pixel, so only tiles with any selected run, the ones at the
+  // edge of the selection over a copy mixed back.
+  Rect area = this->selection.bounds();
+  for (Rect tile : split_into_tiles(area, EDITOR_TILE_SIZE)) {
+    SelectionCoverage coverage = this->selection.coverage(tile);
+    ImageView dst = image_view(this->img, tile);
+    if (SELECTION_FULL == coverage) {
+      this->expression.run(dst, this->img.width, this->img.height);
+    } else if (SELECTION_PARTIAL == coverage) {
+      ImageView copy = take_snapshot(this->img, tile, this->snapshot);
+      this->expression.run(copy, this->img.width, this->img.height);
+      this->selection.merge(copy, dst);
+    }
+  }
+  this->upload_region(area);
+  return true;
+}
+
+/*
+ * Renders the image through the given shader plugin and shows the result
+ * in place of the image, without touching the image data.
+ * @returns true if succeeded, false if failed
+ */
+bool Editor::preview_shader(const Plugin &plugin) {
+  if (nullptr == this->img.data) {
+    return false;
+  }
+  // the shader sees the whole texture, not just what is shown.
+  this->refresh_display(this->bounds());
+  std::string error;
+  if (!this->shader_filter.render(plugin, this->texture,
+                                  this->texture_generation, this->img.width,
+                                  this->img.height, error)) {
+    if (this->plugin_error != error) {
+      nhlog_error("Editor: shader of %s failed: %s", plugin.info()->name,
+                  error.c_str());
+    }
+    this->plugin_error = error;
+    this->shader_preview = false;
+    return false;
+  }
+  this->plugin_error.clear();
+  this->shader_preview = true;
+  return true;
+}
+
+/*
+ * Runs the given replace image plugin over the visible part of the image
+ * in the background whenever its vars change, first downsampled then at
+ * full resolution, without touching the image data. Called every frame
+ * while previewing, see replace_image_preview.
+ * @param visible - part of the image shown
+ * @param scale - screen pixels per image pixel
+ * @returns false if there is no image, a job is running, there are several
+ * layers or adjustments
+ */
+bool Editor::preview_replace_image(const Plugin &plugin, Rect visible,
+                                   float scale) {
+  if (nullptr == this->img.data || this->is_job_running()) {
+    return false;
+  }
+  // the preview is the active layer alone and unadjusted, drawn over the
+  // flattened, adjusted layers it would hide the others and the
+  // adjustments.
+  if (1 < this->layers.size() || 0 < this->adjustments.size()) {
+    this->plugin_error =
+        "filters can only be previewed on one layer, unadjusted";
+    this->filter_preview.stop();
+    return false;
+  }
+  this->shader_preview = false;
+  this->filter_preview.update(plugin, this->editor_state, this->img,
+                              this->selection, this->texture_generation,
+                              visible, scale, this->tone_map.exposure(),
+                              this->plugin_error);
+  return true;
+}
+
+/*
+ * Latest result of preview_replace_image and the part of the image it
+ * covers, to be drawn over the image.
+ * @returns false if there is none
+ */
+bool Editor::replace_image_preview(Texture &texture, Rect &rect) const {
+  if (!this->filter_preview.shown) {
+    return false;
+  }
+  texture = this->filter_preview.texture;
+  rect = this->filter_preview.rect;
+  return true;
+}
+
+/*
+ * Shows the image again after preview_shader or preview_replace_image.
+ */
+void Editor::stop_preview() {
+  this->shader_preview = false;
+  this->filter_preview.stop();
+}
+
+/*
+ * Renders the image through the given shader plugin and writes the result
+ * back into the image data.
+ * @returns true if succeeded, false if failed
+ */
+bool Editor::apply_shader(const Plugin &plugin) {
+  if (this->is_job_running()) {
+    this->plugin_error = "wait for the running filter to finish";
+    return false;
+  }
+  // shaders run over the tone mapped image, the float pixels would lose
+  // everything the tone map dropped.
+  if (SAMPLE_TYPE_F32 == this->img.sample_type) {
+    this->plugin_error = "shader filters can only preview float images";
+    return false;
+  }
+  // shaders run over the flattened, adjusted layers, not what is edited.
+  if (1 < this->layers.size() || 0 < this->adjustments.size()) {
+    this->plugin_error =
+        "shader filters can only be applied to one layer, unadjusted";
+    return false;
+  }
+  if (!this->preview_shader(plugin)) {
+    return false;
+  }
+  this->shader_filter.read_back(this->img.data, this->img.channels,
+                                this->img.sample_type);
+  this->regen_texture();
+  this->shader_preview = false;
+  return true;
+}
+
+/*
+ * Texture to display, the shader preview while there is one.
+ */
+const Texture &Editor::display_texture() const {
+  return this->shader_preview ? this->shader_filter.output : this->texture;
+}
+
+/*
+ * Called every frame with the part of the image shown. Float images are
+ * tone mapped where it went stale.
+ */
+void Editor::update_display(Rect visible) {
+  this->display_rect = visible;
+  this->refresh_display(visible);
+}
+
+/*
+ * Sets the exposure float images are shown at, in stops. Only the shown
+ * part is mapped again right away.
+ */
+void Editor::set_exposure(float stops) {
+  stops = std::clamp(stops, -TONE_MAP_MAX_STOPS, TONE_MAP_MAX_STOPS);
+  if (stops == this->tone_map.exposure()) {
+    return;
+  }
+  this->tone_map.set_exposure(stops);
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
 }
 
+/*
+ * Exposure float images are shown at, in stops.
+ */
+float Editor::exposure() const { return this->tone_map.exposure(); }
+
 /*
  * Get color at a specific location.
  */
 Color Editor::get_pixel(std::int32_t x, std::int32_t y) {
-  const stbi_uc *p = this->img.data + (4 * (y * this->img.width + x));
-  return {.r = p[0], .g = p[1], .b = p[2], .a = p[3]};
+  Color color = {.r = 0, .g = 0, .b = 0, .a = 0};
+  const uint8_t *p =
+      image_view_pixel(image_view(this->img, this->bounds()), x, y);
+  dispatch_pixel_format(this->img.sample_type, this->img.channels,
+                        [&]<typename Format>(Format) {
+                          using T = typename Format::Sample;
+                          color = Format::load(reinterpret_cast<const T *>(p));
+                        });
+  return color;
 }
 
 /*
- * Draws a cirlce around the given point according to internal size paramter.
+ * Brush opacity out of 255.
  */
-void Editor::draw_cirlce(Vec2<std::int32_t> center, Color color) {
-  nhlog_debug("called at center = %d, %d", center.x, center.y);
-  auto pixels_to_update = get_surrounding_pixels(
-      center, this->editor_state.put_pixel_size, this->img);
+static uint8_t brush_opacity(const EditorState &es) {
+  uint32_t percent = std::min<uint32_t>(es.opacity, 100);
+  return static_cast<uint8_t>((percent * 255 + 50) / 100);
+}
+
+/*
+ * Coverage of the first pixel of one of the spans, the rest follow.
+ */
+const uint8_t *Dab::coverage(const RowSpan &span) const {
+  int32_t left = this->pixel.x - this->tip->radius - 1;
+  int32_t top = this->pixel.y - this->tip->radius - 1;
+  return this->tip->coverage.data() +
+         static_cast<size_t>(span.y - top) *
+             static_cast<size_t>(this->tip->size) +
+         static_cast<size_t>(span.x - left);
+}
 
-  for (auto pixel : pixels_to_update) {
-    this->put_pixel(color, pixel.to_imvec2());
+/*
+ * Places a dab of the current brush around `center`, in image coordinates
+ * where pixel x, y spans x to x + 1 and y to y + 1.
+ */
+Dab Editor::place_dab(Vec2<float> center) {
+  // the pixel the center lies in and where in it, rounded to a step.
+  auto split = [](float v, int32_t &pixel, int32_t &sub) {
+    float steps = std::round(v * BRUSH_TIP_SUBPIXEL_STEPS);
+    pixel = static_cast<int32_t>(std::floor(steps / BRUSH_TIP_SUBPIXEL_STEPS));
+    sub = static_cast<int32_t>(steps) - pixel * BRUSH_TIP_SUBPIXEL_STEPS;
+  };
+  Dab dab;
+  int32_t sub_x, sub_y;
+  split(center.x, dab.pixel.x, sub_x);
+  split(center.y, dab.pixel.y, sub_y);
+  dab.tip = this->brush_tips.get(this->editor_state.put_pixel_size,
+                                 this->brush_hardness, sub_x, sub_y,
+                                 this->brush_antialias);
+
+  const BrushTip &tip = *dab.tip;
+  int32_t left = dab.pixel.x - tip.radius - 1;
+  int32_t top = dab.pixel.y - tip.radius - 1;
+  for (int32_t row = 0; row < tip.size; row++) {
+    int32_t y = top + row;
+    if (y < 0 || this->img.height <= y) {
+      continue;
+    }
+    int32_t x0 = std::max(0, left + tip.row_first[static_cast<size_t>(row)]);
+    int32_t x1 = std::min(this->img.width,
+                          left + tip.row_end[static_cast<size_t>(row)]);
+    if (x0 < x1) {
+      dab.spans.push_back(RowSpan{.x = x0, .y = y, .length = x1 - x0});
+    }
   }
+  return dab;
+}
+
+/*
+ * Layers of the image, bottom first.
+ */
+const LayerStack &Editor::layer_stack() const { return this->layers; }
 
+/*
+ * Adds a transparent layer above the active one and makes it active, see
+ * LayerStack::add.
+ * @returns false if there is no image, a job is running or out of memory
+ */
+bool Editor::add_layer() {
+  if (!this->can_edit_layers()) {
+    return false;
+  }
+  this->filter_preview.stop();
+  this->apply_adjustments();
+  if (!this->layers.add()) {
+    this->plugin_error = "out of memory";
+    return false;
+  }
+  // the image may have gained an alpha channel.
+  this->show_active_layer();
   this->regen_texture();
+  return true;
 }
 
 /*
- * Calls the given plugin's replace image call with required fields.
+ * Removes the active layer, unless it is the only one.
+ * @returns false if it wasn't removed
  */
-void Editor::replace_image(PLUGIN_REPLACE_IMAGE_FUNCTION_TYPE func,
-                           void *data) {
-  nhlog_debug("Editor:: called replace_image with func = %p", func);
-  func(this->editor_state, this->img, data);
-  this->regen_texture();
+bool Editor::remove_layer() {
+  if (!this->can_edit_layers()) {
+    return false;
+  }
+  this->filter_preview.stop();
+  this->apply_adjustments();
+  if (!this->layers.remove()) {
+    return false;
+  }
+  this->show_active_layer();
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+  return true;
+}
+
+/*
+ * Moves the active layer `by` places up the stack, down if negative.
+ */
+void Editor::move_layer(int32_t by) {
+  if (!this->can_edit_layers()) {
+    return;
+  }
+  this->layers.move(by);
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+}
+
+/*
+ * Makes the layer at `index` the one brushes and filters edit.
+ */
+void Editor::select_layer(size_t index) {
+  if (!this->can_edit_layers() || this->layers.size() <= index ||
+      index == this->layers.active_index()) {
+    return;
+  }
+  this->filter_preview.stop();
+  this->apply_adjustments();
+  this->layers.set_active(index);
+  this->show_active_layer();
+}
+
+/*
+ * Sets how the layer at `index` is composited, see Layer. Only the shown
+ * part is flattened again right away.
+ */
+void Editor::set_layer_blending(size_t index, bool visible, int32_t opacity,
+                                BlendMode mode) {
+  if (!this->can_edit_layers() || this->layers.size() <= index) {
+    return;
+  }
+  this->layers.set_blending(index, visible, opacity, mode);
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+}
+
+/*
+ * Adjustments of the active layer, filters it is shown through without
+ * its pixels changing, see FilterGraph.
+ */
+const FilterGraph &Editor::adjustment_graph() const {
+  return this->adjustments;
+}
+
+/*
+ * Adds the replace image plugin, with its current vars, as an adjustment
+ * over the last one. Brushes and filters edit the pixels under the
+ * adjustments from then on, until they are applied.
+ * @returns false if there is no image, a job is running, the plugin is
+ * isolated or out of memory
+ */
+bool Editor::add_adjustment(const Plugin &plugin) {
+  if (!this->can_edit_layers()) {
+    return false;
+  }
+  // adjustments run in the editor, whenever a tile is shown.
+  if (plugin.sandboxed) {
+    this->plugin_error = "isolated plugins can't be adjustments";
+    return false;
+  }
+  this->filter_preview.stop();
+  if (0 == this->adjustments.size() && !this->adjustments.reset(this->img)) {
+    this->plugin_error = "out of memory";
+    return false;
+  }
+  this->plugin_error.clear();
+  this->adjustments.add(plugin, this->editor_state,
+                        static_cast<int32_t>(this->adjustments.size()) - 1);
+  this->show_active_layer();
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+  return true;
+}
+
+/*
+ * Sets the vars of the adjustment at `index` and whether it is enabled.
+ * Only it and the ones after it run again, as far as shown.
+ */
+void Editor::set_adjustment(size_t index, bool enabled,
+                            const std::vector<uint8_t> &vars) {
+  if (!this->can_edit_layers() || this->adjustments.size() <= index) {
+    return;
+  }
+  this->adjustments.set(index, enabled, vars);
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
 }
 
 /*
- * Puts color at a specific location.
+ * Removes the adjustment at `index`.
  */
-void Editor::put_pixel(Color color, ImVec2 pos) {
-  nhlog_debug("Editor: put_pixel color = (%d, %d, %d, %d), pos = (%f, %f)",
-              color.r, color.g, color.b, color.a, pos.x, pos.y);
+void Editor::remove_adjustment(size_t index) {
+  if (!this->can_edit_layers() || this->adjustments.size() <= index) {
+    return;
+  }
+  this->adjustments.remove(index);
+  // without any left the layer is the source again.
+  if (0 == this->adjustments.size()) {
+    this->apply_adjustments();
+    return;
+  }
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+}
 
-  size_t index =
-      (static_cast<size_t>(pos.y) * static_cast<size_t>(this->img.width) +
-       static_cast<size_t>(pos.x)) *
-      static_cast<size_t>(this->img.channels);
+/*
+ * Writes the adjustments into the active layer for good and drops them.
+ */
+void Editor::apply_adjustments() {
+  if (!this->can_edit_layers() ||
+      nullptr == this->adjustments.source_image().data) {
+    return;
+  }
+  this->evaluate_adjustments(this->bounds(), true);
+  this->adjustments.clear();
+  this->show_active_layer();
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+}
 
-  this->img.data[index] = color.r;
-  this->img.data[index + 1] = color.g;
-  this->img.data[index + 2] = color.b;
-  // this->img.data[index + 3] = color.a;
+/*
+ * Part of the image brushes and filters change, see Selection.
+ */
+const Selection &Editor::current_selection() const { return this->selection; }
+
+/*
+ * Selects the pixels inside `rect`. Nothing changes while a job runs.
+ */
+void Editor::select_rect(Rect rect, SelectionMode mode) {
+  if (nullptr != this->img.data && !this->is_job_running()) {
+    this->selection.select_rect(rect, mode);
+  }
+}
+
+/*
+ * Selects the ellipse inscribed in `rect`. Nothing changes while a job
+ * runs.
+ */
+void Editor::select_ellipse(Rect rect, SelectionMode mode) {
+  if (nullptr != this->img.data && !this->is_job_running()) {
+    this->selection.select_ellipse(rect, mode);
+  }
+}
+
+/*
+ * Selects the inside of the polygon through `points`, see
+ * Selection::select_polygon. Nothing changes while a job runs.
+ */
+void Editor::select_polygon(const std::vector<Vec2<float>> &points,
+                            SelectionMode mode) {
+  if (nullptr != this->img.data && !this->is_job_running()) {
+    this->selection.select_polygon(points, mode);
+  }
+}
+
+/*
+ * Selects the whole image. Nothing changes while a job runs.
+ */
+void Editor::select_all() {
+  if (!this->is_job_running()) {
+    this->selection.select_all();
+  }
+}
+
+/*
+ * Stamps one dab of the given put pixel plugin, the brush tip of the
+ * current size and hardness around the given point, see place_dab. Doesn't
+ * regen the texture.
+ */
+void Editor::draw_dab(Vec2<float> center, const Plugin &plugin) {
+  nhlog_debug("called at center = %f, %f", static_cast<double>(center.x),
+              static_cast<double>(center.y));
+  if (nullptr == this->img.data || this->is_job_running()) {
+    return;
+  }
+  Dab dab = this->place_dab(center);
+  for (auto &span : dab.spans) {
+    this->dabs_rect = union_rect(
+        this->dabs_rect,
+        Rect{.x = span.x, .y = span.y, .width = span.length, .height = 1});
+  }
+  if (SAMPLE_TYPE_U8 != this->img.sample_type) {
+    this->draw_dab_samples(dab, center, plugin);
+    return;
+  }
+  size_t channels = static_cast<size_t>(this->img.channels);
+  const PixelKernels &kernels = pixel_kernels();
+  auto blend = this->brush_linear_light ? kernels.blend_linear : kernels.blend;
+  uint8_t opacity = brush_opacity(this->editor_state);
+
+  // plugins without a span entry point give one color for the whole dab.
+  Color color = {.r = 0, .g = 0, .b = 0, .a = 0};
+  if (nullptr == plugin.put_pixel_span) {
+    color = plugin.callback.put_pixel(this->editor_state, center.to_imvec2());
+  }
+
+  for (auto &span : dab.spans) {
+    const uint8_t *coverage = this->dab_coverage(dab, span);
+    if (nullptr == coverage) {
+      continue;
+    }
+    size_t length = static_cast<size_t>(span.length);
+    this->span_out.resize(length);
+
+    // RGBA rows are blended in place, others through a copy.
+    uint8_t *row = image_view_pixel(image_view(this->img, this->bounds()),
+                                    span.x, span.y);
+    Color *existing = reinterpret_cast<Color *>(row);
+    if (4 != channels) {
+      this->span_existing.resize(length);
+      existing = this->span_existing.data();
+      kernels.convert(row, channels, reinterpret_cast<uint8_t *>(existing), 4,
+                      length);
+    }
+
+    if (nullptr == plugin.put_pixel_span) {
+      std::fill(this->span_out.begin(), this->span_out.end(), color);
+    } else {
+      plugin.put_pixel_span(this->editor_state,
+                            PixelSpan{.x = span.x,
+                                      .y = span.y,
+                                      .length = span.length,
+                                      .center_x = dab.pixel.x,
+                                      .center_y = dab.pixel.y,
+                                      .radius = dab.tip->radius,
+                                      .existing = existing},
+                            this->span_out.data());
+    }
+
+    blend(existing, this->span_out.data(), coverage, length, opacity);
+    if (4 != channels) {
+      kernels.convert(reinterpret_cast<const uint8_t *>(existing), 4, row,
+                      channels, length);
+    }
+  }
+}
+
+/*
+ * Uploads the part of the image dabs changed since the last call.
+ */
+void Editor::upload_dabs() {
+  Rect rect = grow_rect(this->dabs_rect, 0, this->bounds());
+  this->dabs_rect = {.x = 0, .y = 0, .width = 0, .height = 0};
+  if (nullptr == this->img.data || rect.width <= 0 || rect.height <= 0) {
+    return;
+  }
+  this->upload_region(rect);
+}
+
+/*
+ * draw_dab for images of more than 8 bits per sample, pixel by pixel
+ * through their PixelFormat. Pixels the plugin leaves as they are keep all
+ * their bits.
+ */
+void Editor::draw_dab_samples(const Dab &dab, Vec2<float> center,
+                              const Plugin &plugin) {
+  ImageView view = image_view(this->img, this->bounds());
+  // source alpha, coverage and opacity all out of 255.
+  const float scale = static_cast<float>(brush_opacity(this->editor_state)) /
+                      (255.0f * 255.0f * 255.0f);
+  const bool linear = this->brush_linear_light;
+  auto stamp = [&]<typename Format>(Format) {
+    using T = typename Format::Sample;
+    constexpr size_t channels = Format::channels;
+    auto row_of = [&](const RowSpan &span) {
+      return reinterpret_cast<T *>(image_view_pixel(view, span.x, span.y));
+    };
+    auto blend = [&](T *p, Color color, uint8_t coverage) {
+      float alpha = static_cast<float>(color.a * coverage) * scale;
+      if (0.0f < alpha) {
+        Format::blend(p, color, alpha, linear);
+      }
+    };
+
+    if (nullptr == plugin.put_pixel_span) {
+      Color color =
+          plugin.callback.put_pixel(this->editor_state, center.to_imvec2());
+      for (auto &span : dab.spans) {
+        const uint8_t *coverage = this->dab_coverage(dab, span);
+        if (nullptr == coverage) {
+          continue;
+        }
+        T *p = row_of(span);
+        for (int32_t i = 0; i < span.length; i++, p += channels) {
+          blend(p, color, coverage[i]);
+        }
+      }
+      return;
+    }
+
+    for (auto &span : dab.spans) {
+      const uint8_t *coverage = this->dab_coverage(dab, span);
+      if (nullptr == coverage) {
+        continue;
+      }
+      size_t length = static_cast<size_t>(span.length);
+      this->span_existing.resize(length);
+      this->span_out.resize(length);
+      T *row = row_of(span);
+      for (size_t i = 0; i < length; i++) {
+        this->span_existing[i] = Format::load(row + i * channels);
+      }
+
+      plugin.put_pixel_span(
+          this->editor_state,
+          PixelSpan{.x = span.x,
+                    .y = span.y,
+                    .length = span.length,
+                    .center_x = dab.pixel.x,
+                    .center_y = dab.pixel.y,
+                    .radius = dab.tip->radius,
+                    .existing = this->span_existing.data()},
+          this->span_out.data());
+
+      // handing back the existing color, narrowed to 8 bits, means leaving
+      // the pixel alone.
+      for (size_t i = 0; i < length; i++) {
+        Color before = this->span_existing[i], after = this->span_out[i];
+        if (before.r != after.r || before.g != after.g ||
+            before.b != after.b || before.a != after.a) {
+          blend(row + i * channels, after, coverage[i]);
+        }
+      }
+    }
+  };
+  dispatch_pixel_format(this->img.sample_type, this->img.channels, stamp);
+}
+
+/*
+ * Coverage of the first pixel of one of the dab's spans, the rest
+ * following, as far as they are selected.
+ * @returns nullptr if none of the span is selected
+ */
+const uint8_t *Editor::dab_coverage(const Dab &dab, const RowSpan &span) {
+  const uint8_t *coverage = dab.coverage(span);
+  Rect rect = {.x = span.x, .y = span.y, .width = span.length, .height = 1};
+  switch (this->selection.coverage(rect)) {
+  case SELECTION_EMPTY:
+    return nullptr;
+  case SELECTION_FULL:
+    return coverage;
+  case SELECTION_PARTIAL:
+    break;
+  }
+  const uint8_t *mask = this->selection.mask_row(span.x, span.y);
+  size_t length = static_cast<size_t>(span.length);
+  this->span_coverage.resize(length);
+  bool any = false;
+  for (size_t i = 0; i < length; i++) {
+    uint32_t amount =
+        (static_cast<uint32_t>(coverage[i]) * mask[i] + 127) / 255;
+    this->span_coverage[i] = static_cast<uint8_t>(amount);
+    any = any || 0 != amount;
+  }
+  return any ? this->span_coverage.data() : nullptr;
+}
+
+/*
+ * Part of `img` the plugin reads when run over `area`: the area and its
+ * halo for plugins run by region, else the area alone, which whole image
+ * plugins get a copy of.
+ */
+static Rect plugin_reads(const Plugin &plugin, EditorState es, Image img,
+                         Rect area) {
+  if (nullptr == plugin.replace_region) {
+    return area;
+  }
+  Rect bounds = {.x = 0, .y = 0, .width = img.width, .height = img.height};
+  int32_t halo = plugin.region_info(es, plugin.replace_image_data).halo;
+  return PLUGIN_HALO_UNBOUNDED == halo ? bounds
+                                       : grow_rect(area, halo, bounds);
+}
+
+/*
+ * Starts running the given replace image plugin over the image as a
+ * background task of the shared thread pool, see poll_job. Plugins with a
+ * region entry point are run tile by tile, across threads if they allow
+ * it.
+ * @returns false if there is no image or a job is already running
+ */
+bool Editor::replace_image(const Plugin &plugin) {
+  return this->replace_image(plugin, this->bounds());
+}
+
+/*
+ * Same as above, but only replaces pixels inside `area`.
+ */
+bool Editor::replace_image(const Plugin &plugin, Rect area) {
+  if (nullptr == this->img.data) {
+    nhlog_warn("Editor: no image loaded, skipping replace_image");
+    return false;
+  }
+  if (this->is_job_running()) {
+    nhlog_warn("Editor: a job is already running, skipping replace_image");
+    return false;
+  }
+  // nothing outside the selection changes.
+  area = grow_rect(area, 0, this->selection.bounds());
+  if (0 == area.width || 0 == area.height) {
+    return false;
+  }
+
+  // the image can't change while the job runs, only what the plugin reads
+  // is copied for it to write into. Isolated plugins read the image itself
+  // and hand back the area.
+  Rect read = plugin.sandboxed
+                  ? area
+                  : plugin_reads(plugin, this->editor_state, this->img, area);
+  Image job_img = {.data = nullptr,
+                   .width = read.width,
+                   .height = read.height,
+                   .channels = this->img.channels,
+                   .sample_type = this->img.sample_type};
+  this->job_data = static_cast<uint8_t *>(malloc(image_size(job_img)));
+  if (nullptr == this->job_data) {
+    this->plugin_error = "out of memory";
+    return false;
+  }
+  job_img.data = this->job_data;
+  copy_view(image_view(this->img, read),
+            image_view(job_img, Rect{.x = 0,
+                                     .y = 0,
+                                     .width = read.width,
+                                     .height = read.height}));
+
+  // the UI may change or reload the plugin while the job runs.
+  size_t vars_size = PluginManager::calc_vars_size(plugin);
+  const uint8_t *vars = static_cast<const uint8_t *>(plugin.replace_image_data);
+  this->job_vars.assign(vars, vars + vars_size);
+  this->job_plugin = plugin;
+  this->job_plugin.replace_image_data = this->job_vars.data();
+
+  this->plugin_call.progress = 0.0f;
+  this->plugin_call.cancelled = false;
+  this->plugin_error.clear();
+  this->job_read = read;
+  this->job_area = area;
+  this->job_succeeded = false;
+  this->job_error.clear();
+  this->job_finished = false;
+
+  nhlog_info("Editor: starting %s", plugin.info()->name);
+  EditorState es = this->editor_state;
+  Image source = this->img;
+  auto run = [this, es, source, job_img]() {
+    this->run_job(es, source, job_img);
+  };
+  this->job = nullptr != ThreadPool::shared
+                  ? ThreadPool::shared->submit(TASK_PRIORITY_BACKGROUND, run)
+                  : std::async(std::launch::async, run);
+  return true;
+}
+
+/*
+ * Whether a replace_image job is running. The image can't be edited until
+ * it is done.
+ */
+bool Editor::is_job_running() const { return this->job.valid(); }
+
+/*
+ * Progress of the running job in [0, 1], as far as the plugin reports it.
+ */
+float Editor::job_progress() const { return this->plugin_call.progress; }
+
+/*
+ * Asks the running job to stop, its result is dropped.
+ */
+void Editor::cancel_job() {
+  if (this->is_job_running()) {
+    nhlog_info("Editor: cancelling %s", this->job_plugin.info()->name);
+    this->plugin_call.cancelled = true;
+  }
+}
+
+/*
+ * Called every frame. Once the running job is done swaps its result into
+ * the image and uploads the area it changed.
+ */
+void Editor::poll_job() {
+  if (!this->job.valid() || !this->job_finished) {
+    return;
+  }
+  this->job.get();
+
+  const char *plugin_name = this->job_plugin.info()->name;
+  if (this->plugin_call.cancelled) {
+    nhlog_info("Editor: %s was cancelled", plugin_name);
+  } else if (!this->job_succeeded) {
+    nhlog_error("Editor: %s failed: %s", plugin_name,
+                this->job_error.c_str());
+    this->plugin_error = this->job_error;
+  } else {
+    Rect area = this->job_area;
+    Rect read = this->job_read;
+    if (!this->selection.is_active() && 0 == area.x && 0 == area.y &&
+        this->img.width == area.width && this->img.height == area.height &&
+        this->img.width == read.width && this->img.height == read.height) {
+      this->job_data =
+          0 < this->adjustments.size()
+              ? this->adjustments.swap_source(this->job_data)
+              : this->layers.swap_data(this->layers.active_index(),
+                                       this->job_data);
+      this->show_active_layer();
+    } else {
+      Image job_img = {.data = this->job_data,
+                       .width = read.width,
+                       .height = read.height,
+                       .channels = this->img.channels,
+                       .sample_type = this->img.sample_type};
+      // the area of the copy, where it lies in the image.
+      ImageView result = image_view(job_img, Rect{.x = area.x - read.x,
+                                                  .y = area.y - read.y,
+                                                  .width = area.width,
+                                                  .height = area.height});
+      result.x = area.x;
+      result.y = area.y;
+      this->selection.merge(result, image_view(this->img, area));
+    }
+    this->upload_region(area);
+    nhlog_info("Editor: %s done", plugin_name);
+  }
+
+  free(this->job_data);
+  this->job_data = nullptr;
+  // lets go of the plugin's library, it may have been reloaded since.
+  this->job_plugin = Plugin();
+}
+
+/*
+ * Runs the plugin over a copy with samples of `type` of the part of `img`
+ * it reads, and converts the samples of `area` it changed back. The ones it
+ * left alone keep all their bits.
+ * @param origin - where `img` lies in the image `selection` is of
+ */
+static void run_converted(const Plugin &plugin, EditorState es, Image img,
+                          Rect area, const Selection &selection,
+                          Vec2<int32_t> origin, SampleType type,
+                          PluginCallState &state,
+                          std::vector<uint8_t> &snapshot) {
+  Rect read = plugin_reads(plugin, es, img, area);
+  Image converted = {.data = nullptr,
+                     .width = read.width,
+                     .height = read.height,
+                     .channels = img.channels,
+                     .sample_type = type};
+  std::vector<uint8_t> pixels(image_size(converted));
+  converted.data = pixels.data();
+  convert_view(image_view(img, read),
+               image_view(converted, Rect{.x = 0,
+                                          .y = 0,
+                                          .width = read.width,
+                                          .height = read.height}));
+  Rect converted_area = {.x = area.x - read.x,
+                         .y = area.y - read.y,
+                         .width = area.width,
+                         .height = area.height};
+  // the area as the plugin got it, to tell which samples it changed.
+  std::vector<uint8_t> before_pixels;
+  ImageView before = take_snapshot(converted, converted_area, before_pixels);
+
+  Editor::run_replace_image(
+      plugin, es, converted, converted_area, selection, state, snapshot,
+      Vec2<int32_t>(origin.x + read.x, origin.y + read.y));
+
+  ImageView after = image_view(converted, converted_area);
+  std::vector<uint8_t> back_pixels;
+  ImageView back = take_snapshot(img, area, back_pixels);
+  convert_view(after, back);
+  ImageView dst = image_view(img, area);
+  size_t count = static_cast<size_t>(area.width) *
+                 static_cast<size_t>(img.channels);
+  dispatch_sample_type(type, [&](auto from) {
+    using F = typename decltype(from)::type;
+    dispatch_sample_type(img.sample_type, [&](auto to) {
+      using T = typename decltype(to)::type;
+      parallel_for(static_cast<size_t>(area.height), [&](size_t y) {
+        const F *old_row =
+            reinterpret_cast<const F *>(before.data + y * before.stride);
+        const F *new_row =
+            reinterpret_cast<const F *>(after.data + y * after.stride);
+        const T *in = reinterpret_cast<const T *>(back.data + y * back.stride);
+        T *out = reinterpret_cast<T *>(dst.data + y * dst.stride);
+        for (size_t i = 0; i < count; i++) {
+          if (old_row[i] != new_row[i]) {
+            out[i] = in[i];
+          }
+        }
+      });
+    });
+  });
+}
+
+/*
+ * Runs the plugin over `area` of `img`, which it must lie inside of, in
+ * the calling thread. `snapshot` is scratch for the pixels it reads.
+ * Plugins which don't handle the image's sample type get an 8 bit copy,
+ * linear light ones a float copy.
+ */
+void Editor::run_replace_image(const Plugin &plugin, EditorState es,
+                               Image img, Rect area, PluginCallState &state,
+                               std::vector<uint8_t> &snapshot) {
+  Editor::run_replace_image(plugin, es, img, area, Selection(), state,
+                            snapshot);
+}
+
+/*
+ * Same as above, but tiles of `area` with nothing of `selection` in them are
+ * skipped, as far as the plugin runs tile by tile. The pixels of the ones
+ * run change whether selected or not, see Selection::merge.
+ * @param origin - where `img` lies in the image `selection` is of, when it
+ * is a part of it
+ */
+void Editor::run_replace_image(const Plugin &plugin, EditorState es,
+                               Image img, Rect area,
+                               const Selection &selection,
+                               PluginCallState &state,
+                               std::vector<uint8_t> &snapshot,
+                               Vec2<int32_t> origin) {
+  if (plugin.linear_light && SAMPLE_TYPE_F32 != img.sample_type &&
+      plugin.handles(SAMPLE_TYPE_F32)) {
+    run_converted(plugin, es, img, area, selection, origin, SAMPLE_TYPE_F32,
+                  state, snapshot);
+    return;
+  }
+  if (!plugin.handles(img.sample_type)) {
+    run_converted(plugin, es, img, area, selection, origin, SAMPLE_TYPE_U8,
+                  state, snapshot);
+    return;
+  }
+
+  const char *plugin_name = plugin.info()->name;
+  Rect bounds = {.x = 0, .y = 0, .width = img.width, .height = img.height};
+
+  if (nullptr == plugin.replace_region) {
+    nhlog_debug("Editor:: called replace_image with func = %p",
+                plugin.callback.replace_image);
+    PluginCallScope scope(&state, plugin_name);
+    if (0 == area.x && 0 == area.y && img.width == area.width &&
+        img.height == area.height) {
+      plugin.callback.replace_image(es, img, plugin.replace_image_data);
+    } else {
+      // whole image plugins get a packed copy of just the area.
+      ImageView area_view = take_snapshot(img, area, snapshot);
+      Image area_img = {.data = area_view.data,
+                        .width = area.width,
+                        .height = area.height,
+                        .channels = img.channels,
+                        .sample_type = img.sample_type};
+      plugin.callback.replace_image(es, area_img, plugin.replace_image_data);
+      copy_view(area_view, image_view(img, area));
+    }
+    return;
+  }
+
+  PluginRegionInfo region_info =
+      plugin.region_info(es, plugin.replace_image_data);
+  bool unbounded = PLUGIN_HALO_UNBOUNDED == region_info.halo;
+
+  // only the area and the halo around it are ever read.
+  ImageView src = take_snapshot(
+      img, unbounded ? bounds : grow_rect(area, region_info.halo, bounds),
+      snapshot);
+
+  std::vector<Rect> tiles;
+  if (region_info.thread_safe && !unbounded) {
+    tiles = split_into_tiles(area, EDITOR_TILE_SIZE);
+    std::erase_if(tiles, [&](Rect tile) {
+      tile.x += origin.x;
+      tile.y += origin.y;
+      return SELECTION_EMPTY == selection.coverage(tile);
+    });
+  } else {
+    tiles.push_back(area);
+  }
+
+  nhlog_debug("Editor: replace_region with func = %p, halo = %d, tiles = %zu, "
+              "thread_safe = %d",
+              plugin.replace_region, region_info.halo, tiles.size(),
+              region_info.thread_safe);
+
+  std::atomic<size_t> tiles_done = 0;
+  parallel_for(tiles.size(), [&](size_t i) {
+    if (state.cancelled) {
+      return;
+    }
+    ImageView tile_src =
+        unbounded
+            ? src
+            : sub_view(src, grow_rect(tiles[i], region_info.halo, bounds));
+    {
+      PluginCallScope scope(&state, plugin_name);
+      plugin.replace_region(es, tile_src, image_view(img, tiles[i]),
+                            plugin.replace_image_data);
+    }
+    // single tile runs report their own progress.
+    if (1 < tiles.size()) {
+      state.progress = static_cast<float>(++tiles_done) /
+                       static_cast<float>(tiles.size());
+    }
+  });
+}
+
+/*
+ * Rect covering the whole image.
+ */
+Rect Editor::bounds() const {
+  return Rect{
+      .x = 0, .y = 0, .width = this->img.width, .height = this->img.height};
+}
+
+/*
+ * Body of the job, runs the plugin over `img`, the copy of job_read of
+ * `source`. Isolated plugins read `source` itself.
+ */
+void Editor::run_job(EditorState es, Image source, Image img) {
+  Rect read = this->job_read;
+  Rect area = {.x = this->job_area.x - read.x,
+               .y = this->job_area.y - read.y,
+               .width = this->job_area.width,
+               .height = this->job_area.height};
+  if (this->job_plugin.sandboxed) {
+    this->job_succeeded = this->sandbox.replace_image(
+        this->job_plugin, es, source, this->job_area, image_view(img, area),
+        this->plugin_call, this->job_error);
+  } else {
+    Editor::run_replace_image(this->job_plugin, es, img, area,
+                              this->selection, this->plugin_call,
+                              this->snapshot, Vec2<int32_t>(read.x, read.y));
+    this->job_succeeded = true;
+  }
+  this->job_finished = true;
+}
+
+/*
+ * Cancels the running job, if any, and waits for it to stop.
+ */
+void Editor::stop_job() {
+  if (!this->is_job_running()) {
+    return;
+  }
+  // plugins which don't check for cancellation still run to the end.
+  this->cancel_job();
+  this->job.get();
+  free(this->job_data);
+  this->job_data = nullptr;
+  this->job_plugin = Plugin();
+}
+
+/*
+ * Points `img` at the active layer, or the source of its adjustments, after
+ * either changed.
+ */
+void Editor::show_active_layer() {
+  Image active = 0 < this->adjustments.size()
+                     ? this->adjustments.source_image()
+                     : this->layers.image(this->layers.active_index());
+  this->img.data = active.data;
+  this->img.width = active.width;
+  this->img.height = active.height;
+  this->img.channels = active.channels;
+  this->img.sample_type = active.sample_type;
+}
+
+/*
+ * Layers can't change while a job works on a copy of the active one.
+ */
+bool Editor::can_edit_layers() const {
+  return nullptr != this->img.data && !this->is_job_running();
+}
+
+/*
+ * Marks `rect` of the pixels brushes and filters edit changed, see img.
+ */
+void Editor::invalidate_active(Rect rect) {
+  if (0 < this->adjustments.size()) {
+    this->adjustments.invalidate(rect);
+  } else {
+    this->layers.invalidate(this->layers.active_index(), rect);
+  }
+}
+
+/*
+ * Runs the adjustments over the tiles of `rect` that went stale, and marks
+ * the part of the active layer that changed.
+ * @param fused - whether to run them fused, for output that is final,
+ * see FilterGraph::evaluate
+ */
+void Editor::evaluate_adjustments(Rect rect, bool fused) {
+  size_t active = this->layers.active_index();
+  Rect changed =
+      this->adjustments.evaluate(rect, this->layers.image(active), fused);
+  this->layers.invalidate(active, changed);
+}
+
+/*
+ * Marks `rect` of the pixels brushes and filters edit changed and uploads
+ * it, as far as it is shown. Float images are tone mapped first.
+ */
+void Editor::upload_region(Rect rect) {
+  // the rest is adjusted and flattened once it is shown.
+  this->invalidate_active(rect);
+  this->refresh_display(this->display_rect);
+  this->texture_generation++;
+}
+
+/*
+ * Uploads the pixels of the view into the same part of the texture.
+ */
+void Editor::upload_view(ImageView view) {
+  size_t pixel_size = static_cast<size_t>(view.channels) *
+                      sample_size(view.sample_type);
+  glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                static_cast<GLint>(view.stride / pixel_size));
+  TextureFormat format = texture_format(view.channels, view.sample_type);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, view.x, view.y, view.width, view.height,
+                  format.format, format.type, view.data);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/*
+ * Adjusts and flattens the stale tiles of the layers `rect` touches, tone
+ * maps them for float images, and uploads them.
+ */
+void Editor::refresh_display(Rect rect) {
+  if (nullptr == this->img.data) {
+    return;
+  }
+  // adjustments being tweaked keep every output cached.
+  this->evaluate_adjustments(rect, false);
+  Rect changed = this->layers.flatten(rect);
+  Image composite = this->layers.composite();
+  ImageView view = image_view(composite, this->bounds());
+  if (SAMPLE_TYPE_F32 == this->img.sample_type) {
+    this->tone_map.invalidate(changed);
+    changed = this->tone_map.refresh(composite, rect);
+    view = this->tone_map.view();
+  }
+  if (0 < changed.width && 0 < changed.height) {
+    this->upload_view(sub_view(view, changed));
+  }
 }
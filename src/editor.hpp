@@ -1,14 +1,120 @@
 #pragma once
 #include "common.hpp"
 #include "glad/glad.h"
+#include "src/brush_tip.hpp"
+#include "src/expression_filter.hpp"
+#include "src/filter_graph.hpp"
+#include "src/filter_preview.hpp"
+#include "src/host_services.hpp"
+#include "src/layer_stack.hpp"
+#include "src/plugin_sandbox.hpp"
 #include "src/plugins_manager.hpp"
+#include "src/selection.hpp"
+#include "src/shader_filter.hpp"
+#include "src/tone_map.hpp"
+#include <atomic>
 #include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Brush dab placed on the image: its mask, the pixel its center lies in
+ * and the rows of the image the mask covers, clipped to it.
+ */
+struct Dab {
+  std::shared_ptr<const BrushTip> tip;
+  Vec2<std::int32_t> pixel;
+  std::vector<RowSpan> spans;
+
+  /*
+   * Coverage of the first pixel of one of the spans, the rest follow.
+   */
+  const uint8_t *coverage(const RowSpan &span) const;
+};
 
 class Editor {
 public:
+  // pixels brushes and filters edit: the active layer, or what its
+  // adjustments filter if it has any.
   Image img;
   Texture texture;
   EditorState editor_state;
+  // percent of the brush radius dabs fully cover, the rest fades out.
+  int32_t brush_hardness;
+  // whether dabs get soft edges, and blend in linear light instead of the
+  // image's sRGB.
+  bool brush_antialias;
+  bool brush_linear_light;
+  // why the last replace_image call failed, empty if it succeeded.
+  std::string plugin_error;
+
+private:
+  // unmodified copy of the part of the image region plugins read from, kept
+  // around so repeated applies don't reallocate it.
+  std::vector<uint8_t> snapshot;
+
+  // colors of the span of a dab being drawn, and what the plugin paints
+  // over them.
+  std::vector<Color> span_existing;
+  std::vector<Color> span_out;
+  // coverage of the span under the selection.
+  std::vector<uint8_t> span_coverage;
+
+  // layers of the image, and what they flatten into for display.
+  LayerStack layers;
+
+  // adjustments of the active layer. While there are any the layer holds
+  // their output, see add_adjustment.
+  FilterGraph adjustments;
+
+  // part of the image brushes and filters change. Kept as it is while a
+  // job runs.
+  Selection selection;
+
+  // masks of the brush tips dabs were stamped with.
+  BrushTipCache brush_tips;
+
+  // progress and cancellation of the running replace_image call.
+  PluginCallState plugin_call;
+
+  // runs sandboxed plugins.
+  PluginSandbox sandbox;
+
+  // runs shader plugins, and whether its output is shown instead of the
+  // image.
+  ShaderFilter shader_filter;
+  bool shader_preview;
+  // bumped whenever the texture is regenerated.
+  uint64_t texture_generation;
+
+  // what float images are shown through, and the part of the image shown.
+  ToneMap tone_map;
+  Rect display_rect;
+
+  // part of the image dabs changed since the last upload_dabs.
+  Rect dabs_rect;
+
+  // last expression applied, kept compiled.
+  ExpressionFilter expression;
+
+  // live preview of a replace image plugin.
+  FilterPreview filter_preview;
+
+  // running replace_image job, a background task of the shared thread pool.
+  // It works on its own copy of the part of the image the plugin reads and
+  // of the plugin vars, the image is only touched once it is done.
+  std::future<void> job;
+  std::atomic<bool> job_finished;
+  Plugin job_plugin;
+  std::vector<uint8_t> job_vars;
+  uint8_t *job_data;
+  // part of the image job_data holds, and the part the plugin replaces.
+  Rect job_read;
+  Rect job_area;
+  bool job_succeeded;
+  std::string job_error;
 
 public:
   /*
@@ -39,28 +145,325 @@ public:
   void save_image(const char *const path);
 
   /*
-   * Draws a cirlce around the given point according to internal size paramter.
+   * Layers of the image, bottom first.
    */
-  void draw_cirlce(Vec2<std::int32_t> center, Color color);
+  const LayerStack &layer_stack() const;
 
   /*
-   * Calls the given plugin's replace image call with required fields.
+   * Adds a transparent layer above the active one and makes it active, see
+   * LayerStack::add.
+   * @returns false if there is no image, a job is running or out of memory
    */
-  void replace_image(PLUGIN_REPLACE_IMAGE_FUNCTION_TYPE func, void *data);
+  bool add_layer();
 
   /*
-   * Get color at a specific location.
+   * Removes the active layer, unless it is the only one.
+   * @returns false if it wasn't removed
    */
-  Color get_pixel(std::int32_t x, std::int32_t y);
+  bool remove_layer();
+
+  /*
+   * Moves the active layer `by` places up the stack, down if negative.
+   */
+  void move_layer(int32_t by);
+
+  /*
+   * Makes the layer at `index` the one brushes and filters edit.
+   */
+  void select_layer(size_t index);
+
+  /*
+   * Sets how the layer at `index` is composited, see Layer. Only the shown
+   * part is flattened again right away.
+   */
+  void set_layer_blending(size_t index, bool visible, int32_t opacity,
+                          BlendMode mode);
+
+  /*
+   * Adjustments of the active layer, filters it is shown through without
+   * its pixels changing, see FilterGraph.
+   */
+  const FilterGraph &adjustment_graph() const;
+
+  /*
+   * Adds the replace image plugin, with its current vars, as an adjustment
+   * over the last one. Brushes and filters edit the pixels under the
+   * adjustments from then on, until they are applied.
+   * @returns false if there is no image, a job is running, the plugin is
+   * isolated or out of memory
+   */
+  bool add_adjustment(const Plugin &plugin);
+
+  /*
+   * Sets the vars of the adjustment at `index` and whether it is enabled.
+   * Only it and the ones after it run again, as far as shown.
+   */
+  void set_adjustment(size_t index, bool enabled,
+                      const std::vector<uint8_t> &vars);
+
+  /*
+   * Removes the adjustment at `index`.
+   */
+  void remove_adjustment(size_t index);
+
+  /*
+   * Writes the adjustments into the active layer for good and drops them.
+   */
+  void apply_adjustments();
+
+  /*
+   * Part of the image brushes and filters change, see Selection.
+   */
+  const Selection &current_selection() const;
+
+  /*
+   * Selects the pixels inside `rect`. Nothing changes while a job runs.
+   */
+  void select_rect(Rect rect, SelectionMode mode);
+
+  /*
+   * Selects the ellipse inscribed in `rect`. Nothing changes while a job
+   * runs.
+   */
+  void select_ellipse(Rect rect, SelectionMode mode);
+
+  /*
+   * Selects the inside of the polygon through `points`, see
+   * Selection::select_polygon. Nothing changes while a job runs.
+   */
+  void select_polygon(const std::vector<Vec2<float>> &points,
+                      SelectionMode mode);
+
+  /*
+   * Selects the whole image. Nothing changes while a job runs.
+   */
+  void select_all();
+
+  /*
+   * Stamps one dab of the given put pixel plugin, the brush tip of the
+   * current size and hardness around the given point, see place_dab.
+   * Doesn't regen the texture, see upload_dabs.
+   */
+  void draw_dab(Vec2<float> center, const Plugin &plugin);
+
+  /*
+   * Uploads the part of the image dabs changed since the last call.
+   */
+  void upload_dabs();
+
+  /*
+   * Starts running the given replace image plugin over the selected part
+   * of the image as a background task of the shared thread pool, see
+   * poll_job. Plugins with a region entry point are run tile by tile,
+   * across threads if they allow it, skipping tiles with nothing selected.
+   * @returns false if there is no image or a job is already running
+   */
+  bool replace_image(const Plugin &plugin);
+
+  /*
+   * Same as above, but only replaces pixels inside `area`.
+   */
+  bool replace_image(const Plugin &plugin, Rect area);
+
+  /*
+   * Whether a replace_image job is running. The image can't be edited until
+   * it is done.
+   */
+  bool is_job_running() const;
+
+  /*
+   * Progress of the running job in [0, 1], as far as the plugin reports it.
+   */
+  float job_progress() const;
+
+  /*
+   * Asks the running job to stop, its result is dropped.
+   */
+  void cancel_job();
+
+  /*
+   * Called every frame. Once the running job is done swaps its result into
+   * the image and uploads the area it changed.
+   */
+  void poll_job();
+
+  /*
+   * Runs the plugin over `area` of `img`, which it must lie inside of, in
+   * the calling thread. `snapshot` is scratch for the pixels it reads.
+   * Plugins which don't handle the image's sample type get an 8 bit copy,
+   * linear light ones a float copy.
+   */
+  static void run_replace_image(const Plugin &plugin, EditorState es,
+                                Image img, Rect area, PluginCallState &state,
+                                std::vector<uint8_t> &snapshot);
+
+  /*
+   * Same as above, but tiles of `area` with nothing of `selection` in them
+   * are skipped, as far as the plugin runs tile by tile. The pixels of the
+   * ones run change whether selected or not, see Selection::merge.
+   * @param origin - where `img` lies in the image `selection` is of, when
+   * it is a part of it
+   */
+  static void run_replace_image(const Plugin &plugin, EditorState es,
+                                Image img, Rect area,
+                                const Selection &selection,
+                                PluginCallState &state,
+                                std::vector<uint8_t> &snapshot,
+                                Vec2<int32_t> origin = Vec2<int32_t>());
+
+  /*
+   * Runs the given expression over every selected pixel of the image.
+   * @param error - why the expression doesn't compile, if failed
+   * @returns true if succeeded, false if failed
+   */
+  bool apply_expression(const std::string &source, std::string &error);
+
+  /*
+   * Renders the image through the given shader plugin and shows the result
+   * in place of the image, without touching the image data.
+   * @returns true if succeeded, false if failed
+   */
+  bool preview_shader(const Plugin &plugin);
+
+  /*
+   * Runs the given replace image plugin over the visible part of the image
+   * in the background whenever its vars change, first downsampled then at
+   * full resolution, without touching the image data. Called every frame
+   * while previewing, see replace_image_preview.
+   * @param visible - part of the image shown
+   * @param scale - screen pixels per image pixel
+   * @returns false if there is no image, a job is running, there are
+   * several layers or adjustments
+   */
+  bool preview_replace_image(const Plugin &plugin, Rect visible, float scale);
+
+  /*
+   * Latest result of preview_replace_image and the part of the image it
+   * covers, to be drawn over the image.
+   * @returns false if there is none
+   */
+  bool replace_image_preview(Texture &texture, Rect &rect) const;
+
+  /*
+   * Shows the image again after preview_shader or preview_replace_image.
+   */
+  void stop_preview();
+
+  /*
+   * Renders the image through the given shader plugin and writes the result
+   * back into the image data.
+   * @returns true if succeeded, false if failed
+   */
+  bool apply_shader(const Plugin &plugin);
+
+  /*
+   * Texture to display, the shader preview while there is one.
+   */
+  const Texture &display_texture() const;
+
+  /*
+   * Called every frame with the part of the image shown. Float images are
+   * tone mapped where it went stale.
+   */
+  void update_display(Rect visible);
+
+  /*
+   * Sets the exposure float images are shown at, in stops. Only the shown
+   * part is mapped again right away.
+   */
+  void set_exposure(float stops);
+
+  /*
+   * Exposure float images are shown at, in stops.
+   */
+  float exposure() const;
 
   /*
-   * Puts color at a specific location.
+   * Get color at a specific location.
    */
-  void put_pixel(Color color, ImVec2 pos);
+  Color get_pixel(std::int32_t x, std::int32_t y);
 
   /*
    * Regen texture from image data.
    * @returns true if succeeded, false if failed.
    */
   void regen_texture();
+
+  /*
+   * Rect covering the whole image.
+   */
+  Rect bounds() const;
+
+private:
+  /*
+   * Body of the job, runs the plugin over `img`, the copy of job_read of
+   * `source`. Isolated plugins read `source` itself.
+   */
+  void run_job(EditorState es, Image source, Image img);
+
+  /*
+   * Cancels the running job, if any, and waits for it to stop.
+   */
+  void stop_job();
+
+  /*
+   * Points `img` at the active layer, after the layers changed.
+   */
+  void show_active_layer();
+
+  /*
+   * Layers can't change while a job works on a copy of the active one.
+   */
+  bool can_edit_layers() const;
+
+  /*
+   * Marks `rect` of the pixels brushes and filters edit changed, see img.
+   */
+  void invalidate_active(Rect rect);
+
+  /*
+   * Runs the adjustments over the tiles of `rect` that went stale, and
+   * marks the part of the active layer that changed.
+   * @param fused - whether to run them fused, for output that is final,
+   * see FilterGraph::evaluate
+   */
+  void evaluate_adjustments(Rect rect, bool fused);
+
+  /*
+   * Marks `rect` of the pixels brushes and filters edit changed and
+   * uploads it, as far as it is shown. Float images are tone mapped first.
+   */
+  void upload_region(Rect rect);
+
+  /*
+   * Uploads the pixels of the view into the same part of the texture.
+   */
+  void upload_view(ImageView view);
+
+  /*
+   * Adjusts and flattens the stale tiles of the layers `rect` touches, tone
+   * maps them for float images, and uploads them.
+   */
+  void refresh_display(Rect rect);
+
+  /*
+   * Places a dab of the current brush around `center`, in image
+   * coordinates where pixel x, y spans x to x + 1 and y to y + 1.
+   */
+  Dab place_dab(Vec2<float> center);
+
+  /*
+   * draw_dab for images of more than 8 bits per sample, pixel by pixel
+   * through their PixelFormat. Pixels the plugin leaves as they are keep
+   * all their bits.
+   */
+  void draw_dab_samples(const Dab &dab, Vec2<float> center,
+                        const Plugin &plugin);
+
+  /*
+   * Coverage of the first pixel of one of the dab's spans, the rest
+   * following, as far as they are selected.
+   * @returns nullptr if none of the span is selected
+   */
+  const uint8_t *dab_coverage(const Dab &dab, const RowSpan &span);
 };
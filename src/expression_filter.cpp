@@ -0,0 +1,841 @@
+#include "src/expression_filter.hpp"
+#include "nhlog.h"
+#include "pixel_format.hpp"
+#include "src/common.hpp"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <map>
+#include <type_traits>
+
+enum ExpressionOp : uint8_t {
+  OP_MOVE,
+  OP_NEGATE,
+  OP_ADD,
+  OP_SUBTRACT,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_MIN,
+  OP_MAX,
+  OP_LESS,
+  OP_LESS_EQUAL,
+  OP_EQUAL,
+  OP_NOT_EQUAL,
+  OP_SELECT,
+  OP_MIX,
+  OP_CLAMP,
+  OP_ABS,
+  OP_FLOOR,
+  OP_SQRT,
+  OP_POW,
+  OP_SIN,
+  OP_COS,
+};
+
+// registers every program starts with, in this order.
+enum ExpressionInput : uint16_t {
+  INPUT_R,
+  INPUT_G,
+  INPUT_B,
+  INPUT_A,
+  INPUT_X,
+  INPUT_Y,
+  INPUT_WIDTH,
+  INPUT_HEIGHT,
+  INPUT_COUNT,
+};
+
+/*
+ * Value of a single lane, shared by constant folding and the block loops so
+ * both agree.
+ */
+static inline float apply_op(uint8_t op, float a, float b, float c) {
+  switch (op) {
+  case OP_MOVE:
+    return a;
+  case OP_NEGATE:
+    return -a;
+  case OP_ADD:
+    return a + b;
+  case OP_SUBTRACT:
+    return a - b;
+  case OP_MULTIPLY:
+    return a * b;
+  case OP_DIVIDE:
+    return a / b;
+  case OP_MIN:
+    return a < b ? a : b;
+  case OP_MAX:
+    return a > b ? a : b;
+  case OP_LESS:
+    return a < b ? 1.0f : 0.0f;
+  case OP_LESS_EQUAL:
+    return a <= b ? 1.0f : 0.0f;
+  case OP_EQUAL:
+    return a == b ? 1.0f : 0.0f;
+  case OP_NOT_EQUAL:
+    return a != b ? 1.0f : 0.0f;
+  case OP_SELECT:
+    return 0.0f != a ? b : c;
+  case OP_MIX:
+    return a + (b - a) * c;
+  case OP_CLAMP: {
+    float low = a > b ? a : b;
+    return low < c ? low : c;
+  }
+  case OP_ABS:
+    return std::fabs(a);
+  case OP_FLOOR:
+    return std::floor(a);
+  case OP_SQRT:
+    return std::sqrt(a);
+  case OP_POW:
+    return std::pow(a, b);
+  case OP_SIN:
+    return std::sin(a);
+  case OP_COS:
+    return std::cos(a);
+  }
+  return 0.0f;
+}
+
+/*
+ * Runs one op over a whole block. `op` is a template argument so the switch
+ * in apply_op folds away and the loop vectorizes, the compiler never gives
+ * `dst` the register of an operand.
+ */
+template <uint8_t op>
+static void run_op(float *__restrict dst, const float *a, const float *b,
+                   const float *c) {
+  for (size_t i = 0; i < EXPRESSION_BLOCK_SIZE; i++) {
+    dst[i] = apply_op(op, a[i], b[i], c[i]);
+  }
+}
+
+/*
+ * Channel value in [0, 1] to a sample, NaN turns into 0. Float samples are
+ * kept as they are.
+ */
+template <typename T> static inline T to_sample(float value) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return value;
+  } else {
+    // clamped after scaling, a clamp to [0, 1] keeps the loop from
+    // vectorizing.
+    const float max = static_cast<float>(SampleTraits<T>::max);
+    value = value * max + 0.5f;
+    value = value > 0.0f ? value : 0.0f;
+    return static_cast<T>(static_cast<int32_t>(std::min(value, max)));
+  }
+}
+
+/*
+ * Interleaved samples to one register per channel, alpha is 1 without an
+ * alpha channel. Grey goes into r, g and b alike.
+ */
+template <typename T, size_t channels>
+static void load_block(const T *__restrict pixels, size_t count,
+                       float *__restrict r, float *__restrict g,
+                       float *__restrict b, float *__restrict a) {
+  const float scale = 1.0f / static_cast<float>(SampleTraits<T>::max);
+  if constexpr (channels < 3) {
+    for (size_t i = 0; i < count; i++) {
+      float grey = static_cast<float>(pixels[i * channels]) * scale;
+      r[i] = g[i] = b[i] = grey;
+      a[i] = 2 == channels
+                 ? static_cast<float>(pixels[i * channels + 1]) * scale
+                 : 1.0f;
+    }
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    r[i] = static_cast<float>(pixels[i * channels]) * scale;
+    g[i] = static_cast<float>(pixels[i * channels + 1]) * scale;
+    b[i] = static_cast<float>(pixels[i * channels + 2]) * scale;
+    a[i] = 4 == channels ? static_cast<float>(pixels[i * channels + 3]) * scale
+                         : 1.0f;
+  }
+}
+
+/*
+ * Rec. 601 luma of r, g and b into `grey`, which may be one of them, for
+ * storing into grey images.
+ */
+static void luma_block(size_t count, const float *r, const float *g,
+                       const float *b, float *grey) {
+  for (size_t i = 0; i < count; i++) {
+    grey[i] = 0.299f * r[i] + 0.587f * g[i] + 0.114f * b[i];
+  }
+}
+
+static void fill_x(float *__restrict xs, float x) {
+  for (int32_t i = 0; i < EXPRESSION_BLOCK_SIZE; i++) {
+    xs[i] = x + static_cast<float>(i);
+  }
+}
+
+/*
+ * One register back into one channel of interleaved samples, `pixels`
+ * points at that channel of the first pixel.
+ */
+template <typename T, size_t channels>
+static void store_channel(T *__restrict pixels, size_t count,
+                          const float *__restrict values) {
+  for (size_t i = 0; i < count; i++) {
+    pixels[i * channels] = to_sample<T>(values[i]);
+  }
+}
+
+/*
+ * *****************************
+ * Compiler
+ * *****************************
+ */
+
+// constants live in their own register space until the program is done.
+#define CONSTANT_FLAG 0x8000u
+
+/*
+ * Recursive descent parser which emits bytecode as it goes, folding
+ * operations on constants.
+ */
+class ExpressionCompiler {
+private:
+  struct Operand {
+    bool is_constant;
+    float value;
+    uint16_t reg;
+  };
+
+  struct Function {
+    uint8_t op;
+    size_t arity;
+  };
+
+  const std::string &source;
+  ExpressionFilter &filter;
+  std::string &error;
+  size_t position = 0;
+
+  std::map<std::string, uint16_t> locals;
+  // first register past the locals, temps are allocated above it.
+  uint16_t locals_end = INPUT_COUNT;
+  uint16_t max_register = INPUT_COUNT;
+  std::vector<bool> used = std::vector<bool>(EXPRESSION_MAX_REGISTERS);
+
+public:
+  ExpressionCompiler(const std::string &source, ExpressionFilter &filter,
+                     std::string &error)
+      : source(source), filter(filter), error(error) {}
+
+  bool compile() {
+    while (true) {
+      this->skip_space();
+      if (this->position == this->source.size()) {
+        break;
+      }
+      if (this->accept(";") || this->accept("\n")) {
+        continue;
+      }
+      if (!this->statement()) {
+        return false;
+      }
+      this->skip_space();
+      if (this->position != this->source.size() && !this->accept(";") &&
+          !this->accept("\n")) {
+        return this->fail("expected ';' or a new line");
+      }
+    }
+    this->relocate();
+    return true;
+  }
+
+private:
+  bool fail(const std::string &message) {
+    size_t line = 1, column = 1;
+    for (size_t i = 0; i < this->position && i < this->source.size(); i++) {
+      if ('\n' == this->source[i]) {
+        line++;
+        column = 1;
+      } else {
+        column++;
+      }
+    }
+    this->error = "line " + std::to_string(line) + ", column " +
+                  std::to_string(column) + ": " + message;
+    return false;
+  }
+
+  // new lines separate statements, so they aren't skipped here.
+  void skip_space() {
+    while (this->position < this->source.size() &&
+           (' ' == this->source[this->position] ||
+            '\t' == this->source[this->position] ||
+            '\r' == this->source[this->position])) {
+      this->position++;
+    }
+  }
+
+  bool accept(const char *token) {
+    this->skip_space();
+    size_t length = std::char_traits<char>::length(token);
+    if (0 != this->source.compare(this->position, length, token)) {
+      return false;
+    }
+    this->position += length;
+    return true;
+  }
+
+  std::string name() {
+    this->skip_space();
+    size_t start = this->position;
+    while (this->position < this->source.size() &&
+           (std::isalnum(static_cast<unsigned char>(
+                this->source[this->position])) ||
+            '_' == this->source[this->position])) {
+      if (start == this->position &&
+          std::isdigit(static_cast<unsigned char>(
+              this->source[this->position]))) {
+        break;
+      }
+      this->position++;
+    }
+    return this->source.substr(start, this->position - start);
+  }
+
+  bool statement() {
+    size_t start = this->position;
+    bool new_local = false;
+    std::string target = this->name();
+    if (target.empty()) {
+      return this->fail("expected a name to assign to");
+    }
+    if (!this->accept("=")) {
+      return this->fail("expected '=' after " + target);
+    }
+
+    static const std::map<std::string, uint16_t> channels = {
+        {"r", INPUT_R}, {"g", INPUT_G}, {"b", INPUT_B}, {"a", INPUT_A}};
+    uint16_t dst;
+    if (auto channel = channels.find(target); channel != channels.end()) {
+      dst = channel->second;
+      this->filter.writes[dst] = true;
+    } else if (auto local = this->locals.find(target);
+               local != this->locals.end()) {
+      dst = local->second;
+    } else if (this->is_reserved(target)) {
+      this->position = start;
+      return this->fail("can't assign to " + target);
+    } else {
+      // no temps are live between statements, so this is locals_end.
+      if (!this->allocate(dst)) {
+        return false;
+      }
+      this->locals_end = static_cast<uint16_t>(dst + 1);
+      new_local = true;
+    }
+
+    Operand value;
+    if (!this->expression(value)) {
+      return false;
+    }
+    // only visible from the next statement on.
+    if (new_local) {
+      this->locals[target] = dst;
+    }
+
+    auto &program = this->filter.program;
+    if (!value.is_constant && this->is_temp(value.reg) && !program.empty() &&
+        program.back().dst == value.reg && dst != program.back().a &&
+        dst != program.back().b && dst != program.back().c) {
+      // write the last result straight into the target.
+      program.back().dst = dst;
+    } else if (value.is_constant || dst != value.reg) {
+      this->emit_move(dst, value);
+    }
+    this->release(value);
+    return true;
+  }
+
+  bool expression(Operand &out) {
+    if (!this->comparison(out)) {
+      return false;
+    }
+    if (!this->accept("?")) {
+      return true;
+    }
+    Operand if_true, if_false;
+    if (!this->expression(if_true)) {
+      return false;
+    }
+    if (!this->accept(":")) {
+      return this->fail("expected ':'");
+    }
+    if (!this->expression(if_false)) {
+      return false;
+    }
+    return this->emit(OP_SELECT, {out, if_true, if_false}, out);
+  }
+
+  bool comparison(Operand &out) {
+    if (!this->sum(out)) {
+      return false;
+    }
+    // longest tokens first, so "<=" isn't read as "<".
+    static const struct {
+      const char *token;
+      uint8_t op;
+      bool swap;
+    } comparisons[] = {
+        {"<=", OP_LESS_EQUAL, false}, {">=", OP_LESS_EQUAL, true},
+        {"==", OP_EQUAL, false},      {"!=", OP_NOT_EQUAL, false},
+        {"<", OP_LESS, false},        {">", OP_LESS, true},
+    };
+    for (const auto &comparison : comparisons) {
+      if (this->accept(comparison.token)) {
+        Operand rhs;
+        if (!this->sum(rhs)) {
+          return false;
+        }
+        return comparison.swap ? this->emit(comparison.op, {rhs, out}, out)
+                               : this->emit(comparison.op, {out, rhs}, out);
+      }
+    }
+    return true;
+  }
+
+  bool sum(Operand &out) {
+    if (!this->product(out)) {
+      return false;
+    }
+    while (true) {
+      uint8_t op;
+      if (this->accept("+")) {
+        op = OP_ADD;
+      } else if (this->accept("-")) {
+        op = OP_SUBTRACT;
+      } else {
+        return true;
+      }
+      Operand rhs;
+      if (!this->product(rhs) || !this->emit(op, {out, rhs}, out)) {
+        return false;
+      }
+    }
+  }
+
+  bool product(Operand &out) {
+    if (!this->unary(out)) {
+      return false;
+    }
+    while (true) {
+      uint8_t op;
+      if (this->accept("*")) {
+        op = OP_MULTIPLY;
+      } else if (this->accept("/")) {
+        op = OP_DIVIDE;
+      } else {
+        return true;
+      }
+      Operand rhs;
+      if (!this->unary(rhs) || !this->emit(op, {out, rhs}, out)) {
+        return false;
+      }
+    }
+  }
+
+  bool unary(Operand &out) {
+    if (this->accept("-")) {
+      return this->unary(out) && this->emit(OP_NEGATE, {out}, out);
+    }
+    if (this->accept("+")) {
+      return this->unary(out);
+    }
+    return this->primary(out);
+  }
+
+  bool primary(Operand &out) {
+    this->skip_space();
+    if (this->accept("(")) {
+      if (!this->expression(out)) {
+        return false;
+      }
+      return this->accept(")") ? true : this->fail("expected ')'");
+    }
+
+    if (this->position < this->source.size() &&
+        (std::isdigit(static_cast<unsigned char>(
+             this->source[this->position])) ||
+         '.' == this->source[this->position])) {
+      const char *first = this->source.data() + this->position;
+      const char *last = this->source.data() + this->source.size();
+      float value;
+      auto [end, err] = std::from_chars(first, last, value);
+      if (std::errc() != err) {
+        return this->fail("invalid number");
+      }
+      this->position += static_cast<size_t>(end - first);
+      out = {.is_constant = true, .value = value, .reg = 0};
+      return true;
+    }
+
+    size_t start = this->position;
+    std::string identifier = this->name();
+    if (identifier.empty()) {
+      return this->fail("expected a value");
+    }
+
+    static const std::map<std::string, Function> functions = {
+        {"min", {OP_MIN, 2}},   {"max", {OP_MAX, 2}},
+        {"clamp", {OP_CLAMP, 3}}, {"mix", {OP_MIX, 3}},
+        {"abs", {OP_ABS, 1}},   {"floor", {OP_FLOOR, 1}},
+        {"sqrt", {OP_SQRT, 1}}, {"pow", {OP_POW, 2}},
+        {"sin", {OP_SIN, 1}},   {"cos", {OP_COS, 1}},
+    };
+    if (auto function = functions.find(identifier);
+        function != functions.end()) {
+      if (!this->accept("(")) {
+        return this->fail("expected '(' after " + identifier);
+      }
+      std::vector<Operand> args;
+      do {
+        Operand arg;
+        if (!this->expression(arg)) {
+          return false;
+        }
+        args.push_back(arg);
+      } while (this->accept(","));
+      if (!this->accept(")")) {
+        return this->fail("expected ')'");
+      }
+      if (args.size() != function->second.arity) {
+        this->position = start;
+        return this->fail(identifier + " takes " +
+                          std::to_string(function->second.arity) +
+                          " arguments");
+      }
+      return this->emit(function->second.op, args, out);
+    }
+
+    static const std::map<std::string, uint16_t> inputs = {
+        {"r", INPUT_R},         {"g", INPUT_G}, {"b", INPUT_B},
+        {"a", INPUT_A},         {"x", INPUT_X}, {"y", INPUT_Y},
+        {"width", INPUT_WIDTH}, {"height", INPUT_HEIGHT},
+    };
+    if (auto input = inputs.find(identifier); input != inputs.end()) {
+      out = {.is_constant = false, .value = 0.0f, .reg = input->second};
+      return true;
+    }
+    if (auto local = this->locals.find(identifier);
+        local != this->locals.end()) {
+      out = {.is_constant = false, .value = 0.0f, .reg = local->second};
+      return true;
+    }
+    if ("pi" == identifier) {
+      out = {.is_constant = true, .value = 3.14159265f, .reg = 0};
+      return true;
+    }
+    this->position = start;
+    return this->fail("unknown name " + identifier);
+  }
+
+  bool is_reserved(const std::string &identifier) {
+    return "x" == identifier || "y" == identifier || "width" == identifier ||
+           "height" == identifier || "pi" == identifier;
+  }
+
+  bool is_temp(uint16_t reg) {
+    return 0 == (reg & CONSTANT_FLAG) && reg >= this->locals_end;
+  }
+
+  bool allocate(uint16_t &reg) {
+    for (size_t i = this->locals_end; i < this->used.size(); i++) {
+      if (!this->used[i]) {
+        this->used[i] = true;
+        reg = static_cast<uint16_t>(i);
+        this->max_register =
+            std::max(this->max_register, static_cast<uint16_t>(reg + 1));
+        return true;
+      }
+    }
+    return this->fail("expression is too complex");
+  }
+
+  void release(const Operand &operand) {
+    if (!operand.is_constant && this->is_temp(operand.reg)) {
+      this->used[operand.reg] = false;
+    }
+  }
+
+  uint16_t constant_register(float value) {
+    auto &constants = this->filter.constants;
+    auto it = std::find(constants.begin(), constants.end(), value);
+    if (it == constants.end()) {
+      constants.push_back(value);
+      it = constants.end() - 1;
+    }
+    return static_cast<uint16_t>(CONSTANT_FLAG |
+                                 static_cast<size_t>(it - constants.begin()));
+  }
+
+  uint16_t register_of(const Operand &operand) {
+    return operand.is_constant ? this->constant_register(operand.value)
+                               : operand.reg;
+  }
+
+  void emit_move(uint16_t dst, const Operand &value) {
+    this->filter.program.push_back(ExpressionFilter::Instruction{
+        .op = OP_MOVE,
+        .dst = dst,
+        .a = this->register_of(value),
+        .b = INPUT_R,
+        .c = INPUT_R,
+    });
+  }
+
+  /*
+   * Emits `op` over the given operands into a new temp, or folds it if they
+   * are all constants.
+   */
+  bool emit(uint8_t op, std::vector<Operand> args, Operand &out) {
+    args.resize(3, Operand{.is_constant = true, .value = 0.0f, .reg = 0});
+    bool all_constant = std::all_of(args.begin(), args.end(),
+                                    [](auto &arg) { return arg.is_constant; });
+    if (all_constant) {
+      out = {.is_constant = true,
+             .value = apply_op(op, args[0].value, args[1].value,
+                               args[2].value),
+             .reg = 0};
+      return true;
+    }
+
+    ExpressionFilter::Instruction instruction = {
+        .op = op,
+        .dst = 0,
+        .a = this->register_of(args[0]),
+        .b = this->register_of(args[1]),
+        .c = this->register_of(args[2]),
+    };
+    // allocated while the operands are still held, so it differs from them.
+    if (!this->allocate(instruction.dst)) {
+      return false;
+    }
+    for (const Operand &arg : args) {
+      this->release(arg);
+    }
+    this->filter.program.push_back(instruction);
+    out = {.is_constant = false, .value = 0.0f, .reg = instruction.dst};
+    return true;
+  }
+
+  /*
+   * Moves the constants right after the inputs, now that their count is
+   * known.
+   */
+  void relocate() {
+    uint16_t constant_count =
+        static_cast<uint16_t>(this->filter.constants.size());
+    auto map = [&](uint16_t reg) -> uint16_t {
+      if (0 != (reg & CONSTANT_FLAG)) {
+        return static_cast<uint16_t>(INPUT_COUNT + (reg & ~CONSTANT_FLAG));
+      }
+      return reg < INPUT_COUNT ? reg
+                               : static_cast<uint16_t>(reg + constant_count);
+    };
+    for (auto &instruction : this->filter.program) {
+      instruction.dst = map(instruction.dst);
+      instruction.a = map(instruction.a);
+      instruction.b = map(instruction.b);
+      instruction.c = map(instruction.c);
+    }
+    this->filter.register_count =
+        static_cast<uint16_t>(this->max_register + constant_count);
+  }
+};
+
+/*
+ * *****************************
+ * ExpressionFilter
+ * *****************************
+ */
+
+/*
+ * Constructor, the filter does nothing until compiled.
+ */
+ExpressionFilter::ExpressionFilter()
+    : register_count(INPUT_COUNT), writes{false, false, false, false} {}
+
+/*
+ * Compiles the given expression, unless it is the one already compiled.
+ * @param error - what is wrong with the expression and where, if failed
+ * @returns true if succeeded, false if failed
+ */
+bool ExpressionFilter::compile(const std::string &source, std::string &error) {
+  if (this->source == source && !this->program.empty()) {
+    return true;
+  }
+  this->source.clear();
+  this->program.clear();
+  this->constants.clear();
+  this->register_count = INPUT_COUNT;
+  std::fill(std::begin(this->writes), std::end(this->writes), false);
+
+  ExpressionCompiler compiler(source, *this, error);
+  if (!compiler.compile()) {
+    this->program.clear();
+    return false;
+  }
+  if (this->program.empty()) {
+    error = "expression doesn't assign anything";
+    return false;
+  }
+  nhlog_debug("ExpressionFilter: compiled %zu instructions, %u registers, "
+              "%zu constants",
+              this->program.size(), this->register_count,
+              this->constants.size());
+  this->source = source;
+  return true;
+}
+
+/*
+ * Runs the compiled expression over every pixel of `view`, in place.
+ * Grey images read as r, g and b alike and get the luma written back.
+ * @param width, height - size of the whole image
+ */
+void ExpressionFilter::run(ImageView view, int32_t width,
+                           int32_t height) const {
+  if (this->program.empty() || view.channels < 1 || 4 < view.channels) {
+    nhlog_warn("ExpressionFilter: nothing to run over %d channels",
+               view.channels);
+    return;
+  }
+
+  parallel_for(static_cast<size_t>(view.height), [&](size_t row) {
+    // reused across rows and calls, registers are one block each.
+    thread_local std::vector<float> registers;
+    registers.resize(static_cast<size_t>(this->register_count) *
+                     EXPRESSION_BLOCK_SIZE);
+    auto fill = [&](size_t reg, float value) {
+      float *lanes = registers.data() + reg * EXPRESSION_BLOCK_SIZE;
+      std::fill(lanes, lanes + EXPRESSION_BLOCK_SIZE, value);
+    };
+
+    int32_t y = view.y + static_cast<int32_t>(row);
+    fill(INPUT_Y, static_cast<float>(y));
+    fill(INPUT_WIDTH, static_cast<float>(width));
+    fill(INPUT_HEIGHT, static_cast<float>(height));
+    for (size_t i = 0; i < this->constants.size(); i++) {
+      fill(INPUT_COUNT + i, this->constants[i]);
+    }
+
+    for (int32_t x = view.x; x < view.x + view.width;
+         x += EXPRESSION_BLOCK_SIZE) {
+      size_t count = static_cast<size_t>(
+          std::min(EXPRESSION_BLOCK_SIZE, view.x + view.width - x));
+      this->run_block(view, x, y, count, registers.data());
+    }
+  });
+}
+
+/*
+ * Runs the program over one block of `count` pixels starting at (x, y).
+ */
+void ExpressionFilter::run_block(ImageView view, int32_t x, int32_t y,
+                                 size_t count, float *registers) const {
+  auto lanes = [&](size_t reg) {
+    return registers + reg * EXPRESSION_BLOCK_SIZE;
+  };
+  float *r = lanes(INPUT_R), *g = lanes(INPUT_G), *b = lanes(INPUT_B),
+        *a = lanes(INPUT_A), *xs = lanes(INPUT_X);
+  size_t channels = static_cast<size_t>(view.channels);
+  uint8_t *pixels = image_view_pixel(view, x, y);
+
+  dispatch_sample_type(view.sample_type, [&](auto type) {
+    using T = typename decltype(type)::type;
+    const T *samples = reinterpret_cast<const T *>(pixels);
+    switch (channels) {
+    case 1:
+      load_block<T, 1>(samples, count, r, g, b, a);
+      break;
+    case 2:
+      load_block<T, 2>(samples, count, r, g, b, a);
+      break;
+    case 3:
+      load_block<T, 3>(samples, count, r, g, b, a);
+      break;
+    default:
+      load_block<T, 4>(samples, count, r, g, b, a);
+      break;
+    }
+  });
+  fill_x(xs, static_cast<float>(x));
+
+  for (const Instruction &instruction : this->program) {
+    float *dst = lanes(instruction.dst);
+    const float *op_a = lanes(instruction.a);
+    const float *op_b = lanes(instruction.b);
+    const float *op_c = lanes(instruction.c);
+    switch (instruction.op) {
+#define RUN_OP(op)                                                             \
+  case op:                                                                     \
+    run_op<op>(dst, op_a, op_b, op_c);                                         \
+    break;
+      RUN_OP(OP_MOVE)
+      RUN_OP(OP_NEGATE)
+      RUN_OP(OP_ADD)
+      RUN_OP(OP_SUBTRACT)
+      RUN_OP(OP_MULTIPLY)
+      RUN_OP(OP_DIVIDE)
+      RUN_OP(OP_MIN)
+      RUN_OP(OP_MAX)
+      RUN_OP(OP_LESS)
+      RUN_OP(OP_LESS_EQUAL)
+      RUN_OP(OP_EQUAL)
+      RUN_OP(OP_NOT_EQUAL)
+      RUN_OP(OP_SELECT)
+      RUN_OP(OP_MIX)
+      RUN_OP(OP_CLAMP)
+      RUN_OP(OP_ABS)
+      RUN_OP(OP_FLOOR)
+      RUN_OP(OP_SQRT)
+      RUN_OP(OP_POW)
+      RUN_OP(OP_SIN)
+      RUN_OP(OP_COS)
+#undef RUN_OP
+    }
+  }
+
+  // and back, only the channels the expression wrote to. Grey images get
+  // the luma of r, g and b once any of them was written.
+  dispatch_sample_type(view.sample_type, [&](auto type) {
+    using T = typename decltype(type)::type;
+    T *samples = reinterpret_cast<T *>(pixels);
+    if (channels < 3) {
+      if (this->writes[INPUT_R] || this->writes[INPUT_G] ||
+          this->writes[INPUT_B]) {
+        luma_block(count, r, g, b, r);
+        if (1 == channels) {
+          store_channel<T, 1>(samples, count, r);
+        } else {
+          store_channel<T, 2>(samples, count, r);
+        }
+      }
+      if (2 == channels && this->writes[INPUT_A]) {
+        store_channel<T, 2>(samples + 1, count, a);
+      }
+      return;
+    }
+    for (size_t channel = 0; channel < channels; channel++) {
+      if (!this->writes[channel]) {
+        continue;
+      }
+      if (4 == channels) {
+        store_channel<T, 4>(samples + channel, count, lanes(channel));
+      } else {
+        store_channel<T, 3>(samples + channel, count, lanes(channel));
+      }
+    }
+  });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Built-in per pixel filter written as a small expression, e.g.
+ *
+ *   r = g * 0.5 + b * 0.5; a = x < width / 2 ? a : 1
+ *
+ * Statements are separated by `;` or new lines and assign to r, g, b, a or
+ * to new names used as locals. Channels are read and written in [0, 1],
+ * x, y, width and height are in pixels. Supports + - * /, comparisons
+ * (1 if true, 0 if false), `c ? a : b`, pi, and min, max, clamp, mix, abs,
+ * floor, sqrt, pow, sin and cos.
+ *
+ * The expression is compiled once into register bytecode. Each register
+ * holds a whole block of pixels of one row, so every instruction is a
+ * tight loop over floats which the compiler vectorizes, and rows run
+ * across threads.
+ */
+class ExpressionFilter {
+private:
+  struct Instruction {
+    uint8_t op;
+    uint16_t dst, a, b, c;
+  };
+
+  std::string source;
+  std::vector<Instruction> program;
+  // values of the registers after the inputs, set once per block.
+  std::vector<float> constants;
+  uint16_t register_count;
+  // channels the expression assigns to, the others are left untouched.
+  bool writes[4];
+
+public:
+  /*
+   * Constructor, the filter does nothing until compiled.
+   */
+  ExpressionFilter();
+
+  /*
+   * Compiles the given expression, unless it is the one already compiled.
+   * @param error - what is wrong with the expression and where, if failed
+   * @returns true if succeeded, false if failed
+   */
+  bool compile(const std::string &source, std::string &error);
+
+  /*
+   * Runs the compiled expression over every pixel of `view`, in place.
+   * Grey images read as r, g and b alike and get the luma written back.
+   * @param width, height - size of the whole image
+   */
+  void run(ImageView view, int32_t width, int32_t height) const;
+
+private:
+  /*
+   * Runs the program over one block of `count` pixels starting at (x, y).
+   */
+  void run_block(ImageView view, int32_t x, int32_t y, size_t count,
+                 float *registers) const;
+
+  friend class ExpressionCompiler;
+};
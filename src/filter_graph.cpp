@@ -0,0 +1,708 @@
+#include "src/filter_graph.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include "src/editor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static constexpr uint64_t HASH_OFFSET = 0xcbf29ce484222325ull;
+static constexpr uint64_t HASH_PRIME = 0x100000001b3ull;
+
+/*
+ * FNV-1a of the bytes, continuing from `hash`.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * HASH_PRIME;
+  }
+  return hash;
+}
+
+/*
+ * Mixes a tile key into `hash`.
+ */
+static uint64_t hash_key(uint64_t hash, uint64_t key) {
+  return hash_bytes(hash, &key, sizeof(key));
+}
+
+/*
+ * Constructor, no source.
+ */
+FilterGraph::FilterGraph()
+    : source(nullptr), width(0), height(0), channels(0),
+      sample_type(SAMPLE_TYPE_U8), tiles_x(0), tiles_y(0), next_version(1),
+      last_profile() {}
+
+/*
+ * Frees the source and every node.
+ */
+FilterGraph::~FilterGraph() { this->clear(); }
+
+/*
+ * Drops every node and makes a copy of `base` the source.
+ * @returns false if out of memory, the graph is cleared then
+ */
+bool FilterGraph::reset(const Image &base) {
+  this->clear();
+  size_t size = image_size(base);
+  this->source = static_cast<uint8_t *>(malloc(size));
+  if (nullptr == this->source) {
+    return false;
+  }
+  std::memcpy(this->source, base.data, size);
+  this->width = base.width;
+  this->height = base.height;
+  this->channels = base.channels;
+  this->sample_type = base.sample_type;
+  this->tiles_x = (base.width + EDITOR_TILE_SIZE - 1) / EDITOR_TILE_SIZE;
+  this->tiles_y = (base.height + EDITOR_TILE_SIZE - 1) / EDITOR_TILE_SIZE;
+  size_t tiles =
+      static_cast<size_t>(this->tiles_x) * static_cast<size_t>(this->tiles_y);
+  this->source_keys.resize(tiles);
+  for (uint64_t &key : this->source_keys) {
+    key = this->next_version++;
+  }
+  // the target starts out as the source.
+  this->target_keys = this->source_keys;
+  return true;
+}
+
+/*
+ * Frees the source and every node.
+ */
+void FilterGraph::clear() {
+  free(this->source);
+  this->source = nullptr;
+  this->nodes.clear();
+  this->width = this->height = this->channels = 0;
+  this->tiles_x = this->tiles_y = 0;
+  this->source_keys.clear();
+  this->target_keys.clear();
+}
+
+/*
+ * Number of nodes.
+ */
+size_t FilterGraph::size() const { return this->nodes.size(); }
+
+/*
+ * Node at `index`, in the order they were added.
+ */
+const FilterNode &FilterGraph::node(size_t index) const {
+  return this->nodes[index];
+}
+
+/*
+ * The source pixels as an image, which may be edited in place, see
+ * invalidate.
+ */
+Image FilterGraph::source_image() const {
+  return Image{.data = this->source,
+               .width = this->width,
+               .height = this->height,
+               .channels = this->channels,
+               .sample_type = this->sample_type};
+}
+
+/*
+ * Replaces the source pixels with the given malloc'ed ones, which the
+ * graph takes over.
+ * @returns the previous pixels, now owned by the caller
+ */
+uint8_t *FilterGraph::swap_source(uint8_t *data) {
+  std::swap(this->source, data);
+  this->invalidate(
+      Rect{.x = 0, .y = 0, .width = this->width, .height = this->height});
+  return data;
+}
+
+/*
+ * Adds a node running the plugin with its current vars over the output
+ * of node `input`, -1 for the source.
+ * @returns the index of the new node, the last one
+ */
+size_t FilterGraph::add(const Plugin &plugin, EditorState es,
+                        int32_t input) {
+  const auto *vars = static_cast<const uint8_t *>(plugin.replace_image_data);
+  size_t vars_size = PluginManager::calc_vars_size(plugin);
+  FilterNode node = {
+      .plugin = plugin,
+      .vars = std::vector<uint8_t>(vars, vars + vars_size),
+      .es = es,
+      .input = std::clamp(input, -1,
+                          static_cast<int32_t>(this->nodes.size()) - 1),
+      .enabled = true,
+      .params = 0,
+      .halo = 0,
+      .tiled = false,
+      .thread_safe = false,
+      .pixels = {},
+      .keys = std::vector<uint64_t>(this->source_keys.size(), 0),
+  };
+  this->nodes.push_back(std::move(node));
+  size_t index = this->nodes.size() - 1;
+  this->update_params(index);
+  nhlog_debug("FilterGraph: added %s as node %zu over %d",
+              plugin.info()->name, index, this->nodes[index].input);
+  return index;
+}
+
+/*
+ * Removes the node at `index`, the nodes it fed read from its input
+ * instead.
+ */
+void FilterGraph::remove(size_t index) {
+  auto removed = static_cast<int32_t>(index);
+  int32_t input = this->nodes[index].input;
+  this->nodes.erase(this->nodes.begin() + static_cast<ptrdiff_t>(index));
+  for (FilterNode &node : this->nodes) {
+    if (removed == node.input) {
+      node.input = input;
+    } else if (removed < node.input) {
+      node.input--;
+    }
+  }
+}
+
+/*
+ * Sets the vars of the node at `index` and whether it is enabled.
+ */
+void FilterGraph::set(size_t index, bool enabled,
+                      const std::vector<uint8_t> &vars) {
+  FilterNode &node = this->nodes[index];
+  node.enabled = enabled;
+  node.vars = vars;
+  this->update_params(index);
+}
+
+/*
+ * Marks the source tiles under `rect` changed.
+ */
+void FilterGraph::invalidate(Rect rect) {
+  std::vector<uint8_t> touched(this->source_keys.size(), 0);
+  this->mark_tiles(rect, touched);
+  for (size_t t = 0; t < touched.size(); t++) {
+    if (0 != touched[t]) {
+      this->source_keys[t] = this->next_version++;
+    }
+  }
+}
+
+/*
+ * Brings the tiles of the output `rect` touches up to date and copies the
+ * ones that changed into `target`, an image of the source's format.
+ * @param fused - whether chains of tiled nodes are run through each tile
+ * together, keeping only what the last one of them outputs, see run_chain.
+ * For output that isn't tweaked after, like the final one
+ * @returns the part of `target` that changed, empty if none
+ */
+Rect FilterGraph::evaluate(Rect rect, Image target, bool fused) {
+  Rect changed = {.x = 0, .y = 0, .width = 0, .height = 0};
+  if (nullptr == this->source) {
+    return changed;
+  }
+  auto start = std::chrono::steady_clock::now();
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  const size_t tiles = this->source_keys.size();
+  std::vector<uint8_t> shown(tiles, 0);
+  this->mark_tiles(rect, shown);
+
+  // from the output back, every node needs the part of its input its
+  // tiles read.
+  std::vector<std::vector<uint8_t>> needed(this->nodes.size());
+  int32_t output = this->resolve(static_cast<int32_t>(this->nodes.size()) - 1);
+  if (0 <= output) {
+    needed[static_cast<size_t>(output)] = shown;
+  }
+  for (size_t i = this->nodes.size(); 0 < i--;) {
+    const FilterNode &node = this->nodes[i];
+    int32_t input = this->resolve(node.input);
+    if (needed[i].empty() || 0 > input) {
+      continue;
+    }
+    std::vector<uint8_t> &input_needed = needed[static_cast<size_t>(input)];
+    input_needed.resize(tiles, 0);
+    for (size_t t = 0; t < tiles; t++) {
+      if (0 == needed[i][t]) {
+        continue;
+      }
+      if (!node.tiled) {
+        std::fill(input_needed.begin(), input_needed.end(), 1);
+        break;
+      }
+      this->mark_tiles(grow_rect(this->tile_rect(t), node.halo, bounds),
+                       input_needed);
+    }
+  }
+
+  FilterGraphProfile profile = {.nodes = 0,
+                                .passes = 0,
+                                .fused_nodes = 0,
+                                .tiles = 0,
+                                .milliseconds = 0.0};
+  if (fused) {
+    changed = this->run_fused(output, needed, shown, target, profile);
+  } else {
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+      size_t run = needed[i].empty() ? 0 : this->run_node(i, needed[i]);
+      if (0 < run) {
+        profile.nodes++;
+        profile.passes++;
+        profile.tiles += run;
+      }
+    }
+    changed = this->copy_output(output, shown, target);
+  }
+
+  // evaluating what is shown mostly runs nothing, keep what last did.
+  if (0 < profile.nodes) {
+    profile.milliseconds = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    this->last_profile = profile;
+    nhlog_debug("FilterGraph: ran %zu nodes over %zu tiles in %zu passes, "
+                "%zu nodes fused, %.1f ms",
+                profile.nodes, profile.tiles, profile.passes,
+                profile.fused_nodes, profile.milliseconds);
+  }
+  return changed;
+}
+
+/*
+ * What the last evaluate that ran any node did.
+ */
+const FilterGraphProfile &FilterGraph::profile() const {
+  return this->last_profile;
+}
+
+/*
+ * Bytes the cached outputs take.
+ */
+size_t FilterGraph::bytes() const {
+  size_t bytes = 0;
+  for (const FilterNode &node : this->nodes) {
+    bytes += node.pixels.size();
+  }
+  return bytes;
+}
+
+/*
+ * Part of the image tile t covers.
+ */
+Rect FilterGraph::tile_rect(size_t t) const {
+  auto tx = static_cast<int32_t>(t % static_cast<size_t>(this->tiles_x));
+  auto ty = static_cast<int32_t>(t / static_cast<size_t>(this->tiles_x));
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  return grow_rect(Rect{.x = tx * EDITOR_TILE_SIZE,
+                        .y = ty * EDITOR_TILE_SIZE,
+                        .width = EDITOR_TILE_SIZE,
+                        .height = EDITOR_TILE_SIZE},
+                   0, bounds);
+}
+
+/*
+ * Marks in `marks` the tiles `rect` touches.
+ */
+void FilterGraph::mark_tiles(Rect rect,
+                             std::vector<uint8_t> &marks) const {
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, bounds);
+  if (rect.width <= 0 || rect.height <= 0) {
+    return;
+  }
+  int32_t x0 = rect.x / EDITOR_TILE_SIZE;
+  int32_t y0 = rect.y / EDITOR_TILE_SIZE;
+  int32_t x1 = (rect.x + rect.width - 1) / EDITOR_TILE_SIZE;
+  int32_t y1 = (rect.y + rect.height - 1) / EDITOR_TILE_SIZE;
+  for (int32_t ty = y0; ty <= y1; ty++) {
+    for (int32_t tx = x0; tx <= x1; tx++) {
+      marks[static_cast<size_t>(ty * this->tiles_x + tx)] = 1;
+    }
+  }
+}
+
+/*
+ * Index of the enabled node whose output node `index` shows, following
+ * disabled ones to their input, -1 for the source.
+ */
+int32_t FilterGraph::resolve(int32_t index) const {
+  while (0 <= index && !this->nodes[static_cast<size_t>(index)].enabled) {
+    index = this->nodes[static_cast<size_t>(index)].input;
+  }
+  return index;
+}
+
+/*
+ * Computes the params hash, halo and tiling of the node at `index`.
+ */
+void FilterGraph::update_params(size_t index) {
+  FilterNode &node = this->nodes[index];
+  const Plugin &plugin = node.plugin;
+  node.plugin.replace_image_data = node.vars.data();
+
+  // a reloaded library is a different plugin.
+  std::string path = plugin.path.string();
+  const void *handler = plugin.handler.get();
+  uint64_t hash = hash_bytes(HASH_OFFSET, path.data(), path.size());
+  hash = hash_bytes(hash, &handler, sizeof(handler));
+  hash = hash_bytes(hash, node.vars.data(), node.vars.size());
+  hash = hash_bytes(hash, &node.es.primary_selected_color, sizeof(Color));
+  hash = hash_bytes(hash, &node.es.opacity, sizeof(node.es.opacity));
+  hash = hash_bytes(hash, &node.es.put_pixel_size,
+                    sizeof(node.es.put_pixel_size));
+  hash = hash_bytes(hash, &plugin.linear_light, sizeof(plugin.linear_light));
+  node.params = hash;
+
+  // plugins run on a converted copy only ever see the whole image.
+  node.halo = 0;
+  node.tiled = false;
+  node.thread_safe = false;
+  bool converted = !plugin.handles(this->sample_type) ||
+                   (plugin.linear_light &&
+                    SAMPLE_TYPE_F32 != this->sample_type &&
+                    plugin.handles(SAMPLE_TYPE_F32));
+  if (!plugin.sandboxed && !converted && nullptr != plugin.replace_region &&
+      nullptr != plugin.region_info) {
+    PluginRegionInfo info = plugin.region_info(node.es, node.vars.data());
+    node.tiled = PLUGIN_HALO_UNBOUNDED != info.halo;
+    node.halo = node.tiled ? info.halo : 0;
+    node.thread_safe = info.thread_safe;
+  }
+}
+
+/*
+ * Output of the node at `index` as an image, the source for -1.
+ */
+Image FilterGraph::output_image(int32_t index) {
+  Image img = this->source_image();
+  if (0 <= index) {
+    img.data = this->nodes[static_cast<size_t>(index)].pixels.data();
+  }
+  return img;
+}
+
+/*
+ * Keys of the tiles of the output of the node at `index`, the source's for
+ * -1.
+ */
+const std::vector<uint64_t> &FilterGraph::output_keys(int32_t index) const {
+  return 0 > index ? this->source_keys
+                   : this->nodes[static_cast<size_t>(index)].keys;
+}
+
+/*
+ * Keys the tiles of the node at `index` marked in `needed` get, given the
+ * keys of its input, 0 for the rest.
+ */
+std::vector<uint64_t>
+FilterGraph::node_keys(size_t index, const std::vector<uint64_t> &input_keys,
+                       const std::vector<uint8_t> &needed) const {
+  const FilterNode &node = this->nodes[index];
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  std::vector<uint64_t> keys(input_keys.size(), 0);
+
+  // untiled nodes depend on every input tile.
+  uint64_t whole_key = node.params;
+  if (!node.tiled) {
+    for (uint64_t key : input_keys) {
+      whole_key = hash_key(whole_key, key);
+    }
+  }
+  for (size_t t = 0; t < needed.size(); t++) {
+    if (0 == needed[t]) {
+      continue;
+    }
+    uint64_t key = whole_key;
+    if (node.tiled) {
+      Rect reach = grow_rect(this->tile_rect(t), node.halo, bounds);
+      for (int32_t ty = reach.y / EDITOR_TILE_SIZE;
+           ty <= (reach.y + reach.height - 1) / EDITOR_TILE_SIZE; ty++) {
+        for (int32_t tx = reach.x / EDITOR_TILE_SIZE;
+             tx <= (reach.x + reach.width - 1) / EDITOR_TILE_SIZE; tx++) {
+          size_t u = static_cast<size_t>(ty * this->tiles_x + tx);
+          key = hash_key(key, input_keys[u]);
+        }
+      }
+    }
+    // 0 stands for never computed.
+    keys[t] = std::max(key, uint64_t{1});
+  }
+  return keys;
+}
+
+/*
+ * Copies the tiles of the output of node `output`, -1 for the source,
+ * marked in `shown` into `target` where it holds something else.
+ * @returns the part of `target` that changed, empty if none
+ */
+Rect FilterGraph::copy_output(int32_t output,
+                              const std::vector<uint8_t> &shown,
+                              Image target) {
+  Rect changed = {.x = 0, .y = 0, .width = 0, .height = 0};
+  const std::vector<uint64_t> &keys = this->output_keys(output);
+  Image from = this->output_image(output);
+  std::vector<size_t> copies;
+  for (size_t t = 0; t < shown.size(); t++) {
+    if (0 != shown[t] && keys[t] != this->target_keys[t]) {
+      this->target_keys[t] = keys[t];
+      copies.push_back(t);
+      changed = union_rect(changed, this->tile_rect(t));
+    }
+  }
+  parallel_for(copies.size(), [&](size_t i) {
+    Rect tile = this->tile_rect(copies[i]);
+    copy_view(image_view(from, tile), image_view(target, tile));
+  });
+  return changed;
+}
+
+/*
+ * Runs the node at `index` over the tiles marked in `needed` whose key
+ * changed.
+ * @returns the number of tiles run
+ */
+size_t FilterGraph::run_node(size_t index,
+                             const std::vector<uint8_t> &needed) {
+  FilterNode &node = this->nodes[index];
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  int32_t input_index = this->resolve(node.input);
+  Image input = this->output_image(input_index);
+  std::vector<uint64_t> keys =
+      this->node_keys(index, this->output_keys(input_index), needed);
+  std::vector<size_t> stale;
+  for (size_t t = 0; t < needed.size(); t++) {
+    if (0 != needed[t] && keys[t] != node.keys[t]) {
+      stale.push_back(t);
+    }
+  }
+  if (stale.empty()) {
+    return 0;
+  }
+
+  if (node.pixels.empty()) {
+    node.pixels.resize(image_size(input));
+  }
+  Image output = this->output_image(static_cast<int32_t>(index));
+  if (!node.tiled) {
+    std::memcpy(output.data, input.data, node.pixels.size());
+    Editor::run_replace_image(node.plugin, node.es, output, bounds,
+                              this->call_state, this->snapshot);
+    std::fill(node.keys.begin(), node.keys.end(), keys[stale[0]]);
+    return node.keys.size();
+  }
+
+  // plugins replace what is in `dst`, as when run over the image.
+  const char *plugin_name = node.plugin.info()->name;
+  auto run_tile = [&](size_t i) {
+    Rect tile = this->tile_rect(stale[i]);
+    ImageView dst = image_view(output, tile);
+    copy_view(image_view(input, tile), dst);
+    {
+      PluginCallScope scope(&this->call_state, plugin_name);
+      node.plugin.replace_region(
+          node.es, image_view(input, grow_rect(tile, node.halo, bounds)), dst,
+          node.vars.data());
+    }
+    node.keys[stale[i]] = keys[stale[i]];
+  };
+  if (node.thread_safe) {
+    parallel_for(stale.size(), run_tile);
+  } else {
+    for (size_t i = 0; i < stale.size(); i++) {
+      run_tile(i);
+    }
+  }
+  return stale.size();
+}
+
+/*
+ * Runs the nodes the output `output` is computed through, chains of tiled
+ * ones fused, see run_chain, and writes the tiles of it marked in `shown`
+ * into `target`.
+ * @returns the part of `target` that changed, empty if none
+ */
+Rect FilterGraph::run_fused(int32_t output,
+                            const std::vector<std::vector<uint8_t>> &needed,
+                            const std::vector<uint8_t> &shown, Image target,
+                            FilterGraphProfile &profile) {
+  std::vector<size_t> path;
+  for (int32_t i = output; 0 <= i;
+       i = this->resolve(this->nodes[static_cast<size_t>(i)].input)) {
+    path.push_back(static_cast<size_t>(i));
+  }
+  std::reverse(path.begin(), path.end());
+
+  for (size_t first = 0; first < path.size();) {
+    const FilterNode &head = this->nodes[path[first]];
+    if (!head.tiled) {
+      size_t run = this->run_node(path[first], needed[path[first]]);
+      if (0 < run) {
+        profile.nodes++;
+        profile.passes++;
+        profile.tiles += run;
+      }
+      first++;
+      continue;
+    }
+    // the nodes of a chunk run over it grown by the halos of the nodes
+    // after them, recomputing the overlap with the chunks around. Chains
+    // only grow while that stays small, the first node reads its input.
+    size_t end = first + 1;
+    int32_t halo = 0;
+    while (end < path.size() && this->nodes[path[end]].tiled &&
+           halo + this->nodes[path[end]].halo <= FILTER_CHAIN_MAX_HALO) {
+      halo += this->nodes[path[end]].halo;
+      end++;
+    }
+    std::vector<size_t> chain(path.begin() + static_cast<ptrdiff_t>(first),
+                              path.begin() + static_cast<ptrdiff_t>(end));
+    if (path.size() == end) {
+      return this->run_chain(chain, needed, &target, profile);
+    }
+    this->run_chain(chain, needed, nullptr, profile);
+    first = end;
+  }
+  return this->copy_output(output, shown, target);
+}
+
+/*
+ * Runs a chain of tiled nodes, each filtering the output of the one before,
+ * over the tiles of the last one marked in `needed` whose key changed. The
+ * tiles are split into FILTER_CHAIN_TILE_SIZE chunks that go through the
+ * whole chain while they are in cache, see run_chunk. Only what the last
+ * node outputs is kept: in `target` if given, copied from its cache where
+ * that is up to date, or else in its cache.
+ * @returns the part of `target` that changed, empty if none
+ */
+Rect FilterGraph::run_chain(const std::vector<size_t> &chain,
+                            const std::vector<std::vector<uint8_t>> &needed,
+                            Image *target, FilterGraphProfile &profile) {
+  Rect changed = {.x = 0, .y = 0, .width = 0, .height = 0};
+  int32_t input_index = this->resolve(this->nodes[chain[0]].input);
+  Image input = this->output_image(input_index);
+  // keys the tiles of every node of the chain get, the ones in between are
+  // never kept.
+  std::vector<uint64_t> keys = this->output_keys(input_index);
+  for (size_t index : chain) {
+    keys = this->node_keys(index, keys, needed[index]);
+  }
+
+  FilterNode &tail = this->nodes[chain.back()];
+  const std::vector<uint8_t> &tail_needed = needed[chain.back()];
+  std::vector<size_t> runs, copies;
+  for (size_t t = 0; t < tail_needed.size(); t++) {
+    if (0 == tail_needed[t]) {
+      continue;
+    }
+    if (nullptr == target) {
+      if (keys[t] != tail.keys[t]) {
+        tail.keys[t] = keys[t];
+        runs.push_back(t);
+      }
+      continue;
+    }
+    if (keys[t] != this->target_keys[t]) {
+      this->target_keys[t] = keys[t];
+      changed = union_rect(changed, this->tile_rect(t));
+      (keys[t] == tail.keys[t] ? copies : runs).push_back(t);
+    }
+  }
+  if (!runs.empty() && nullptr == target && tail.pixels.empty()) {
+    tail.pixels.resize(image_size(input));
+  }
+
+  Image cached = this->output_image(static_cast<int32_t>(chain.back()));
+  Image output = nullptr != target ? *target : cached;
+  parallel_for(copies.size(), [&](size_t i) {
+    Rect tile = this->tile_rect(copies[i]);
+    copy_view(image_view(cached, tile), image_view(output, tile));
+  });
+
+  std::vector<Rect> chunks;
+  for (size_t t : runs) {
+    for (Rect chunk :
+         split_into_tiles(this->tile_rect(t), FILTER_CHAIN_TILE_SIZE)) {
+      chunks.push_back(chunk);
+    }
+  }
+  bool thread_safe = true;
+  for (size_t index : chain) {
+    thread_safe = thread_safe && this->nodes[index].thread_safe;
+  }
+  auto run_chunk = [&](size_t i) {
+    this->run_chunk(chain, input, output, chunks[i]);
+  };
+  if (thread_safe) {
+    parallel_for(chunks.size(), run_chunk);
+  } else {
+    for (size_t i = 0; i < chunks.size(); i++) {
+      run_chunk(i);
+    }
+  }
+
+  if (!runs.empty()) {
+    profile.nodes += chain.size();
+    profile.passes++;
+    profile.fused_nodes += 1 < chain.size() ? chain.size() : 0;
+    profile.tiles += runs.size() * chain.size();
+  }
+  return changed;
+}
+
+/*
+ * View of `rect` over pixels held in `scratch`, sized to fit.
+ */
+static ImageView scratch_view(std::vector<uint8_t> &scratch, Rect rect,
+                              int32_t channels, SampleType sample_type) {
+  size_t stride = static_cast<size_t>(rect.width) *
+                  static_cast<size_t>(channels) * sample_size(sample_type);
+  scratch.resize(stride * static_cast<size_t>(rect.height));
+  return ImageView{
+      .data = scratch.data(),
+      .x = rect.x,
+      .y = rect.y,
+      .width = rect.width,
+      .height = rect.height,
+      .channels = channels,
+      .stride = stride,
+      .sample_type = sample_type,
+  };
+}
+
+/*
+ * Runs the chain over `chunk` of `output`. Each node runs over the chunk
+ * grown by the halos of the nodes after it, into scratch of the calling
+ * thread, the last one into `output`.
+ */
+void FilterGraph::run_chunk(const std::vector<size_t> &chain, Image input,
+                            Image output, Rect chunk) {
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  std::vector<Rect> areas(chain.size());
+  areas.back() = chunk;
+  for (size_t k = chain.size() - 1; 0 < k; k--) {
+    areas[k - 1] = grow_rect(areas[k], this->nodes[chain[k]].halo, bounds);
+  }
+
+  thread_local std::vector<uint8_t> front, back;
+  ImageView src = image_view(
+      input, grow_rect(areas[0], this->nodes[chain[0]].halo, bounds));
+  for (size_t k = 0; k < chain.size(); k++) {
+    FilterNode &node = this->nodes[chain[k]];
+    ImageView dst = k + 1 == chain.size()
+                        ? image_view(output, areas[k])
+                        : scratch_view(back, areas[k], this->channels,
+                                       this->sample_type);
+    // plugins replace what is in `dst`, as when run over the image.
+    copy_view(sub_view(src, areas[k]), dst);
+    {
+      PluginCallScope scope(&this->call_state, node.plugin.info()->name);
+      node.plugin.replace_region(node.es, src, dst, node.vars.data());
+    }
+    std::swap(front, back);
+    src = dst;
+  }
+}
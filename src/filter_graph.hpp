@@ -0,0 +1,260 @@
+#pragma once
+
+#include "common.hpp"
+#include "src/host_services.hpp"
+#include "src/plugins_manager.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * One replace image plugin run of a FilterGraph, with the vars and editor
+ * state it runs with.
+ */
+struct FilterNode {
+  Plugin plugin;
+  std::vector<uint8_t> vars;
+  EditorState es;
+  // node whose output this one filters, -1 for the source image. Always an
+  // earlier node.
+  int32_t input;
+  // disabled nodes pass their input through.
+  bool enabled;
+  // hash of everything above the output depends on but the input.
+  uint64_t params;
+  // pixels the plugin reads around a tile, whether it is run tile by tile
+  // at all, and whether tiles may run at once. Plugins that aren't tiled
+  // are run over the whole image.
+  int32_t halo;
+  bool tiled;
+  bool thread_safe;
+  // the output, sized once first needed, and per tile the key of what it
+  // was computed from, 0 if never.
+  std::vector<uint8_t> pixels;
+  std::vector<uint64_t> keys;
+};
+
+/*
+ * What an evaluation of a FilterGraph ran: the node runs, the passes over
+ * the image they took, chains of nodes run fused by tile taking one, how
+ * many of the nodes were in such chains, and the node tiles run.
+ */
+struct FilterGraphProfile {
+  size_t nodes;
+  size_t passes;
+  size_t fused_nodes;
+  size_t tiles;
+  double milliseconds;
+};
+
+/*
+ * Replace image plugins applied to a source image without changing it, each
+ * node filtering the output of an earlier one. The last node is the output.
+ *
+ * Outputs are cached by EDITOR_TILE_SIZE tile. A tile's key hashes the
+ * node's params with the keys of the input tiles its halo reaches, the
+ * source tiles being keyed by version. Evaluating a part of the output only
+ * runs the nodes whose tiles there have a new key, so tweaking one node
+ * reruns it and the ones after it, and editing the source reruns the tiles
+ * downstream of the edit.
+ *
+ * Chains of tiled nodes can instead run fused: small chunks of a tile go
+ * through every node of the chain while in cache, and only what the last
+ * node outputs is written, see run_chain.
+ */
+class FilterGraph {
+private:
+  std::vector<FilterNode> nodes;
+  // malloc'ed, owned by the graph.
+  uint8_t *source;
+  int32_t width, height, channels;
+  SampleType sample_type;
+  int32_t tiles_x, tiles_y;
+  // per tile, version of the source and key of what the target holds.
+  std::vector<uint64_t> source_keys;
+  std::vector<uint64_t> target_keys;
+  uint64_t next_version;
+  // progress and scratch of the plugins run.
+  PluginCallState call_state;
+  std::vector<uint8_t> snapshot;
+  FilterGraphProfile last_profile;
+
+public:
+  /*
+   * Constructor, no source.
+   */
+  FilterGraph();
+
+  /*
+   * Frees the source and every node.
+   */
+  ~FilterGraph();
+
+  FilterGraph(const FilterGraph &) = delete;
+  FilterGraph &operator=(const FilterGraph &) = delete;
+
+  /*
+   * Drops every node and makes a copy of `base` the source.
+   * @returns false if out of memory, the graph is cleared then
+   */
+  bool reset(const Image &base);
+
+  /*
+   * Frees the source and every node.
+   */
+  void clear();
+
+  /*
+   * Number of nodes.
+   */
+  size_t size() const;
+
+  /*
+   * Node at `index`, in the order they were added.
+   */
+  const FilterNode &node(size_t index) const;
+
+  /*
+   * The source pixels as an image, which may be edited in place, see
+   * invalidate.
+   */
+  Image source_image() const;
+
+  /*
+   * Replaces the source pixels with the given malloc'ed ones, which the
+   * graph takes over.
+   * @returns the previous pixels, now owned by the caller
+   */
+  uint8_t *swap_source(uint8_t *data);
+
+  /*
+   * Adds a node running the plugin with its current vars over the output
+   * of node `input`, -1 for the source.
+   * @returns the index of the new node, the last one
+   */
+  size_t add(const Plugin &plugin, EditorState es, int32_t input);
+
+  /*
+   * Removes the node at `index`, the nodes it fed read from its input
+   * instead.
+   */
+  void remove(size_t index);
+
+  /*
+   * Sets the vars of the node at `index` and whether it is enabled.
+   */
+  void set(size_t index, bool enabled, const std::vector<uint8_t> &vars);
+
+  /*
+   * Marks the source tiles under `rect` changed.
+   */
+  void invalidate(Rect rect);
+
+  /*
+   * Brings the tiles of the output `rect` touches up to date and copies the
+   * ones that changed into `target`, an image of the source's format.
+   * @param fused - whether chains of tiled nodes are run through each tile
+   * together, keeping only what the last one of them outputs, see run_chain.
+   * For output that isn't tweaked after, like the final one
+   * @returns the part of `target` that changed, empty if none
+   */
+  Rect evaluate(Rect rect, Image target, bool fused);
+
+  /*
+   * What the last evaluate that ran any node did.
+   */
+  const FilterGraphProfile &profile() const;
+
+  /*
+   * Bytes the cached outputs take.
+   */
+  size_t bytes() const;
+
+private:
+  /*
+   * Part of the image tile t covers.
+   */
+  Rect tile_rect(size_t t) const;
+
+  /*
+   * Marks in `marks` the tiles `rect` touches.
+   */
+  void mark_tiles(Rect rect, std::vector<uint8_t> &marks) const;
+
+  /*
+   * Index of the enabled node whose output node `index` shows, following
+   * disabled ones to their input, -1 for the source.
+   */
+  int32_t resolve(int32_t index) const;
+
+  /*
+   * Computes the params hash, halo and tiling of the node at `index`.
+   */
+  void update_params(size_t index);
+
+  /*
+   * Output of the node at `index` as an image, the source for -1.
+   */
+  Image output_image(int32_t index);
+
+  /*
+   * Keys of the tiles of the output of the node at `index`, the source's for
+   * -1.
+   */
+  const std::vector<uint64_t> &output_keys(int32_t index) const;
+
+  /*
+   * Keys the tiles of the node at `index` marked in `needed` get, given the
+   * keys of its input, 0 for the rest.
+   */
+  std::vector<uint64_t> node_keys(size_t index,
+                                  const std::vector<uint64_t> &input_keys,
+                                  const std::vector<uint8_t> &needed) const;
+
+  /*
+   * Copies the tiles of the output of node `output`, -1 for the source,
+   * marked in `shown` into `target` where it holds something else.
+   * @returns the part of `target` that changed, empty if none
+   */
+  Rect copy_output(int32_t output, const std::vector<uint8_t> &shown,
+                   Image target);
+
+  /*
+   * Runs the node at `index` over the tiles marked in `needed` whose key
+   * changed.
+   * @returns the number of tiles run
+   */
+  size_t run_node(size_t index, const std::vector<uint8_t> &needed);
+
+  /*
+   * Runs the nodes the output `output` is computed through, chains of tiled
+   * ones fused, see run_chain, and writes the tiles of it marked in `shown`
+   * into `target`.
+   * @returns the part of `target` that changed, empty if none
+   */
+  Rect run_fused(int32_t output,
+                 const std::vector<std::vector<uint8_t>> &needed,
+                 const std::vector<uint8_t> &shown, Image target,
+                 FilterGraphProfile &profile);
+
+  /*
+   * Runs a chain of tiled nodes, each filtering the output of the one
+   * before, over the tiles of the last one marked in `needed` whose key
+   * changed. The tiles are split into FILTER_CHAIN_TILE_SIZE chunks that go
+   * through the whole chain while they are in cache, see run_chunk. Only
+   * what the last node outputs is kept: in `target` if given, copied from
+   * its cache where that is up to date, or else in its cache.
+   * @returns the part of `target` that changed, empty if none
+   */
+  Rect run_chain(const std::vector<size_t> &chain,
+                 const std::vector<std::vector<uint8_t>> &needed,
+                 Image *target, FilterGraphProfile &profile);
+
+  /*
+   * Runs the chain over `chunk` of `output`. Each node runs over the chunk
+   * grown by the halos of the nodes after it, into scratch of the calling
+   * thread, the last one into `output`.
+   */
+  void run_chunk(const std::vector<size_t> &chain, Image input, Image output,
+                 Rect chunk);
+};
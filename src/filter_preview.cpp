@@ -0,0 +1,546 @@
+#include "src/filter_preview.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include "src/editor.hpp"
+#include "src/pixel_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+/*
+ * Constructor, starts the worker.
+ */
+FilterPreview::FilterPreview()
+    : stopping(false), latest_id(0), busy(false), plugin_handler(nullptr),
+      plugin_sandboxed(false), plugin_linear_light(false), es(), visible(),
+      scale(0.0f), exposure(0.0f), generation(0), selection_generation(0),
+      active(false), dirty(false), sources_generation(0),
+      sources_selection_generation(0), sources_visible(), sources_halo(0),
+      sources_scale(0.0f), texture({.texture_id = 0}), rect(), shown(false) {
+  this->worker = std::thread(&FilterPreview::run_worker, this);
+}
+
+/*
+ * Stops the worker and deletes the texture.
+ */
+FilterPreview::~FilterPreview() {
+  {
+    std::lock_guard lock(this->mutex);
+    this->stopping = true;
+    this->call_state.cancelled = true;
+  }
+  this->wake.notify_one();
+  this->worker.join();
+  if (0 != this->texture.texture_id) {
+    glDeleteTextures(1, &this->texture.texture_id);
+  }
+}
+
+static bool same_rect(Rect a, Rect b) {
+  return a.x == b.x && a.y == b.y && a.width == b.width &&
+         a.height == b.height;
+}
+
+static bool same_state(const EditorState &a, const EditorState &b) {
+  return 0 == std::memcmp(&a.primary_selected_color,
+                          &b.primary_selected_color, sizeof(Color)) &&
+         a.opacity == b.opacity && a.put_pixel_size == b.put_pixel_size;
+}
+
+/*
+ * Called every frame while previewing. Starts a new run when the plugin,
+ * its vars, the image or the visible part of it changed, and uploads
+ * finished results into the texture.
+ * @param selection - part of the image the plugin changes
+ * @param generation - changes whenever the image does
+ * @param visible - part of the image shown
+ * @param scale - screen pixels per image pixel
+ * @param exposure - stops float images are shown at
+ * @param error - why the last run failed, if it did
+ */
+void FilterPreview::update(const Plugin &plugin, EditorState es, Image &img,
+                           const Selection &selection, uint64_t generation,
+                           Rect visible, float scale, float exposure,
+                           std::string &error) {
+  Rect bounds = {.x = 0, .y = 0, .width = img.width, .height = img.height};
+  visible = grow_rect(visible, 0, bounds);
+  if (0 >= visible.width || 0 >= visible.height) {
+    return;
+  }
+
+  const uint8_t *vars = static_cast<const uint8_t *>(plugin.replace_image_data);
+  size_t vars_size = PluginManager::calc_vars_size(plugin);
+  if (!this->active || plugin.path != this->plugin_path ||
+      plugin.handler.get() != this->plugin_handler ||
+      plugin.sandboxed != this->plugin_sandboxed ||
+      plugin.linear_light != this->plugin_linear_light ||
+      vars_size != this->vars.size() ||
+      !std::equal(vars, vars + vars_size, this->vars.begin()) ||
+      !same_state(es, this->es) || !same_rect(visible, this->visible) ||
+      scale != this->scale || exposure != this->exposure ||
+      generation != this->generation ||
+      selection.generation() != this->selection_generation) {
+    this->active = true;
+    this->plugin_path = plugin.path;
+    this->plugin_handler = plugin.handler.get();
+    this->plugin_sandboxed = plugin.sandboxed;
+    this->plugin_linear_light = plugin.linear_light;
+    this->vars.assign(vars, vars + vars_size);
+    this->es = es;
+    this->visible = visible;
+    this->scale = scale;
+    this->exposure = exposure;
+    this->generation = generation;
+    this->selection_generation = selection.generation();
+    this->dirty = true;
+  }
+
+  // changes keep coming in while a var is dragged, only cancel the run in
+  // flight for them every so often.
+  auto now = std::chrono::steady_clock::now();
+  if (this->dirty &&
+      (!this->busy || now - this->submitted_at >=
+                          std::chrono::milliseconds(PREVIEW_DEBOUNCE_MS))) {
+    this->dirty = false;
+    this->submitted_at = now;
+
+    int32_t halo = 0;
+    if (!plugin.sandboxed && nullptr != plugin.replace_region &&
+        nullptr != plugin.region_info) {
+      halo = plugin.region_info(es, plugin.replace_image_data).halo;
+    }
+    this->update_sources(img, selection, halo);
+
+    Request request = {
+        .id = this->latest_id + 1,
+        .plugin = plugin,
+        .vars = this->vars,
+        .es = es,
+        .visible = visible,
+        .proxy = this->proxy,
+        .full = this->full,
+    };
+    {
+      std::lock_guard lock(this->mutex);
+      this->latest_id = request.id;
+      this->pending = std::move(request);
+      this->call_state.cancelled = true;
+    }
+    this->wake.notify_one();
+  }
+
+  std::optional<Result> result;
+  {
+    std::lock_guard lock(this->mutex);
+    result.swap(this->result);
+  }
+  if (!result) {
+    return;
+  }
+  if (!result->error.empty()) {
+    error = result->error;
+    return;
+  }
+  error.clear();
+
+  if (0 == this->texture.texture_id) {
+    glGenTextures(1, &this->texture.texture_id);
+    glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
+  glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  TextureFormat format = texture_format(result->channels, SAMPLE_TYPE_U8);
+  glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, result->width,
+               result->height, 0, format.format, format.type,
+               result->pixels.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  set_texture_swizzle(result->channels);
+  this->rect = result->visible;
+  this->shown = true;
+}
+
+/*
+ * Cancels the run in flight and hides the result.
+ */
+void FilterPreview::stop() {
+  if (!this->active) {
+    return;
+  }
+  {
+    std::lock_guard lock(this->mutex);
+    this->latest_id = this->latest_id + 1;
+    this->pending.reset();
+    this->result.reset();
+    this->call_state.cancelled = true;
+  }
+  this->active = false;
+  this->dirty = false;
+  this->shown = false;
+  this->proxy.reset();
+  this->full.reset();
+}
+
+/*
+ * Copies the pixels at the given byte offsets of `row` to `out`, packed.
+ */
+template <size_t channels>
+static void sample_row(const uint8_t *row, const size_t *columns,
+                       uint8_t *out, size_t count) {
+  for (size_t x = 0; x < count; x++, out += channels) {
+    std::memcpy(out, row + columns[x], channels);
+  }
+}
+
+/*
+ * How much of each pixel of `visible` is selected, sampled nearest down to
+ * `width` by `height`, empty if all of it is.
+ */
+static std::vector<uint8_t> sample_mask(const Selection &selection,
+                                        Rect visible, int32_t width,
+                                        int32_t height) {
+  std::vector<uint8_t> mask;
+  SelectionCoverage coverage = selection.coverage(visible);
+  if (SELECTION_FULL == coverage) {
+    return mask;
+  }
+  size_t stride = static_cast<size_t>(width);
+  mask.resize(stride * static_cast<size_t>(height));
+  if (SELECTION_EMPTY == coverage) {
+    return mask;
+  }
+  parallel_for(static_cast<size_t>(height), [&](size_t y) {
+    int32_t sy = visible.y + static_cast<int32_t>(static_cast<int64_t>(y) *
+                                                  visible.height / height);
+    const uint8_t *row = selection.mask_row(visible.x, sy);
+    uint8_t *out = mask.data() + y * stride;
+    if (width == visible.width) {
+      std::memcpy(out, row, stride);
+      return;
+    }
+    for (size_t x = 0; x < stride; x++) {
+      out[x] = row[static_cast<size_t>(static_cast<int64_t>(x) *
+                                        visible.width / width)];
+    }
+  });
+  return mask;
+}
+
+/*
+ * Mixes `pixels`, what the plugin made of `original`, back into it by how
+ * little of each pixel `mask` selects. Both are `width` pixels wide.
+ */
+static void mix_selected(uint8_t *pixels, const uint8_t *original,
+                         size_t original_stride, const uint8_t *mask,
+                         size_t width, size_t height, size_t channels) {
+  size_t stride = width * channels;
+  parallel_for(height, [&](size_t y) {
+    uint8_t *to = pixels + y * stride;
+    const uint8_t *from = original + y * original_stride;
+    const uint8_t *row = mask + y * width;
+    for (size_t x = 0; x < width; x++) {
+      uint32_t m = row[x];
+      for (size_t c = x * channels; c < (x + 1) * channels; c++) {
+        uint32_t mixed = static_cast<uint32_t>(to[c]) * m +
+                         static_cast<uint32_t>(from[c]) * (255 - m);
+        to[c] = static_cast<uint8_t>((mixed + 127) / 255);
+      }
+    }
+  });
+}
+
+/*
+ * Copies `src` into the 8 bit `dst`, tone mapping float pixels at the given
+ * exposure like the display does.
+ */
+static void narrow_view(ImageView src, ImageView dst, float exposure) {
+  if (SAMPLE_TYPE_F32 != src.sample_type) {
+    convert_view(src, dst);
+    return;
+  }
+  const PixelKernels &kernels = pixel_kernels();
+  const float scale = std::exp2(exposure);
+  parallel_for(static_cast<size_t>(src.height), [&](size_t y) {
+    kernels.tone_map(
+        reinterpret_cast<const float *>(src.data + y * src.stride),
+        dst.data + y * dst.stride, static_cast<size_t>(src.channels),
+        static_cast<size_t>(src.width), scale);
+  });
+}
+
+/*
+ * Copies `visible` of the image grown by `halo` into a new source, or a
+ * downsampled copy of just `visible` when `scale` is below 1. Sources are
+ * 8 bit whatever the image is, they are only ever shown, float images tone
+ * mapped at `exposure` stops. The selection over `visible` is sampled along.
+ */
+std::shared_ptr<const FilterPreview::Source>
+FilterPreview::make_source(Image &img, const Selection &selection,
+                           Rect visible, int32_t halo, float scale,
+                           float exposure) {
+  auto source = std::make_shared<Source>();
+  Rect bounds = {.x = 0, .y = 0, .width = img.width, .height = img.height};
+  size_t channels = static_cast<size_t>(img.channels);
+  source->channels = img.channels;
+
+  if (1.0f <= scale) {
+    Rect rect = PLUGIN_HALO_UNBOUNDED == halo
+                    ? bounds
+                    : grow_rect(visible, halo, bounds);
+    size_t stride = static_cast<size_t>(rect.width) * channels;
+    source->pixels.resize(stride * static_cast<size_t>(rect.height));
+    source->width = rect.width;
+    source->height = rect.height;
+    source->area = {.x = visible.x - rect.x,
+                    .y = visible.y - rect.y,
+                    .width = visible.width,
+                    .height = visible.height};
+    narrow_view(image_view(img, rect),
+                ImageView{.data = source->pixels.data(),
+                          .x = rect.x,
+                          .y = rect.y,
+                          .width = rect.width,
+                          .height = rect.height,
+                          .channels = img.channels,
+                          .stride = stride,
+                          .sample_type = SAMPLE_TYPE_U8},
+                exposure);
+    source->mask =
+        sample_mask(selection, visible, visible.width, visible.height);
+    return source;
+  }
+
+  int32_t width = std::max(
+      1, static_cast<int32_t>(static_cast<float>(visible.width) * scale));
+  int32_t height = std::max(
+      1, static_cast<int32_t>(static_cast<float>(visible.height) * scale));
+  source->pixels.resize(static_cast<size_t>(width) *
+                        static_cast<size_t>(height) * channels);
+  source->width = width;
+  source->height = height;
+  source->area = {.x = 0, .y = 0, .width = width, .height = height};
+  source->mask = sample_mask(selection, visible, width, height);
+
+  // halve with a box filter while the proxy is at most half as large, so
+  // it doesn't alias, then sample what is left nearest.
+  ImageView src = image_view(img, visible);
+  int32_t src_width = visible.width, src_height = visible.height;
+  std::vector<uint8_t> reduced;
+  if (SAMPLE_TYPE_U8 != img.sample_type) {
+    reduced.resize(static_cast<size_t>(src_width) *
+                   static_cast<size_t>(src_height) * channels);
+    ImageView narrow = {.data = reduced.data(),
+                        .x = visible.x,
+                        .y = visible.y,
+                        .width = src_width,
+                        .height = src_height,
+                        .channels = img.channels,
+                        .stride = static_cast<size_t>(src_width) * channels,
+                        .sample_type = SAMPLE_TYPE_U8};
+    narrow_view(src, narrow, exposure);
+    src = narrow;
+  }
+  const PixelKernels &kernels = pixel_kernels();
+  while (2 * width <= src_width && 2 * height <= src_height) {
+    size_t half_width = static_cast<size_t>(src_width / 2);
+    size_t half_stride = half_width * channels;
+    std::vector<uint8_t> half(half_stride *
+                              static_cast<size_t>(src_height / 2));
+    parallel_for(static_cast<size_t>(src_height / 2), [&](size_t y) {
+      const uint8_t *row0 = src.data + 2 * y * src.stride;
+      kernels.downsample(row0, row0 + src.stride,
+                         half.data() + y * half_stride, channels,
+                         half_width);
+    });
+    reduced = std::move(half);
+    src.data = reduced.data();
+    src.stride = half_stride;
+    src_width /= 2;
+    src_height /= 2;
+  }
+
+  // the columns sampled are the same for every row.
+  std::vector<size_t> columns(static_cast<size_t>(width));
+  for (int32_t x = 0; x < width; x++) {
+    columns[static_cast<size_t>(x)] =
+        static_cast<size_t>(static_cast<int64_t>(x) * src_width / width) *
+        channels;
+  }
+  size_t stride = static_cast<size_t>(width) * channels;
+  parallel_for(static_cast<size_t>(height), [&](size_t y) {
+    int64_t sy = static_cast<int64_t>(y) * src_height / height;
+    const uint8_t *row = src.data + static_cast<size_t>(sy) * src.stride;
+    uint8_t *out = source->pixels.data() + y * stride;
+    switch (channels) {
+    case 4:
+      sample_row<4>(row, columns.data(), out, columns.size());
+      break;
+    case 3:
+      sample_row<3>(row, columns.data(), out, columns.size());
+      break;
+    default:
+      for (size_t x = 0; x < columns.size(); x++, out += channels) {
+        std::memcpy(out, row + columns[x], channels);
+      }
+    }
+  });
+  return source;
+}
+
+/*
+ * Remakes the sources if the image, the selection, the view or the halo
+ * changed.
+ */
+void FilterPreview::update_sources(Image &img, const Selection &selection,
+                                   int32_t halo) {
+  // the proxy is kept small enough to run in a few milliseconds, the second
+  // pass is at full resolution unless the view is too large for that too.
+  float pixels = static_cast<float>(this->visible.width) *
+                 static_cast<float>(this->visible.height);
+  float proxy_scale =
+      std::min({1.0f, this->scale,
+                std::sqrt(static_cast<float>(PREVIEW_PROXY_MAX_PIXELS) /
+                          pixels)});
+  float full_scale = std::min(
+      1.0f, std::sqrt(static_cast<float>(PREVIEW_FULL_MAX_PIXELS) / pixels));
+
+  bool view_changed =
+      this->generation != this->sources_generation ||
+      this->selection_generation != this->sources_selection_generation ||
+      !same_rect(this->visible, this->sources_visible);
+  if (full_scale <= proxy_scale) {
+    this->proxy.reset();
+  } else if (view_changed || nullptr == this->proxy ||
+             proxy_scale != this->sources_scale) {
+    this->proxy = make_source(img, selection, this->visible, 0, proxy_scale,
+                              this->exposure);
+  }
+  // the halo only matters at full resolution.
+  if (view_changed || nullptr == this->full ||
+      (1.0f <= full_scale && halo != this->sources_halo)) {
+    this->full = make_source(img, selection, this->visible, halo, full_scale,
+                             this->exposure);
+  }
+
+  this->sources_generation = this->generation;
+  this->sources_selection_generation = this->selection_generation;
+  this->sources_visible = this->visible;
+  this->sources_halo = halo;
+  this->sources_scale = proxy_scale;
+}
+
+/*
+ * Whether the given request has been replaced by a newer one.
+ */
+bool FilterPreview::is_stale(uint64_t id) const {
+  return id != this->latest_id;
+}
+
+/*
+ * Body of the worker thread.
+ */
+void FilterPreview::run_worker() {
+  while (true) {
+    Request request;
+    {
+      std::unique_lock lock(this->mutex);
+      this->busy = false;
+      this->wake.wait(lock,
+                      [this] { return this->stopping || this->pending; });
+      if (this->stopping) {
+        return;
+      }
+      request = std::move(*this->pending);
+      this->pending.reset();
+      this->busy = true;
+      this->call_state.cancelled = false;
+      this->call_state.progress = 0.0f;
+    }
+    request.plugin.replace_image_data = request.vars.data();
+
+    for (const auto &source : {request.proxy, request.full}) {
+      if (nullptr != source && !this->run_phase(request, *source)) {
+        break;
+      }
+    }
+  }
+}
+
+/*
+ * Runs one phase of the request over `source` and publishes the result.
+ * @returns false if the run failed or went stale
+ */
+bool FilterPreview::run_phase(const Request &request, const Source &source) {
+  if (this->is_stale(request.id)) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<uint8_t> pixels = source.pixels;
+  Image img = {.data = pixels.data(),
+               .width = source.width,
+               .height = source.height,
+               .channels = source.channels};
+  std::string error;
+  if (request.plugin.sandboxed) {
+    this->sandbox.replace_image(request.plugin, request.es, img, source.area,
+                                this->call_state, error);
+  } else {
+    Editor::run_replace_image(request.plugin, request.es, img, source.area,
+                              this->call_state, this->snapshot);
+  }
+  if (this->call_state.cancelled || this->is_stale(request.id)) {
+    return false;
+  }
+
+  Result result = {.visible = request.visible,
+                   .width = source.area.width,
+                   .height = source.area.height,
+                   .channels = source.channels,
+                   .pixels = {},
+                   .error = error};
+  if (source.width == source.area.width &&
+      source.height == source.area.height) {
+    result.pixels = std::move(pixels);
+  } else {
+    // drop the halo.
+    size_t stride = static_cast<size_t>(source.area.width) *
+                    static_cast<size_t>(source.channels);
+    result.pixels.resize(stride * static_cast<size_t>(source.area.height));
+    copy_view(image_view(img, source.area),
+              ImageView{.data = result.pixels.data(),
+                        .x = source.area.x,
+                        .y = source.area.y,
+                        .width = source.area.width,
+                        .height = source.area.height,
+                        .channels = source.channels,
+                        .stride = stride,
+                        .sample_type = SAMPLE_TYPE_U8});
+  }
+  if (!source.mask.empty()) {
+    size_t channels = static_cast<size_t>(source.channels);
+    size_t stride = static_cast<size_t>(source.width) * channels;
+    mix_selected(result.pixels.data(),
+                 source.pixels.data() +
+                     static_cast<size_t>(source.area.y) * stride +
+                     static_cast<size_t>(source.area.x) * channels,
+                 stride, source.mask.data(),
+                 static_cast<size_t>(source.area.width),
+                 static_cast<size_t>(source.area.height), channels);
+  }
+
+  nhlog_debug("FilterPreview: %s over %dx%d took %.1f ms",
+              request.plugin.info()->name, source.width, source.height,
+              std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count());
+
+  std::lock_guard lock(this->mutex);
+  if (this->is_stale(request.id)) {
+    return false;
+  }
+  this->result = std::move(result);
+  return error.empty();
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "common.hpp"
+#include "glad/glad.h"
+#include "src/host_services.hpp"
+#include "src/plugin_sandbox.hpp"
+#include "src/plugins_manager.hpp"
+#include "src/selection.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Live preview of a replace image plugin while its vars are being tuned.
+ *
+ * Every change runs the plugin over the visible part of the image only, on
+ * a thread of its own: first over a small downsampled proxy so something
+ * shows up right away, then again at full resolution. A newer change
+ * cancels the run in flight. Only the selected part changes, by a copy of
+ * the mask taken with the pixels. The image itself is never written to.
+ */
+class FilterPreview {
+private:
+  // pixels one phase of a run starts from, copied off the image on the UI
+  // thread so the worker never reads the live image.
+  struct Source {
+    std::vector<uint8_t> pixels;
+    int32_t width, height, channels;
+    // part of the pixels the plugin replaces, the rest is halo.
+    Rect area;
+    // how much of each pixel of area is selected, empty if all of it.
+    std::vector<uint8_t> mask;
+  };
+
+  struct Request {
+    uint64_t id;
+    Plugin plugin;
+    std::vector<uint8_t> vars;
+    EditorState es;
+    // part of the image shown.
+    Rect visible;
+    // shared with the next requests while the image and view are unchanged.
+    std::shared_ptr<const Source> proxy, full;
+  };
+
+  struct Result {
+    Rect visible;
+    int32_t width, height, channels;
+    std::vector<uint8_t> pixels;
+    std::string error;
+  };
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping;
+  // next request for the worker, and the newest finished result not yet
+  // uploaded. Both guarded by `mutex`.
+  std::optional<Request> pending;
+  std::optional<Result> result;
+  // id of the newest request, runs of older ones are stale.
+  std::atomic<uint64_t> latest_id;
+  std::atomic<bool> busy;
+  // progress and cancellation of the worker's run.
+  PluginCallState call_state;
+  // used by the worker only.
+  PluginSandbox sandbox;
+  std::vector<uint8_t> snapshot;
+
+  // what the last request was made from.
+  std::filesystem::path plugin_path;
+  const void *plugin_handler;
+  bool plugin_sandboxed;
+  bool plugin_linear_light;
+  std::vector<uint8_t> vars;
+  EditorState es;
+  Rect visible;
+  float scale;
+  float exposure;
+  uint64_t generation;
+  uint64_t selection_generation;
+  // whether update was called since the last stop.
+  bool active;
+  // whether any of the above changed since the last request, and when the
+  // last one was made.
+  bool dirty;
+  std::chrono::steady_clock::time_point submitted_at;
+
+  // sources of the last request and what they were made from.
+  std::shared_ptr<const Source> proxy, full;
+  uint64_t sources_generation;
+  uint64_t sources_selection_generation;
+  Rect sources_visible;
+  int32_t sources_halo;
+  float sources_scale;
+
+public:
+  // latest result, and the part of the image it covers.
+  Texture texture;
+  Rect rect;
+  bool shown;
+
+  /*
+   * Constructor, starts the worker.
+   */
+  FilterPreview();
+
+  /*
+   * Stops the worker and deletes the texture.
+   */
+  ~FilterPreview();
+
+  FilterPreview(const FilterPreview &) = delete;
+  FilterPreview &operator=(const FilterPreview &) = delete;
+
+  /*
+   * Called every frame while previewing. Starts a new run when the plugin,
+   * its vars, the image or the visible part of it changed, and uploads
+   * finished results into the texture.
+   * @param selection - part of the image the plugin changes
+   * @param generation - changes whenever the image does
+   * @param visible - part of the image shown
+   * @param scale - screen pixels per image pixel
+   * @param exposure - stops float images are shown at
+   * @param error - why the last run failed, if it did
+   */
+  void update(const Plugin &plugin, EditorState es, Image &img,
+              const Selection &selection, uint64_t generation, Rect visible,
+              float scale, float exposure, std::string &error);
+
+  /*
+   * Cancels the run in flight and hides the result.
+   */
+  void stop();
+
+private:
+  /*
+   * Body of the worker thread.
+   */
+  void run_worker();
+
+  /*
+   * Runs one phase of the request over `source` and publishes the result.
+   * @returns false if the run failed or went stale
+   */
+  bool run_phase(const Request &request, const Source &source);
+
+  /*
+   * Whether the given request has been replaced by a newer one.
+   */
+  bool is_stale(uint64_t id) const;
+
+  /*
+   * Remakes the sources if the image, the selection, the view or the halo
+   * changed.
+   */
+  void update_sources(Image &img, const Selection &selection, int32_t halo);
+
+  /*
+   * Copies `visible` of the image grown by `halo` into a new source, or a
+   * downsampled copy of just `visible` when `scale` is below 1, float
+   * images tone mapped at `exposure` stops, along with the selection over
+   * `visible`.
+   */
+  static std::shared_ptr<const Source>
+  make_source(Image &img, const Selection &selection, Rect visible,
+              int32_t halo, float scale, float exposure);
+};
@@ -0,0 +1,186 @@
+#include "src/host_services.hpp"
+#include "nhlog.h"
+#include "src/common.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+#define SCRATCH_ALIGNMENT 64
+#define HOST_LOG_MESSAGE_SIZE 1024
+
+static size_t align_up(size_t size) {
+  return (size + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+}
+
+/*
+ * Constructor
+ */
+ScratchArena::ScratchArena()
+    : block(nullptr), capacity(0), used(0), peak(0) {}
+
+/*
+ * Frees all memory
+ */
+ScratchArena::~ScratchArena() {
+  std::free(this->block);
+  for (auto &overflow_block : this->overflow) {
+    std::free(overflow_block.data);
+  }
+}
+
+/*
+ * Allocates 64 byte aligned memory.
+ * @returns nullptr if out of memory
+ */
+void *ScratchArena::alloc(size_t size) {
+  size = align_up(std::max(size, static_cast<size_t>(1)));
+  void *ptr = nullptr;
+  if (this->overflow.empty() && this->capacity - this->used >= size) {
+    ptr = this->block + this->used;
+  } else {
+    // doesn't fit, hand out a separate block for now and grow the arena to
+    // cover it once everything is released.
+    ptr = std::aligned_alloc(SCRATCH_ALIGNMENT, size);
+    if (nullptr == ptr) {
+      return nullptr;
+    }
+    this->overflow.push_back(
+        Overflow{.data = static_cast<uint8_t *>(ptr), .position = this->used});
+  }
+
+  this->used += size;
+  this->peak = std::max(this->peak, this->used);
+  return ptr;
+}
+
+/*
+ * Current position, to be passed to release.
+ */
+size_t ScratchArena::mark() const { return this->used; }
+
+/*
+ * Frees everything allocated after the given mark.
+ */
+void ScratchArena::release(size_t mark) {
+  this->used = mark;
+  while (!this->overflow.empty() && this->overflow.back().position >= mark) {
+    std::free(this->overflow.back().data);
+    this->overflow.pop_back();
+  }
+
+  if (0 != mark || this->peak <= this->capacity) {
+    return;
+  }
+
+  size_t new_capacity = this->peak;
+  this->peak = 0;
+  uint8_t *new_block = static_cast<uint8_t *>(
+      std::aligned_alloc(SCRATCH_ALIGNMENT, new_capacity));
+  if (nullptr == new_block) {
+    nhlog_error("ScratchArena: failed to grow to %zu bytes", new_capacity);
+    return;
+  }
+  std::free(this->block);
+  this->block = new_block;
+  this->capacity = new_capacity;
+  nhlog_debug("ScratchArena: grew to %zu bytes", new_capacity);
+}
+
+/*
+ * The calling thread's arena.
+ */
+ScratchArena &ScratchArena::current() {
+  static thread_local ScratchArena arena;
+  return arena;
+}
+
+// what the calling thread is currently doing on behalf of a plugin.
+static thread_local PluginCallState *current_state = nullptr;
+static thread_local const char *current_plugin_name = nullptr;
+
+PluginCallScope::PluginCallScope(PluginCallState *state,
+                                 const char *plugin_name)
+    : previous_state(current_state), previous_name(current_plugin_name),
+      scratch_mark(ScratchArena::current().mark()) {
+  current_state = state;
+  current_plugin_name = plugin_name;
+}
+
+PluginCallScope::~PluginCallScope() {
+  ScratchArena::current().release(this->scratch_mark);
+  current_state = this->previous_state;
+  current_plugin_name = this->previous_name;
+}
+
+/*
+ * *****************************
+ * Services
+ * *****************************
+ */
+static void *service_scratch_alloc(size_t size) {
+  return ScratchArena::current().alloc(size);
+}
+
+static void service_parallel_for(size_t count,
+                                 void (*fn)(size_t index, void *user),
+                                 void *user) {
+  // carry the caller's plugin call over to the worker threads.
+  PluginCallState *state = current_state;
+  const char *plugin_name = current_plugin_name;
+  parallel_for(count, [&](size_t index) {
+    PluginCallScope scope(state, plugin_name);
+    fn(index, user);
+  });
+}
+
+static void service_report_progress(float done) {
+  if (nullptr != current_state) {
+    current_state->progress = std::clamp(done, 0.0f, 1.0f);
+  }
+}
+
+static bool service_is_cancelled() {
+  return nullptr != current_state && current_state->cancelled;
+}
+
+static void service_log(PluginLogLevel level, const char *fmt, ...) {
+  char msg[HOST_LOG_MESSAGE_SIZE];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  LogLevel log_level = NHLOG_DEBUG;
+  switch (level) {
+  case PLUGIN_LOG_DEBUG:
+    log_level = NHLOG_DEBUG;
+    break;
+  case PLUGIN_LOG_INFO:
+    log_level = NHLOG_INFO;
+    break;
+  case PLUGIN_LOG_WARN:
+    log_level = NHLOG_WARN;
+    break;
+  case PLUGIN_LOG_ERROR:
+    log_level = NHLOG_ERROR;
+    break;
+  }
+
+  const char *name =
+      nullptr != current_plugin_name ? current_plugin_name : "plugin";
+  nhlog_log(log_level, name, 0, "%s", msg);
+}
+
+static const HostServices services = {
+    .scratch_alloc = service_scratch_alloc,
+    .parallel_for = service_parallel_for,
+    .report_progress = service_report_progress,
+    .is_cancelled = service_is_cancelled,
+    .log = service_log,
+};
+
+/*
+ * The services table handed to plugins.
+ */
+const HostServices *host_services() { return &services; }
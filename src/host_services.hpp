@@ -0,0 +1,97 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Stack like scratch allocator, one per thread.
+ * Grows to the biggest amount ever used between two releases to zero and
+ * never shrinks, so steady state use doesn't allocate.
+ */
+class ScratchArena {
+private:
+  /*
+   * Allocation which didn't fit into `block`, with its position in the arena.
+   */
+  struct Overflow {
+    uint8_t *data;
+    size_t position;
+  };
+
+  uint8_t *block;
+  size_t capacity;
+  // stack position, including overflow allocations.
+  size_t used;
+  // highest position reached since the arena was last empty.
+  size_t peak;
+  std::vector<Overflow> overflow;
+
+public:
+  /*
+   * Constructor
+   */
+  ScratchArena();
+
+  /*
+   * Frees all memory
+   */
+  ~ScratchArena();
+
+  /*
+   * Allocates 64 byte aligned memory.
+   * @returns nullptr if out of memory
+   */
+  void *alloc(size_t size);
+
+  /*
+   * Current position, to be passed to release.
+   */
+  size_t mark() const;
+
+  /*
+   * Frees everything allocated after the given mark.
+   */
+  void release(size_t mark);
+
+  /*
+   * The calling thread's arena.
+   */
+  static ScratchArena &current();
+};
+
+/*
+ * Progress and cancellation of one plugin invocation, shared by all threads
+ * working on it.
+ */
+struct PluginCallState {
+  std::atomic<float> progress = 0.0f;
+  std::atomic<bool> cancelled = false;
+};
+
+/*
+ * Marks the calling thread as working on behalf of a plugin for the lifetime
+ * of the scope. Host services called from the thread report to `state`, log
+ * as `plugin_name`, and scratch allocated inside the scope is released when it
+ * ends.
+ */
+class PluginCallScope {
+private:
+  PluginCallState *previous_state;
+  const char *previous_name;
+  size_t scratch_mark;
+
+public:
+  PluginCallScope(PluginCallState *state, const char *plugin_name);
+  ~PluginCallScope();
+
+  PluginCallScope(const PluginCallScope &) = delete;
+  PluginCallScope &operator=(const PluginCallScope &) = delete;
+};
+
+/*
+ * The services table handed to plugins.
+ */
+const HostServices *host_services();
@@ -0,0 +1,150 @@
+#include "src/icon_atlas.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+// icons are kept a pixel apart, so linear filtering never samples a
+// neighbouring icon.
+#define ICON_ATLAS_GUTTER 1
+#define ICON_ATLAS_CELL (ICON_SIZE + 2 * ICON_ATLAS_GUTTER)
+#define ICON_ATLAS_WIDTH (ICON_ATLAS_COLUMNS * ICON_ATLAS_CELL)
+
+/*
+ * Constructor, the texture is created with the first icon.
+ */
+IconAtlas::IconAtlas()
+    : texture({.texture_id = 0}), rows(0), slots_used(0) {}
+
+/*
+ * Destructor
+ */
+IconAtlas::~IconAtlas() {
+  if (0 != this->texture.texture_id) {
+    glDeleteTextures(1, &this->texture.texture_id);
+  }
+}
+
+/*
+ * Puts the icon into the next free slot.
+ * @returns the slot, -1 if failed
+ */
+int32_t IconAtlas::add(const uint8_t icon[ICON_SIZE][ICON_SIZE]) {
+  if (this->slots_used == this->rows * ICON_ATLAS_COLUMNS && !this->grow()) {
+    return -1;
+  }
+
+  int32_t slot = this->slots_used;
+  if (!this->set(slot, icon)) {
+    return -1;
+  }
+  this->slots_used++;
+  return slot;
+}
+
+/*
+ * Replaces the icon in a slot, only uploading it if it changed.
+ * @returns true if succeeded, false if failed
+ */
+bool IconAtlas::set(int32_t slot, const uint8_t icon[ICON_SIZE][ICON_SIZE]) {
+  int32_t cell_x = (slot % ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL;
+  int32_t cell_y = (slot / ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL;
+
+  bool changed = false;
+  for (int32_t y = 0; y < ICON_SIZE; y++) {
+    for (int32_t x = 0; x < ICON_SIZE; x++) {
+      size_t idx = (static_cast<size_t>(cell_y + ICON_ATLAS_GUTTER + y) *
+                        ICON_ATLAS_WIDTH +
+                    static_cast<size_t>(cell_x + ICON_ATLAS_GUTTER + x)) *
+                   4;
+      auto color = icon[y][x] ? COLOR_ICON : 0;
+      changed = changed || 0 != std::memcmp(&this->pixels[idx], &color, 4);
+      std::memcpy(&this->pixels[idx], &color, 4);
+    }
+  }
+
+  return !changed || this->upload_slot(slot);
+}
+
+/*
+ * Texture coordinates of the slot's icon. They change when the atlas grows,
+ * see `get_rows`.
+ */
+void IconAtlas::get_uv(int32_t slot, ImVec2 &uv0, ImVec2 &uv1) const {
+  float width = static_cast<float>(ICON_ATLAS_WIDTH);
+  float height = static_cast<float>(this->rows * ICON_ATLAS_CELL);
+  float x = static_cast<float>((slot % ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL +
+                               ICON_ATLAS_GUTTER);
+  float y = static_cast<float>((slot / ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL +
+                               ICON_ATLAS_GUTTER);
+  uv0 = ImVec2(x / width, y / height);
+  uv1 = ImVec2((x + ICON_SIZE) / width, (y + ICON_SIZE) / height);
+}
+
+/*
+ * Number of rows of slots, changes whenever the atlas grows.
+ */
+int32_t IconAtlas::get_rows() const { return this->rows; }
+
+/*
+ * Doubles the number of rows and re-uploads the whole texture.
+ * @returns true if succeeded, false if failed
+ */
+bool IconAtlas::grow() {
+  int32_t new_rows = std::max(1, this->rows * 2);
+  // rows are stored top to bottom, so growing only appends.
+  this->pixels.resize(static_cast<size_t>(ICON_ATLAS_WIDTH) *
+                          static_cast<size_t>(new_rows * ICON_ATLAS_CELL) * 4,
+                      0);
+
+  if (0 == this->texture.texture_id) {
+    glGenTextures(1, &this->texture.texture_id);
+  }
+  glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ICON_ATLAS_WIDTH,
+               new_rows * ICON_ATLAS_CELL, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               this->pixels.data());
+
+  GLenum err = glGetError();
+  if (err != 0) {
+    nhlog_fatal("IconAtlas: failed to grow to %d rows", new_rows);
+    return false;
+  }
+
+  nhlog_debug("IconAtlas: grew to %d rows", new_rows);
+  this->rows = new_rows;
+  return true;
+}
+
+/*
+ * Uploads a single slot of `pixels` to the texture.
+ * @returns true if succeeded, false if failed
+ */
+bool IconAtlas::upload_slot(int32_t slot) {
+  int32_t x = (slot % ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL + ICON_ATLAS_GUTTER;
+  int32_t y = (slot / ICON_ATLAS_COLUMNS) * ICON_ATLAS_CELL + ICON_ATLAS_GUTTER;
+  size_t first = (static_cast<size_t>(y) * ICON_ATLAS_WIDTH +
+                  static_cast<size_t>(x)) *
+                 4;
+
+  glBindTexture(GL_TEXTURE_2D, this->texture.texture_id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, ICON_ATLAS_WIDTH);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, ICON_SIZE, ICON_SIZE, GL_RGBA,
+                  GL_UNSIGNED_BYTE, &this->pixels[first]);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+  GLenum err = glGetError();
+  if (err != 0) {
+    nhlog_fatal("IconAtlas: icon failed to upload to gpu");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.hpp"
+#include "plugins/plugin_base.hpp"
+#include <cstdint>
+#include <vector>
+
+/*
+ * One texture holding the icons of all plugins, so drawing them doesn't
+ * switch textures. Icons live in fixed size slots laid out in rows of
+ * ICON_ATLAS_COLUMNS, the texture grows by doubling its rows when full.
+ */
+class IconAtlas {
+public:
+  Texture texture;
+
+private:
+  int32_t rows;
+  // slots are handed out in order and never freed, plugins keep theirs
+  // across reloads.
+  int32_t slots_used;
+  // RGBA copy of the texture, re-uploaded when it grows.
+  std::vector<uint8_t> pixels;
+
+public:
+  /*
+   * Constructor, the texture is created with the first icon.
+   */
+  IconAtlas();
+
+  /*
+   * Destructor
+   */
+  ~IconAtlas();
+
+  IconAtlas(const IconAtlas &) = delete;
+  IconAtlas &operator=(const IconAtlas &) = delete;
+
+  /*
+   * Puts the icon into the next free slot.
+   * @returns the slot, -1 if failed
+   */
+  int32_t add(const uint8_t icon[ICON_SIZE][ICON_SIZE]);
+
+  /*
+   * Replaces the icon in a slot, only uploading it if it changed.
+   * @returns true if succeeded, false if failed
+   */
+  bool set(int32_t slot, const uint8_t icon[ICON_SIZE][ICON_SIZE]);
+
+  /*
+   * Texture coordinates of the slot's icon. They change when the atlas grows,
+   * see `get_rows`.
+   */
+  void get_uv(int32_t slot, ImVec2 &uv0, ImVec2 &uv1) const;
+
+  /*
+   * Number of rows of slots, changes whenever the atlas grows.
+   */
+  int32_t get_rows() const;
+
+private:
+  /*
+   * Doubles the number of rows and re-uploads the whole texture.
+   * @returns true if succeeded, false if failed
+   */
+  bool grow();
+
+  /*
+   * Uploads a single slot of `pixels` to the texture.
+   * @returns true if succeeded, false if failed
+   */
+  bool upload_slot(int32_t slot);
+};
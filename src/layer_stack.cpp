@@ -0,0 +1,531 @@
+#include "src/layer_stack.hpp"
+#include "nhlog.h"
+#include "pixel_format.hpp"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * Layer opacity out of 255.
+ */
+static uint8_t layer_opacity(const Layer &layer) {
+  uint32_t percent = static_cast<uint32_t>(std::clamp(layer.opacity, 0, 100));
+  return static_cast<uint8_t>((percent * 255 + 50) / 100);
+}
+
+/*
+ * Constructor, no layers.
+ */
+LayerStack::LayerStack()
+    : active(0), width(0), height(0), channels(0),
+      sample_type(SAMPLE_TYPE_U8), tiles_x(0), tiles_y(0) {}
+
+/*
+ * Frees every layer.
+ */
+LayerStack::~LayerStack() { this->clear(); }
+
+/*
+ * Replaces every layer with one holding the given image, whose malloc'ed
+ * pixels the stack takes over.
+ */
+void LayerStack::reset(const Image &base) {
+  this->clear();
+  this->width = base.width;
+  this->height = base.height;
+  this->channels = base.channels;
+  this->sample_type = base.sample_type;
+  this->tiles_x = (base.width + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+  this->tiles_y = (base.height + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+  size_t tiles =
+      static_cast<size_t>(this->tiles_x) * static_cast<size_t>(this->tiles_y);
+  this->stale.assign(tiles, Rect{.x = 0, .y = 0, .width = 0, .height = 0});
+  this->below_stale.assign(tiles, 1);
+  this->layers.push_back(Layer{.name = "Background",
+                               .data = base.data,
+                               .visible = true,
+                               .opacity = 100,
+                               .mode = BLEND_MODE_NORMAL});
+  this->active = 0;
+  this->restack();
+}
+
+/*
+ * Frees every layer.
+ */
+void LayerStack::clear() {
+  for (auto &layer : this->layers) {
+    free(layer.data);
+  }
+  this->layers.clear();
+  this->active = 0;
+  this->width = this->height = this->channels = 0;
+  this->tiles_x = this->tiles_y = 0;
+  this->composite_pixels = std::vector<uint8_t>();
+  this->below_pixels = std::vector<uint8_t>();
+  this->stale = std::vector<Rect>();
+  this->below_stale = std::vector<uint8_t>();
+}
+
+/*
+ * Number of layers.
+ */
+size_t LayerStack::size() const { return this->layers.size(); }
+
+/*
+ * Layer at `index`, 0 being the bottom one.
+ */
+const Layer &LayerStack::layer(size_t index) const {
+  return this->layers[index];
+}
+
+/*
+ * Index of the layer being edited.
+ */
+size_t LayerStack::active_index() const { return this->active; }
+
+/*
+ * Makes the layer at `index` the one being edited.
+ */
+void LayerStack::set_active(size_t index) {
+  index = std::min(index, this->layers.size() - 1);
+  if (index == this->active) {
+    return;
+  }
+  // the flattened image stays the same, what lies under the active layer
+  // doesn't.
+  this->active = index;
+  std::fill(this->below_stale.begin(), this->below_stale.end(), 1);
+  if (!this->is_plain() && 0 < this->active) {
+    this->below_pixels.resize(this->composite_pixels.size());
+  }
+}
+
+/*
+ * The pixels of the layer at `index` as an image.
+ */
+Image LayerStack::image(size_t index) const {
+  return Image{.data = this->layers[index].data,
+               .width = this->width,
+               .height = this->height,
+               .channels = this->channels,
+               .sample_type = this->sample_type};
+}
+
+/*
+ * Adds a transparent layer above the active one and makes it active.
+ * Images without alpha gain an alpha channel first, in every layer.
+ * @returns false if out of memory, nothing changes then
+ */
+bool LayerStack::add() {
+  if (this->layers.empty() ||
+      (0 != this->channels % 2 && !this->add_alpha())) {
+    return false;
+  }
+  auto *data =
+      static_cast<uint8_t *>(calloc(image_size(this->image(0)), 1));
+  if (nullptr == data) {
+    return false;
+  }
+  this->active++;
+  this->layers.insert(
+      this->layers.begin() + static_cast<ptrdiff_t>(this->active),
+      Layer{.name = "Layer " + std::to_string(this->layers.size()),
+            .data = data,
+            .visible = true,
+            .opacity = 100,
+            .mode = BLEND_MODE_NORMAL});
+  this->restack();
+  nhlog_debug("LayerStack: added layer %zu of %zu", this->active,
+              this->layers.size());
+  return true;
+}
+
+/*
+ * Frees the active layer, the one under it becomes active. The last layer
+ * is never removed.
+ * @returns false if it is the last one
+ */
+bool LayerStack::remove() {
+  if (this->layers.size() <= 1) {
+    return false;
+  }
+  free(this->layers[this->active].data);
+  this->layers.erase(this->layers.begin() +
+                     static_cast<ptrdiff_t>(this->active));
+  if (0 < this->active) {
+    this->active--;
+  }
+  this->restack();
+  return true;
+}
+
+/*
+ * Moves the active layer `by` places up the stack, down if negative,
+ * clamped to the stack.
+ */
+void LayerStack::move(int32_t by) {
+  if (this->layers.empty()) {
+    return;
+  }
+  auto last = static_cast<int64_t>(this->layers.size()) - 1;
+  auto to = static_cast<size_t>(
+      std::clamp(static_cast<int64_t>(this->active) + by, int64_t{0}, last));
+  if (to == this->active) {
+    return;
+  }
+  Layer moved = std::move(this->layers[this->active]);
+  this->layers.erase(this->layers.begin() +
+                     static_cast<ptrdiff_t>(this->active));
+  this->layers.insert(this->layers.begin() + static_cast<ptrdiff_t>(to),
+                      std::move(moved));
+  this->active = to;
+  this->restack();
+}
+
+/*
+ * Sets how the layer at `index` is composited, see Layer.
+ */
+void LayerStack::set_blending(size_t index, bool visible, int32_t opacity,
+                              BlendMode mode) {
+  Layer &layer = this->layers[index];
+  opacity = std::clamp(opacity, 0, 100);
+  if (visible == layer.visible && opacity == layer.opacity &&
+      mode == layer.mode) {
+    return;
+  }
+  bool was_plain = this->is_plain();
+  layer.visible = visible;
+  layer.opacity = opacity;
+  layer.mode = mode;
+  if (was_plain != this->is_plain()) {
+    this->restack();
+  } else {
+    this->invalidate(index, Rect{.x = 0,
+                                 .y = 0,
+                                 .width = this->width,
+                                 .height = this->height});
+  }
+}
+
+/*
+ * Replaces the pixels of the layer at `index` with the given malloc'ed
+ * ones, which the stack takes over, every tile goes stale.
+ * @returns the previous pixels, now owned by the caller
+ */
+uint8_t *LayerStack::swap_data(size_t index, uint8_t *data) {
+  std::swap(this->layers[index].data, data);
+  this->invalidate(
+      index,
+      Rect{.x = 0, .y = 0, .width = this->width, .height = this->height});
+  return data;
+}
+
+/*
+ * Marks the tiles under `rect` stale, after the pixels of the layer at
+ * `index` changed there.
+ */
+void LayerStack::invalidate(size_t index, Rect rect) {
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, bounds);
+  if (rect.width <= 0 || rect.height <= 0) {
+    return;
+  }
+  int32_t x0 = rect.x / LAYER_TILE_SIZE;
+  int32_t y0 = rect.y / LAYER_TILE_SIZE;
+  int32_t x1 = (rect.x + rect.width - 1) / LAYER_TILE_SIZE;
+  int32_t y1 = (rect.y + rect.height - 1) / LAYER_TILE_SIZE;
+  for (int32_t ty = y0; ty <= y1; ty++) {
+    for (int32_t tx = x0; tx <= x1; tx++) {
+      size_t tile = static_cast<size_t>(ty * this->tiles_x + tx);
+      this->stale[tile] = union_rect(
+          this->stale[tile], grow_rect(rect, 0, this->tile_rect(tx, ty)));
+      if (index < this->active) {
+        this->below_stale[tile] = 1;
+      }
+    }
+  }
+}
+
+/*
+ * Composites the stale parts of the tiles `rect` touches, across
+ * threads.
+ * @returns the part of the flattened image that changed, empty if none
+ */
+Rect LayerStack::flatten(Rect rect) {
+  Rect changed = {.x = 0, .y = 0, .width = 0, .height = 0};
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, bounds);
+  if (this->layers.empty() || rect.width <= 0 || rect.height <= 0) {
+    return changed;
+  }
+
+  std::vector<size_t> indices;
+  std::vector<Rect> parts;
+  int32_t x0 = rect.x / LAYER_TILE_SIZE;
+  int32_t y0 = rect.y / LAYER_TILE_SIZE;
+  int32_t x1 = (rect.x + rect.width - 1) / LAYER_TILE_SIZE;
+  int32_t y1 = (rect.y + rect.height - 1) / LAYER_TILE_SIZE;
+  for (int32_t ty = y0; ty <= y1; ty++) {
+    for (int32_t tx = x0; tx <= x1; tx++) {
+      size_t index = static_cast<size_t>(ty * this->tiles_x + tx);
+      Rect part = this->stale[index];
+      if (part.width <= 0 || part.height <= 0) {
+        continue;
+      }
+      this->stale[index] = Rect{.x = 0, .y = 0, .width = 0, .height = 0};
+      indices.push_back(index);
+      parts.push_back(part);
+      changed = union_rect(changed, part);
+    }
+  }
+  // a plain layer changed in place, there is nothing to composite.
+  if (parts.empty() || this->is_plain()) {
+    return changed;
+  }
+
+  const size_t layer_count = this->layers.size();
+  const bool use_below = 0 < this->active;
+  parallel_for(parts.size(), [&](size_t i) {
+    const uint8_t *base = nullptr;
+    if (use_below) {
+      // the layers under are cached whole tiles at a time.
+      uint8_t &below_stale = this->below_stale[indices[i]];
+      if (0 != below_stale) {
+        auto tx = static_cast<int32_t>(indices[i] %
+                                       static_cast<size_t>(this->tiles_x));
+        auto ty = static_cast<int32_t>(indices[i] /
+                                       static_cast<size_t>(this->tiles_x));
+        this->compose(0, this->active, nullptr, this->below_pixels.data(),
+                      this->tile_rect(tx, ty));
+        below_stale = 0;
+      }
+      base = this->below_pixels.data();
+    }
+    this->compose(use_below ? this->active : 0, layer_count, base,
+                  this->composite_pixels.data(), parts[i]);
+  });
+  nhlog_trace("LayerStack: flattened %zu tiles of %zu layers", parts.size(),
+              layer_count);
+  return changed;
+}
+
+/*
+ * The flattened image, tiles not flattened since they went stale are out
+ * of date.
+ */
+Image LayerStack::composite() {
+  if (this->layers.empty()) {
+    return Image{.data = nullptr, .width = 0, .height = 0, .channels = 0};
+  }
+  Image img = this->image(0);
+  if (!this->is_plain()) {
+    img.data = this->composite_pixels.data();
+  }
+  return img;
+}
+
+/*
+ * Whether the only layer is shown as it is, being its own composite.
+ */
+bool LayerStack::is_plain() const {
+  return 1 == this->layers.size() && this->layers[0].visible &&
+         100 <= this->layers[0].opacity;
+}
+
+/*
+ * Part of the image tile tx, ty covers.
+ */
+Rect LayerStack::tile_rect(int32_t tx, int32_t ty) const {
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  return grow_rect(Rect{.x = tx * LAYER_TILE_SIZE,
+                        .y = ty * LAYER_TILE_SIZE,
+                        .width = LAYER_TILE_SIZE,
+                        .height = LAYER_TILE_SIZE},
+                   0, bounds);
+}
+
+/*
+ * Marks every tile stale, and sizes the caches for how the stack is
+ * composited now.
+ */
+void LayerStack::restack() {
+  for (int32_t ty = 0; ty < this->tiles_y; ty++) {
+    for (int32_t tx = 0; tx < this->tiles_x; tx++) {
+      this->stale[static_cast<size_t>(ty * this->tiles_x + tx)] =
+          this->tile_rect(tx, ty);
+    }
+  }
+  std::fill(this->below_stale.begin(), this->below_stale.end(), 1);
+  if (this->is_plain()) {
+    this->composite_pixels = std::vector<uint8_t>();
+    this->below_pixels = std::vector<uint8_t>();
+    return;
+  }
+  size_t size = image_size(this->image(0));
+  this->composite_pixels.resize(size);
+  if (0 < this->active) {
+    this->below_pixels.resize(size);
+  }
+}
+
+/*
+ * Composites layers [first, end) over `base`, or over nothing if null,
+ * into `rect` of `dst`. Both are images of the layers' format.
+ */
+void LayerStack::compose(size_t first, size_t end, const uint8_t *base,
+                         uint8_t *dst, Rect rect) const {
+  const PixelKernels &kernels = pixel_kernels();
+  const size_t pixel_size = static_cast<size_t>(this->channels) *
+                            sample_size(this->sample_type);
+  const size_t stride = static_cast<size_t>(this->width) * pixel_size;
+  const size_t count = static_cast<size_t>(rect.width);
+
+  // a bottom layer shown as it is over nothing is just copied.
+  const Layer *bottom = first < end ? &this->layers[first] : nullptr;
+  if (nullptr == base && nullptr != bottom && bottom->visible &&
+      100 <= bottom->opacity) {
+    base = bottom->data;
+    first++;
+  }
+  std::vector<const Layer *> shown;
+  for (size_t i = first; i < end; i++) {
+    if (this->layers[i].visible && 0 < this->layers[i].opacity) {
+      shown.push_back(&this->layers[i]);
+    }
+  }
+
+  // 8 bit RGBA is composited in place, anything else through RGBA rows.
+  std::vector<Color> under, over;
+  std::vector<float> under_float, over_float;
+  for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+    size_t offset = static_cast<size_t>(y) * stride +
+                    static_cast<size_t>(rect.x) * pixel_size;
+    uint8_t *row = dst + offset;
+    if (nullptr != base) {
+      std::memcpy(row, base + offset, count * pixel_size);
+    } else {
+      std::memset(row, 0, count * pixel_size);
+    }
+    if (shown.empty()) {
+      continue;
+    }
+
+    if (SAMPLE_TYPE_U8 == this->sample_type && 4 == this->channels) {
+      for (const Layer *layer : shown) {
+        kernels.composite(reinterpret_cast<Color *>(row),
+                          reinterpret_cast<const Color *>(layer->data + offset),
+                          count, layer_opacity(*layer), layer->mode);
+      }
+      continue;
+    }
+
+    if (SAMPLE_TYPE_U8 == this->sample_type) {
+      size_t c = static_cast<size_t>(this->channels);
+      under.resize(count);
+      over.resize(count);
+      kernels.convert(row, c, reinterpret_cast<uint8_t *>(under.data()), 4,
+                      count);
+      for (const Layer *layer : shown) {
+        kernels.convert(layer->data + offset, c,
+                        reinterpret_cast<uint8_t *>(over.data()), 4, count);
+        kernels.composite(under.data(), over.data(), count,
+                          layer_opacity(*layer), layer->mode);
+      }
+      kernels.convert(reinterpret_cast<const uint8_t *>(under.data()), 4,
+                      row, c, count);
+      continue;
+    }
+
+    // deeper samples as unit floats, grey spread to RGB and missing alpha
+    // opaque. Modes mix channels separately, grey stays grey.
+    under_float.resize(count * 4);
+    over_float.resize(count * 4);
+    dispatch_pixel_format(
+        this->sample_type, this->channels, [&]<typename Format>(Format) {
+          using T = typename Format::Sample;
+          using Traits = typename Format::Traits;
+          constexpr size_t C = Format::channels;
+          auto load = [&](const uint8_t *from, float *to) {
+            const T *p = reinterpret_cast<const T *>(from);
+            for (size_t i = 0; i < count; i++, p += C, to += 4) {
+              to[0] = to[1] = to[2] = Traits::to_unit(p[0]);
+              if constexpr (3 <= C) {
+                to[1] = Traits::to_unit(p[1]);
+                to[2] = Traits::to_unit(p[2]);
+              }
+              to[3] = Format::has_alpha ? Traits::to_unit(p[C - 1]) : 1.0f;
+            }
+          };
+          load(row, under_float.data());
+          for (const Layer *layer : shown) {
+            load(layer->data + offset, over_float.data());
+            kernels.composite_float(
+                under_float.data(), over_float.data(), count,
+                static_cast<float>(layer->opacity) / 100.0f, layer->mode);
+          }
+          T *p = reinterpret_cast<T *>(row);
+          const float *from = under_float.data();
+          for (size_t i = 0; i < count; i++, p += C, from += 4) {
+            p[0] = Traits::from_unit(from[0]);
+            if constexpr (3 <= C) {
+              p[1] = Traits::from_unit(from[1]);
+              p[2] = Traits::from_unit(from[2]);
+            }
+            if constexpr (Format::has_alpha) {
+              p[C - 1] = Traits::from_unit(from[3]);
+            }
+          }
+        });
+  }
+}
+
+/*
+ * Gives every layer an alpha channel, opaque.
+ * @returns false if out of memory, nothing changes then
+ */
+bool LayerStack::add_alpha() {
+  const size_t pixels =
+      static_cast<size_t>(this->width) * static_cast<size_t>(this->height);
+  const size_t to_size = static_cast<size_t>(this->channels + 1) *
+                         sample_size(this->sample_type);
+  std::vector<uint8_t *> converted;
+  for (size_t i = 0; i < this->layers.size(); i++) {
+    auto *data = static_cast<uint8_t *>(malloc(pixels * to_size));
+    if (nullptr == data) {
+      for (uint8_t *p : converted) {
+        free(p);
+      }
+      return false;
+    }
+    converted.push_back(data);
+  }
+
+  dispatch_pixel_format(
+      this->sample_type, this->channels, [&]<typename Format>(Format) {
+        using T = typename Format::Sample;
+        constexpr size_t C = Format::channels;
+        for (size_t i = 0; i < this->layers.size(); i++) {
+          const T *from = reinterpret_cast<const T *>(this->layers[i].data);
+          T *to = reinterpret_cast<T *>(converted[i]);
+          parallel_for(static_cast<size_t>(this->height), [&](size_t y) {
+            size_t row = y * static_cast<size_t>(this->width);
+            for (size_t x = row; x < row + static_cast<size_t>(this->width);
+                 x++) {
+              for (size_t c = 0; c < C; c++) {
+                to[x * (C + 1) + c] = from[x * C + c];
+              }
+              to[x * (C + 1) + C] = Format::Traits::max;
+            }
+          });
+        }
+      });
+  for (size_t i = 0; i < this->layers.size(); i++) {
+    free(this->layers[i].data);
+    this->layers[i].data = converted[i];
+  }
+  this->channels++;
+  nhlog_debug("LayerStack: added alpha, %d channels", this->channels);
+  return true;
+}
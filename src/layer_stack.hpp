@@ -0,0 +1,181 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include "src/common.hpp"
+#include "src/pixel_kernels.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * One layer of an image, its pixels in the format of the stack.
+ */
+struct Layer {
+  std::string name;
+  // malloc'ed, owned by the stack.
+  uint8_t *data;
+  bool visible;
+  // percent, like the brush opacity.
+  int32_t opacity;
+  BlendMode mode;
+};
+
+/*
+ * Layers of an image, bottom first, all of the same size and pixel format,
+ * and the image they flatten into.
+ *
+ * The flattened image is cached by LAYER_TILE_SIZE tiles. Changes mark the
+ * part of the tiles they touch stale and flatten only composites that
+ * again. The layers under the active one are kept flattened too, so edits
+ * to the active layer only composite it and the ones above it over that. A
+ * stack of one plain layer is its own flattened image, nothing is copied.
+ */
+class LayerStack {
+private:
+  std::vector<Layer> layers;
+  size_t active;
+  int32_t width, height, channels;
+  SampleType sample_type;
+  int32_t tiles_x, tiles_y;
+  // every layer flattened, and the ones under the active layer, in the
+  // format of the layers. Empty while not needed.
+  std::vector<uint8_t> composite_pixels;
+  std::vector<uint8_t> below_pixels;
+  // per tile, the part that has to be composited again, empty if none,
+  // and whether its layers under the active one have to be.
+  std::vector<Rect> stale;
+  std::vector<uint8_t> below_stale;
+
+public:
+  /*
+   * Constructor, no layers.
+   */
+  LayerStack();
+
+  /*
+   * Frees every layer.
+   */
+  ~LayerStack();
+
+  LayerStack(const LayerStack &) = delete;
+  LayerStack &operator=(const LayerStack &) = delete;
+
+  /*
+   * Replaces every layer with one holding the given image, whose malloc'ed
+   * pixels the stack takes over.
+   */
+  void reset(const Image &base);
+
+  /*
+   * Frees every layer.
+   */
+  void clear();
+
+  /*
+   * Number of layers.
+   */
+  size_t size() const;
+
+  /*
+   * Layer at `index`, 0 being the bottom one.
+   */
+  const Layer &layer(size_t index) const;
+
+  /*
+   * Index of the layer being edited.
+   */
+  size_t active_index() const;
+
+  /*
+   * Makes the layer at `index` the one being edited.
+   */
+  void set_active(size_t index);
+
+  /*
+   * The pixels of the layer at `index` as an image.
+   */
+  Image image(size_t index) const;
+
+  /*
+   * Adds a transparent layer above the active one and makes it active.
+   * Images without alpha gain an alpha channel first, in every layer.
+   * @returns false if out of memory, nothing changes then
+   */
+  bool add();
+
+  /*
+   * Frees the active layer, the one under it becomes active. The last layer
+   * is never removed.
+   * @returns false if it is the last one
+   */
+  bool remove();
+
+  /*
+   * Moves the active layer `by` places up the stack, down if negative,
+   * clamped to the stack.
+   */
+  void move(int32_t by);
+
+  /*
+   * Sets how the layer at `index` is composited, see Layer.
+   */
+  void set_blending(size_t index, bool visible, int32_t opacity,
+                    BlendMode mode);
+
+  /*
+   * Replaces the pixels of the layer at `index` with the given malloc'ed
+   * ones, which the stack takes over, every tile goes stale.
+   * @returns the previous pixels, now owned by the caller
+   */
+  uint8_t *swap_data(size_t index, uint8_t *data);
+
+  /*
+   * Marks the tiles under `rect` stale, after the pixels of the layer at
+   * `index` changed there.
+   */
+  void invalidate(size_t index, Rect rect);
+
+  /*
+   * Composites the stale parts of the tiles `rect` touches, across
+   * threads.
+   * @returns the part of the flattened image that changed, empty if none
+   */
+  Rect flatten(Rect rect);
+
+  /*
+   * The flattened image, tiles not flattened since they went stale are out
+   * of date.
+   */
+  Image composite();
+
+private:
+  /*
+   * Whether the only layer is shown as it is, being its own composite.
+   */
+  bool is_plain() const;
+
+  /*
+   * Part of the image tile tx, ty covers.
+   */
+  Rect tile_rect(int32_t tx, int32_t ty) const;
+
+  /*
+   * Marks every tile stale, and sizes the caches for how the stack is
+   * composited now.
+   */
+  void restack();
+
+  /*
+   * Composites layers [first, end) over `base`, or over nothing if null,
+   * into `rect` of `dst`. Both are images of the layers' format.
+   */
+  void compose(size_t first, size_t end, const uint8_t *base, uint8_t *dst,
+               Rect rect) const;
+
+  /*
+   * Gives every layer an alpha channel, opaque.
+   * @returns false if out of memory, nothing changes then
+   */
+  bool add_alpha();
+};
@@ -1,8 +1,17 @@
 #include "app.hpp"
 #include "nhlog.h"
 #include "src/config.hpp"
+#include "src/plugin_sandbox.hpp"
+#include <cstdlib>
+#include <cstring>
 
 int main(int argc, char *argv[]) {
+  // helper process running an isolated plugin, see PluginSandbox.
+  if (3 == argc && 0 == strcmp(argv[1], PLUGIN_SANDBOX_ARG)) {
+    nhlog_init(APPLICATION_DEBUG_LEVEL, stderr);
+    return run_plugin_sandbox(atoi(argv[2]));
+  }
+
 #ifdef DEBUG_BUILD
   void *fd = NULL;
 #else
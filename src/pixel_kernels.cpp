@@ -0,0 +1,856 @@
+#include "src/pixel_kernels.hpp"
+#include "nhlog.h"
+#include "pixel_format.hpp"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cstring>
+
+/*
+ * The loops are written once, as plain C++ the compiler vectorizes, and
+ * forced inline into one small wrapper per instruction set, so each copy is
+ * vectorized for its own instruction set. Float kernels never fuse
+ * multiply and add, so every copy rounds the same way.
+ */
+#if defined(__GNUC__)
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#define KERNEL_RESTRICT __restrict
+#else
+#define KERNEL_INLINE inline
+#define KERNEL_RESTRICT
+#endif
+
+// float kernels keep a * b + c as two roundings on every instruction set,
+// so the fma the avx512 targets allow can't make them differ from scalar.
+// Float exceptions are never looked at, assuming they may trap keeps clamps
+// from vectorizing. The build passes -ffp-contract=off to clang as well.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off", "no-trapping-math")
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_KERNELS_X86
+#endif
+
+/*
+ * x / 255 rounded to nearest, exact for x up to 255 * 255.
+ */
+static KERNEL_INLINE uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * div255 in 16 bits, so vectors hold twice the lanes. Exact for x up to
+ * 255 * 255, nothing on the way overflows.
+ */
+static KERNEL_INLINE uint16_t div255_16(uint16_t x) {
+  x = static_cast<uint16_t>(x + 128);
+  return static_cast<uint16_t>(static_cast<uint16_t>(x + (x >> 8)) >> 8);
+}
+
+/*
+ * Rec. 601 luma, the weights add up to 256.
+ */
+static KERNEL_INLINE uint8_t luma(uint32_t r, uint32_t g, uint32_t b) {
+  return static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+/*
+ * Alpha a source pixel is blended with, its own scaled by coverage and
+ * opacity.
+ */
+static KERNEL_INLINE uint16_t blend_alpha(uint16_t alpha, uint16_t coverage,
+                                          uint16_t opacity) {
+  uint16_t scaled = div255_16(static_cast<uint16_t>(alpha * opacity));
+  return div255_16(static_cast<uint16_t>(scaled * coverage));
+}
+
+/*
+ * Factor dividing by `divisor`, 1 to 255, when multiplied in floats and
+ * truncated, exact for dividends below 2^16: a little over 1 / divisor so
+ * whole quotients don't round under, too little to reach the next one.
+ * Floats vectorize where integer division doesn't.
+ */
+static KERNEL_INLINE float divide_scale(uint32_t divisor) {
+  return (1.0f + 0x1p-18f) / static_cast<float>(divisor);
+}
+
+static KERNEL_INLINE void blend_impl(Color *KERNEL_RESTRICT dst,
+                                     const Color *KERNEL_RESTRICT src,
+                                     const uint8_t *KERNEL_RESTRICT coverage,
+                                     size_t count, uint8_t opacity) {
+  uint8_t *KERNEL_RESTRICT out = reinterpret_cast<uint8_t *>(dst);
+  const uint8_t *KERNEL_RESTRICT in = reinterpret_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < count; i++, out += 4, in += 4) {
+    // source-over, what shows through of dst counts by its alpha and the
+    // colors are divided by the alpha the two make together. Pixels nothing
+    // covers keep their colors.
+    uint32_t alpha = blend_alpha(in[3], coverage[i], opacity);
+    uint32_t kept = div255(out[3] * (255u - alpha));
+    uint32_t covered = alpha + kept;
+    // 1 if nothing covers it, the mix is 0 then.
+    uint32_t uncovered = (covered - 1) >> 31;
+    float scale = divide_scale(covered + uncovered);
+    for (size_t c = 0; c < 3; c++) {
+      uint32_t mixed = in[c] * alpha + out[c] * kept;
+      uint32_t value = static_cast<uint32_t>(
+          static_cast<float>(mixed + covered / 2) * scale);
+      out[c] = static_cast<uint8_t>(value + out[c] * uncovered);
+    }
+    out[3] = static_cast<uint8_t>(covered);
+  }
+}
+
+template <size_t channels, size_t value_channels>
+static KERNEL_INLINE void fill_span_n(uint8_t *KERNEL_RESTRICT dst,
+                                      const uint8_t *KERNEL_RESTRICT value,
+                                      size_t count) {
+  uint8_t v[value_channels];
+  std::memcpy(v, value, value_channels);
+  for (size_t i = 0; i < count; i++, dst += channels) {
+    for (size_t c = 0; c < value_channels; c++) {
+      dst[c] = v[c];
+    }
+  }
+}
+
+template <size_t channels>
+static KERNEL_INLINE void fill_span_c(uint8_t *dst, const uint8_t *value,
+                                      size_t value_channels, size_t count) {
+  switch (std::min(value_channels, channels)) {
+  case 1:
+    fill_span_n<channels, 1>(dst, value, count);
+    break;
+  case 2:
+    if constexpr (2 <= channels) {
+      fill_span_n<channels, 2>(dst, value, count);
+    }
+    break;
+  case 3:
+    if constexpr (3 <= channels) {
+      fill_span_n<channels, 3>(dst, value, count);
+    }
+    break;
+  case 4:
+    if constexpr (4 <= channels) {
+      fill_span_n<channels, 4>(dst, value, count);
+    }
+    break;
+  }
+}
+
+static KERNEL_INLINE void fill_span_impl(uint8_t *dst, size_t channels,
+                                         const uint8_t *value,
+                                         size_t value_channels, size_t count) {
+  switch (channels) {
+  case 1:
+    fill_span_c<1>(dst, value, value_channels, count);
+    break;
+  case 2:
+    fill_span_c<2>(dst, value, value_channels, count);
+    break;
+  case 3:
+    fill_span_c<3>(dst, value, value_channels, count);
+    break;
+  case 4:
+    fill_span_c<4>(dst, value, value_channels, count);
+    break;
+  }
+}
+
+template <size_t src_channels, size_t dst_channels>
+static KERNEL_INLINE void convert_n(const uint8_t *KERNEL_RESTRICT src,
+                                    uint8_t *KERNEL_RESTRICT dst,
+                                    size_t count) {
+  for (size_t i = 0; i < count;
+       i++, src += src_channels, dst += dst_channels) {
+    uint8_t r = src[0], g = src[0], b = src[0], a = 255;
+    if constexpr (3 <= src_channels) {
+      g = src[1];
+      b = src[2];
+    }
+    if constexpr (2 == src_channels || 4 == src_channels) {
+      a = src[src_channels - 1];
+    }
+
+    if constexpr (3 <= dst_channels) {
+      dst[0] = r;
+      dst[1] = g;
+      dst[2] = b;
+    } else if constexpr (3 <= src_channels) {
+      dst[0] = luma(r, g, b);
+    } else {
+      dst[0] = r;
+    }
+    if constexpr (2 == dst_channels || 4 == dst_channels) {
+      dst[dst_channels - 1] = a;
+    }
+  }
+}
+
+template <size_t src_channels>
+static KERNEL_INLINE void convert_c(const uint8_t *src, uint8_t *dst,
+                                    size_t dst_channels, size_t count) {
+  switch (dst_channels) {
+  case 1:
+    convert_n<src_channels, 1>(src, dst, count);
+    break;
+  case 2:
+    convert_n<src_channels, 2>(src, dst, count);
+    break;
+  case 3:
+    convert_n<src_channels, 3>(src, dst, count);
+    break;
+  case 4:
+    convert_n<src_channels, 4>(src, dst, count);
+    break;
+  }
+}
+
+static KERNEL_INLINE void convert_impl(const uint8_t *src, size_t src_channels,
+                                       uint8_t *dst, size_t dst_channels,
+                                       size_t count) {
+  if (src_channels == dst_channels) {
+    std::memcpy(dst, src, count * src_channels);
+    return;
+  }
+  switch (src_channels) {
+  case 1:
+    convert_c<1>(src, dst, dst_channels, count);
+    break;
+  case 2:
+    convert_c<2>(src, dst, dst_channels, count);
+    break;
+  case 3:
+    convert_c<3>(src, dst, dst_channels, count);
+    break;
+  case 4:
+    convert_c<4>(src, dst, dst_channels, count);
+    break;
+  }
+}
+
+static KERNEL_INLINE void box_sum_impl(const uint8_t *KERNEL_RESTRICT src,
+                                       uint32_t *KERNEL_RESTRICT sums,
+                                       size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    sums[i] += src[i];
+  }
+}
+
+template <size_t channels>
+static KERNEL_INLINE void downsample_n(const uint8_t *KERNEL_RESTRICT row0,
+                                       const uint8_t *KERNEL_RESTRICT row1,
+                                       uint8_t *KERNEL_RESTRICT dst,
+                                       size_t width) {
+  for (size_t i = 0; i < width; i++) {
+    for (size_t c = 0; c < channels; c++) {
+      size_t left = 2 * i * channels + c;
+      size_t right = left + channels;
+      dst[i * channels + c] = static_cast<uint8_t>(
+          (static_cast<uint32_t>(row0[left]) + row0[right] + row1[left] +
+           row1[right] + 2) >>
+          2);
+    }
+  }
+}
+
+static KERNEL_INLINE void downsample_impl(const uint8_t *row0,
+                                          const uint8_t *row1, uint8_t *dst,
+                                          size_t channels, size_t width) {
+  switch (channels) {
+  case 1:
+    downsample_n<1>(row0, row1, dst, width);
+    break;
+  case 2:
+    downsample_n<2>(row0, row1, dst, width);
+    break;
+  case 3:
+    downsample_n<3>(row0, row1, dst, width);
+    break;
+  case 4:
+    downsample_n<4>(row0, row1, dst, width);
+    break;
+  }
+}
+
+static KERNEL_INLINE void apply_lut_impl(const uint8_t *KERNEL_RESTRICT src,
+                                         uint8_t *KERNEL_RESTRICT dst,
+                                         const uint8_t *KERNEL_RESTRICT lut,
+                                         size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = lut[src[i]];
+  }
+}
+
+/*
+ * sRGB tables. Linear values are encoded by their float bits, the top
+ * SRGB_MANTISSA_BITS of the mantissa and the exponent index
+ * SRGB_ENCODE_SIZE steps over the 13 octaves below 1. Anything smaller
+ * encodes to 0.
+ */
+#define SRGB_MANTISSA_BITS 9
+#define SRGB_MIN_BITS 0x39000000u // 2^-13
+#define SRGB_ENCODE_SIZE (13 << SRGB_MANTISSA_BITS)
+
+struct SrgbTables {
+  float decode[256];
+  uint8_t encode[SRGB_ENCODE_SIZE];
+};
+
+static const SrgbTables &srgb_tables() {
+  static const SrgbTables tables = []() {
+    SrgbTables t;
+    for (size_t i = 0; i < 256; i++) {
+      t.decode[i] = srgb_to_linear(static_cast<float>(i) / 255.0f);
+    }
+    // every step encodes the middle of its range.
+    for (uint32_t i = 0; i < SRGB_ENCODE_SIZE; i++) {
+      uint32_t bits = SRGB_MIN_BITS + (i << (23 - SRGB_MANTISSA_BITS)) +
+                      (1u << (22 - SRGB_MANTISSA_BITS));
+      float v;
+      std::memcpy(&v, &bits, sizeof(v));
+      t.encode[i] = SampleTraits<uint8_t>::from_unit(linear_to_srgb(v));
+    }
+    return t;
+  }();
+  return tables;
+}
+
+/*
+ * Index of the linear value in SrgbTables::encode, NaN is 0 and values
+ * past 1 are 1.
+ */
+static KERNEL_INLINE int32_t srgb_index(float v) {
+  const float min = 0x1p-13f;
+  const float max = 0x1.fffffep-1f;
+  v = v > min ? v : min;
+  v = v < max ? v : max;
+  uint32_t bits;
+  std::memcpy(&bits, &v, sizeof(bits));
+  return static_cast<int32_t>((bits - SRGB_MIN_BITS) >>
+                              (23 - SRGB_MANTISSA_BITS));
+}
+
+/*
+ * Alpha in [0, 1] to 8 bit, clamped.
+ */
+static KERNEL_INLINE uint8_t encode_alpha(float v) {
+  v = v * 255.0f;
+  v = v > 0.0f ? (v < 255.0f ? v : 255.0f) : 0.0f;
+  v = v + 0.5f;
+  return static_cast<uint8_t>(v);
+}
+
+// float loops below vectorize, table lookups don't, so loops over pixels
+// work in blocks: one pass computing table indices, one looking them up.
+#define FLOAT_KERNEL_BLOCK 64
+
+template <size_t channels>
+static KERNEL_INLINE void decode_srgb_n(const uint8_t *KERNEL_RESTRICT src,
+                                        float *KERNEL_RESTRICT dst,
+                                        size_t count,
+                                        const SrgbTables &tables) {
+  size_t samples = count * channels;
+  for (size_t i = 0; i < samples; i++) {
+    dst[i] = tables.decode[src[i]];
+  }
+  // alpha is coverage, not light.
+  if constexpr (0 == channels % 2) {
+    for (size_t i = channels - 1; i < samples; i += channels) {
+      dst[i] = static_cast<float>(src[i]) / 255.0f;
+    }
+  }
+}
+
+template <size_t channels>
+static KERNEL_INLINE void encode_srgb_n(const float *KERNEL_RESTRICT src,
+                                        uint8_t *KERNEL_RESTRICT dst,
+                                        size_t count,
+                                        const SrgbTables &tables) {
+  constexpr size_t block = FLOAT_KERNEL_BLOCK * channels;
+  int32_t indices[block];
+  size_t samples = count * channels;
+  for (size_t start = 0; start < samples; start += block) {
+    size_t n = std::min(block, samples - start);
+    for (size_t i = 0; i < n; i++) {
+      indices[i] = srgb_index(src[start + i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+      dst[start + i] = tables.encode[indices[i]];
+    }
+    if constexpr (0 == channels % 2) {
+      for (size_t i = channels - 1; i < n; i += channels) {
+        dst[start + i] = encode_alpha(src[start + i]);
+      }
+    }
+  }
+}
+
+static KERNEL_INLINE void
+blend_linear_impl(Color *KERNEL_RESTRICT dst, const Color *KERNEL_RESTRICT src,
+                  const uint8_t *KERNEL_RESTRICT coverage, size_t count,
+                  uint8_t opacity, const SrgbTables &tables) {
+  uint8_t *KERNEL_RESTRICT out = reinterpret_cast<uint8_t *>(dst);
+  const uint8_t *KERNEL_RESTRICT in = reinterpret_cast<const uint8_t *>(src);
+  int32_t indices[FLOAT_KERNEL_BLOCK * 3];
+  for (size_t start = 0; start < count; start += FLOAT_KERNEL_BLOCK) {
+    size_t n = std::min(static_cast<size_t>(FLOAT_KERNEL_BLOCK),
+                        count - start);
+    const uint8_t *block_in = in + start * 4;
+    const uint8_t *block_coverage = coverage + start;
+    uint8_t *block_out = out + start * 4;
+    for (size_t i = 0; i < n; i++) {
+      // source-over as in blend, the colors mixed linear.
+      uint32_t alpha =
+          blend_alpha(block_in[i * 4 + 3], block_coverage[i], opacity);
+      uint32_t kept = div255(block_out[i * 4 + 3] * (255u - alpha));
+      uint32_t covered = alpha + kept;
+      float scale = 1.0f / static_cast<float>(0 == covered ? 1 : covered);
+      float a = static_cast<float>(alpha) * scale;
+      float rest = static_cast<float>(kept) * scale;
+      for (size_t c = 0; c < 3; c++) {
+        float mixed = tables.decode[block_in[i * 4 + c]] * a;
+        float shown = tables.decode[block_out[i * 4 + c]] * rest;
+        indices[i * 3 + c] = srgb_index(mixed + shown);
+      }
+      block_out[i * 4 + 3] = static_cast<uint8_t>(covered);
+    }
+    for (size_t i = 0; i < n; i++) {
+      // pixels nothing covers keep their colors, the mix is 0 for them.
+      uint32_t uncovered = 0 == block_out[i * 4 + 3];
+      for (size_t c = 0; c < 3; c++) {
+        block_out[i * 4 + c] =
+            static_cast<uint8_t>(tables.encode[indices[i * 3 + c]] +
+                                 block_out[i * 4 + c] * uncovered);
+      }
+    }
+  }
+}
+
+template <size_t channels>
+static KERNEL_INLINE void tone_map_n(const float *KERNEL_RESTRICT src,
+                                     uint8_t *KERNEL_RESTRICT dst,
+                                     size_t count, float exposure,
+                                     const SrgbTables &tables) {
+  const float white = 1.0f / (TONE_MAP_WHITE * TONE_MAP_WHITE);
+  constexpr size_t block = FLOAT_KERNEL_BLOCK * channels;
+  int32_t indices[block];
+  size_t samples = count * channels;
+  for (size_t start = 0; start < samples; start += block) {
+    size_t n = std::min(block, samples - start);
+    // extended Reinhard, x (1 + x / white^2) / (1 + x). NaN fails every
+    // comparison and ends up 0.
+    for (size_t i = 0; i < n; i++) {
+      float x = src[start + i] * exposure;
+      x = x > 0.0f ? x : 0.0f;
+      float white_term = x * white;
+      float numerator = x * (1.0f + white_term);
+      indices[i] = srgb_index(numerator / (1.0f + x));
+    }
+    for (size_t i = 0; i < n; i++) {
+      dst[start + i] = tables.encode[indices[i]];
+    }
+    if constexpr (0 == channels % 2) {
+      for (size_t i = channels - 1; i < n; i += channels) {
+        dst[start + i] = encode_alpha(src[start + i]);
+      }
+    }
+  }
+}
+
+/*
+ * Color `s` of a layer mixes with the color `b` under it into, see
+ * BlendMode.
+ */
+template <BlendMode mode>
+static KERNEL_INLINE float mix_colors(float b, float s) {
+  if constexpr (BLEND_MODE_MULTIPLY == mode) {
+    return b * s;
+  } else if constexpr (BLEND_MODE_SCREEN == mode) {
+    return b + s - b * s;
+  } else if constexpr (BLEND_MODE_ADD == mode) {
+    return b + s;
+  } else if constexpr (BLEND_MODE_DARKEN == mode) {
+    return b < s ? b : s;
+  } else if constexpr (BLEND_MODE_LIGHTEN == mode) {
+    return b < s ? s : b;
+  } else if constexpr (BLEND_MODE_DIFFERENCE == mode) {
+    return b < s ? s - b : b - s;
+  } else {
+    return s;
+  }
+}
+
+/*
+ * One color of source over, before dividing by the resulting alpha: `s`
+ * of a layer of alpha `a`, mixed with `b` of pixels of alpha `below` by
+ * the mode as far as there is something under. `kept` is below (1 - a).
+ */
+template <BlendMode mode>
+static KERNEL_INLINE float composite_color(float s, float b, float a,
+                                           float below, float kept) {
+  float mixed = s + below * (mix_colors<mode>(b, s) - s);
+  return mixed * a + b * kept;
+}
+
+// shift of channel c of a Color loaded as one 32 bit word.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define COLOR_SHIFT(c) (24 - 8 * (c))
+#else
+#define COLOR_SHIFT(c) (8 * (c))
+#endif
+
+template <BlendMode mode>
+static KERNEL_INLINE void composite_n(Color *KERNEL_RESTRICT dst,
+                                      const Color *KERNEL_RESTRICT src,
+                                      size_t count, uint8_t opacity) {
+  const float unit = 1.0f / 255.0f;
+  const float unit_opacity = static_cast<float>(opacity) * unit;
+  for (size_t start = 0; start < count; start += FLOAT_KERNEL_BLOCK) {
+    size_t n = std::min(static_cast<size_t>(FLOAT_KERNEL_BLOCK),
+                        count - start);
+    const Color *in = src + start;
+    Color *out = dst + start;
+    // layers are mostly empty, transparent blocks change nothing.
+    uint8_t any = 0;
+    for (size_t i = 0; i < n; i++) {
+      any |= in[i].a;
+    }
+    if (0 == any) {
+      continue;
+    }
+    // whole pixels as words, so loads and stores stay in order and the
+    // channels are unpacked by shifts.
+    for (size_t i = 0; i < n; i++) {
+      uint32_t over, under;
+      std::memcpy(&over, in + i, sizeof(over));
+      std::memcpy(&under, out + i, sizeof(under));
+      float a = static_cast<float>((over >> COLOR_SHIFT(3)) & 255) * unit *
+                unit_opacity;
+      float below = static_cast<float>((under >> COLOR_SHIFT(3)) & 255) * unit;
+      // non-premultiplied source over, a + below (1 - a).
+      float kept = below * (1.0f - a);
+      float alpha = a + kept;
+      float scale = 0.0f < alpha ? 255.0f / alpha : 0.0f;
+      uint32_t result = static_cast<uint32_t>(alpha * 255.0f + 0.5f)
+                        << COLOR_SHIFT(3);
+      for (uint32_t c = 0; c < 3; c++) {
+        float s = static_cast<float>((over >> COLOR_SHIFT(c)) & 255) * unit;
+        float b = static_cast<float>((under >> COLOR_SHIFT(c)) & 255) * unit;
+        float v = composite_color<mode>(s, b, a, below, kept) * scale;
+        v = v > 0.0f ? (v < 255.0f ? v : 255.0f) : 0.0f;
+        result |= static_cast<uint32_t>(v + 0.5f) << COLOR_SHIFT(c);
+      }
+      std::memcpy(out + i, &result, sizeof(result));
+    }
+  }
+}
+
+template <BlendMode mode>
+static KERNEL_INLINE void composite_float_n(float *KERNEL_RESTRICT dst,
+                                            const float *KERNEL_RESTRICT src,
+                                            size_t count, float opacity) {
+  // blocks are split into planes of red, green, blue and alpha, so every
+  // lane does the same work.
+  constexpr size_t plane = FLOAT_KERNEL_BLOCK;
+  float under[plane * 4], over[plane * 4];
+  for (size_t start = 0; start < count; start += plane) {
+    size_t n = std::min(plane, count - start);
+    const float *in = src + start * 4;
+    float *out = dst + start * 4;
+    for (size_t c = 0; c < 4; c++) {
+      for (size_t i = 0; i < n; i++) {
+        over[c * plane + i] = in[i * 4 + c];
+        under[c * plane + i] = out[i * 4 + c];
+      }
+    }
+    for (size_t i = 0; i < n; i++) {
+      float a = over[3 * plane + i] * opacity;
+      a = a > 0.0f ? (a < 1.0f ? a : 1.0f) : 0.0f;
+      float below = under[3 * plane + i];
+      below = below > 0.0f ? (below < 1.0f ? below : 1.0f) : 0.0f;
+      float kept = below * (1.0f - a);
+      float alpha = a + kept;
+      float scale = 0.0f < alpha ? 1.0f / alpha : 0.0f;
+      for (size_t c = 0; c < 3; c++) {
+        float v = composite_color<mode>(over[c * plane + i],
+                                        under[c * plane + i], a, below, kept);
+        under[c * plane + i] = v * scale;
+      }
+      under[3 * plane + i] = alpha;
+    }
+    for (size_t c = 0; c < 4; c++) {
+      for (size_t i = 0; i < n; i++) {
+        out[i * 4 + c] = under[c * plane + i];
+      }
+    }
+  }
+}
+
+static KERNEL_INLINE void decode_srgb_impl(const uint8_t *src, float *dst,
+                                           size_t channels, size_t count) {
+  const SrgbTables &tables = srgb_tables();
+  switch (channels) {
+  case 1:
+    decode_srgb_n<1>(src, dst, count, tables);
+    break;
+  case 2:
+    decode_srgb_n<2>(src, dst, count, tables);
+    break;
+  case 3:
+    decode_srgb_n<3>(src, dst, count, tables);
+    break;
+  case 4:
+    decode_srgb_n<4>(src, dst, count, tables);
+    break;
+  }
+}
+
+static KERNEL_INLINE void encode_srgb_impl(const float *src, uint8_t *dst,
+                                           size_t channels, size_t count) {
+  const SrgbTables &tables = srgb_tables();
+  switch (channels) {
+  case 1:
+    encode_srgb_n<1>(src, dst, count, tables);
+    break;
+  case 2:
+    encode_srgb_n<2>(src, dst, count, tables);
+    break;
+  case 3:
+    encode_srgb_n<3>(src, dst, count, tables);
+    break;
+  case 4:
+    encode_srgb_n<4>(src, dst, count, tables);
+    break;
+  }
+}
+
+static KERNEL_INLINE void tone_map_impl(const float *src, uint8_t *dst,
+                                        size_t channels, size_t count,
+                                        float exposure) {
+  const SrgbTables &tables = srgb_tables();
+  switch (channels) {
+  case 1:
+    tone_map_n<1>(src, dst, count, exposure, tables);
+    break;
+  case 2:
+    tone_map_n<2>(src, dst, count, exposure, tables);
+    break;
+  case 3:
+    tone_map_n<3>(src, dst, count, exposure, tables);
+    break;
+  case 4:
+    tone_map_n<4>(src, dst, count, exposure, tables);
+    break;
+  }
+}
+
+static KERNEL_INLINE void composite_impl(Color *dst, const Color *src,
+                                         size_t count, uint8_t opacity,
+                                         BlendMode mode) {
+  switch (mode) {
+  case BLEND_MODE_MULTIPLY:
+    composite_n<BLEND_MODE_MULTIPLY>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_SCREEN:
+    composite_n<BLEND_MODE_SCREEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_ADD:
+    composite_n<BLEND_MODE_ADD>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_DARKEN:
+    composite_n<BLEND_MODE_DARKEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_LIGHTEN:
+    composite_n<BLEND_MODE_LIGHTEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_DIFFERENCE:
+    composite_n<BLEND_MODE_DIFFERENCE>(dst, src, count, opacity);
+    break;
+  default:
+    composite_n<BLEND_MODE_NORMAL>(dst, src, count, opacity);
+  }
+}
+
+static KERNEL_INLINE void composite_float_impl(float *dst, const float *src,
+                                               size_t count, float opacity,
+                                               BlendMode mode) {
+  switch (mode) {
+  case BLEND_MODE_MULTIPLY:
+    composite_float_n<BLEND_MODE_MULTIPLY>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_SCREEN:
+    composite_float_n<BLEND_MODE_SCREEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_ADD:
+    composite_float_n<BLEND_MODE_ADD>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_DARKEN:
+    composite_float_n<BLEND_MODE_DARKEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_LIGHTEN:
+    composite_float_n<BLEND_MODE_LIGHTEN>(dst, src, count, opacity);
+    break;
+  case BLEND_MODE_DIFFERENCE:
+    composite_float_n<BLEND_MODE_DIFFERENCE>(dst, src, count, opacity);
+    break;
+  default:
+    composite_float_n<BLEND_MODE_NORMAL>(dst, src, count, opacity);
+  }
+}
+
+/*
+ * Defines `<variant>_kernels`, every kernel built with the given function
+ * attributes.
+ */
+#define DEFINE_PIXEL_KERNELS(variant, label, attributes)                      \
+  attributes static void blend_##variant(Color *dst, const Color *src,        \
+                                         const uint8_t *coverage,             \
+                                         size_t count, uint8_t opacity) {     \
+    blend_impl(dst, src, coverage, count, opacity);                           \
+  }                                                                           \
+  attributes static void fill_span_##variant(                                 \
+      uint8_t *dst, size_t channels, const uint8_t *value,                    \
+      size_t value_channels, size_t count) {                                  \
+    fill_span_impl(dst, channels, value, value_channels, count);              \
+  }                                                                           \
+  attributes static void convert_##variant(const uint8_t *src,                \
+                                           size_t src_channels, uint8_t *dst, \
+                                           size_t dst_channels,               \
+                                           size_t count) {                    \
+    convert_impl(src, src_channels, dst, dst_channels, count);                \
+  }                                                                           \
+  attributes static void box_sum_##variant(const uint8_t *src,                \
+                                           uint32_t *sums, size_t count) {    \
+    box_sum_impl(src, sums, count);                                           \
+  }                                                                           \
+  attributes static void downsample_##variant(                                \
+      const uint8_t *row0, const uint8_t *row1, uint8_t *dst,                 \
+      size_t channels, size_t width) {                                        \
+    downsample_impl(row0, row1, dst, channels, width);                        \
+  }                                                                           \
+  attributes static void apply_lut_##variant(                                 \
+      const uint8_t *src, uint8_t *dst, const uint8_t *lut, size_t count) {   \
+    apply_lut_impl(src, dst, lut, count);                                     \
+  }                                                                           \
+  attributes static void decode_srgb_##variant(                               \
+      const uint8_t *src, float *dst, size_t channels, size_t count) {        \
+    decode_srgb_impl(src, dst, channels, count);                              \
+  }                                                                           \
+  attributes static void encode_srgb_##variant(                               \
+      const float *src, uint8_t *dst, size_t channels, size_t count) {        \
+    encode_srgb_impl(src, dst, channels, count);                              \
+  }                                                                           \
+  attributes static void blend_linear_##variant(                              \
+      Color *dst, const Color *src, const uint8_t *coverage, size_t count,    \
+      uint8_t opacity) {                                                      \
+    blend_linear_impl(dst, src, coverage, count, opacity, srgb_tables());     \
+  }                                                                           \
+  attributes static void tone_map_##variant(const float *src, uint8_t *dst,   \
+                                            size_t channels, size_t count,    \
+                                            float exposure) {                 \
+    tone_map_impl(src, dst, channels, count, exposure);                       \
+  }                                                                           \
+  attributes static void composite_##variant(Color *dst, const Color *src,    \
+                                             size_t count, uint8_t opacity,   \
+                                             BlendMode mode) {                \
+    composite_impl(dst, src, count, opacity, mode);                           \
+  }                                                                           \
+  attributes static void composite_float_##variant(                           \
+      float *dst, const float *src, size_t count, float opacity,              \
+      BlendMode mode) {                                                       \
+    composite_float_impl(dst, src, count, opacity, mode);                     \
+  }                                                                           \
+  static const PixelKernels variant##_kernels = {                             \
+      .name = label,                                                          \
+      .blend = blend_##variant,                                               \
+      .fill_span = fill_span_##variant,                                       \
+      .convert = convert_##variant,                                           \
+      .box_sum = box_sum_##variant,                                           \
+      .downsample = downsample_##variant,                                     \
+      .apply_lut = apply_lut_##variant,                                       \
+      .decode_srgb = decode_srgb_##variant,                                   \
+      .encode_srgb = encode_srgb_##variant,                                   \
+      .blend_linear = blend_linear_##variant,                                 \
+      .tone_map = tone_map_##variant,                                         \
+      .composite = composite_##variant,                                       \
+      .composite_float = composite_float_##variant,                           \
+  };
+
+// the reference the others are checked against, kept scalar where the
+// compiler allows turning vectorization off.
+#if defined(__GNUC__) && !defined(__clang__)
+DEFINE_PIXEL_KERNELS(scalar, "scalar",
+                     __attribute__((optimize("no-tree-vectorize"))))
+#else
+DEFINE_PIXEL_KERNELS(scalar, "scalar", )
+#endif
+
+#ifdef PIXEL_KERNELS_X86
+#ifdef __clang__
+#define PIXEL_KERNELS_AVX512_TARGET "avx512f,avx512bw,avx512vl"
+#else
+#define PIXEL_KERNELS_AVX512_TARGET                                           \
+  "avx512f,avx512bw,avx512vl,prefer-vector-width=512"
+#endif
+DEFINE_PIXEL_KERNELS(sse41, "sse4.1", __attribute__((target("sse4.1"))))
+DEFINE_PIXEL_KERNELS(avx2, "avx2", __attribute__((target("avx2"))))
+DEFINE_PIXEL_KERNELS(avx512, "avx512",
+                     __attribute__((target(PIXEL_KERNELS_AVX512_TARGET))))
+#endif
+
+// NEON is part of every aarch64 CPU, the baseline build already uses it.
+#ifdef __aarch64__
+DEFINE_PIXEL_KERNELS(neon, "neon", )
+#endif
+
+/*
+ * Every variant the CPU supports, the scalar reference first.
+ */
+std::vector<const PixelKernels *> supported_pixel_kernels() {
+  std::vector<const PixelKernels *> variants = {&scalar_kernels};
+#ifdef PIXEL_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1")) {
+    variants.push_back(&sse41_kernels);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    variants.push_back(&avx2_kernels);
+  }
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl")) {
+    variants.push_back(&avx512_kernels);
+  }
+#endif
+#ifdef __aarch64__
+  variants.push_back(&neon_kernels);
+#endif
+  return variants;
+}
+
+/*
+ * Kernels of the best instruction set the CPU supports, detected on the
+ * first call.
+ */
+const PixelKernels &pixel_kernels() {
+  static const PixelKernels *kernels = []() {
+    const PixelKernels *best = supported_pixel_kernels().back();
+    nhlog_info("PixelKernels: using %s kernels", best->name);
+    return best;
+  }();
+  return *kernels;
+}
+
+/*
+ * Name of the blend mode, for the UI.
+ */
+const char *blend_mode_name(BlendMode mode) {
+  static const char *names[] = {"Normal",  "Multiply", "Screen",    "Add",
+                                "Darken",  "Lighten",  "Difference"};
+  static_assert(BLEND_MODE_COUNT == sizeof(names) / sizeof(names[0]));
+  return 0 <= mode && mode < BLEND_MODE_COUNT ? names[mode] : "Unknown";
+}
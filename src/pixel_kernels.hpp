@@ -0,0 +1,118 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * How a layer's colors mix with the ones under it before being blended
+ * over them by its alpha, the separable modes of the W3C compositing spec
+ * and add. Colors are unit values, as encoded. Add isn't clamped, float
+ * images keep the range, 8 bit ones clamp once blended.
+ */
+enum BlendMode {
+  BLEND_MODE_NORMAL = 0,
+  BLEND_MODE_MULTIPLY,
+  BLEND_MODE_SCREEN,
+  BLEND_MODE_ADD,
+  BLEND_MODE_DARKEN,
+  BLEND_MODE_LIGHTEN,
+  BLEND_MODE_DIFFERENCE,
+  BLEND_MODE_COUNT,
+};
+
+/*
+ * Name of the blend mode, for the UI.
+ */
+const char *blend_mode_name(BlendMode mode);
+
+/*
+ * Core pixel loops, built once per instruction set the CPU may have. The
+ * best variant the CPU supports is picked once at startup, see
+ * pixel_kernels. Every variant gives exactly the same bytes as the scalar
+ * one, they only differ in how fast they get there.
+ *
+ * Pixels are interleaved 8 bit samples, unless stated otherwise, `channels`
+ * is 1 (grey), 2 (grey and alpha), 3 (RGB) or 4 (RGBA).
+ */
+struct PixelKernels {
+  // instruction set the variant was built for.
+  const char *name;
+
+  // Blends `count` RGBA pixels of `src` over `dst`, in place. The source
+  // alpha is scaled by the pixel's `coverage` and by `opacity`, 255 being
+  // fully opaque.
+  void (*blend)(Color *dst, const Color *src, const uint8_t *coverage,
+                size_t count, uint8_t opacity);
+
+  // Writes the first `value_channels` samples of `value` into each of the
+  // `count` pixels of `channels` samples at `dst`, the rest of each pixel
+  // is left as is.
+  void (*fill_span)(uint8_t *dst, size_t channels, const uint8_t *value,
+                    size_t value_channels, size_t count);
+
+  // Converts `count` pixels between channel counts. Grey is spread to RGB,
+  // RGB turns into grey by luma, missing alpha is opaque.
+  void (*convert)(const uint8_t *src, size_t src_channels, uint8_t *dst,
+                  size_t dst_channels, size_t count);
+
+  // Adds each of the `count` samples of `src` to the matching sum, to sum
+  // up boxes of rows.
+  void (*box_sum)(const uint8_t *src, uint32_t *sums, size_t count);
+
+  // Averages the 2x2 blocks of two rows into one row of `width` pixels,
+  // half as wide as the rows.
+  void (*downsample)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                     size_t channels, size_t width);
+
+  // Maps each of the `count` samples of `src` through `lut` into `dst`.
+  void (*apply_lut)(const uint8_t *src, uint8_t *dst, const uint8_t *lut,
+                    size_t count);
+
+  // Decodes `count` pixels of sRGB samples into linear float ones, alpha
+  // is scaled to [0, 1].
+  void (*decode_srgb)(const uint8_t *src, float *dst, size_t channels,
+                      size_t count);
+
+  // Encodes `count` pixels of linear float samples into sRGB ones, values
+  // are clamped to [0, 1]. Off by at most 0.6 of a step from the exact
+  // curve, and decode_srgb round trips exactly.
+  void (*encode_srgb)(const float *src, uint8_t *dst, size_t channels,
+                      size_t count);
+
+  // blend in linear light, the colors are decoded, blended and encoded
+  // again. Alpha blends the same.
+  void (*blend_linear)(Color *dst, const Color *src, const uint8_t *coverage,
+                       size_t count, uint8_t opacity);
+
+  // Tone maps `count` pixels of linear float samples into 8 bit ones for
+  // display. Color is scaled by `exposure`, compressed into [0, 1] with
+  // TONE_MAP_WHITE as white and sRGB encoded. Alpha is only clamped.
+  void (*tone_map)(const float *src, uint8_t *dst, size_t channels,
+                   size_t count, float exposure);
+
+  // Composites `count` RGBA pixels of a layer at `src` over the ones under
+  // it at `dst`, in place, mixing colors by `mode`. The layer's alpha is
+  // scaled by `opacity`, 255 being fully opaque. Unlike blend, the result
+  // is divided by its alpha, so a layer over transparent pixels keeps its
+  // own color.
+  void (*composite)(Color *dst, const Color *src, size_t count,
+                    uint8_t opacity, BlendMode mode);
+
+  // composite for pixels of float samples, `opacity` in [0, 1]. Colors
+  // aren't clamped.
+  void (*composite_float)(float *dst, const float *src, size_t count,
+                          float opacity, BlendMode mode);
+};
+
+/*
+ * Kernels of the best instruction set the CPU supports, detected on the
+ * first call.
+ */
+const PixelKernels &pixel_kernels();
+
+/*
+ * Every variant the CPU supports, the scalar reference first.
+ */
+std::vector<const PixelKernels *> supported_pixel_kernels();
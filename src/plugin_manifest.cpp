@@ -0,0 +1,278 @@
+#include "src/plugin_manifest.hpp"
+#include "nhlog.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+// "IMKM", bumped along with MANIFEST_FORMAT_VERSION whenever the layout
+// below changes.
+#define MANIFEST_MAGIC 0x4d4b4d49u
+#define MANIFEST_FORMAT_VERSION 1u
+
+/*
+ * Copies the info a loaded plugin exposes.
+ */
+std::shared_ptr<const PluginMeta>
+PluginMeta::from_info(const PluginInfo *info) {
+  auto meta = std::make_shared<PluginMeta>();
+  meta->name = nullptr != info->name ? info->name : "";
+  meta->description = nullptr != info->description ? info->description : "";
+  meta->info.plugin_type = info->plugin_type;
+  std::memcpy(meta->info.icon, info->icon, sizeof(info->icon));
+
+  for (size_t i = 0; nullptr != info->vars && i < info->vars_len; i++) {
+    const VariableMeta &var = info->vars[i];
+    meta->var_names.push_back(nullptr != var.name ? var.name : "");
+    meta->var_descriptions.push_back(nullptr != var.description
+                                         ? var.description
+                                         : "");
+    meta->vars.push_back(var);
+  }
+
+  meta->link_info();
+  return meta;
+}
+
+/*
+ * Points `info` at the owned strings and vars, once they are filled in.
+ */
+void PluginMeta::link_info() {
+  this->info.name = this->name.c_str();
+  this->info.description = this->description.c_str();
+  for (size_t i = 0; i < this->vars.size(); i++) {
+    this->vars[i].name = this->var_names[i].c_str();
+    this->vars[i].description = this->var_descriptions[i].c_str();
+  }
+  this->info.vars = this->vars.empty() ? nullptr : this->vars.data();
+  this->info.vars_len = static_cast<uint8_t>(this->vars.size());
+}
+
+/*
+ * Modification time and size of the given file, the key of its manifest
+ * entry.
+ * @returns false if the file can't be read
+ */
+bool plugin_file_key(const std::filesystem::path &path, int64_t &file_mtime,
+                     uint64_t &file_size) {
+  std::error_code err;
+  auto mtime = std::filesystem::last_write_time(path, err);
+  if (err) {
+    return false;
+  }
+  auto size = std::filesystem::file_size(path, err);
+  if (err) {
+    return false;
+  }
+
+  file_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+  file_size = static_cast<uint64_t>(size);
+  return true;
+}
+
+/*
+ * *****************************
+ * Serialization
+ * *****************************
+ */
+namespace {
+/*
+ * Appends fixed size values and length prefixed strings to a buffer.
+ */
+struct ManifestWriter {
+  std::vector<uint8_t> buffer;
+
+  template <typename T> void put(const T &value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    this->buffer.insert(this->buffer.end(), bytes, bytes + sizeof(T));
+  }
+
+  void put_string(const std::string &value) {
+    this->put(static_cast<uint32_t>(value.size()));
+    this->buffer.insert(this->buffer.end(), value.begin(), value.end());
+  }
+};
+
+/*
+ * Reads back what ManifestWriter wrote, `ok` turns false on the first read
+ * past the end.
+ */
+struct ManifestReader {
+  const std::vector<uint8_t> &buffer;
+  size_t position = 0;
+  bool ok = true;
+
+  template <typename T> T get() {
+    T value{};
+    if (!this->ok || this->buffer.size() - this->position < sizeof(T)) {
+      this->ok = false;
+      return value;
+    }
+    std::memcpy(&value, this->buffer.data() + this->position, sizeof(T));
+    this->position += sizeof(T);
+    return value;
+  }
+
+  std::string get_string() {
+    uint32_t size = this->get<uint32_t>();
+    if (!this->ok || this->buffer.size() - this->position < size) {
+      this->ok = false;
+      return "";
+    }
+    std::string value(reinterpret_cast<const char *>(this->buffer.data()) +
+                          this->position,
+                      size);
+    this->position += size;
+    return value;
+  }
+};
+} // namespace
+
+static bool read_meta(ManifestReader &reader, PluginMeta &meta) {
+  meta.name = reader.get_string();
+  meta.description = reader.get_string();
+  uint32_t plugin_type = reader.get<uint32_t>();
+  if (PLUGIN_TYPE_PUT_PIXEL != plugin_type &&
+      PLUGIN_TYPE_REPLACE_IMAGE != plugin_type &&
+      PLUGIN_TYPE_SHADER != plugin_type) {
+    return false;
+  }
+  meta.info.plugin_type = static_cast<PluginType>(plugin_type);
+
+  uint8_t vars_len = reader.get<uint8_t>();
+  for (uint8_t i = 0; reader.ok && i < vars_len; i++) {
+    meta.var_names.push_back(reader.get_string());
+    meta.var_descriptions.push_back(reader.get_string());
+
+    VariableMeta var = {};
+    uint32_t type = reader.get<uint32_t>();
+    if (TYPE_FLOAT != type && TYPE_INT != type && TYPE_BOOL != type) {
+      return false;
+    }
+    var.type = static_cast<VariableMetaType>(type);
+    var.default_value = reader.get<decltype(var.default_value)>();
+    var.range = reader.get<FloatRange>();
+    meta.vars.push_back(var);
+  }
+
+  for (size_t y = 0; y < ICON_SIZE; y++) {
+    for (size_t x = 0; x < ICON_SIZE; x++) {
+      meta.info.icon[y][x] = reader.get<uint8_t>();
+    }
+  }
+
+  meta.link_info();
+  return reader.ok;
+}
+
+static void write_meta(ManifestWriter &writer, const PluginMeta &meta) {
+  writer.put_string(meta.name);
+  writer.put_string(meta.description);
+  writer.put(static_cast<uint32_t>(meta.info.plugin_type));
+
+  writer.put(static_cast<uint8_t>(meta.vars.size()));
+  for (size_t i = 0; i < meta.vars.size(); i++) {
+    const VariableMeta &var = meta.vars[i];
+    writer.put_string(meta.var_names[i]);
+    writer.put_string(meta.var_descriptions[i]);
+    writer.put(static_cast<uint32_t>(var.type));
+    writer.put(var.default_value);
+    writer.put(var.range);
+  }
+
+  for (size_t y = 0; y < ICON_SIZE; y++) {
+    for (size_t x = 0; x < ICON_SIZE; x++) {
+      writer.put(meta.info.icon[y][x]);
+    }
+  }
+}
+
+/*
+ * Reads the manifest cache at the given path.
+ * @returns an empty manifest if the file is missing, outdated or corrupt
+ */
+PluginManifest read_plugin_manifest(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    nhlog_debug("PluginManifest: no manifest at %s", path.c_str());
+    return {};
+  }
+  std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+
+  ManifestReader reader = {.buffer = buffer};
+  if (MANIFEST_MAGIC != reader.get<uint32_t>() ||
+      MANIFEST_FORMAT_VERSION != reader.get<uint32_t>() ||
+      PLUGIN_ABI_VERSION != reader.get<uint32_t>()) {
+    nhlog_info("PluginManifest: %s is outdated, ignoring it", path.c_str());
+    return {};
+  }
+
+  PluginManifest manifest;
+  uint32_t count = reader.get<uint32_t>();
+  for (uint32_t i = 0; reader.ok && i < count; i++) {
+    std::filesystem::path plugin_path = reader.get_string();
+    PluginManifestEntry entry = {
+        .file_mtime = reader.get<int64_t>(),
+        .file_size = reader.get<uint64_t>(),
+        .meta = nullptr,
+    };
+    auto meta = std::make_shared<PluginMeta>();
+    if (!read_meta(reader, *meta)) {
+      reader.ok = false;
+      break;
+    }
+    entry.meta = meta;
+    manifest[plugin_path] = entry;
+  }
+
+  if (!reader.ok) {
+    nhlog_error("PluginManifest: %s is corrupt, ignoring it", path.c_str());
+    return {};
+  }
+  nhlog_debug("PluginManifest: read %zu entries", manifest.size());
+  return manifest;
+}
+
+/*
+ * Writes the manifest cache to the given path.
+ * @returns true if succeeded, false if failed
+ */
+bool write_plugin_manifest(const std::filesystem::path &path,
+                           const PluginManifest &manifest) {
+  ManifestWriter writer;
+  writer.put(static_cast<uint32_t>(MANIFEST_MAGIC));
+  writer.put(static_cast<uint32_t>(MANIFEST_FORMAT_VERSION));
+  writer.put(static_cast<uint32_t>(PLUGIN_ABI_VERSION));
+  writer.put(static_cast<uint32_t>(manifest.size()));
+  for (const auto &[plugin_path, entry] : manifest) {
+    writer.put_string(plugin_path.string());
+    writer.put(entry.file_mtime);
+    writer.put(entry.file_size);
+    write_meta(writer, *entry.meta);
+  }
+
+  // write next to it and rename, so a crash never leaves a torn manifest.
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(writer.buffer.data()),
+               static_cast<std::streamsize>(writer.buffer.size()));
+    if (!file) {
+      nhlog_error("PluginManifest: failed to write %s", tmp_path.c_str());
+      return false;
+    }
+  }
+
+  std::error_code err;
+  std::filesystem::rename(tmp_path, path, err);
+  if (err) {
+    nhlog_error("PluginManifest: failed to replace %s: %s", path.c_str(),
+                err.message().c_str());
+    std::filesystem::remove(tmp_path, err);
+    return false;
+  }
+  nhlog_debug("PluginManifest: wrote %zu entries", manifest.size());
+  return true;
+}
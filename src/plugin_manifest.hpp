@@ -0,0 +1,69 @@
+#pragma once
+
+#include "plugins/plugin_base.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Copy of the info a plugin exposes, which outlives the plugin's library and
+ * can be cached on disk. `info` points into the strings and vars it owns.
+ */
+struct PluginMeta {
+  std::string name;
+  std::string description;
+  std::vector<std::string> var_names;
+  std::vector<std::string> var_descriptions;
+  std::vector<VariableMeta> vars;
+  PluginInfo info;
+
+  PluginMeta() = default;
+  PluginMeta(const PluginMeta &) = delete;
+  PluginMeta &operator=(const PluginMeta &) = delete;
+
+  /*
+   * Copies the info a loaded plugin exposes.
+   */
+  static std::shared_ptr<const PluginMeta> from_info(const PluginInfo *info);
+
+  /*
+   * Points `info` at the owned strings and vars, once they are filled in.
+   */
+  void link_info();
+};
+
+/*
+ * Cached info of one plugin file, valid as long as the file's modification
+ * time and size still match.
+ */
+struct PluginManifestEntry {
+  int64_t file_mtime;
+  uint64_t file_size;
+  std::shared_ptr<const PluginMeta> meta;
+};
+
+typedef std::map<std::filesystem::path, PluginManifestEntry> PluginManifest;
+
+/*
+ * Modification time and size of the given file, the key of its manifest
+ * entry.
+ * @returns false if the file can't be read
+ */
+bool plugin_file_key(const std::filesystem::path &path, int64_t &file_mtime,
+                     uint64_t &file_size);
+
+/*
+ * Reads the manifest cache at the given path.
+ * @returns an empty manifest if the file is missing, outdated or corrupt
+ */
+PluginManifest read_plugin_manifest(const std::filesystem::path &path);
+
+/*
+ * Writes the manifest cache to the given path.
+ * @returns true if succeeded, false if failed
+ */
+bool write_plugin_manifest(const std::filesystem::path &path,
+                           const PluginManifest &manifest);
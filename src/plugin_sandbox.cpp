@@ -0,0 +1,536 @@
+#include "src/plugin_sandbox.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include "src/editor.hpp"
+#include "src/thread_pool.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define SANDBOX_PATH_SIZE 4096
+#define SANDBOX_VARS_SIZE 1024
+#define SANDBOX_MESSAGE_SIZE 256
+// how often a waiting editor checks for cancellation.
+#define SANDBOX_POLL_MS 50
+
+enum SandboxMessageType : uint32_t {
+  SANDBOX_LOAD = 0,
+  SANDBOX_APPLY,
+  SANDBOX_OK,
+  SANDBOX_FAILED,
+};
+
+/*
+ * Message from the editor to the helper.
+ */
+struct SandboxRequest {
+  SandboxMessageType type;
+
+  // SANDBOX_LOAD: plugin file to load.
+  char path[SANDBOX_PATH_SIZE];
+
+  // SANDBOX_APPLY: the image in the shared mapping, and the call.
+  EditorState es;
+  Rect area;
+  int32_t width, height, channels;
+  SampleType sample_type;
+  bool linear_light;
+  size_t mapping_size;
+  uint32_t vars_size;
+  uint8_t vars[SANDBOX_VARS_SIZE];
+};
+
+/*
+ * Message from the helper to the editor.
+ */
+struct SandboxReply {
+  SandboxMessageType type;
+  char message[SANDBOX_MESSAGE_SIZE];
+};
+
+#ifdef __linux__
+/*
+ * Sends one message, along with `fd` if it isn't -1.
+ */
+static bool send_message(int socket_fd, const void *data, size_t size,
+                         int fd) {
+  iovec iov = {.iov_base = const_cast<void *>(data), .iov_len = size};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (0 <= fd) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  // a dead peer must not raise SIGPIPE.
+  ssize_t sent = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+  return sent == static_cast<ssize_t>(size);
+}
+
+/*
+ * Receives one message, and the fd sent along with it into `fd`, -1 if none.
+ * @returns the size of the message, 0 if the peer is gone, -1 if failed
+ */
+static ssize_t receive_message(int socket_fd, void *data, size_t size,
+                               int &fd) {
+  iovec iov = {.iov_base = data, .iov_len = size};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {0};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  fd = -1;
+  ssize_t received = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); 0 < received && nullptr != cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+      std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  return received;
+}
+#endif // __linux__
+
+/*
+ * Constructor, the helper is started on the first call.
+ */
+PluginSandbox::PluginSandbox()
+    : pid(-1), socket_fd(-1), plugin_mtime(0), plugin_size(0), memfd(-1),
+      mapping(nullptr), mapping_size(0), memfd_sent(false) {}
+
+/*
+ * Stops the helper.
+ */
+PluginSandbox::~PluginSandbox() {
+#ifdef __linux__
+  this->stop();
+  if (nullptr != this->mapping) {
+    munmap(this->mapping, this->mapping_size);
+  }
+  if (0 <= this->memfd) {
+    close(this->memfd);
+  }
+#endif
+}
+
+/*
+ * Runs the plugin over `area` of the image in the helper. The image is only
+ * written to if the call succeeded.
+ * @param state - cancelling it kills the call
+ * @param error - why the call failed
+ * @returns true if succeeded, false if failed
+ */
+bool PluginSandbox::replace_image(const Plugin &plugin, EditorState es,
+                                  Image img, Rect area, PluginCallState &state,
+                                  std::string &error) {
+  return this->replace_image(plugin, es, img, area, image_view(img, area),
+                             state, error);
+}
+
+/*
+ * Same as above, but `img` is only read and the area the plugin made goes to
+ * `dst`, of the same size and format as the area.
+ */
+bool PluginSandbox::replace_image(const Plugin &plugin, EditorState es,
+                                  Image img, Rect area, ImageView dst,
+                                  PluginCallState &state, std::string &error) {
+#ifdef __linux__
+  size_t size = image_size(img);
+  size_t vars_size = PluginManager::calc_vars_size(plugin);
+  if (SANDBOX_VARS_SIZE < vars_size) {
+    error = "plugin has too many vars to run isolated";
+    return false;
+  }
+  if (!this->start(plugin, error) || !this->reserve(size, error)) {
+    return false;
+  }
+
+  std::memcpy(this->mapping, img.data, size);
+
+  SandboxRequest request = {};
+  request.type = SANDBOX_APPLY;
+  request.es = es;
+  request.area = area;
+  request.width = img.width;
+  request.height = img.height;
+  request.channels = img.channels;
+  request.sample_type = img.sample_type;
+  request.linear_light = plugin.linear_light;
+  request.mapping_size = this->mapping_size;
+  request.vars_size = static_cast<uint32_t>(vars_size);
+  if (0 < vars_size) {
+    std::memcpy(request.vars, plugin.replace_image_data, vars_size);
+  }
+
+  if (!send_message(this->socket_fd, &request, sizeof(request),
+                    this->memfd_sent ? -1 : this->memfd)) {
+    error = "helper " + this->stop();
+    return false;
+  }
+  this->memfd_sent = true;
+
+  if (!this->wait_reply(state, error)) {
+    return false;
+  }
+
+  // only the area was written, leave the rest of the image alone.
+  Image shared = {.data = this->mapping,
+                  .width = img.width,
+                  .height = img.height,
+                  .channels = img.channels,
+                  .sample_type = img.sample_type};
+  copy_view(image_view(shared, area), dst);
+  return true;
+#else
+  error = "isolated plugins are not supported on this platform";
+  return false;
+#endif
+}
+
+/*
+ * Starts a helper for the plugin, unless one already has it loaded.
+ * @returns true if succeeded, false if failed
+ */
+bool PluginSandbox::start(const Plugin &plugin, std::string &error) {
+#ifdef __linux__
+  int64_t mtime = 0;
+  uint64_t size = 0;
+  plugin_file_key(plugin.path, mtime, size);
+  if (0 < this->pid && this->plugin_path == plugin.path &&
+      this->plugin_mtime == mtime && this->plugin_size == size) {
+    return true;
+  }
+  this->stop();
+
+  std::string path = plugin.path.string();
+  if (SANDBOX_PATH_SIZE <= path.size()) {
+    error = "plugin path is too long";
+    return false;
+  }
+
+  int fds[2];
+  if (0 != socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) {
+    error = std::string("socketpair failed: ") + strerror(errno);
+    return false;
+  }
+
+  // everything the child needs is prepared before forking, only async signal
+  // safe calls are allowed between fork and exec.
+  std::string fd_arg = std::to_string(fds[1]);
+  char *const argv[] = {const_cast<char *>("imkur"),
+                        const_cast<char *>(PLUGIN_SANDBOX_ARG),
+                        const_cast<char *>(fd_arg.c_str()), nullptr};
+  pid_t child = fork();
+  if (0 == child) {
+    fcntl(fds[1], F_SETFD, 0);
+    execv("/proc/self/exe", argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  if (0 > child) {
+    close(fds[0]);
+    error = std::string("fork failed: ") + strerror(errno);
+    return false;
+  }
+
+  nhlog_info("PluginSandbox: started helper %d for %s", child, path.c_str());
+  this->pid = child;
+  this->socket_fd = fds[0];
+  this->memfd_sent = false;
+
+  SandboxRequest request = {};
+  request.type = SANDBOX_LOAD;
+  std::memcpy(request.path, path.c_str(), path.size() + 1);
+  PluginCallState load_state;
+  if (!send_message(this->socket_fd, &request, sizeof(request), -1)) {
+    error = "helper " + this->stop();
+    return false;
+  }
+  if (!this->wait_reply(load_state, error)) {
+    return false;
+  }
+
+  this->plugin_path = plugin.path;
+  this->plugin_mtime = mtime;
+  this->plugin_size = size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * Kills the helper and waits for it to exit.
+ * @returns how it exited, for error messages
+ */
+std::string PluginSandbox::stop() {
+  std::string how = "is not running";
+#ifdef __linux__
+  if (0 < this->pid) {
+    // no-op if it already died, its exit status is kept until waited for.
+    kill(this->pid, SIGKILL);
+    int status = 0;
+    waitpid(this->pid, &status, 0);
+    char buffer[SANDBOX_MESSAGE_SIZE];
+    if (WIFSIGNALED(status)) {
+      snprintf(buffer, sizeof(buffer), "was killed by signal %d (%s)",
+               WTERMSIG(status), strsignal(WTERMSIG(status)));
+    } else {
+      snprintf(buffer, sizeof(buffer), "exited with code %d",
+               WEXITSTATUS(status));
+    }
+    how = buffer;
+    nhlog_info("PluginSandbox: helper %d %s", this->pid, how.c_str());
+  }
+  if (0 <= this->socket_fd) {
+    close(this->socket_fd);
+  }
+#endif
+  this->pid = -1;
+  this->socket_fd = -1;
+  this->plugin_path.clear();
+  this->memfd_sent = false;
+  return how;
+}
+
+/*
+ * Makes sure the shared mapping can hold `size` bytes.
+ * @returns true if succeeded, false if failed
+ */
+bool PluginSandbox::reserve(size_t size, std::string &error) {
+#ifdef __linux__
+  if (size <= this->mapping_size) {
+    return true;
+  }
+
+  if (0 > this->memfd) {
+    this->memfd = memfd_create("imkur-sandbox", MFD_CLOEXEC);
+    if (0 > this->memfd) {
+      error = std::string("memfd_create failed: ") + strerror(errno);
+      return false;
+    }
+  }
+
+  if (nullptr != this->mapping) {
+    munmap(this->mapping, this->mapping_size);
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+  }
+  if (0 != ftruncate(this->memfd, static_cast<off_t>(size))) {
+    error = std::string("ftruncate failed: ") + strerror(errno);
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->memfd, 0);
+  if (MAP_FAILED == mapping) {
+    error = std::string("mmap failed: ") + strerror(errno);
+    return false;
+  }
+  this->mapping = static_cast<uint8_t *>(mapping);
+  this->mapping_size = size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * Waits for the helper's reply to the last request.
+ * @returns true if it replied with success, false if failed
+ */
+bool PluginSandbox::wait_reply(PluginCallState &state, std::string &error) {
+#ifdef __linux__
+  auto start = std::chrono::steady_clock::now();
+  while (true) {
+    if (state.cancelled) {
+      this->stop();
+      error = "cancelled";
+      return false;
+    }
+    if (std::chrono::steady_clock::now() - start >
+        std::chrono::milliseconds(PLUGIN_SANDBOX_TIMEOUT_MS)) {
+      this->stop();
+      error = "timed out after " + std::to_string(PLUGIN_SANDBOX_TIMEOUT_MS) +
+              " ms";
+      return false;
+    }
+
+    pollfd pfd = {.fd = this->socket_fd, .events = POLLIN, .revents = 0};
+    int ready = poll(&pfd, 1, SANDBOX_POLL_MS);
+    if (0 > ready && EINTR != errno) {
+      error = "helper " + this->stop();
+      return false;
+    }
+    if (0 < ready) {
+      break;
+    }
+  }
+
+  SandboxReply reply = {};
+  int fd = -1;
+  ssize_t received =
+      receive_message(this->socket_fd, &reply, sizeof(reply), fd);
+  if (0 <= fd) {
+    close(fd);
+  }
+  if (static_cast<ssize_t>(sizeof(reply)) != received) {
+    // the helper died, most likely the plugin crashed.
+    error = "helper " + this->stop();
+    return false;
+  }
+  if (SANDBOX_OK != reply.type) {
+    reply.message[SANDBOX_MESSAGE_SIZE - 1] = '\0';
+    error = reply.message;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * *****************************
+ * Helper process
+ * *****************************
+ */
+#ifdef __linux__
+static bool reply(int socket_fd, SandboxMessageType type,
+                  const char *message) {
+  SandboxReply reply = {};
+  reply.type = type;
+  snprintf(reply.message, sizeof(reply.message), "%s", message);
+  return send_message(socket_fd, &reply, sizeof(reply), -1);
+}
+#endif
+
+/*
+ * Entry point of the helper process, serves requests on `socket_fd` until the
+ * editor closes it.
+ * @returns the exit code
+ */
+int run_plugin_sandbox(int socket_fd) {
+#ifdef __linux__
+  std::optional<Plugin> plugin;
+  int memfd = -1;
+  uint8_t *mapping = nullptr;
+  size_t mapping_size = 0;
+  PluginCallState call_state;
+  std::vector<uint8_t> snapshot;
+  // the helper has no App, region plugins still run across threads.
+  ThreadPool thread_pool(THREAD_POOL_THREADS);
+  ThreadPool::shared = &thread_pool;
+
+  SandboxRequest request;
+  while (true) {
+    int fd = -1;
+    ssize_t received =
+        receive_message(socket_fd, &request, sizeof(request), fd);
+    if (static_cast<ssize_t>(sizeof(request)) != received) {
+      break;
+    }
+    if (0 <= fd) {
+      if (nullptr != mapping) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+      }
+      if (0 <= memfd) {
+        close(memfd);
+      }
+      memfd = fd;
+    }
+
+    if (SANDBOX_LOAD == request.type) {
+      request.path[SANDBOX_PATH_SIZE - 1] = '\0';
+      plugin = PluginManager::load_plugin(request.path, request.path);
+      bool loaded = plugin.has_value() &&
+                    PLUGIN_TYPE_REPLACE_IMAGE == plugin->info()->plugin_type;
+      if (!reply(socket_fd, loaded ? SANDBOX_OK : SANDBOX_FAILED,
+                 loaded ? "" : "failed to load plugin")) {
+        break;
+      }
+      continue;
+    }
+
+    if (SANDBOX_APPLY != request.type || !plugin.has_value() || 0 > memfd ||
+        PluginManager::calc_vars_size(*plugin) != request.vars_size) {
+      if (!reply(socket_fd, SANDBOX_FAILED, "invalid request")) {
+        break;
+      }
+      continue;
+    }
+
+    // the editor grows the mapping when images get bigger.
+    if (mapping_size != request.mapping_size) {
+      if (nullptr != mapping) {
+        munmap(mapping, mapping_size);
+      }
+      void *new_mapping = mmap(nullptr, request.mapping_size,
+                               PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+      mapping = MAP_FAILED == new_mapping
+                    ? nullptr
+                    : static_cast<uint8_t *>(new_mapping);
+      mapping_size = nullptr == mapping ? 0 : request.mapping_size;
+      if (nullptr == mapping) {
+        if (!reply(socket_fd, SANDBOX_FAILED, "failed to map the image")) {
+          break;
+        }
+        continue;
+      }
+    }
+
+    Image img = {.data = mapping,
+                 .width = request.width,
+                 .height = request.height,
+                 .channels = request.channels,
+                 .sample_type = request.sample_type};
+    if (0 >= img.width || 0 >= img.height || 0 >= img.channels ||
+        SAMPLE_TYPE_F32 < img.sample_type || mapping_size < image_size(img)) {
+      if (!reply(socket_fd, SANDBOX_FAILED, "invalid image")) {
+        break;
+      }
+      continue;
+    }
+
+    if (0 < request.vars_size) {
+      std::memcpy(plugin->replace_image_data, request.vars,
+                  request.vars_size);
+    }
+    plugin->linear_light = request.linear_light;
+    Editor::run_replace_image(*plugin, request.es, img, request.area,
+                              call_state, snapshot);
+
+    if (!reply(socket_fd, SANDBOX_OK, "")) {
+      break;
+    }
+  }
+
+  if (plugin.has_value()) {
+    free(plugin->replace_image_data);
+  }
+  return 0;
+#else
+  return 1;
+#endif
+}
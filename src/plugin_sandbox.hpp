@@ -0,0 +1,104 @@
+#pragma once
+
+#include "plugins/plugin_base.hpp"
+#include "src/host_services.hpp"
+#include "src/plugins_manager.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <sys/types.h>
+
+// argument which makes the editor's executable run as a sandbox helper.
+#define PLUGIN_SANDBOX_ARG "--plugin-sandbox"
+
+/*
+ * Runs replace image plugins in a helper process, so a plugin crashing or
+ * hanging can't take the editor down with it.
+ *
+ * The helper is the editor's own executable started with PLUGIN_SANDBOX_ARG,
+ * it stays alive between calls and is restarted for a different plugin or
+ * after the plugin file changed. Pixels are shared through a memfd mapping
+ * both processes map, only small fixed size messages go over the socket.
+ */
+class PluginSandbox {
+private:
+  pid_t pid;
+  int socket_fd;
+  // plugin the helper has loaded, and its file's modification time and size
+  // when it did.
+  std::filesystem::path plugin_path;
+  int64_t plugin_mtime;
+  uint64_t plugin_size;
+
+  // image memory shared with the helper.
+  int memfd;
+  uint8_t *mapping;
+  size_t mapping_size;
+  // whether the helper has been sent the current memfd.
+  bool memfd_sent;
+
+public:
+  /*
+   * Constructor, the helper is started on the first call.
+   */
+  PluginSandbox();
+
+  /*
+   * Stops the helper.
+   */
+  ~PluginSandbox();
+
+  PluginSandbox(const PluginSandbox &) = delete;
+  PluginSandbox &operator=(const PluginSandbox &) = delete;
+
+  /*
+   * Runs the plugin over `area` of the image in the helper. The image is only
+   * written to if the call succeeded.
+   * @param state - cancelling it kills the call
+   * @param error - why the call failed
+   * @returns true if succeeded, false if failed
+   */
+  bool replace_image(const Plugin &plugin, EditorState es, Image img,
+                     Rect area, PluginCallState &state, std::string &error);
+
+  /*
+   * Same as above, but `img` is only read and the area the plugin made goes
+   * to `dst`, of the same size and format as the area.
+   */
+  bool replace_image(const Plugin &plugin, EditorState es, Image img,
+                     Rect area, ImageView dst, PluginCallState &state,
+                     std::string &error);
+
+private:
+  /*
+   * Starts a helper for the plugin, unless one already has it loaded.
+   * @returns true if succeeded, false if failed
+   */
+  bool start(const Plugin &plugin, std::string &error);
+
+  /*
+   * Kills the helper and waits for it to exit.
+   * @returns how it exited, for error messages
+   */
+  std::string stop();
+
+  /*
+   * Makes sure the shared mapping can hold `size` bytes.
+   * @returns true if succeeded, false if failed
+   */
+  bool reserve(size_t size, std::string &error);
+
+  /*
+   * Waits for the helper's reply to the last request.
+   * @returns true if it replied with success, false if failed
+   */
+  bool wait_reply(PluginCallState &state, std::string &error);
+};
+
+/*
+ * Entry point of the helper process, serves requests on `socket_fd` until the
+ * editor closes it.
+ * @returns the exit code
+ */
+int run_plugin_sandbox(int socket_fd);
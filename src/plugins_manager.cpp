@@ -2,16 +2,27 @@
 #include "nhlog.h"
 #include "plugin_base.hpp"
 #include "src/config.hpp"
+#include "src/host_services.hpp"
 #include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 /*
  * Constructor
  */
-PluginManager::PluginManager() {
+PluginManager::PluginManager() : inotify_fd(-1), reload_count(0) {
+  PluginManifest cached = read_plugin_manifest(PATH_PLUGIN_MANIFEST_FILE);
+  bool manifest_changed = false;
+
   for (const auto &plugin_path : get_plugin_files()) {
     nhlog_debug("PluginManager: loading = %s", plugin_path.path().c_str());
 
@@ -23,73 +34,349 @@ PluginManager::PluginManager() {
 
     std::filesystem::path abs_path =
         std::filesystem::absolute(plugin_path.path());
-
-    Plugin p = Plugin();
-    p.handler = DL_OPEN(abs_path.c_str());
-    if (nullptr == p.handler) {
-      nhlog_error("PluginManager: plugin handler is null for %s",
-                  abs_path.c_str());
-      nhlog_error("PluginManager: plugin loading failed due to = %s",
-                  DL_LAST_ERROR());
+    PluginManifestEntry entry = {
+        .file_mtime = 0, .file_size = 0, .meta = nullptr};
+    if (!plugin_file_key(abs_path, entry.file_mtime, entry.file_size)) {
+      nhlog_error("PluginManager: failed to stat %s", abs_path.c_str());
       continue;
     }
 
-    if (!PluginManager::is_plugin_valid(p)) {
-      nhlog_error("PluginManager: invalid plugin = %s",
-                  plugin_path.path().c_str());
-      DL_CLOSE(abs_path.c_str());
+    // unchanged since it was cached, its library is opened on first use.
+    auto hit = cached.find(abs_path);
+    if (hit != cached.end() &&
+        hit->second.file_mtime == entry.file_mtime &&
+        hit->second.file_size == entry.file_size) {
+      auto p = this->load_cached_plugin(abs_path, hit->second.meta);
+      if (p.has_value()) {
+        this->plugins.push_back(*p);
+        this->manifest[abs_path] = hit->second;
+      }
       continue;
     }
 
-    if (!PluginManager::load_plugin_icon(p)) {
-      continue;
+    manifest_changed = true;
+    auto p = PluginManager::load_plugin(abs_path, abs_path);
+    if (p.has_value() && this->load_plugin_icon(*p)) {
+      this->plugins.push_back(*p);
+      entry.meta = p->meta;
+      this->manifest[abs_path] = entry;
+    } else if (p.has_value()) {
+      free(p->replace_image_data);
     }
+  }
 
-    this->plugins.push_back(p);
+  if (manifest_changed || cached.size() != this->manifest.size()) {
+    write_plugin_manifest(PATH_PLUGIN_MANIFEST_FILE, this->manifest);
   }
+  nhlog_info("PluginManager: %zu plugins, %zu from the manifest cache",
+             this->plugins.size(),
+             static_cast<size_t>(std::count_if(
+                 this->plugins.begin(), this->plugins.end(),
+                 [](const Plugin &p) { return nullptr == p.handler; })));
+
+  this->start_watching();
 }
+
 /*
  *  Destructor
  */
 PluginManager::~PluginManager() {
   nhlog_debug("PluginManager: destroying plugin manager");
-  for (auto plugin : this->plugins) {
+  for (auto &plugin : this->plugins) {
     nhlog_debug("PluginManager: unloading plugin = %s",
-                plugin.info_function()->name);
-    glDeleteTextures(1, &plugin.icon.texture_id);
-    if (PLUGIN_TYPE_REPLACE_IMAGE == plugin.info_function()->plugin_type &&
-        nullptr != plugin.replace_image_data) {
-      free(plugin.replace_image_data);
+                plugin.info()->name);
+    free(plugin.replace_image_data);
+  }
+
+#ifdef __linux__
+  if (0 <= this->inotify_fd) {
+    close(this->inotify_fd);
+  }
+#endif
+}
+
+/*
+ * Opens, validates and prepares the plugin at `path`, without its icon.
+ * @param load_path - file to actually open, can be a copy of `path`
+ */
+std::optional<Plugin>
+PluginManager::load_plugin(const std::filesystem::path &path,
+                           const std::filesystem::path &load_path) {
+  Plugin p = Plugin();
+  p.path = path;
+  void *handler = DL_OPEN(load_path.c_str());
+  if (nullptr == handler) {
+    nhlog_error("PluginManager: plugin handler is null for %s",
+                load_path.c_str());
+    nhlog_error("PluginManager: plugin loading failed due to = %s",
+                DL_LAST_ERROR());
+    return std::nullopt;
+  }
+  p.handler = std::shared_ptr<void>(handler, [](void *h) { DL_CLOSE(h); });
+
+  if (!PluginManager::is_plugin_valid(p)) {
+    nhlog_error("PluginManager: invalid plugin = %s", path.c_str());
+    return std::nullopt;
+  }
+
+  PluginManager::create_vars(p);
+  return p;
+}
+
+/*
+ * Creates a not yet opened plugin from its cached info.
+ */
+std::optional<Plugin> PluginManager::load_cached_plugin(
+    const std::filesystem::path &path,
+    const std::shared_ptr<const PluginMeta> &meta) {
+  Plugin p = Plugin();
+  p.path = path;
+  p.meta = meta;
+  if (!this->load_plugin_icon(p)) {
+    return std::nullopt;
+  }
+  PluginManager::create_vars(p);
+  return p;
+}
+
+/*
+ * Opens the library of the plugin at `index` if it isn't yet, must be
+ * called before any of its functions are.
+ * @returns false if the plugin can't be used
+ */
+bool PluginManager::ensure_loaded(size_t index) {
+  Plugin &plugin = this->plugins[index];
+  if (nullptr != plugin.handler) {
+    return true;
+  }
+  if (plugin.load_failed) {
+    return false;
+  }
+
+  nhlog_debug("PluginManager: opening cached plugin = %s",
+              plugin.path.c_str());
+  auto p = PluginManager::load_plugin(plugin.path, plugin.path);
+  if (!p.has_value()) {
+    nhlog_error("PluginManager: failed to open %s, which the manifest "
+                "listed as valid",
+                plugin.path.c_str());
+    plugin.load_failed = true;
+    return false;
+  }
+
+  if (!this->replace_plugin(plugin, *p)) {
+    free(p->replace_image_data);
+    plugin.load_failed = true;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Reloads plugins whose files changed since the last call. Called once per
+ * frame, between plugin calls.
+ */
+void PluginManager::poll_reload() {
+#ifdef __linux__
+  if (0 > this->inotify_fd) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t len;
+  while (0 < (len = read(this->inotify_fd, buffer, sizeof(buffer)))) {
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      auto event = reinterpret_cast<struct inotify_event *>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+      if (0 == event->len) {
+        continue;
+      }
+
+      std::filesystem::path changed =
+          std::filesystem::absolute(PATH_PLUGINS_DIR) / event->name;
+      if (changed.extension() != ".so") {
+        continue;
+      }
+      nhlog_debug("PluginManager: plugin file changed = %s", changed.c_str());
+      this->pending_reloads[changed] = now;
+    }
+  }
+
+  // linkers write in several steps, wait for the file to settle.
+  for (auto it = this->pending_reloads.begin();
+       it != this->pending_reloads.end();) {
+    if (now - it->second <
+        std::chrono::milliseconds(PLUGIN_RELOAD_DEBOUNCE_MS)) {
+      ++it;
+      continue;
+    }
+    this->reload_plugin(it->first);
+    it = this->pending_reloads.erase(it);
+  }
+#endif
+}
+
+/*
+ * Loads a fresh copy of the plugin at `path` and swaps it in place of the
+ * loaded one, or adds it if it is new.
+ */
+void PluginManager::reload_plugin(const std::filesystem::path &path) {
+  nhlog_info("PluginManager: reloading = %s", path.c_str());
+
+  // libraries are cached by path, so opening the same file again would hand
+  // back the old code. Open a uniquely named copy instead.
+  std::error_code err;
+  std::filesystem::path copy_path =
+      std::filesystem::temp_directory_path(err) /
+      ("imkur-" + path.stem().string() + "-" +
+       std::to_string(++this->reload_count) + path.extension().string());
+  std::filesystem::copy_file(
+      path, copy_path, std::filesystem::copy_options::overwrite_existing, err);
+  if (err) {
+    nhlog_error("PluginManager: failed to copy %s for reloading: %s",
+                path.c_str(), err.message().c_str());
+    return;
+  }
+
+  auto p = PluginManager::load_plugin(path, copy_path);
+  // the library stays mapped after its file is gone.
+  std::filesystem::remove(copy_path, err);
+  if (!p.has_value()) {
+    nhlog_error("PluginManager: reload failed, keeping the loaded version of "
+                "%s",
+                path.c_str());
+    return;
+  }
+
+  auto old = std::find_if(
+      this->plugins.begin(), this->plugins.end(),
+      [&](const Plugin &plugin) { return plugin.path == path; });
+  bool added = old == this->plugins.end() ? this->load_plugin_icon(*p)
+                                          : this->replace_plugin(*old, *p);
+  if (!added) {
+    free(p->replace_image_data);
+    return;
+  }
+  if (old == this->plugins.end()) {
+    this->plugins.push_back(*p);
+  }
+  this->update_manifest(*p);
+}
+
+/*
+ * Records the plugin's info in the manifest and writes it out.
+ */
+void PluginManager::update_manifest(const Plugin &plugin) {
+  PluginManifestEntry entry = {
+      .file_mtime = 0, .file_size = 0, .meta = plugin.meta};
+  if (!plugin_file_key(plugin.path, entry.file_mtime, entry.file_size)) {
+    return;
+  }
+  this->manifest[plugin.path] = entry;
+  write_plugin_manifest(PATH_PLUGIN_MANIFEST_FILE, this->manifest);
+}
+
+/*
+ * Replaces `old` with `fresh` in place, keeping the values the user set
+ * when the vars still mean the same thing, and its icon slot.
+ */
+bool PluginManager::replace_plugin(Plugin &old, Plugin &fresh) {
+  if (!this->load_plugin_icon(fresh, old.icon_slot)) {
+    return false;
+  }
+  fresh.sandboxed = old.sandboxed;
+  fresh.linear_light = old.linear_light;
+
+  if (nullptr != old.replace_image_data) {
+    if (PluginManager::has_same_vars(old, fresh)) {
+      free(fresh.replace_image_data);
+      fresh.replace_image_data = old.replace_image_data;
+    } else {
+      free(old.replace_image_data);
+    }
+  }
+
+  // the old library is closed here, unless a call still holds a copy.
+  old = fresh;
+  return true;
+}
+
+/*
+ * Starts watching PATH_PLUGINS_DIR for changes.
+ */
+void PluginManager::start_watching() {
+#ifdef __linux__
+  if (!std::filesystem::is_directory(PATH_PLUGINS_DIR)) {
+    return;
+  }
+
+  this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (0 > this->inotify_fd) {
+    nhlog_error("PluginManager: inotify_init1 failed: %s", strerror(errno));
+    return;
+  }
+
+  if (0 > inotify_add_watch(this->inotify_fd, PATH_PLUGINS_DIR,
+                            IN_CLOSE_WRITE | IN_MOVED_TO)) {
+    nhlog_error("PluginManager: failed to watch %s: %s", PATH_PLUGINS_DIR,
+                strerror(errno));
+    close(this->inotify_fd);
+    this->inotify_fd = -1;
+    return;
+  }
+  nhlog_info("PluginManager: watching %s for changes", PATH_PLUGINS_DIR);
+#endif
+}
+
+/*
+ * Whether both plugins expose the same vars, so var blocks can be shared.
+ */
+bool PluginManager::has_same_vars(const Plugin &a, const Plugin &b) {
+  const PluginInfo *a_info = a.info();
+  const PluginInfo *b_info = b.info();
+  if (a_info->plugin_type != b_info->plugin_type ||
+      a_info->vars_len != b_info->vars_len) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a_info->vars_len; i++) {
+    if (a_info->vars[i].type != b_info->vars[i].type ||
+        0 != strcmp(a_info->vars[i].name, b_info->vars[i].name)) {
+      return false;
     }
-    DL_CLOSE(plugin.handler);
   }
+  return true;
 }
 
 /*
  * verifies if the given plugin is valid or not
  */
 bool PluginManager::is_plugin_valid(Plugin &plugin) {
-  plugin.info_function = (PLUGIN_INFO_FUNCTION_TYPE)DL_SYMBOL(
-      plugin.handler, PLUGIN_INFO_FUNCTION_NAME);
+  auto info_function = (PLUGIN_INFO_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_INFO_FUNCTION_NAME);
 
-  if (nullptr == plugin.info_function) {
+  if (nullptr == info_function) {
     nhlog_error("PluginManager: info_function is null");
     return false;
   }
-  PluginInfo *info = plugin.info_function();
+  PluginInfo *info = info_function();
   if (nullptr == info) {
     nhlog_error("PluginManager: Invalid info function");
     return false;
   }
   nhlog_debug("PluginManager: plugin name = %s", info->name);
+  plugin.meta = PluginMeta::from_info(info);
 
   plugin.replace_image_data = nullptr;
   switch (info->plugin_type) {
   case PluginType::PLUGIN_TYPE_PUT_PIXEL: {
     plugin.callback.put_pixel = (PLUGIN_PUT_PIXEL_FUNCTION_TYPE)DL_SYMBOL(
-        plugin.handler, PLUGIN_PUT_PIXEL_FUNCTION_NAME);
+        plugin.handler.get(), PLUGIN_PUT_PIXEL_FUNCTION_NAME);
+    PluginManager::load_span_function(plugin);
 
-    if (nullptr == plugin.callback.put_pixel) {
+    if (nullptr == plugin.callback.put_pixel &&
+        nullptr == plugin.put_pixel_span) {
       nhlog_error("PluginManager: put_pixel function was null.");
       return false;
     }
@@ -98,14 +385,31 @@ bool PluginManager::is_plugin_valid(Plugin &plugin) {
   case PluginType::PLUGIN_TYPE_REPLACE_IMAGE: {
     plugin.callback.replace_image =
         (PLUGIN_REPLACE_IMAGE_FUNCTION_TYPE)DL_SYMBOL(
-            plugin.handler, PLUGIN_REPLACE_IMAGE_FUNCTION_NAME);
+            plugin.handler.get(), PLUGIN_REPLACE_IMAGE_FUNCTION_NAME);
+    PluginManager::load_region_functions(plugin);
+    PluginManager::load_sample_types(plugin);
 
-    if (nullptr == plugin.callback.replace_image) {
+    if (nullptr == plugin.callback.replace_image &&
+        nullptr == plugin.replace_region) {
       nhlog_error("PluginManager: replace_image function was null.");
       return false;
     }
-    // allocate memmory for meta vars
-    plugin.replace_image_data = malloc(PluginManager::calc_vars_size(plugin));
+    break;
+  }
+  case PluginType::PLUGIN_TYPE_SHADER: {
+    plugin.shader_source = (PLUGIN_SHADER_SOURCE_FUNCTION_TYPE)DL_SYMBOL(
+        plugin.handler.get(), PLUGIN_SHADER_SOURCE_FUNCTION_NAME);
+
+    if (nullptr == plugin.shader_source) {
+      nhlog_error("PluginManager: shader_source function was null.");
+      return false;
+    }
+    if (!PluginManager::is_abi_compatible(plugin)) {
+      nhlog_error("PluginManager: %s was built against a different plugin "
+                  "abi",
+                  info->name);
+      return false;
+    }
     break;
   }
   default: {
@@ -114,37 +418,142 @@ bool PluginManager::is_plugin_valid(Plugin &plugin) {
   }
   }
 
+  PluginManager::load_host_services(plugin);
   return true;
 }
 
 /*
- * Loads icon for plugins
+ * Whether the plugin was built against the same versioned entry points.
  */
-bool PluginManager::load_plugin_icon(Plugin &p) {
-  GLubyte data[PLUGIN_ICON_SIZE * PLUGIN_ICON_SIZE * 4];
-  for (int y = 0; y < PLUGIN_ICON_SIZE; ++y) {
-    for (int x = 0; x < PLUGIN_ICON_SIZE; ++x) {
-      int idx = (y * PLUGIN_ICON_SIZE + x) * 4;
-      auto color = p.info_function()->icon[y][x] ? COLOR_ICON : 0;
-      std::memcpy(&data[idx], &color, 4);
-    }
+bool PluginManager::is_abi_compatible(Plugin &plugin) {
+  auto abi_version = (PLUGIN_ABI_VERSION_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_ABI_VERSION_FUNCTION_NAME);
+  return nullptr != abi_version && PLUGIN_ABI_VERSION == abi_version();
+}
+
+/*
+ * Looks up the versioned span entry point, if the plugin has it.
+ */
+void PluginManager::load_span_function(Plugin &plugin) {
+  plugin.put_pixel_span = nullptr;
+
+  auto put_pixel_span = (PLUGIN_PUT_PIXEL_SPAN_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_PUT_PIXEL_SPAN_FUNCTION_NAME);
+  if (nullptr == put_pixel_span) {
+    return;
+  }
+
+  if (!PluginManager::is_abi_compatible(plugin)) {
+    nhlog_warn("PluginManager: %s was built against a different plugin abi, "
+               "ignoring its span entry point",
+               plugin.info()->name);
+    return;
+  }
+
+  plugin.put_pixel_span = put_pixel_span;
+}
+
+/*
+ * Looks up the versioned region entry points, if the plugin has them.
+ */
+void PluginManager::load_region_functions(Plugin &plugin) {
+  plugin.replace_region = nullptr;
+  plugin.region_info = nullptr;
+
+  auto replace_region = (PLUGIN_REPLACE_REGION_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_REPLACE_REGION_FUNCTION_NAME);
+  auto region_info = (PLUGIN_REGION_INFO_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_REGION_INFO_FUNCTION_NAME);
+  if (nullptr == replace_region) {
+    return;
+  }
+
+  if (!PluginManager::is_abi_compatible(plugin)) {
+    nhlog_warn("PluginManager: %s was built against a different plugin abi, "
+               "ignoring its region entry point",
+               plugin.info()->name);
+    return;
+  }
+
+  if (nullptr == region_info) {
+    nhlog_warn("PluginManager: %s has no region info function, ignoring its "
+               "region entry point",
+               plugin.info()->name);
+    return;
+  }
+
+  plugin.replace_region = replace_region;
+  plugin.region_info = region_info;
+}
+
+/*
+ * Asks the plugin which sample types it works on, if it says.
+ */
+void PluginManager::load_sample_types(Plugin &plugin) {
+  plugin.sample_types = 1u << SAMPLE_TYPE_U8;
+
+  auto sample_types = (PLUGIN_SAMPLE_TYPES_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_SAMPLE_TYPES_FUNCTION_NAME);
+  if (nullptr == sample_types) {
+    return;
   }
 
-  glGenTextures(1, &p.icon.texture_id);
-  glBindTexture(GL_TEXTURE_2D, p.icon.texture_id);
+  if (!PluginManager::is_abi_compatible(plugin)) {
+    nhlog_warn("PluginManager: %s was built against a different plugin abi, "
+               "handing it 8 bit images only",
+               plugin.info()->name);
+    return;
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  // 8 bit images are always supported, they are what others get converted
+  // to.
+  plugin.sample_types = sample_types() | (1u << SAMPLE_TYPE_U8);
+}
 
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PLUGIN_ICON_SIZE, PLUGIN_ICON_SIZE, 0,
-               GL_RGBA, GL_UNSIGNED_BYTE, data);
+/*
+ * Hands the host services table to the plugin, if it wants it.
+ */
+void PluginManager::load_host_services(Plugin &plugin) {
+  auto set_host_services = (PLUGIN_SET_HOST_SERVICES_FUNCTION_TYPE)DL_SYMBOL(
+      plugin.handler.get(), PLUGIN_SET_HOST_SERVICES_FUNCTION_NAME);
+  if (nullptr == set_host_services) {
+    return;
+  }
 
-  GLenum err = glGetError();
-  if (err != 0) {
-    nhlog_fatal("PluginManager: Icon failed to upload to gpu");
+  if (!PluginManager::is_abi_compatible(plugin)) {
+    nhlog_warn("PluginManager: %s was built against a different plugin abi, "
+               "not giving it host services",
+               plugin.info()->name);
+    return;
+  }
+
+  set_host_services(host_services());
+}
+
+/*
+ * Puts the plugin's icon into the icon atlas, into `slot` if it is not -1.
+ */
+bool PluginManager::load_plugin_icon(Plugin &p, int32_t slot) {
+  int32_t rows = this->icon_atlas.get_rows();
+  if (-1 == slot) {
+    slot = this->icon_atlas.add(p.info()->icon);
+    if (-1 == slot) {
+      return false;
+    }
+  } else if (!this->icon_atlas.set(slot, p.info()->icon)) {
     return false;
   }
+
+  p.icon_slot = slot;
+  this->icon_atlas.get_uv(slot, p.icon_uv0, p.icon_uv1);
+
+  // growing moved every icon.
+  if (rows != this->icon_atlas.get_rows()) {
+    for (auto &plugin : this->plugins) {
+      this->icon_atlas.get_uv(plugin.icon_slot, plugin.icon_uv0,
+                              plugin.icon_uv1);
+    }
+  }
   return true;
 }
 
@@ -189,10 +598,10 @@ PluginManager::get_plugin_files() {
 /*
  * Calculate size of all vars.
  */
-size_t PluginManager::calc_vars_size(Plugin &plugin) {
-  auto info = plugin.info_function();
+size_t PluginManager::calc_vars_size(const Plugin &plugin) {
+  auto info = plugin.info();
   size_t size = 0;
-  if (PLUGIN_TYPE_REPLACE_IMAGE != info->plugin_type) {
+  if (PLUGIN_TYPE_PUT_PIXEL == info->plugin_type) {
     return size;
   }
 
@@ -216,3 +625,48 @@ size_t PluginManager::calc_vars_size(Plugin &plugin) {
 
   return size;
 }
+
+/*
+ * Allocates the plugin's var block, filled with the default values.
+ */
+void PluginManager::create_vars(Plugin &plugin) {
+  plugin.replace_image_data = nullptr;
+  if (PLUGIN_TYPE_PUT_PIXEL == plugin.info()->plugin_type) {
+    return;
+  }
+  // allocate memmory for meta vars
+  plugin.replace_image_data = malloc(PluginManager::calc_vars_size(plugin));
+  PluginManager::write_default_vars(plugin);
+}
+
+/*
+ * Writes default values of all vars into the plugin's var block.
+ */
+void PluginManager::write_default_vars(Plugin &plugin) {
+  auto info = plugin.info();
+  char *vars_data_ptr = (char *)plugin.replace_image_data;
+  if (nullptr == vars_data_ptr) {
+    return;
+  }
+
+  for (size_t i = 0; i < info->vars_len; i++) {
+    auto var = info->vars[i];
+    switch (var.type) {
+    case TYPE_FLOAT:
+      memcpy(vars_data_ptr, &var.default_value.default_float, sizeof(float));
+      vars_data_ptr += sizeof(float);
+      break;
+    case TYPE_INT:
+      memcpy(vars_data_ptr, &var.default_value.default_int, sizeof(int32_t));
+      vars_data_ptr += sizeof(int32_t);
+      break;
+    case TYPE_BOOL:
+      memcpy(vars_data_ptr, &var.default_value.default_bool, sizeof(bool));
+      vars_data_ptr += sizeof(bool);
+      break;
+    default:
+      nhlog_fatal("Plugin's var type is invalid for = %s", info->name);
+      std::abort();
+    }
+  }
+}
@@ -1,9 +1,16 @@
 #pragma once
 
 #include "common.hpp"
+#include "icon_atlas.hpp"
 #include "imgui.h"
+#include "plugin_manifest.hpp"
 #include "plugins/plugin_base.hpp"
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #define PLUGIN_ICON_SIZE 32
@@ -18,18 +25,76 @@ typedef Color (*PLUGIN_PUT_PIXEL_FUNCTION_TYPE)(EditorState, ImVec2);
 typedef void (*PLUGIN_REPLACE_IMAGE_FUNCTION_TYPE)(EditorState, Image,
                                                    void *data);
 
+#define PLUGIN_ABI_VERSION_FUNCTION_NAME "GET_PLUGIN_ABI_VERSION"
+typedef uint32_t (*PLUGIN_ABI_VERSION_FUNCTION_TYPE)();
+
+#define PLUGIN_SET_HOST_SERVICES_FUNCTION_NAME "PLUGIN_SET_HOST_SERVICES"
+typedef void (*PLUGIN_SET_HOST_SERVICES_FUNCTION_TYPE)(const HostServices *);
+
+#define PLUGIN_PUT_PIXEL_SPAN_FUNCTION_NAME "PLUGIN_PUT_PIXEL_SPAN"
+typedef void (*PLUGIN_PUT_PIXEL_SPAN_FUNCTION_TYPE)(EditorState, PixelSpan,
+                                                    Color *out);
+
+#define PLUGIN_REPLACE_REGION_FUNCTION_NAME "PLUGIN_REPLACE_REGION"
+typedef void (*PLUGIN_REPLACE_REGION_FUNCTION_TYPE)(EditorState,
+                                                    ImageView src,
+                                                    ImageView dst,
+                                                    void *data);
+
+#define PLUGIN_REGION_INFO_FUNCTION_NAME "PLUGIN_REGION_INFO"
+typedef PluginRegionInfo (*PLUGIN_REGION_INFO_FUNCTION_TYPE)(EditorState,
+                                                             void *data);
+
+#define PLUGIN_SAMPLE_TYPES_FUNCTION_NAME "PLUGIN_SAMPLE_TYPES"
+typedef uint32_t (*PLUGIN_SAMPLE_TYPES_FUNCTION_TYPE)();
+
+#define PLUGIN_SHADER_SOURCE_FUNCTION_NAME "PLUGIN_SHADER_SOURCE"
+typedef const char *(*PLUGIN_SHADER_SOURCE_FUNCTION_TYPE)();
+
 /*
- * Single loaded plugin
+ * Single plugin. Plugins found in the manifest cache start out with only
+ * their info, the library is opened on first use.
  */
 struct Plugin {
-  void *handler;
-  PLUGIN_INFO_FUNCTION_TYPE info_function;
+  // keeps the library loaded, it is closed once the last copy of the plugin
+  // is gone, so copies held by calls in flight survive a reload. Null until
+  // the library is opened.
+  std::shared_ptr<void> handler;
+  // file the plugin was loaded from.
+  std::filesystem::path path;
+  // copy of the plugin's info, available without opening the library.
+  std::shared_ptr<const PluginMeta> meta;
+  // set once opening the library failed, so it isn't retried every frame.
+  bool load_failed = false;
   union {
     PLUGIN_PUT_PIXEL_FUNCTION_TYPE put_pixel;
     PLUGIN_REPLACE_IMAGE_FUNCTION_TYPE replace_image;
   } callback;
-  Texture icon;
+  // optional span entry point of PLUGIN_TYPE_PUT_PIXEL plugins.
+  PLUGIN_PUT_PIXEL_SPAN_FUNCTION_TYPE put_pixel_span = nullptr;
+  // optional region entry points of PLUGIN_TYPE_REPLACE_IMAGE plugins.
+  PLUGIN_REPLACE_REGION_FUNCTION_TYPE replace_region = nullptr;
+  PLUGIN_REGION_INFO_FUNCTION_TYPE region_info = nullptr;
+  // sample types PLUGIN_TYPE_REPLACE_IMAGE plugins work on, as a mask of
+  // 1 << SampleType.
+  uint32_t sample_types = 1u << SAMPLE_TYPE_U8;
+  // entry point of PLUGIN_TYPE_SHADER plugins.
+  PLUGIN_SHADER_SOURCE_FUNCTION_TYPE shader_source = nullptr;
+  // slot of the plugin's icon in PluginManager::icon_atlas, and where it is
+  // in the atlas texture.
+  int32_t icon_slot = -1;
+  ImVec2 icon_uv0, icon_uv1;
   void *replace_image_data = nullptr;
+  // run in a helper process instead of the editor, see PluginSandbox.
+  bool sandboxed = false;
+  // filter 8 and 16 bit images in linear light, on a float copy, if the
+  // plugin handles float.
+  bool linear_light = false;
+
+  const PluginInfo *info() const { return &this->meta->info; }
+  bool handles(SampleType type) const {
+    return 0 != (this->sample_types & (1u << type));
+  }
 };
 
 #ifdef _WIN32
@@ -53,6 +118,19 @@ class PluginManager {
 public:
   // all the verified loaded plugins.
   std::vector<Plugin> plugins;
+  // icons of all plugins.
+  IconAtlas icon_atlas;
+
+private:
+  // inotify instance watching PATH_PLUGINS_DIR, -1 if not watching.
+  int inotify_fd;
+  // changed plugin files waiting to be reloaded, with when they last changed.
+  std::map<std::filesystem::path, std::chrono::steady_clock::time_point>
+      pending_reloads;
+  // makes the names of the copies reloaded plugins are loaded from unique.
+  uint32_t reload_count;
+  // cached info of every valid plugin file, see PATH_PLUGIN_MANIFEST_FILE.
+  PluginManifest manifest;
 
 public:
   /*
@@ -65,7 +143,67 @@ public:
    */
   ~PluginManager();
 
+  /*
+   * Reloads plugins whose files changed since the last call. Called once per
+   * frame, between plugin calls.
+   */
+  void poll_reload();
+
+  /*
+   * Opens the library of the plugin at `index` if it isn't yet, must be
+   * called before any of its functions are.
+   * @returns false if the plugin can't be used
+   */
+  bool ensure_loaded(size_t index);
+
+  /*
+   * Opens, validates and prepares the plugin at `path`, without its icon.
+   * @param load_path - file to actually open, can be a copy of `path`
+   */
+  static std::optional<Plugin>
+  load_plugin(const std::filesystem::path &path,
+              const std::filesystem::path &load_path);
+
+  /*
+   * Calculate size of all vars.
+   */
+  static size_t calc_vars_size(const Plugin &plugin);
+
 private:
+  /*
+   * Loads a fresh copy of the plugin at `path` and swaps it in place of the
+   * loaded one, or adds it if it is new.
+   */
+  void reload_plugin(const std::filesystem::path &path);
+
+  /*
+   * Creates a not yet opened plugin from its cached info.
+   */
+  std::optional<Plugin>
+  load_cached_plugin(const std::filesystem::path &path,
+                     const std::shared_ptr<const PluginMeta> &meta);
+
+  /*
+   * Records the plugin's info in the manifest and writes it out.
+   */
+  void update_manifest(const Plugin &plugin);
+
+  /*
+   * Replaces `old` with `fresh` in place, keeping the values the user set
+   * when the vars still mean the same thing, and its icon slot.
+   */
+  bool replace_plugin(Plugin &old, Plugin &fresh);
+
+  /*
+   * Starts watching PATH_PLUGINS_DIR for changes.
+   */
+  void start_watching();
+
+  /*
+   * Whether both plugins expose the same vars, so var blocks can be shared.
+   */
+  static bool has_same_vars(const Plugin &a, const Plugin &b);
+
   /*
    * Iterator for all plugin files.
    */
@@ -77,12 +215,42 @@ private:
   static bool is_plugin_valid(Plugin &plugin);
 
   /*
-   * Loads icon for plugins
+   * Puts the plugin's icon into the icon atlas, into `slot` if it is not -1.
    */
-  static bool load_plugin_icon(Plugin &plugin);
+  bool load_plugin_icon(Plugin &plugin, int32_t slot = -1);
 
   /*
-   * Calculate size of all vars.
+   * Whether the plugin was built against the same versioned entry points.
+   */
+  static bool is_abi_compatible(Plugin &plugin);
+
+  /*
+   * Looks up the versioned span entry point, if the plugin has it.
+   */
+  static void load_span_function(Plugin &plugin);
+
+  /*
+   * Looks up the versioned region entry points, if the plugin has them.
+   */
+  static void load_region_functions(Plugin &plugin);
+
+  /*
+   * Asks the plugin which sample types it works on, if it says.
+   */
+  static void load_sample_types(Plugin &plugin);
+
+  /*
+   * Hands the host services table to the plugin, if it wants it.
+   */
+  static void load_host_services(Plugin &plugin);
+
+  /*
+   * Allocates the plugin's var block, filled with the default values.
+   */
+  static void create_vars(Plugin &plugin);
+
+  /*
+   * Writes default values of all vars into the plugin's var block.
    */
-  static size_t calc_vars_size(Plugin &plugin);
+  static void write_default_vars(Plugin &plugin);
 };
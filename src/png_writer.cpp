@@ -0,0 +1,177 @@
+#include "src/png_writer.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// defined along with the rest of stb_image_write, but only declared when
+// STB_IMAGE_WRITE_IMPLEMENTATION is.
+extern "C" unsigned char *stbi_zlib_compress(unsigned char *data,
+                                             int data_len, int *out_len,
+                                             int quality);
+
+/*
+ * CRC-32 of `size` bytes, continuing from `crc`.
+ */
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size) {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+  out.push_back(static_cast<uint8_t>(value >> 24));
+  out.push_back(static_cast<uint8_t>(value >> 16));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+/*
+ * Appends a chunk: length, type, data and the CRC of type and data.
+ */
+static void put_chunk(std::vector<uint8_t> &out, const char type[4],
+                      const uint8_t *data, size_t size) {
+  put_u32(out, static_cast<uint32_t>(size));
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + size);
+  put_u32(out, crc32(0, out.data() + start, size + 4));
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+  return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+/*
+ * Filters one row of `size` bytes with the given PNG filter type, `bpp`
+ * being the bytes per pixel and `prior` the unfiltered row above, null for
+ * the first one.
+ */
+static void filter_row(uint8_t filter, const uint8_t *row,
+                       const uint8_t *prior, size_t size, size_t bpp,
+                       uint8_t *out) {
+  for (size_t i = 0; i < size; i++) {
+    uint8_t a = bpp <= i ? row[i - bpp] : 0;
+    uint8_t b = nullptr != prior ? prior[i] : 0;
+    uint8_t c = nullptr != prior && bpp <= i ? prior[i - bpp] : 0;
+    uint8_t predicted = 0;
+    switch (filter) {
+    case 1:
+      predicted = a;
+      break;
+    case 2:
+      predicted = b;
+      break;
+    case 3:
+      predicted = static_cast<uint8_t>((a + b) / 2);
+      break;
+    case 4:
+      predicted = paeth(a, b, c);
+      break;
+    }
+    out[i] = static_cast<uint8_t>(row[i] - predicted);
+  }
+}
+
+/*
+ * Writes a 16 bit per sample PNG, which stb_image_write can't.
+ * @param data - tightly packed rows of `channels` samples per pixel, 1 is
+ * grey, 2 grey and alpha, 3 RGB and 4 RGBA
+ * @returns true if succeeded, false if failed
+ */
+bool write_png_16(const char *path, int32_t width, int32_t height,
+                  int32_t channels, const uint16_t *data) {
+  static const uint8_t color_types[] = {0, 4, 2, 6};
+  if (width <= 0 || height <= 0 || channels < 1 || 4 < channels) {
+    return false;
+  }
+
+  // PNG samples are big endian, every row starts with its filter type.
+  size_t bpp = static_cast<size_t>(channels) * 2;
+  size_t row_size = static_cast<size_t>(width) * bpp;
+  std::vector<uint8_t> rows[2] = {std::vector<uint8_t>(row_size),
+                                  std::vector<uint8_t>(row_size)};
+  std::vector<uint8_t> candidate(row_size);
+  std::vector<uint8_t> filtered((row_size + 1) *
+                                static_cast<size_t>(height));
+  size_t samples_per_row = static_cast<size_t>(width) *
+                           static_cast<size_t>(channels);
+  for (size_t y = 0; y < static_cast<size_t>(height); y++) {
+    std::vector<uint8_t> &row = rows[y % 2];
+    const uint16_t *samples = data + y * samples_per_row;
+    for (size_t i = 0; i < samples_per_row; i++) {
+      row[2 * i] = static_cast<uint8_t>(samples[i] >> 8);
+      row[2 * i + 1] = static_cast<uint8_t>(samples[i]);
+    }
+    const uint8_t *prior = 0 == y ? nullptr : rows[(y + 1) % 2].data();
+
+    // same heuristic as stb_image_write, the filter leaving the smallest
+    // sum of signed differences.
+    uint8_t *out = filtered.data() + y * (row_size + 1);
+    uint64_t best_cost = UINT64_MAX;
+    for (uint8_t filter = 0; filter < 5; filter++) {
+      filter_row(filter, row.data(), prior, row_size, bpp, candidate.data());
+      uint64_t cost = 0;
+      for (uint8_t value : candidate) {
+        cost += static_cast<uint64_t>(std::abs(static_cast<int8_t>(value)));
+      }
+      if (cost < best_cost) {
+        best_cost = cost;
+        out[0] = filter;
+        std::memcpy(out + 1, candidate.data(), row_size);
+      }
+    }
+  }
+
+  int zlib_size = 0;
+  uint8_t *zlib = stbi_zlib_compress(filtered.data(),
+                                     static_cast<int>(filtered.size()),
+                                     &zlib_size, PNG_WRITER_COMPRESSION);
+  if (nullptr == zlib) {
+    nhlog_error("PngWriter: failed to compress %s", path);
+    return false;
+  }
+
+  std::vector<uint8_t> png = {137, 80, 78, 71, 13, 10, 26, 10};
+  std::vector<uint8_t> header;
+  put_u32(header, static_cast<uint32_t>(width));
+  put_u32(header, static_cast<uint32_t>(height));
+  header.push_back(16);
+  header.push_back(color_types[channels - 1]);
+  // deflate, adaptive filtering, not interlaced.
+  header.push_back(0);
+  header.push_back(0);
+  header.push_back(0);
+  put_chunk(png, "IHDR", header.data(), header.size());
+  put_chunk(png, "IDAT", zlib, static_cast<size_t>(zlib_size));
+  put_chunk(png, "IEND", nullptr, 0);
+  free(zlib);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(png.data()),
+             static_cast<std::streamsize>(png.size()));
+  if (!file) {
+    nhlog_error("PngWriter: failed to write %s", path);
+    return false;
+  }
+  return true;
+}
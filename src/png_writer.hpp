@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Writes a 16 bit per sample PNG, which stb_image_write can't.
+ * @param data - tightly packed rows of `channels` samples per pixel, 1 is
+ * grey, 2 grey and alpha, 3 RGB and 4 RGBA
+ * @returns true if succeeded, false if failed
+ */
+bool write_png_16(const char *path, int32_t width, int32_t height,
+                  int32_t channels, const uint16_t *data);
@@ -0,0 +1,368 @@
+#include "src/selection.hpp"
+#include "pixel_format.hpp"
+#include "src/config.hpp"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+/*
+ * Constructor, for an empty image.
+ */
+Selection::Selection()
+    : width(0), height(0), tiles_x(0), tiles_y(0),
+      bbox{.x = 0, .y = 0, .width = 0, .height = 0}, changes(0) {}
+
+/*
+ * Selects everything of an image of the given size.
+ */
+void Selection::reset(int32_t width, int32_t height) {
+  this->width = width;
+  this->height = height;
+  this->tiles_x = (width + EDITOR_TILE_SIZE - 1) / EDITOR_TILE_SIZE;
+  this->tiles_y = (height + EDITOR_TILE_SIZE - 1) / EDITOR_TILE_SIZE;
+  this->select_all();
+}
+
+/*
+ * Selects everything, dropping the mask.
+ */
+void Selection::select_all() {
+  size_t tiles = static_cast<size_t>(this->tiles_x * this->tiles_y);
+  this->mask.clear();
+  this->mask.shrink_to_fit();
+  this->tile_coverage.assign(tiles, SELECTION_FULL);
+  this->tile_bounds.resize(tiles);
+  for (size_t t = 0; t < tiles; t++) {
+    this->tile_bounds[t] = this->tile_rect(t);
+  }
+  this->bbox = {
+      .x = 0, .y = 0, .width = this->width, .height = this->height};
+  this->changes++;
+}
+
+/*
+ * Whether only a part of the image is selected.
+ */
+bool Selection::is_active() const { return !this->mask.empty(); }
+
+/*
+ * Smallest rect covering what is selected, the whole image if inactive.
+ */
+Rect Selection::bounds() const { return this->bbox; }
+
+/*
+ * Changes whenever what is selected does.
+ */
+uint64_t Selection::generation() const { return this->changes; }
+
+/*
+ * Selects the pixels inside `rect`.
+ */
+void Selection::select_rect(Rect rect, SelectionMode mode) {
+  float left = static_cast<float>(rect.x);
+  float right = static_cast<float>(rect.x + rect.width);
+  this->fill(rect, mode, [&](float, std::vector<float> &xs) {
+    xs.push_back(left);
+    xs.push_back(right);
+  });
+}
+
+/*
+ * Selects the ellipse inscribed in `rect`.
+ */
+void Selection::select_ellipse(Rect rect, SelectionMode mode) {
+  float rx = 0.5f * static_cast<float>(rect.width);
+  float ry = 0.5f * static_cast<float>(rect.height);
+  float cx = static_cast<float>(rect.x) + rx;
+  float cy = static_cast<float>(rect.y) + ry;
+  this->fill(rect, mode, [&](float y, std::vector<float> &xs) {
+    float dy = (y - cy) / ry;
+    if (1.0f <= dy * dy) {
+      return;
+    }
+    float half = rx * std::sqrt(1.0f - dy * dy);
+    xs.push_back(cx - half);
+    xs.push_back(cx + half);
+  });
+}
+
+/*
+ * Selects the inside of the polygon through `points`, in image coordinates
+ * where pixel x, y spans x to x + 1 and y to y + 1, closed back to the
+ * first. Parts it crosses over itself in are outside.
+ */
+void Selection::select_polygon(const std::vector<Vec2<float>> &points,
+                               SelectionMode mode) {
+  if (points.size() < 3) {
+    return;
+  }
+  float min_x = points[0].x, max_x = points[0].x;
+  float min_y = points[0].y, max_y = points[0].y;
+  for (const Vec2<float> &p : points) {
+    min_x = std::min(min_x, p.x);
+    max_x = std::max(max_x, p.x);
+    min_y = std::min(min_y, p.y);
+    max_y = std::max(max_y, p.y);
+  }
+  int32_t x0 = static_cast<int32_t>(std::floor(min_x));
+  int32_t y0 = static_cast<int32_t>(std::floor(min_y));
+  Rect area = {.x = x0,
+               .y = y0,
+               .width = static_cast<int32_t>(std::ceil(max_x)) - x0,
+               .height = static_cast<int32_t>(std::ceil(max_y)) - y0};
+
+  this->fill(area, mode, [&](float y, std::vector<float> &xs) {
+    // edges count from their top end to just above their bottom one, so
+    // rows through a vertex cross its edges once.
+    for (size_t i = 0; i < points.size(); i++) {
+      const Vec2<float> &a = points[i];
+      const Vec2<float> &b = points[(i + 1) % points.size()];
+      if ((a.y <= y) == (b.y <= y)) {
+        continue;
+      }
+      xs.push_back(a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y));
+    }
+    std::sort(xs.begin(), xs.end());
+  });
+}
+
+/*
+ * How much of `rect` is selected, by the tiles it touches. Partial may
+ * still hold no selected pixel.
+ */
+SelectionCoverage Selection::coverage(Rect rect) const {
+  if (!this->is_active()) {
+    return SELECTION_FULL;
+  }
+  Rect image = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, image);
+  if (0 == rect.width || 0 == rect.height) {
+    return SELECTION_EMPTY;
+  }
+  bool any_empty = false, any_full = false, any_partial = false;
+  for (int32_t ty = rect.y / EDITOR_TILE_SIZE;
+       ty <= (rect.y + rect.height - 1) / EDITOR_TILE_SIZE; ty++) {
+    for (int32_t tx = rect.x / EDITOR_TILE_SIZE;
+         tx <= (rect.x + rect.width - 1) / EDITOR_TILE_SIZE; tx++) {
+      size_t t = static_cast<size_t>(ty * this->tiles_x + tx);
+      uint8_t coverage = this->tile_coverage[t];
+      // partial tiles are empty away from what they select.
+      Rect overlap = grow_rect(rect, 0, this->tile_bounds[t]);
+      if (SELECTION_PARTIAL == coverage &&
+          (0 == overlap.width || 0 == overlap.height)) {
+        coverage = SELECTION_EMPTY;
+      }
+      any_empty |= SELECTION_EMPTY == coverage;
+      any_full |= SELECTION_FULL == coverage;
+      any_partial |= SELECTION_PARTIAL == coverage;
+    }
+  }
+  if (any_partial || (any_empty && any_full)) {
+    return SELECTION_PARTIAL;
+  }
+  return any_full ? SELECTION_FULL : SELECTION_EMPTY;
+}
+
+/*
+ * Mask of row y from x on, only while active.
+ */
+const uint8_t *Selection::mask_row(int32_t x, int32_t y) const {
+  return this->mask.data() +
+         static_cast<size_t>(y) * static_cast<size_t>(this->width) +
+         static_cast<size_t>(x);
+}
+
+/*
+ * Copies `src` into `dst`, views of the same part of images of the same
+ * format, as far as it is selected, mixing the two at the edges. Tiles run
+ * across threads.
+ */
+void Selection::merge(ImageView src, ImageView dst) const {
+  if (!this->is_active()) {
+    copy_view(src, dst);
+    return;
+  }
+  Rect rect = {
+      .x = dst.x, .y = dst.y, .width = dst.width, .height = dst.height};
+  std::vector<Rect> chunks;
+  for (size_t t = 0; t < this->tile_coverage.size(); t++) {
+    Rect chunk = grow_rect(this->tile_rect(t), 0, rect);
+    if (0 < chunk.width && 0 < chunk.height &&
+        SELECTION_EMPTY != this->tile_coverage[t]) {
+      chunks.push_back(chunk);
+    }
+  }
+
+  size_t channels = static_cast<size_t>(dst.channels);
+  parallel_for(chunks.size(), [&](size_t i) {
+    Rect chunk = chunks[i];
+    SelectionCoverage coverage = this->coverage(chunk);
+    if (SELECTION_EMPTY == coverage) {
+      return;
+    }
+    if (SELECTION_FULL == coverage) {
+      copy_view(sub_view(src, chunk), sub_view(dst, chunk));
+      return;
+    }
+    auto mix = [&]<typename T>(std::type_identity<T>) {
+      for (int32_t y = chunk.y; y < chunk.y + chunk.height; y++) {
+        const uint8_t *mask = this->mask_row(chunk.x, y);
+        const T *from =
+            reinterpret_cast<const T *>(image_view_pixel(src, chunk.x, y));
+        T *to = reinterpret_cast<T *>(image_view_pixel(dst, chunk.x, y));
+        for (size_t x = 0; x < static_cast<size_t>(chunk.width); x++) {
+          uint32_t m = mask[x];
+          for (size_t c = x * channels; c < (x + 1) * channels; c++) {
+            if constexpr (std::is_floating_point_v<T>) {
+              to[c] += (from[c] - to[c]) * static_cast<float>(m) / 255.0f;
+            } else {
+              uint32_t mixed = static_cast<uint32_t>(from[c]) * m +
+                               static_cast<uint32_t>(to[c]) * (255 - m);
+              to[c] = static_cast<T>((mixed + 127) / 255);
+            }
+          }
+        }
+      }
+    };
+    dispatch_sample_type(dst.sample_type, mix);
+  });
+}
+
+/*
+ * Part of the image tile t covers.
+ */
+Rect Selection::tile_rect(size_t t) const {
+  int32_t tx = static_cast<int32_t>(t) % this->tiles_x;
+  int32_t ty = static_cast<int32_t>(t) / this->tiles_x;
+  Rect image = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  return grow_rect(Rect{.x = tx * EDITOR_TILE_SIZE,
+                        .y = ty * EDITOR_TILE_SIZE,
+                        .width = EDITOR_TILE_SIZE,
+                        .height = EDITOR_TILE_SIZE},
+                   0, image);
+}
+
+/*
+ * Combines the shape into the mask over `area`, the part of the image it
+ * covers. `spans(y, xs)` fills xs with the x where the edges cross row y,
+ * sorted, the shape being inside between every other pair.
+ */
+template <typename Spans>
+void Selection::fill(Rect area, SelectionMode mode, const Spans &spans) {
+  Rect image = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  size_t size = static_cast<size_t>(this->width) *
+                static_cast<size_t>(this->height);
+  Rect changed = grow_rect(area, 0, image);
+  if (SELECTION_REPLACE == mode) {
+    this->mask.assign(size, 0);
+    changed = image;
+  } else if (!this->is_active()) {
+    // adding to everything leaves everything.
+    if (SELECTION_ADD == mode) {
+      return;
+    }
+    this->mask.assign(size, 255);
+    changed = image;
+  }
+  area = grow_rect(area, 0, image);
+
+  // rows are sampled SELECTION_SUBSAMPLES times, each sample covering the
+  // exact part of the pixels between its crossings.
+  parallel_for(static_cast<size_t>(area.height), [&](size_t i) {
+    thread_local std::vector<float> cover, xs;
+    cover.assign(static_cast<size_t>(area.width), 0.0f);
+    int32_t y = area.y + static_cast<int32_t>(i);
+    const float left = static_cast<float>(area.x);
+    const float right = static_cast<float>(area.x + area.width);
+    for (int32_t s = 0; s < SELECTION_SUBSAMPLES; s++) {
+      xs.clear();
+      spans(static_cast<float>(y) + (static_cast<float>(s) + 0.5f) /
+                                        SELECTION_SUBSAMPLES,
+            xs);
+      for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+        float a = std::clamp(xs[k], left, right) - left;
+        float b = std::clamp(xs[k + 1], left, right) - left;
+        if (b <= a) {
+          continue;
+        }
+        size_t first = static_cast<size_t>(a);
+        size_t last = static_cast<size_t>(std::ceil(b)) - 1;
+        if (first == last) {
+          cover[first] += b - a;
+          continue;
+        }
+        cover[first] += static_cast<float>(first + 1) - a;
+        cover[last] += b - static_cast<float>(last);
+        for (size_t x = first + 1; x < last; x++) {
+          cover[x] += 1.0f;
+        }
+      }
+    }
+
+    uint8_t *row = this->mask.data() +
+                   static_cast<size_t>(y) * static_cast<size_t>(this->width) +
+                   static_cast<size_t>(area.x);
+    for (size_t x = 0; x < cover.size(); x++) {
+      float amount = std::min(cover[x] / SELECTION_SUBSAMPLES, 1.0f);
+      uint8_t value = static_cast<uint8_t>(std::lround(amount * 255.0f));
+      row[x] = SELECTION_SUBTRACT == mode
+                   ? std::min(row[x], static_cast<uint8_t>(255 - value))
+                   : std::max(row[x], value);
+    }
+  });
+  this->classify(changed);
+  this->changes++;
+}
+
+/*
+ * Classifies the tiles `rect` touches again and updates the bounds, and
+ * drops the mask once everything or nothing is selected.
+ */
+void Selection::classify(Rect rect) {
+  std::vector<size_t> tiles;
+  for (size_t t = 0; t < this->tile_coverage.size(); t++) {
+    Rect overlap = grow_rect(this->tile_rect(t), 0, rect);
+    if (0 < overlap.width && 0 < overlap.height) {
+      tiles.push_back(t);
+    }
+  }
+  parallel_for(tiles.size(), [&](size_t i) {
+    size_t t = tiles[i];
+    Rect tile = this->tile_rect(t);
+    int32_t min_x = tile.x + tile.width, max_x = tile.x - 1;
+    int32_t min_y = tile.y + tile.height, max_y = tile.y - 1;
+    bool full = true;
+    for (int32_t y = tile.y; y < tile.y + tile.height; y++) {
+      const uint8_t *row = this->mask_row(tile.x, y);
+      for (int32_t x = 0; x < tile.width; x++) {
+        uint8_t m = row[x];
+        full = full && 255 == m;
+        if (0 != m) {
+          min_x = std::min(min_x, tile.x + x);
+          max_x = std::max(max_x, tile.x + x);
+          min_y = std::min(min_y, y);
+          max_y = y;
+        }
+      }
+    }
+    this->tile_coverage[t] = full           ? SELECTION_FULL
+                             : max_x < min_x ? SELECTION_EMPTY
+                                             : SELECTION_PARTIAL;
+    this->tile_bounds[t] = {.x = min_x,
+                            .y = min_y,
+                            .width = std::max(0, max_x - min_x + 1),
+                            .height = std::max(0, max_y - min_y + 1)};
+  });
+
+  bool all_full = true, all_empty = true;
+  this->bbox = {.x = 0, .y = 0, .width = 0, .height = 0};
+  for (size_t t = 0; t < this->tile_coverage.size(); t++) {
+    all_full = all_full && SELECTION_FULL == this->tile_coverage[t];
+    all_empty = all_empty && SELECTION_EMPTY == this->tile_coverage[t];
+    this->bbox = union_rect(this->bbox, this->tile_bounds[t]);
+  }
+  // an empty selection acts like none, as filters over nothing do nothing.
+  if (all_full || all_empty) {
+    this->select_all();
+  }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include "src/common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * How a new shape combines with what is selected already.
+ */
+typedef enum {
+  SELECTION_REPLACE,
+  SELECTION_ADD,
+  SELECTION_SUBTRACT,
+} SelectionMode;
+
+/*
+ * How much of a part of the image is selected.
+ */
+typedef enum {
+  SELECTION_EMPTY,
+  SELECTION_PARTIAL,
+  SELECTION_FULL,
+} SelectionCoverage;
+
+/*
+ * The part of an image filters and brushes change, a mask of how much each
+ * pixel is selected, out of 255. Shapes have antialiased edges.
+ *
+ * The mask is classified by EDITOR_TILE_SIZE tile as empty, full or
+ * partial, with the bounds of what is selected in each tile and in the
+ * whole image, so callers skip what isn't selected and only mix in the
+ * pixels at the edges. While nothing or everything is selected there is no
+ * mask and everything counts as selected.
+ */
+class Selection {
+private:
+  int32_t width, height;
+  int32_t tiles_x, tiles_y;
+  // empty while everything is selected.
+  std::vector<uint8_t> mask;
+  // per tile, its SelectionCoverage and the part of it with any selected.
+  std::vector<uint8_t> tile_coverage;
+  std::vector<Rect> tile_bounds;
+  Rect bbox;
+  // bumped whenever what is selected changes.
+  uint64_t changes;
+
+public:
+  /*
+   * Constructor, for an empty image.
+   */
+  Selection();
+
+  /*
+   * Selects everything of an image of the given size.
+   */
+  void reset(int32_t width, int32_t height);
+
+  /*
+   * Selects everything, dropping the mask.
+   */
+  void select_all();
+
+  /*
+   * Whether only a part of the image is selected.
+   */
+  bool is_active() const;
+
+  /*
+   * Smallest rect covering what is selected, the whole image if inactive.
+   */
+  Rect bounds() const;
+
+  /*
+   * Changes whenever what is selected does.
+   */
+  uint64_t generation() const;
+
+  /*
+   * Selects the pixels inside `rect`.
+   */
+  void select_rect(Rect rect, SelectionMode mode);
+
+  /*
+   * Selects the ellipse inscribed in `rect`.
+   */
+  void select_ellipse(Rect rect, SelectionMode mode);
+
+  /*
+   * Selects the inside of the polygon through `points`, in image
+   * coordinates where pixel x, y spans x to x + 1 and y to y + 1, closed
+   * back to the first. Parts it crosses over itself in are outside.
+   */
+  void select_polygon(const std::vector<Vec2<float>> &points,
+                      SelectionMode mode);
+
+  /*
+   * How much of `rect` is selected, by the tiles it touches. Partial may
+   * still hold no selected pixel.
+   */
+  SelectionCoverage coverage(Rect rect) const;
+
+  /*
+   * Mask of row y from x on, only while active.
+   */
+  const uint8_t *mask_row(int32_t x, int32_t y) const;
+
+  /*
+   * Copies `src` into `dst`, views of the same part of images of the same
+   * format, as far as it is selected, mixing the two at the edges. Tiles
+   * run across threads.
+   */
+  void merge(ImageView src, ImageView dst) const;
+
+private:
+  /*
+   * Part of the image tile t covers.
+   */
+  Rect tile_rect(size_t t) const;
+
+  /*
+   * Combines the shape into the mask over `area`, the part of the image it
+   * covers. `spans(y, xs)` fills xs with the x where the edges cross row y,
+   * sorted, the shape being inside between every other pair.
+   */
+  template <typename Spans>
+  void fill(Rect area, SelectionMode mode, const Spans &spans);
+
+  /*
+   * Classifies the tiles `rect` touches again and updates the bounds, and
+   * drops the mask once everything or nothing is selected.
+   */
+  void classify(Rect rect);
+};
@@ -0,0 +1,340 @@
+#include "src/shader_filter.hpp"
+#include "nhlog.h"
+#include <cstring>
+
+// same GLSL version the UI's context is created for, see UI::UI.
+// before GLSL 3.30 `#line n` numbers the next line n + 1.
+#if defined(IMGUI_IMPL_OPENGL_ES3)
+#define SHADER_VERSION "#version 300 es\nprecision highp float;\n"
+#define SHADER_FIRST_LINE "#line 1\n"
+#elif defined(__APPLE__)
+#define SHADER_VERSION "#version 150\n"
+#define SHADER_FIRST_LINE "#line 0\n"
+#else
+#define SHADER_VERSION "#version 130\n"
+#define SHADER_FIRST_LINE "#line 0\n"
+#endif
+
+#define SHADER_LOG_SIZE 1024
+
+// full screen triangle, no vertex buffer needed.
+static const char *vertex_source =
+    SHADER_VERSION "out vec2 uv;\n"
+                   "void main() {\n"
+                   "  vec2 pos = vec2(gl_VertexID == 1 ? 3.0 : -1.0,\n"
+                   "                  gl_VertexID == 2 ? 3.0 : -1.0);\n"
+                   "  uv = (pos + 1.0) * 0.5;\n"
+                   "  gl_Position = vec4(pos, 0.0, 1.0);\n"
+                   "}\n";
+
+static const char *fragment_prelude = SHADER_VERSION
+    "uniform sampler2D image;\n"
+    "uniform vec2 image_size;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n";
+
+/*
+ * Compiles one shader stage from the given sources.
+ * @returns the shader, 0 if failed
+ */
+static GLuint compile_stage(GLenum stage, GLsizei count,
+                            const char *const *sources, std::string &error) {
+  GLuint shader = glCreateShader(stage);
+  glShaderSource(shader, count, sources, nullptr);
+  glCompileShader(shader);
+
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (GL_TRUE != compiled) {
+    char log[SHADER_LOG_SIZE] = {0};
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    error = log;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+/*
+ * Constructor, GL objects are created on the first render.
+ */
+ShaderFilter::ShaderFilter()
+    : output({.texture_id = 0}), program(0), framebuffer(0), vertex_array(0),
+      width(0), height(0), input_generation(0), rendered(false) {}
+
+/*
+ * Deletes all GL objects.
+ */
+ShaderFilter::~ShaderFilter() {
+  if (0 != this->program) {
+    glDeleteProgram(this->program);
+  }
+  if (0 != this->framebuffer) {
+    glDeleteFramebuffers(1, &this->framebuffer);
+  }
+  if (0 != this->vertex_array) {
+    glDeleteVertexArrays(1, &this->vertex_array);
+  }
+  if (0 != this->output.texture_id) {
+    glDeleteTextures(1, &this->output.texture_id);
+  }
+}
+
+/*
+ * Renders `input` through the plugin's shader with its current vars,
+ * unless neither changed since the last render.
+ * @param generation - changes whenever the contents of `input` do
+ * @param error - compile or link log if failed
+ * @returns true if succeeded, false if failed
+ */
+bool ShaderFilter::render(const Plugin &plugin, Texture input,
+                          uint64_t generation, int32_t width, int32_t height,
+                          std::string &error) {
+  const char *source = plugin.shader_source();
+  if (nullptr == source) {
+    error = "plugin returned no shader source";
+    return false;
+  }
+  if (0 == this->program || this->source != source) {
+    if (!this->compile(plugin, source, error)) {
+      return false;
+    }
+  }
+  if (this->width != width || this->height != height) {
+    if (!this->resize(width, height, error)) {
+      return false;
+    }
+  }
+
+  size_t vars_size = PluginManager::calc_vars_size(plugin);
+  const uint8_t *vars = static_cast<const uint8_t *>(plugin.replace_image_data);
+  if (this->rendered && this->input_generation == generation &&
+      this->vars.size() == vars_size &&
+      0 == std::memcmp(this->vars.data(), vars, vars_size)) {
+    return true;
+  }
+
+  // the UI renders right after, put back everything it relies on.
+  GLint last_framebuffer, last_program, last_vertex_array, last_texture;
+  GLint last_viewport[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &last_program);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &last_vertex_array);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+  glGetIntegerv(GL_VIEWPORT, last_viewport);
+  GLboolean last_blend = glIsEnabled(GL_BLEND);
+  GLboolean last_scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+  glViewport(0, 0, width, height);
+  glDisable(GL_BLEND);
+  glDisable(GL_SCISSOR_TEST);
+  glUseProgram(this->program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, input.texture_id);
+  glUniform1i(glGetUniformLocation(this->program, "image"), 0);
+  glUniform2f(glGetUniformLocation(this->program, "image_size"),
+              static_cast<float>(width), static_cast<float>(height));
+  this->set_uniforms(plugin);
+  glBindVertexArray(this->vertex_array);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindVertexArray(static_cast<GLuint>(last_vertex_array));
+  glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(last_texture));
+  glUseProgram(static_cast<GLuint>(last_program));
+  glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(last_framebuffer));
+  glViewport(last_viewport[0], last_viewport[1], last_viewport[2],
+             last_viewport[3]);
+  if (last_blend) {
+    glEnable(GL_BLEND);
+  }
+  if (last_scissor) {
+    glEnable(GL_SCISSOR_TEST);
+  }
+
+  this->vars.assign(vars, vars + vars_size);
+  this->input_generation = generation;
+  this->rendered = true;
+  return true;
+}
+
+/*
+ * Reads the output back into `data`, tightly packed rows of `channels`
+ * samples of `sample_type` per pixel.
+ */
+void ShaderFilter::read_back(uint8_t *data, int32_t channels,
+                             SampleType sample_type) {
+  GLint last_framebuffer;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  TextureFormat format = texture_format(channels, sample_type);
+  if (2 != channels) {
+    glReadPixels(0, 0, this->width, this->height, format.format, format.type,
+                 data);
+  } else {
+    // grey and alpha are the red and alpha of the output, GL can't read
+    // those two alone.
+    size_t size = sample_size(sample_type);
+    size_t pixels = static_cast<size_t>(this->width) *
+                    static_cast<size_t>(this->height);
+    std::vector<uint8_t> rgba(pixels * 4 * size);
+    glReadPixels(0, 0, this->width, this->height, GL_RGBA, format.type,
+                 rgba.data());
+    for (size_t i = 0; i < pixels; i++) {
+      std::memcpy(data + i * 2 * size, rgba.data() + i * 4 * size, size);
+      std::memcpy(data + (i * 2 + 1) * size, rgba.data() + (i * 4 + 3) * size,
+                  size);
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(last_framebuffer));
+}
+
+/*
+ * Compiles and links `source` into `program`.
+ * @returns true if succeeded, false if failed
+ */
+bool ShaderFilter::compile(const Plugin &plugin, const char *source,
+                           std::string &error) {
+  // every var becomes a uniform of the same name.
+  std::string uniforms;
+  const PluginInfo *info = plugin.info();
+  for (size_t i = 0; i < info->vars_len; i++) {
+    switch (info->vars[i].type) {
+    case TYPE_FLOAT:
+      uniforms += "uniform float ";
+      break;
+    case TYPE_INT:
+      uniforms += "uniform int ";
+      break;
+    case TYPE_BOOL:
+      uniforms += "uniform bool ";
+      break;
+    }
+    uniforms += info->vars[i].name;
+    uniforms += ";\n";
+  }
+  // errors point at lines of the plugin's source.
+  uniforms += SHADER_FIRST_LINE;
+
+  GLuint vertex = compile_stage(GL_VERTEX_SHADER, 1, &vertex_source, error);
+  if (0 == vertex) {
+    return false;
+  }
+  const char *fragment_sources[] = {fragment_prelude, uniforms.c_str(),
+                                    source};
+  GLuint fragment =
+      compile_stage(GL_FRAGMENT_SHADER, 3, fragment_sources, error);
+  if (0 == fragment) {
+    glDeleteShader(vertex);
+    return false;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertex);
+  glAttachShader(program, fragment);
+#ifndef IMGUI_IMPL_OPENGL_ES3
+  glBindFragDataLocation(program, 0, "color");
+#endif
+  glLinkProgram(program);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (GL_TRUE != linked) {
+    char log[SHADER_LOG_SIZE] = {0};
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    error = log;
+    glDeleteProgram(program);
+    return false;
+  }
+
+  if (0 != this->program) {
+    glDeleteProgram(this->program);
+  }
+  if (0 == this->vertex_array) {
+    glGenVertexArrays(1, &this->vertex_array);
+  }
+  nhlog_debug("ShaderFilter: compiled shader of %s", info->name);
+  this->program = program;
+  this->source = source;
+  this->rendered = false;
+  return true;
+}
+
+/*
+ * (Re)creates the output texture and framebuffer at the given size.
+ * @returns true if succeeded, false if failed
+ */
+bool ShaderFilter::resize(int32_t width, int32_t height, std::string &error) {
+  if (0 == this->output.texture_id) {
+    glGenTextures(1, &this->output.texture_id);
+  }
+  GLint last_texture, last_framebuffer;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
+
+  glBindTexture(GL_TEXTURE_2D, this->output.texture_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  // 16 bit, so applying a shader to a 16 bit image keeps its precision.
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_SHORT, nullptr);
+
+  if (0 == this->framebuffer) {
+    glGenFramebuffers(1, &this->framebuffer);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         this->output.texture_id, 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(last_framebuffer));
+  glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(last_texture));
+
+  if (GL_FRAMEBUFFER_COMPLETE != status) {
+    error = "framebuffer incomplete: " + std::to_string(status);
+    this->width = this->height = 0;
+    return false;
+  }
+  this->width = width;
+  this->height = height;
+  this->rendered = false;
+  return true;
+}
+
+/*
+ * Sets the uniform of every var from the plugin's var block.
+ */
+void ShaderFilter::set_uniforms(const Plugin &plugin) {
+  const PluginInfo *info = plugin.info();
+  const char *vars_data_ptr = (const char *)plugin.replace_image_data;
+  for (size_t i = 0; i < info->vars_len; i++) {
+    GLint location = glGetUniformLocation(this->program, info->vars[i].name);
+    switch (info->vars[i].type) {
+    case TYPE_FLOAT: {
+      float value;
+      memcpy(&value, vars_data_ptr, sizeof(float));
+      glUniform1f(location, value);
+      vars_data_ptr += sizeof(float);
+      break;
+    }
+    case TYPE_INT: {
+      int32_t value;
+      memcpy(&value, vars_data_ptr, sizeof(int32_t));
+      glUniform1i(location, value);
+      vars_data_ptr += sizeof(int32_t);
+      break;
+    }
+    case TYPE_BOOL: {
+      bool value;
+      memcpy(&value, vars_data_ptr, sizeof(bool));
+      glUniform1i(location, value ? 1 : 0);
+      vars_data_ptr += sizeof(bool);
+      break;
+    }
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.hpp"
+#include "glad/glad.h"
+#include "src/plugins_manager.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Runs shader plugins: renders the image texture through the plugin's
+ * fragment shader into a texture of the same size, on the GPU. The result
+ * is only read back to the CPU when asked to.
+ */
+class ShaderFilter {
+public:
+  // the shader's output, valid after a successful render.
+  Texture output;
+
+private:
+  GLuint program;
+  GLuint framebuffer;
+  GLuint vertex_array;
+  int32_t width, height;
+
+  // what the output was last rendered from, so unchanged frames are skipped.
+  std::string source;
+  std::vector<uint8_t> vars;
+  uint64_t input_generation;
+  bool rendered;
+
+public:
+  /*
+   * Constructor, GL objects are created on the first render.
+   */
+  ShaderFilter();
+
+  /*
+   * Deletes all GL objects.
+   */
+  ~ShaderFilter();
+
+  ShaderFilter(const ShaderFilter &) = delete;
+  ShaderFilter &operator=(const ShaderFilter &) = delete;
+
+  /*
+   * Renders `input` through the plugin's shader with its current vars,
+   * unless neither changed since the last render.
+   * @param generation - changes whenever the contents of `input` do
+   * @param error - compile or link log if failed
+   * @returns true if succeeded, false if failed
+   */
+  bool render(const Plugin &plugin, Texture input, uint64_t generation,
+              int32_t width, int32_t height, std::string &error);
+
+  /*
+   * Reads the output back into `data`, tightly packed rows of `channels`
+   * samples of `sample_type` per pixel.
+   */
+  void read_back(uint8_t *data, int32_t channels, SampleType sample_type);
+
+private:
+  /*
+   * Compiles and links `source` into `program`.
+   * @returns true if succeeded, false if failed
+   */
+  bool compile(const Plugin &plugin, const char *source, std::string &error);
+
+  /*
+   * (Re)creates the output texture and framebuffer at the given size.
+   * @returns true if succeeded, false if failed
+   */
+  bool resize(int32_t width, int32_t height, std::string &error);
+
+  /*
+   * Sets the uniform of every var from the plugin's var block.
+   */
+  void set_uniforms(const Plugin &plugin);
+};
@@ -0,0 +1,188 @@
+#include "src/thread_pool.hpp"
+#include "common.hpp"
+#include "nhlog.h"
+#include <algorithm>
+
+ThreadPool *ThreadPool::shared = nullptr;
+thread_local ThreadPool *ThreadPool::current_pool = nullptr;
+thread_local size_t ThreadPool::current_queue = 0;
+thread_local TaskPriority ThreadPool::current_priority =
+    TASK_PRIORITY_INTERACTIVE;
+
+namespace {
+/*
+ * One parallel_for call, shared between its caller and the tasks helping
+ * it. Helpers may still hold it after the call returned, they find no items
+ * left then.
+ */
+struct Batch {
+  const std::function<void(size_t)> *fn;
+  size_t count;
+  std::atomic<size_t> next = 0;
+  std::atomic<size_t> done = 0;
+  std::mutex mutex;
+  std::condition_variable finished;
+};
+
+void run_items(Batch &batch) {
+  for (size_t i = batch.next++; i < batch.count; i = batch.next++) {
+    (*batch.fn)(i);
+    if (++batch.done == batch.count) {
+      std::lock_guard lock(batch.mutex);
+      batch.finished.notify_all();
+    }
+  }
+}
+} // namespace
+
+/*
+ * Starts the workers.
+ * @param thread_count - 0 starts one per hardware thread but one, threads
+ * calling parallel_for work on it too
+ */
+ThreadPool::ThreadPool(size_t thread_count) : queued(0), stopping(false) {
+  if (0 == thread_count) {
+    thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  }
+  for (size_t i = 0; i <= thread_count; i++) {
+    this->queues.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    this->threads.emplace_back(&ThreadPool::run_worker, this, i);
+  }
+  nhlog_info("ThreadPool: started %zu workers", thread_count);
+}
+
+/*
+ * Runs the queued tasks to the end and stops the workers.
+ */
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(this->sleep_mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (auto &thread : this->threads) {
+    thread.join();
+  }
+  if (this == ThreadPool::shared) {
+    ThreadPool::shared = nullptr;
+  }
+}
+
+/*
+ * Number of worker threads.
+ */
+size_t ThreadPool::thread_count() const { return this->threads.size(); }
+
+/*
+ * Runs `fn(i)` for every i in [0, count) across the workers and the
+ * calling thread, at the priority of the task calling it, interactive
+ * outside of tasks. Returns once all of them have finished.
+ */
+void ThreadPool::parallel_for(size_t count,
+                              const std::function<void(size_t)> &fn) {
+  if (count <= 1 || this->threads.empty()) {
+    for (size_t i = 0; i < count; i++) {
+      fn(i);
+    }
+    return;
+  }
+
+  auto batch = std::make_shared<Batch>();
+  batch->fn = &fn;
+  batch->count = count;
+  // the calling thread takes items too, so one helper less is enough.
+  size_t helpers = std::min(count - 1, this->threads.size());
+  for (size_t i = 0; i < helpers; i++) {
+    this->push([batch]() { run_items(*batch); }, current_priority);
+  }
+  run_items(*batch);
+
+  // every item is taken by now, the ones still running don't need this
+  // thread to finish.
+  std::unique_lock lock(batch->mutex);
+  batch->finished.wait(lock, [&]() { return batch->done == batch->count; });
+}
+
+/*
+ * Same as above, over the tiles of at most tile_size x tile_size pixels
+ * `rect` splits into.
+ */
+void ThreadPool::parallel_for_tiles(Rect rect, int32_t tile_size,
+                                    const std::function<void(Rect)> &fn) {
+  std::vector<Rect> tiles = split_into_tiles(rect, tile_size);
+  this->parallel_for(tiles.size(), [&](size_t i) { fn(tiles[i]); });
+}
+
+/*
+ * Queues a task, on the calling worker's own queue if it is one.
+ */
+void ThreadPool::push(Task task, TaskPriority priority) {
+  size_t queue = this == current_pool ? current_queue : this->threads.size();
+  // counted first, so it never drops below the tasks actually queued.
+  {
+    std::lock_guard lock(this->sleep_mutex);
+    this->queued++;
+  }
+  {
+    std::lock_guard lock(this->queues[queue]->mutex);
+    this->queues[queue]->tasks[priority].push_back(std::move(task));
+  }
+  this->wake.notify_one();
+}
+
+/*
+ * Takes the next task for the given queue's worker.
+ * @returns false if there are none
+ */
+bool ThreadPool::pop(size_t queue, Task &task, TaskPriority &priority) {
+  size_t queue_count = this->queues.size();
+  for (size_t p = 0; p < TASK_PRIORITY_COUNT; p++) {
+    // own newest first, it is likely still in cache, then the oldest of the
+    // shared queue and the other workers.
+    for (size_t i = 0; i < queue_count; i++) {
+      size_t victim = (queue + i) % queue_count;
+      Queue &q = *this->queues[victim];
+      std::lock_guard lock(q.mutex);
+      if (q.tasks[p].empty()) {
+        continue;
+      }
+      if (victim == queue) {
+        task = std::move(q.tasks[p].back());
+        q.tasks[p].pop_back();
+      } else {
+        task = std::move(q.tasks[p].front());
+        q.tasks[p].pop_front();
+      }
+      priority = static_cast<TaskPriority>(p);
+      this->queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Body of the worker threads.
+ */
+void ThreadPool::run_worker(size_t queue) {
+  current_pool = this;
+  current_queue = queue;
+  while (true) {
+    Task task;
+    TaskPriority priority;
+    if (this->pop(queue, task, priority)) {
+      current_priority = priority;
+      task();
+      continue;
+    }
+
+    std::unique_lock lock(this->sleep_mutex);
+    this->wake.wait(lock,
+                    [this]() { return this->stopping || 0 < this->queued; });
+    if (this->stopping && 0 == this->queued) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "plugin_base.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Which tasks workers pick first. Interactive work is what the user is
+ * waiting on right now, background work only has to finish eventually.
+ */
+enum TaskPriority {
+  TASK_PRIORITY_INTERACTIVE = 0,
+  TASK_PRIORITY_BACKGROUND = 1,
+  TASK_PRIORITY_COUNT = 2,
+};
+
+/*
+ * Fixed set of worker threads shared by everything in the program that
+ * wants to run in parallel, so cores are never oversubscribed.
+ *
+ * Every worker has a queue of its own per priority. Tasks queued from a
+ * worker go to its own queue and it takes the newest first, tasks queued
+ * from other threads go to a shared queue. Idle workers take from the
+ * shared queue and steal the oldest tasks of the other workers. Interactive
+ * tasks are always taken before background ones, a task runs to the end
+ * once started.
+ */
+class ThreadPool {
+public:
+  // the pool parallel_for and plugins run on, null runs them inline.
+  static ThreadPool *shared;
+
+private:
+  using Task = std::function<void()>;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks[TASK_PRIORITY_COUNT];
+  };
+
+  // one per worker, then the shared one.
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  // sleeping workers wait for tasks to be queued.
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<size_t> queued;
+  bool stopping;
+
+  // pool and queue of the calling thread if it is a worker, and the
+  // priority of the task it runs.
+  static thread_local ThreadPool *current_pool;
+  static thread_local size_t current_queue;
+  static thread_local TaskPriority current_priority;
+
+public:
+  /*
+   * Starts the workers.
+   * @param thread_count - 0 starts one per hardware thread but one, threads
+   * calling parallel_for work on it too
+   */
+  explicit ThreadPool(size_t thread_count);
+
+  /*
+   * Runs the queued tasks to the end and stops the workers.
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /*
+   * Number of worker threads.
+   */
+  size_t thread_count() const;
+
+  /*
+   * Queues `fn` to run on a worker.
+   * @returns a future for what fn returns
+   */
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(TaskPriority priority, F &&fn) {
+    using R = std::invoke_result_t<F>;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    std::future<R> future = task->get_future();
+    this->push([task]() { (*task)(); }, priority);
+    return future;
+  }
+
+  /*
+   * Runs `fn(i)` for every i in [0, count) across the workers and the
+   * calling thread, at the priority of the task calling it, interactive
+   * outside of tasks. Returns once all of them have finished.
+   */
+  void parallel_for(size_t count, const std::function<void(size_t)> &fn);
+
+  /*
+   * Same as above, over the tiles of at most tile_size x tile_size pixels
+   * `rect` splits into.
+   */
+  void parallel_for_tiles(Rect rect, int32_t tile_size,
+                          const std::function<void(Rect)> &fn);
+
+private:
+  /*
+   * Queues a task, on the calling worker's own queue if it is one.
+   */
+  void push(Task task, TaskPriority priority);
+
+  /*
+   * Takes the next task for the given queue's worker.
+   * @returns false if there are none
+   */
+  bool pop(size_t queue, Task &task, TaskPriority &priority);
+
+  /*
+   * Body of the worker threads.
+   */
+  void run_worker(size_t queue);
+};
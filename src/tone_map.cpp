@@ -0,0 +1,154 @@
+#include "src/tone_map.hpp"
+#include "nhlog.h"
+#include "src/config.hpp"
+#include "src/pixel_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/*
+ * Constructor, sized by reset.
+ */
+ToneMap::ToneMap()
+    : width(0), height(0), channels(0), tiles_x(0), tiles_y(0), version(1),
+      stops(0.0f) {}
+
+/*
+ * Sizes the display copy for the given image, every tile is stale.
+ */
+void ToneMap::reset(const Image &img) {
+  this->width = img.width;
+  this->height = img.height;
+  this->channels = img.channels;
+  this->tiles_x = (img.width + TONE_MAP_TILE_SIZE - 1) / TONE_MAP_TILE_SIZE;
+  this->tiles_y = (img.height + TONE_MAP_TILE_SIZE - 1) / TONE_MAP_TILE_SIZE;
+  this->pixels.assign(static_cast<size_t>(img.width) *
+                          static_cast<size_t>(img.height) *
+                          static_cast<size_t>(img.channels),
+                      0);
+  this->tile_versions.assign(static_cast<size_t>(this->tiles_x) *
+                                 static_cast<size_t>(this->tiles_y),
+                             0);
+}
+
+/*
+ * Frees the display copy.
+ */
+void ToneMap::clear() {
+  this->width = this->height = this->channels = 0;
+  this->tiles_x = this->tiles_y = 0;
+  this->pixels = std::vector<uint8_t>();
+  this->tile_versions = std::vector<uint64_t>();
+}
+
+/*
+ * Sets the exposure in stops, every tile goes stale.
+ */
+void ToneMap::set_exposure(float stops) {
+  if (stops != this->stops) {
+    this->stops = stops;
+    this->version++;
+  }
+}
+
+/*
+ * Exposure in stops.
+ */
+float ToneMap::exposure() const { return this->stops; }
+
+/*
+ * Marks the tiles under `rect` stale, after its pixels changed.
+ */
+void ToneMap::invalidate(Rect rect) {
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, bounds);
+  if (rect.width <= 0 || rect.height <= 0) {
+    return;
+  }
+  int32_t x0 = rect.x / TONE_MAP_TILE_SIZE;
+  int32_t y0 = rect.y / TONE_MAP_TILE_SIZE;
+  int32_t x1 = (rect.x + rect.width - 1) / TONE_MAP_TILE_SIZE;
+  int32_t y1 = (rect.y + rect.height - 1) / TONE_MAP_TILE_SIZE;
+  for (int32_t ty = y0; ty <= y1; ty++) {
+    for (int32_t tx = x0; tx <= x1; tx++) {
+      this->tile_versions[static_cast<size_t>(ty * this->tiles_x + tx)] = 0;
+    }
+  }
+}
+
+/*
+ * Maps the stale tiles `rect` touches out of `img`, across threads.
+ * @returns the part of the display copy that changed, empty if none
+ */
+Rect ToneMap::refresh(const Image &img, Rect rect) {
+  Rect changed = {.x = 0, .y = 0, .width = 0, .height = 0};
+  Rect bounds = {.x = 0, .y = 0, .width = this->width, .height = this->height};
+  rect = grow_rect(rect, 0, bounds);
+  if (SAMPLE_TYPE_F32 != img.sample_type || img.width != this->width ||
+      img.height != this->height || img.channels != this->channels ||
+      rect.width <= 0 || rect.height <= 0) {
+    return changed;
+  }
+
+  std::vector<Rect> stale;
+  int32_t x0 = rect.x / TONE_MAP_TILE_SIZE;
+  int32_t y0 = rect.y / TONE_MAP_TILE_SIZE;
+  int32_t x1 = (rect.x + rect.width - 1) / TONE_MAP_TILE_SIZE;
+  int32_t y1 = (rect.y + rect.height - 1) / TONE_MAP_TILE_SIZE;
+  for (int32_t ty = y0; ty <= y1; ty++) {
+    for (int32_t tx = x0; tx <= x1; tx++) {
+      uint64_t &tile_version =
+          this->tile_versions[static_cast<size_t>(ty * this->tiles_x + tx)];
+      if (this->version == tile_version) {
+        continue;
+      }
+      tile_version = this->version;
+      Rect tile = {.x = tx * TONE_MAP_TILE_SIZE,
+                   .y = ty * TONE_MAP_TILE_SIZE,
+                   .width = TONE_MAP_TILE_SIZE,
+                   .height = TONE_MAP_TILE_SIZE};
+      tile = grow_rect(tile, 0, bounds);
+      stale.push_back(tile);
+      changed = union_rect(changed, tile);
+    }
+  }
+  if (stale.empty()) {
+    return changed;
+  }
+
+  const PixelKernels &kernels = pixel_kernels();
+  const float scale = std::exp2(this->stops);
+  const size_t channels = static_cast<size_t>(this->channels);
+  const size_t stride = static_cast<size_t>(this->width) * channels;
+  const float *src = reinterpret_cast<const float *>(img.data);
+  parallel_for(stale.size(), [&](size_t i) {
+    const Rect &tile = stale[i];
+    size_t offset = static_cast<size_t>(tile.x) * channels;
+    for (int32_t y = tile.y; y < tile.y + tile.height; y++) {
+      size_t row = static_cast<size_t>(y) * stride + offset;
+      kernels.tone_map(src + row, this->pixels.data() + row, channels,
+                       static_cast<size_t>(tile.width), scale);
+    }
+  });
+  nhlog_trace("ToneMap: mapped %zu tiles at %.2f stops", stale.size(),
+              static_cast<double>(this->stops));
+  return changed;
+}
+
+/*
+ * The display copy, tiles not refreshed since they went stale are out of
+ * date.
+ */
+ImageView ToneMap::view() {
+  return ImageView{
+      .data = this->pixels.data(),
+      .x = 0,
+      .y = 0,
+      .width = this->width,
+      .height = this->height,
+      .channels = this->channels,
+      .stride = static_cast<size_t>(this->width) *
+                static_cast<size_t>(this->channels),
+      .sample_type = SAMPLE_TYPE_U8,
+  };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.hpp"
+#include "plugins/plugin_base.hpp"
+#include <cstdint>
+#include <vector>
+
+/*
+ * 8 bit display copy of a float image, tone mapped tile by tile.
+ *
+ * Tiles of TONE_MAP_TILE_SIZE go stale when the pixels under them or the
+ * exposure change, and are only mapped again once asked for, which the
+ * editor does for the visible part of the image. Changing the exposure
+ * costs the visible tiles only and never touches the float pixels.
+ */
+class ToneMap {
+private:
+  std::vector<uint8_t> pixels;
+  int32_t width, height, channels;
+  int32_t tiles_x, tiles_y;
+  // version each tile was last mapped at, 0 for never. Bumped whenever the
+  // exposure changes.
+  std::vector<uint64_t> tile_versions;
+  uint64_t version;
+  float stops;
+
+public:
+  /*
+   * Constructor, sized by reset.
+   */
+  ToneMap();
+
+  /*
+   * Sizes the display copy for the given image, every tile is stale.
+   */
+  void reset(const Image &img);
+
+  /*
+   * Frees the display copy.
+   */
+  void clear();
+
+  /*
+   * Sets the exposure in stops, every tile goes stale.
+   */
+  void set_exposure(float stops);
+
+  /*
+   * Exposure in stops.
+   */
+  float exposure() const;
+
+  /*
+   * Marks the tiles under `rect` stale, after its pixels changed.
+   */
+  void invalidate(Rect rect);
+
+  /*
+   * Maps the stale tiles `rect` touches out of `img`, across threads.
+   * @returns the part of the display copy that changed, empty if none
+   */
+  Rect refresh(const Image &img, Rect rect);
+
+  /*
+   * The display copy, tiles not refreshed since they went stale are out of
+   * date.
+   */
+  ImageView view();
+};
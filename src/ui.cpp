@@ -14,9 +14,11 @@
 #include <GLFW/glfw3.h>
 #include <algorithm>
 #include <cfloat>
+#include <cmath>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #define NFD_NATIVE
 #include "nhlog.h"
 #include <cassert>
@@ -25,10 +27,11 @@
 #ifdef _WIN32
 const wchar_t *default_path = L"default.png";
 static nfdfilteritem_t open_dialog_filter_list[1] = {
-    {L"Image", L"png,jpg,jpeg"}};
+    {L"Image", L"png,jpg,jpeg,hdr"}};
 #else
 const char *default_path = "default.png";
-static nfdfilteritem_t open_dialog_filter_list[1] = {{"Image", "png,jpg,jpeg"}};
+static nfdfilteritem_t open_dialog_filter_list[1] = {
+    {"Image", "png,jpg,jpeg,hdr"}};
 #endif
 
 static void glfw_error_callback(int error, const char *description) {
@@ -36,13 +39,67 @@ static void glfw_error_callback(int error, const char *description) {
   std::abort();
 }
 
+/*
+ * Inputs for the vars of a plugin, laid out as in its vars block.
+ * @returns whether any changed
+ */
+static bool edit_vars(const PluginInfo *info, std::vector<uint8_t> &vars) {
+  bool changed = false;
+  uint8_t *var_ptr = vars.data();
+  for (size_t i = 0; i < info->vars_len; i++) {
+    auto var = info->vars[i];
+    switch (var.type) {
+    case TYPE_FLOAT: {
+      float value;
+      memcpy(&value, var_ptr, sizeof(float));
+      if (ImGui::InputFloat(var.name, &value, 0, 0, 0)) {
+        memcpy(var_ptr, &value, sizeof(float));
+        changed = true;
+      }
+      var_ptr += sizeof(float);
+      break;
+    }
+    case TYPE_INT: {
+      int32_t value;
+      memcpy(&value, var_ptr, sizeof(int32_t));
+      if (ImGui::InputInt(var.name, &value, 0, 0, 0)) {
+        memcpy(var_ptr, &value, sizeof(int32_t));
+        changed = true;
+      }
+      var_ptr += sizeof(int32_t);
+      break;
+    }
+    case TYPE_BOOL: {
+      bool value;
+      memcpy(&value, var_ptr, sizeof(bool));
+      if (ImGui::Checkbox(var.name, &value)) {
+        memcpy(var_ptr, &value, sizeof(bool));
+        changed = true;
+      }
+      var_ptr += sizeof(bool);
+      break;
+    }
+    default: {
+      nhlog_error("UI: var.type invalid for %s", info->name);
+      std::abort();
+    }
+    }
+  }
+  return changed;
+}
+
 /*
  * constructor
  */
 UI::UI() noexcept
-    : scale(1.0f), pan(ImVec2(0.0f, 0.0f)), active_plugin_index(-1),
-      last_pos_put_pixel(Vec2(-1, -1)), last_put_pixel_time(0) {
+    : scale(1.0f), pan(ImVec2(0.0f, 0.0f)),
+      visible_rect({.x = 0, .y = 0, .width = 0, .height = 0}),
+      active_plugin_index(-1), previewing_plugin_index(-1),
+      expression_source{}, selection_tool(SELECTION_TOOL_NONE),
+      last_pos_put_pixel(Vec2(-1.0f, -1.0f)), last_put_pixel_time(0) {
   nhlog_info("UI: ui init");
+  std::strncpy(this->expression_source, UI_DEFAULT_EXPRESSION,
+               sizeof(this->expression_source) - 1);
   glfwSetErrorCallback(glfw_error_callback);
   if (!glfwInit()) {
     nhlog_fatal("UI: glfw init failed");
@@ -224,39 +281,53 @@ void UI::update_layout_sidebar() {
           ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoNavFocus);
 
   ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 10.f);
+  const ImGuiStyle &style = ImGui::GetStyle();
+  const ImVec2 button_size =
+      ImVec2(PLUGIN_ICON_SIZE + style.FramePadding.x * 2,
+             PLUGIN_ICON_SIZE + style.FramePadding.y * 2);
+  ImTextureID atlas = plugins_manager->icon_atlas.texture.texture_id;
+
+  // button frames and icons are drawn into separate channels, so the icons,
+  // which all come from the same atlas, end up in a single draw call.
+  ImDrawList *draw_list = ImGui::GetWindowDrawList();
+  draw_list->ChannelsSplit(2);
   for (int32_t i = 0; i < plugins_manager->plugins.size(); i++) {
-    Plugin plugin = plugins_manager->plugins[static_cast<size_t>(i)];
-    if (PLUGIN_TYPE_PUT_PIXEL != plugin.info_function()->plugin_type) {
+    const Plugin &plugin = plugins_manager->plugins[static_cast<size_t>(i)];
+    if (PLUGIN_TYPE_PUT_PIXEL != plugin.info()->plugin_type) {
       continue;
     }
 
-    if (i == this->active_plugin_index) {
-      ImGui::PushStyleColor(ImGuiCol_Button,
-                            ImVec4(COLOR_SECONDARY_BACKGROUND));
-
-      if (ImGui::ImageButton(plugin.info_function()->name,
-                             plugin.icon.texture_id,
-                             ImVec2(PLUGIN_ICON_SIZE, PLUGIN_ICON_SIZE))) {
-        this->active_plugin_index = i;
-      }
-
-      ImGui::PopStyleColor();
-    } else {
-      if (ImGui::ImageButton(plugin.info_function()->name,
-                             plugin.icon.texture_id,
-                             ImVec2(PLUGIN_ICON_SIZE, PLUGIN_ICON_SIZE))) {
-        this->active_plugin_index = i;
-      }
+    if (ImGui::InvisibleButton(plugin.info()->name, button_size)) {
+      this->active_plugin_index = i;
     }
+    ImVec2 min = ImGui::GetItemRectMin();
+    ImVec2 max = ImGui::GetItemRectMax();
+
+    ImU32 frame_color =
+        ImGui::IsItemActive()    ? ImGui::GetColorU32(ImGuiCol_ButtonActive)
+        : ImGui::IsItemHovered() ? ImGui::GetColorU32(ImGuiCol_ButtonHovered)
+        : i == this->active_plugin_index
+            ? ImGui::GetColorU32(ImVec4(COLOR_SECONDARY_BACKGROUND))
+            : ImGui::GetColorU32(ImGuiCol_Button);
+    draw_list->ChannelsSetCurrent(0);
+    draw_list->AddRectFilled(min, max, frame_color, style.FrameRounding);
+
+    draw_list->ChannelsSetCurrent(1);
+    draw_list->AddImage(
+        atlas,
+        ImVec2(min.x + style.FramePadding.x, min.y + style.FramePadding.y),
+        ImVec2(max.x - style.FramePadding.x, max.y - style.FramePadding.y),
+        plugin.icon_uv0, plugin.icon_uv1);
 
     if (ImGui::BeginItemTooltip()) {
-      ImGui::Text("%s", plugin.info_function()->name);
+      ImGui::Text("%s", plugin.info()->name);
       ImGui::PushFontSize(ImGui::GetFontSize() * 0.8f);
-      ImGui::Text("%s", plugin.info_function()->description);
+      ImGui::Text("%s", plugin.info()->description);
       ImGui::PopFontSize();
       ImGui::EndTooltip();
     }
   }
+  draw_list->ChannelsMerge();
   ImGui::PopStyleVar();
   ImGui::End();
 }
@@ -329,11 +400,47 @@ void UI::update_layout_bottombar() {
   App::global_app_context->editor.editor_state.put_pixel_size =
       std::max(1, App::global_app_context->editor.editor_state.put_pixel_size);
 
+  Editor *editor = &App::global_app_context->editor;
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(100.0f);
+  int opacity = editor->editor_state.opacity;
+  if (ImGui::SliderInt("opacity", &opacity, 0, 100, "%d%%")) {
+    editor->editor_state.opacity =
+        static_cast<uint8_t>(std::clamp(opacity, 0, 100));
+  }
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(100.0f);
+  ImGui::SliderInt("hardness", &editor->brush_hardness, 0, 100, "%d%%",
+                   ImGuiSliderFlags_AlwaysClamp);
+  ImGui::SameLine();
+  ImGui::Checkbox("AA", &editor->brush_antialias);
+  if (ImGui::BeginItemTooltip()) {
+    ImGui::Text("Soft edges on brush dabs.");
+    ImGui::EndTooltip();
+  }
+  ImGui::SameLine();
+  ImGui::Checkbox("linear", &editor->brush_linear_light);
+  if (ImGui::BeginItemTooltip()) {
+    ImGui::Text("Blends brush dabs in linear light instead of sRGB.");
+    ImGui::EndTooltip();
+  }
+
+  // float images are shown through an exposure.
+  if (nullptr != editor->img.data &&
+      SAMPLE_TYPE_F32 == editor->img.sample_type) {
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(120.0f);
+    float stops = editor->exposure();
+    if (ImGui::SliderFloat("exposure", &stops, -TONE_MAP_MAX_STOPS,
+                           TONE_MAP_MAX_STOPS, "%.1f stops")) {
+      editor->set_exposure(stops);
+    }
+  }
+
   ImGui::End();
 }
 
 void UI::update_layout_rightbar() {
-  // Editor *editor = &App::global_app_context->editor;
 
   ImGuiViewportP *viewport = (ImGuiViewportP *)(void *)ImGui::GetMainViewport();
   PluginManager *plugins_manager = &App::global_app_context->plugins_manager;
@@ -343,11 +450,180 @@ void UI::update_layout_rightbar() {
       ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse |
           ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoNavFocus);
 
+  Editor *editor = &App::global_app_context->editor;
+  if (editor->is_job_running()) {
+    float progress = editor->job_progress();
+    ImGui::ProgressBar(progress, ImVec2(-1.0f, 0.0f),
+                       0.0f < progress ? nullptr : "Working...");
+    if (ImGui::Button("Cancel")) {
+      editor->cancel_job();
+    }
+  }
+  // the image is locked while a job runs.
+  ImGui::BeginDisabled(editor->is_job_running());
+
+  const LayerStack &layers = editor->layer_stack();
+  if (0 < layers.size() &&
+      ImGui::CollapsingHeader("Layers", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::PushFontSize(ImGui::GetFontSize() * 0.8f);
+    // top of the stack first.
+    for (size_t i = layers.size(); 0 < i--;) {
+      const Layer &layer = layers.layer(i);
+      ImGui::PushID(static_cast<int>(i));
+      bool visible = layer.visible;
+      if (ImGui::Checkbox("##VISIBLE", &visible)) {
+        editor->set_layer_blending(i, visible, layer.opacity, layer.mode);
+      }
+      ImGui::SameLine();
+      if (ImGui::Selectable(layer.name.c_str(), i == layers.active_index())) {
+        editor->select_layer(i);
+      }
+      ImGui::PopID();
+    }
+
+    size_t active = layers.active_index();
+    const Layer &layer = layers.layer(active);
+    int opacity = layer.opacity;
+    BlendMode mode = layer.mode;
+    bool changed = ImGui::SliderInt("opacity##LAYER", &opacity, 0, 100,
+                                    "%d%%", ImGuiSliderFlags_AlwaysClamp);
+    if (ImGui::BeginCombo("mode", blend_mode_name(mode))) {
+      for (int32_t m = 0; m < BLEND_MODE_COUNT; m++) {
+        auto option = static_cast<BlendMode>(m);
+        if (ImGui::Selectable(blend_mode_name(option), option == mode)) {
+          mode = option;
+          changed = true;
+        }
+      }
+      ImGui::EndCombo();
+    }
+    if (changed) {
+      editor->set_layer_blending(active, layer.visible, opacity, mode);
+    }
+
+    if (ImGui::Button("Add")) {
+      editor->add_layer();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Remove")) {
+      editor->remove_layer();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Up")) {
+      editor->move_layer(1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Down")) {
+      editor->move_layer(-1);
+    }
+    ImGui::PopFontSize();
+  }
+
+  const Selection &selection = editor->current_selection();
+  if (nullptr != editor->img.data &&
+      ImGui::CollapsingHeader("Selection", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::PushFontSize(ImGui::GetFontSize() * 0.8f);
+    int tool = this->selection_tool;
+    ImGui::RadioButton("Paint", &tool, SELECTION_TOOL_NONE);
+    ImGui::SameLine();
+    ImGui::RadioButton("Rect", &tool, SELECTION_TOOL_RECT);
+    ImGui::SameLine();
+    ImGui::RadioButton("Ellipse", &tool, SELECTION_TOOL_ELLIPSE);
+    ImGui::SameLine();
+    ImGui::RadioButton("Freehand", &tool, SELECTION_TOOL_FREEHAND);
+    this->selection_tool = static_cast<SelectionTool>(tool);
+    if (ImGui::BeginItemTooltip()) {
+      ImGui::Text("Drag over the image to select. Shift adds to the "
+                  "selection, Alt subtracts from it.");
+      ImGui::EndTooltip();
+    }
+    if (selection.is_active()) {
+      Rect bounds = selection.bounds();
+      ImGui::Text("%d x %d at %d, %d", bounds.width, bounds.height, bounds.x,
+                  bounds.y);
+      ImGui::SameLine();
+      if (ImGui::Button("Select all")) {
+        editor->select_all();
+      }
+    } else {
+      ImGui::TextDisabled("Everything is selected");
+    }
+    ImGui::PopFontSize();
+  }
+
+  const FilterGraph &adjustments = editor->adjustment_graph();
+  if (0 < adjustments.size() &&
+      ImGui::CollapsingHeader("Adjustments", ImGuiTreeNodeFlags_DefaultOpen)) {
+    ImGui::PushFontSize(ImGui::GetFontSize() * 0.8f);
+    int32_t removed = -1;
+    for (size_t i = 0; i < adjustments.size(); i++) {
+      const FilterNode &node = adjustments.node(i);
+      ImGui::PushID(static_cast<int>(i));
+      bool enabled = node.enabled;
+      std::vector<uint8_t> vars = node.vars;
+      bool changed = ImGui::Checkbox("##ENABLED", &enabled);
+      ImGui::SameLine();
+      bool open = ImGui::TreeNode(node.plugin.info()->name);
+      ImGui::SameLine();
+      if (ImGui::SmallButton("Remove")) {
+        removed = static_cast<int32_t>(i);
+      }
+      if (open) {
+        changed |= edit_vars(node.plugin.info(), vars);
+        ImGui::TreePop();
+      }
+      if (changed) {
+        editor->set_adjustment(i, enabled, vars);
+      }
+      ImGui::PopID();
+    }
+    if (0 <= removed) {
+      editor->remove_adjustment(static_cast<size_t>(removed));
+    }
+    if (ImGui::Button("Apply all")) {
+      editor->apply_adjustments();
+    }
+    if (ImGui::BeginItemTooltip()) {
+      ImGui::Text("Writes the adjustments into the layer and drops them.");
+      ImGui::EndTooltip();
+    }
+    const FilterGraphProfile &profile = adjustments.profile();
+    if (0 < profile.nodes) {
+      ImGui::TextDisabled("Last run: %zu nodes in %zu passes, %zu fused, "
+                          "%.0f ms",
+                          profile.nodes, profile.passes, profile.fused_nodes,
+                          profile.milliseconds);
+    }
+    ImGui::PopFontSize();
+  }
+
+  // built-in, always first.
+  if (ImGui::CollapsingHeader("Expression")) {
+    ImGui::PushFontSize(ImGui::GetFontSize() * 0.8f);
+    if (ImGui::BeginItemTooltip()) {
+      ImGui::Text("Per pixel filter. Assign to r, g, b or a (0 to 1), can "
+                  "read them and x, y, width, height.");
+      ImGui::EndTooltip();
+    }
+    ImGui::InputTextMultiline("##EXPRESSION", this->expression_source,
+                              sizeof(this->expression_source),
+                              ImVec2(-1.0f, ImGui::GetTextLineHeight() * 4));
+    if (ImGui::Button("Apply")) {
+      editor->apply_expression(this->expression_source,
+                               this->expression_error);
+    }
+    if (!this->expression_error.empty()) {
+      ImGui::TextWrapped("Failed: %s", this->expression_error.c_str());
+    }
+    ImGui::PopFontSize();
+  }
+
   for (size_t i = 0; i < plugins_manager->plugins.size(); i++) {
     Plugin plugin = plugins_manager->plugins[i];
-    PluginInfo *info = plugin.info_function();
+    const PluginInfo *info = plugin.info();
 
-    if (PLUGIN_TYPE_REPLACE_IMAGE != info->plugin_type) {
+    if (PLUGIN_TYPE_REPLACE_IMAGE != info->plugin_type &&
+        PLUGIN_TYPE_SHADER != info->plugin_type) {
       continue;
     }
 
@@ -393,14 +669,87 @@ void UI::update_layout_rightbar() {
         }
       }
 
-      if (ImGui::Button("Apply")) {
-        App::global_app_context->editor.replace_image(
-            plugin.callback.replace_image, plugin.replace_image_data);
-      };
+      int32_t index = static_cast<int32_t>(i);
+      bool previewing = index == this->previewing_plugin_index;
+      if (ImGui::Checkbox("Preview", &previewing)) {
+        this->previewing_plugin_index = previewing ? index : -1;
+      }
+      if (ImGui::BeginItemTooltip()) {
+        ImGui::Text("Shows the result live while tweaking the vars.");
+        ImGui::EndTooltip();
+      }
+
+      if (PLUGIN_TYPE_SHADER == info->plugin_type) {
+        if (ImGui::Button("Apply") && plugins_manager->ensure_loaded(i) &&
+            editor->apply_shader(plugins_manager->plugins[i])) {
+          this->previewing_plugin_index = -1;
+        }
+      } else {
+        ImGui::Checkbox("Isolated", &plugins_manager->plugins[i].sandboxed);
+        if (ImGui::BeginItemTooltip()) {
+          ImGui::Text("Runs in a separate process, a crashing plugin won't "
+                      "take the editor down.");
+          ImGui::EndTooltip();
+        }
+        if (plugins_manager->plugins[i].handles(SAMPLE_TYPE_F32)) {
+          ImGui::SameLine();
+          ImGui::Checkbox("Linear light",
+                          &plugins_manager->plugins[i].linear_light);
+          if (ImGui::BeginItemTooltip()) {
+            ImGui::Text("Filters in linear light instead of sRGB, so blurs "
+                        "and blends don't darken edges. Slower.");
+            ImGui::EndTooltip();
+          }
+        }
+
+        // isolated plugins are only ever opened by the helper process.
+        if (ImGui::Button("Apply") &&
+            (plugins_manager->plugins[i].sandboxed ||
+             plugins_manager->ensure_loaded(i)) &&
+            editor->replace_image(plugins_manager->plugins[i])) {
+          this->previewing_plugin_index = -1;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Adjust") && plugins_manager->ensure_loaded(i) &&
+            editor->add_adjustment(plugins_manager->plugins[i])) {
+          this->previewing_plugin_index = -1;
+        }
+        if (ImGui::BeginItemTooltip()) {
+          ImGui::Text("Adds the filter as an adjustment instead, its vars "
+                      "stay editable and the pixels under it unchanged.");
+          ImGui::EndTooltip();
+        }
+      }
+      const std::string &error = editor->plugin_error;
+      if (!error.empty()) {
+        ImGui::TextWrapped("Failed: %s", error.c_str());
+      }
       ImGui::PopFontSize();
     }
   }
 
+  ImGui::EndDisabled();
+
+  // the preview follows the vars and the image as they change.
+  size_t previewing = static_cast<size_t>(this->previewing_plugin_index);
+  const Plugin *plugin = 0 <= this->previewing_plugin_index &&
+                                 previewing < plugins_manager->plugins.size()
+                             ? &plugins_manager->plugins[previewing]
+                             : nullptr;
+  if (nullptr != plugin && !plugin->sandboxed &&
+      !plugins_manager->ensure_loaded(previewing)) {
+    plugin = nullptr;
+  }
+  if (nullptr != plugin &&
+      PLUGIN_TYPE_SHADER == plugin->info()->plugin_type) {
+    editor->preview_shader(*plugin);
+  } else if (nullptr != plugin) {
+    editor->preview_replace_image(*plugin, this->visible_rect, this->scale);
+  } else {
+    this->previewing_plugin_index = -1;
+    editor->stop_preview();
+  }
+
   ImGui::End();
 }
 
@@ -442,16 +791,47 @@ void UI::update_layout_image_window() {
       this->last_pos_put_pixel.x = this->last_pos_put_pixel.y = -1;
     }
 
+    // dragging a selection, it is made once let go.
+    if (SELECTION_TOOL_NONE != this->selection_tool &&
+        nullptr != editor->img.data) {
+      ImVec2 mouse = ImGui::GetMousePos();
+      ImVec2 window = ImGui::GetWindowPos();
+      Vec2<float> at = Vec2(
+          (mouse.x - window.x -
+           (float)top_left_of_image_relative_to_image_window.x) /
+              this->scale,
+          (mouse.y - window.y -
+           (float)top_left_of_image_relative_to_image_window.y) /
+              this->scale);
+      if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+        this->selection_points = {at};
+      } else if (ImGui::IsMouseDown(ImGuiMouseButton_Left) &&
+                 !this->selection_points.empty()) {
+        // freehand keeps a point per screen pixel moved, the others the
+        // corners of the rect dragged.
+        if (SELECTION_TOOL_FREEHAND != this->selection_tool) {
+          this->selection_points.resize(2);
+          this->selection_points[1] = at;
+        } else if (1.0f <= (at - this->selection_points.back()).dist() *
+                               this->scale) {
+          this->selection_points.push_back(at);
+        }
+      }
+    }
+
     // clicked over the image.
     if (ImGui::IsMouseDown(ImGuiMouseButton_Left) &&
+        SELECTION_TOOL_NONE == this->selection_tool &&
         -1 != this->active_plugin_index &&
+        !App::global_app_context->editor.is_job_running() &&
+        App::global_app_context->plugins_manager.ensure_loaded(
+            static_cast<size_t>(this->active_plugin_index)) &&
         // we only draw if it have been more than EDITOR_PUT_PIXEL_DELAY_MS
         (now - this->last_put_pixel_time).count() > EDITOR_PUT_PIXEL_DELAY_MS) {
 
       nhlog_debug("drawing over image");
       this->last_put_pixel_time = now;
 
-      EditorState es = App::global_app_context->editor.editor_state;
       // calc mouse position relative to image.
       Vec2 absolute_mouse_pos = Vec2<std::int32_t>(ImGui::GetMousePos());
       Vec2 window_pos = Vec2<std::int32_t>(ImGui::GetWindowPos());
@@ -482,35 +862,36 @@ void UI::update_layout_image_window() {
                 (top_left_of_image_relative_to_image_window.y +
                  image_scaled_size.y)) {
 
-          // finally calculate mouse position relative to image.
-          Vec2<std::int32_t> mouse_relative_to_image =
-              Vec2(static_cast<std::int32_t>(
-                       ((float)relative_mouse_pos.x -
-                        (float)top_left_of_image_relative_to_image_window.x) /
-                       this->scale),
-                   static_cast<std::int32_t>(
-                       ((float)relative_mouse_pos.y -
-                        (float)top_left_of_image_relative_to_image_window.y) /
-                       this->scale));
-          nhlog_trace("UI: clicking inside image at x = %d, y = %d",
-                      mouse_relative_to_image.x, mouse_relative_to_image.y);
-
-          Color color =
+          // finally calculate mouse position relative to image, keeping the
+          // fraction so dabs can land anywhere in a pixel.
+          ImVec2 mouse = ImGui::GetMousePos();
+          ImVec2 window = ImGui::GetWindowPos();
+          Vec2<float> mouse_relative_to_image =
+              Vec2((mouse.x - window.x -
+                    (float)top_left_of_image_relative_to_image_window.x) /
+                       this->scale,
+                   (mouse.y - window.y -
+                    (float)top_left_of_image_relative_to_image_window.y) /
+                       this->scale);
+          nhlog_trace("UI: clicking inside image at x = %f, y = %f",
+                      (double)mouse_relative_to_image.x,
+                      (double)mouse_relative_to_image.y);
+
+          const Plugin &plugin =
               App::global_app_context->plugins_manager
-                  .plugins[static_cast<size_t>(this->active_plugin_index)]
-                  .callback.put_pixel(es, mouse_relative_to_image.to_imvec2());
+                  .plugins[static_cast<size_t>(this->active_plugin_index)];
 
           // if last frame mouse wasnt clicking on the image.
           if (this->last_pos_put_pixel.x < 0 ||
               this->last_pos_put_pixel.y < 0) {
             this->last_pos_put_pixel = mouse_relative_to_image;
-            App::global_app_context->editor.draw_cirlce(mouse_relative_to_image,
-                                                        color);
+            App::global_app_context->editor.draw_dab(mouse_relative_to_image,
+                                                     plugin);
           }
           // but if last frame mouse was clicking on the image we lerp through
           // these two mouse positions
           else {
-            Vec2<std::int32_t> diff =
+            Vec2<float> diff =
                 mouse_relative_to_image - this->last_pos_put_pixel;
             auto step_spacing =
                 (EDITOR_LERP_STEP_SPACING_PERCENT / 100) *
@@ -519,14 +900,17 @@ void UI::update_layout_image_window() {
 
             // lerp through each step
             for (std::int32_t i = 0; i <= steps; i++) {
-              float t = static_cast<float>(i) / static_cast<float>(steps);
-              Vec2<std::int32_t> pos = Vec2<std::int32_t>::lerp(
+              float t = 0 == steps ? 1.0f
+                                   : static_cast<float>(i) /
+                                         static_cast<float>(steps);
+              Vec2<float> pos = Vec2<float>::lerp(
                   this->last_pos_put_pixel, mouse_relative_to_image, t);
 
-              App::global_app_context->editor.draw_cirlce(pos, color);
+              App::global_app_context->editor.draw_dab(pos, plugin);
             }
           }
 
+          App::global_app_context->editor.upload_dabs();
           this->last_pos_put_pixel = mouse_relative_to_image;
         }
       }
@@ -580,11 +964,113 @@ void UI::update_layout_image_window() {
   } else {
     this->last_pos_put_pixel.x = this->last_pos_put_pixel.y = -1;
   }
+
+  if (!this->selection_points.empty() &&
+      !ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+    SelectionMode mode = ImGui::IsKeyDown(ImGuiKey_LeftShift)
+                             ? SELECTION_ADD
+                         : ImGui::IsKeyDown(ImGuiKey_LeftAlt)
+                             ? SELECTION_SUBTRACT
+                             : SELECTION_REPLACE;
+    Vec2<float> a = this->selection_points.front();
+    Vec2<float> b = this->selection_points.back();
+    int32_t x0 = static_cast<int32_t>(std::round(std::min(a.x, b.x)));
+    int32_t y0 = static_cast<int32_t>(std::round(std::min(a.y, b.y)));
+    Rect dragged = {
+        .x = x0,
+        .y = y0,
+        .width = static_cast<int32_t>(std::round(std::max(a.x, b.x))) - x0,
+        .height = static_cast<int32_t>(std::round(std::max(a.y, b.y))) - y0};
+    // a click without a drag selects nothing, which selects everything.
+    if (SELECTION_TOOL_RECT == this->selection_tool) {
+      editor->select_rect(dragged, mode);
+    } else if (SELECTION_TOOL_ELLIPSE == this->selection_tool) {
+      editor->select_ellipse(dragged, mode);
+    } else if (this->selection_points.size() < 3) {
+      editor->select_rect(Rect{.x = 0, .y = 0, .width = 0, .height = 0},
+                          mode);
+    } else {
+      editor->select_polygon(this->selection_points, mode);
+    }
+    this->selection_points.clear();
+  }
+  // part of the image inside the window, what filter previews run over and
+  // float images are tone mapped for.
+  ImVec2 window_size = ImGui::GetWindowSize();
+  float left = (float)-top_left_of_image_relative_to_image_window.x;
+  float top = (float)-top_left_of_image_relative_to_image_window.y;
+  int32_t x0 = std::max(0, static_cast<int32_t>(left / this->scale));
+  int32_t y0 = std::max(0, static_cast<int32_t>(top / this->scale));
+  int32_t x1 = std::min(editor->img.width,
+                        static_cast<int32_t>(std::ceil(
+                            (left + window_size.x) / this->scale)));
+  int32_t y1 = std::min(editor->img.height,
+                        static_cast<int32_t>(std::ceil(
+                            (top + window_size.y) / this->scale)));
+  this->visible_rect = {.x = x0,
+                        .y = y0,
+                        .width = std::max(0, x1 - x0),
+                        .height = std::max(0, y1 - y0)};
+
+  editor->update_display(this->visible_rect);
   ImGui::SetCursorPos(top_left_of_image_relative_to_image_window.to_imvec2());
-  ImGui::Image((ImTextureID)(intptr_t)editor->texture.texture_id,
+  ImGui::Image((ImTextureID)(intptr_t)editor->display_texture().texture_id,
                ImVec2((float)editor->img.width * this->scale,
                       (float)editor->img.height * this->scale));
 
+  Texture preview;
+  Rect rect;
+  if (editor->replace_image_preview(preview, rect)) {
+    ImVec2 image_pos = ImGui::GetWindowPos();
+    image_pos.x -= left;
+    image_pos.y -= top;
+    ImGui::GetWindowDrawList()->AddImage(
+        (ImTextureID)(intptr_t)preview.texture_id,
+        ImVec2(image_pos.x + (float)rect.x * this->scale,
+               image_pos.y + (float)rect.y * this->scale),
+        ImVec2(image_pos.x + (float)(rect.x + rect.width) * this->scale,
+               image_pos.y + (float)(rect.y + rect.height) * this->scale));
+  }
+
+  // bounds of the selection, and the shape being dragged.
+  ImDrawList *draw_list = ImGui::GetWindowDrawList();
+  ImU32 outline = ImGui::GetColorU32(ImGuiCol_Text);
+  ImVec2 origin = ImGui::GetWindowPos();
+  origin.x -= left;
+  origin.y -= top;
+  auto to_screen = [&](float x, float y) {
+    return ImVec2(origin.x + x * this->scale, origin.y + y * this->scale);
+  };
+  const Selection &selection = editor->current_selection();
+  if (selection.is_active()) {
+    Rect bounds = selection.bounds();
+    draw_list->AddRect(
+        to_screen((float)bounds.x, (float)bounds.y),
+        to_screen((float)(bounds.x + bounds.width),
+                  (float)(bounds.y + bounds.height)),
+        outline);
+  }
+  if (2 <= this->selection_points.size()) {
+    Vec2<float> a = this->selection_points.front();
+    Vec2<float> b = this->selection_points.back();
+    if (SELECTION_TOOL_RECT == this->selection_tool) {
+      draw_list->AddRect(to_screen(a.x, a.y), to_screen(b.x, b.y), outline);
+    } else if (SELECTION_TOOL_ELLIPSE == this->selection_tool) {
+      draw_list->AddEllipse(
+          to_screen(0.5f * (a.x + b.x), 0.5f * (a.y + b.y)),
+          ImVec2(0.5f * std::abs(b.x - a.x) * this->scale,
+                 0.5f * std::abs(b.y - a.y) * this->scale),
+          outline);
+    } else {
+      std::vector<ImVec2> points;
+      for (Vec2<float> p : this->selection_points) {
+        points.push_back(to_screen(p.x, p.y));
+      }
+      draw_list->AddPolyline(points.data(), static_cast<int>(points.size()),
+                             outline, ImDrawFlags_Closed, 1.0f);
+    }
+  }
+
   ImGui::End();
 }
 
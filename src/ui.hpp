@@ -3,12 +3,16 @@
 #include "glad/glad.h"
 #include "imgui.h"
 #include "src/common.hpp"
+#include "src/config.hpp"
 #include <GLFW/glfw3.h>
 #include <chrono>
 #include <cstdint>
 #include <expected>
 #include <memory>
+#include <optional>
 #include <queue>
+#include <string>
+#include <vector>
 
 #define UI_FONT_ID_REGULAR 0
 #define UI_FONT_ID_BOLD 1
@@ -22,6 +26,16 @@ typedef enum {
   NOTIF_SUCCESS,
 } NotifType;
 
+/*
+ * What dragging over the image selects, nothing for painting.
+ */
+typedef enum {
+  SELECTION_TOOL_NONE,
+  SELECTION_TOOL_RECT,
+  SELECTION_TOOL_ELLIPSE,
+  SELECTION_TOOL_FREEHAND,
+} SelectionTool;
+
 /*
  * A single notification
  */
@@ -40,8 +54,19 @@ public:
 private:
   float scale;
   Vec2<float> pan;
+  // part of the image inside the image window, as of the last frame.
+  Rect visible_rect;
   int32_t active_plugin_index;
-  Vec2<std::int32_t> last_pos_put_pixel;
+  // plugin whose output is previewed live, -1 if none.
+  int32_t previewing_plugin_index;
+  // text of the built-in expression filter, and why it last failed.
+  char expression_source[EXPRESSION_MAX_LENGTH];
+  std::string expression_error;
+  // tool dragging over the image selects with, and the points of the drag
+  // so far, in image coordinates.
+  SelectionTool selection_tool;
+  std::vector<Vec2<float>> selection_points;
+  Vec2<float> last_pos_put_pixel;
   std::chrono::milliseconds last_put_pixel_time;
 
 public:
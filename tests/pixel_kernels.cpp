@@ -0,0 +1,299 @@
+#include "nhlog.h"
+#include "pixel_format.hpp"
+#include "src/pixel_kernels.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+/*
+ * Checks that every pixel kernel variant the CPU supports gives exactly the
+ * bytes the scalar reference gives, over random pixels, channel counts and
+ * lengths, the odd ones exercising the loop tails, and that blending is
+ * source-over onto pixels that aren't opaque.
+ */
+
+#define TEST_ROUNDS 200
+#define TEST_MAX_COUNT 300
+
+static std::mt19937 rng(1234);
+static int failures = 0;
+
+static size_t random_count() {
+  return std::uniform_int_distribution<size_t>(0, TEST_MAX_COUNT)(rng);
+}
+
+static size_t random_channels() {
+  return std::uniform_int_distribution<size_t>(1, 4)(rng);
+}
+
+static std::vector<uint8_t> random_bytes(size_t count) {
+  std::vector<uint8_t> bytes(count);
+  for (uint8_t &byte : bytes) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  // runs of the values kernels special case.
+  if (0 < count && 0 == rng() % 4) {
+    std::fill(bytes.begin(), bytes.begin() + static_cast<ptrdiff_t>(count / 2),
+              0 == rng() % 2 ? 0 : 255);
+  }
+  return bytes;
+}
+
+/*
+ * Floats around and beyond [0, 1], with some exact 0 and 1.
+ */
+static std::vector<float> random_floats(size_t count) {
+  std::uniform_real_distribution<float> values(-0.5f, 6.0f);
+  std::vector<float> floats(count);
+  for (float &value : floats) {
+    uint32_t pick = rng() % 8;
+    value = 0 == pick ? 0.0f : 1 == pick ? 1.0f : values(rng);
+  }
+  return floats;
+}
+
+static std::vector<Color> random_colors(size_t count) {
+  std::vector<uint8_t> bytes = random_bytes(count * 4);
+  std::vector<Color> colors(count);
+  std::memcpy(colors.data(), bytes.data(), bytes.size());
+  return colors;
+}
+
+/*
+ * Compares the bytes of what the variant and the reference wrote.
+ */
+template <typename T>
+static void expect_same(const char *variant, const char *kernel,
+                        const std::vector<T> &expected,
+                        const std::vector<T> &actual, size_t channels,
+                        size_t count) {
+  if (0 == std::memcmp(expected.data(), actual.data(),
+                       expected.size() * sizeof(T))) {
+    return;
+  }
+  std::fprintf(stderr, "%s: %s differs from scalar, %zu channels, %zu "
+                       "pixels\n",
+               variant, kernel, channels, count);
+  failures++;
+}
+
+static void test_variant(const PixelKernels &ref, const PixelKernels &k) {
+  for (int32_t round = 0; round < TEST_ROUNDS; round++) {
+    size_t count = random_count();
+    size_t channels = random_channels();
+    uint8_t opacity = static_cast<uint8_t>(rng());
+    std::vector<uint8_t> coverage = random_bytes(count);
+
+    {
+      std::vector<Color> src = random_colors(count);
+      std::vector<Color> expected = random_colors(count), actual = expected;
+      ref.blend(expected.data(), src.data(), coverage.data(), count, opacity);
+      k.blend(actual.data(), src.data(), coverage.data(), count, opacity);
+      expect_same(k.name, "blend", expected, actual, 4, count);
+
+      expected = actual = random_colors(count);
+      ref.blend_linear(expected.data(), src.data(), coverage.data(), count,
+                       opacity);
+      k.blend_linear(actual.data(), src.data(), coverage.data(), count,
+                     opacity);
+      expect_same(k.name, "blend_linear", expected, actual, 4, count);
+
+      for (int32_t mode = 0; mode < BLEND_MODE_COUNT; mode++) {
+        expected = actual = random_colors(count);
+        ref.composite(expected.data(), src.data(), count, opacity,
+                      static_cast<BlendMode>(mode));
+        k.composite(actual.data(), src.data(), count, opacity,
+                    static_cast<BlendMode>(mode));
+        expect_same(k.name, blend_mode_name(static_cast<BlendMode>(mode)),
+                    expected, actual, 4, count);
+      }
+    }
+
+    {
+      size_t value_channels =
+          std::uniform_int_distribution<size_t>(1, channels)(rng);
+      std::vector<uint8_t> value = random_bytes(4);
+      std::vector<uint8_t> expected = random_bytes(count * channels);
+      std::vector<uint8_t> actual = expected;
+      ref.fill_span(expected.data(), channels, value.data(), value_channels,
+                    count);
+      k.fill_span(actual.data(), channels, value.data(), value_channels,
+                  count);
+      expect_same(k.name, "fill_span", expected, actual, channels, count);
+    }
+
+    {
+      size_t dst_channels = random_channels();
+      std::vector<uint8_t> src = random_bytes(count * channels);
+      std::vector<uint8_t> expected(count * dst_channels), actual(expected);
+      ref.convert(src.data(), channels, expected.data(), dst_channels, count);
+      k.convert(src.data(), channels, actual.data(), dst_channels, count);
+      expect_same(k.name, "convert", expected, actual, channels, count);
+
+      std::vector<uint32_t> sums(count), actual_sums(count);
+      for (size_t i = 0; i < count; i++) {
+        sums[i] = actual_sums[i] = static_cast<uint32_t>(rng() % 100000);
+      }
+      ref.box_sum(src.data(), sums.data(), count);
+      k.box_sum(src.data(), actual_sums.data(), count);
+      expect_same(k.name, "box_sum", sums, actual_sums, 1, count);
+
+      std::vector<uint8_t> lut = random_bytes(256);
+      expected.assign(count, 0);
+      actual.assign(count, 0);
+      ref.apply_lut(src.data(), expected.data(), lut.data(), count);
+      k.apply_lut(src.data(), actual.data(), lut.data(), count);
+      expect_same(k.name, "apply_lut", expected, actual, 1, count);
+    }
+
+    {
+      std::vector<uint8_t> row0 = random_bytes(2 * count * channels);
+      std::vector<uint8_t> row1 = random_bytes(2 * count * channels);
+      std::vector<uint8_t> expected(count * channels), actual(expected);
+      ref.downsample(row0.data(), row1.data(), expected.data(), channels,
+                     count);
+      k.downsample(row0.data(), row1.data(), actual.data(), channels, count);
+      expect_same(k.name, "downsample", expected, actual, channels, count);
+    }
+
+    {
+      std::vector<uint8_t> src = random_bytes(count * channels);
+      std::vector<float> expected(count * channels), actual(expected);
+      ref.decode_srgb(src.data(), expected.data(), channels, count);
+      k.decode_srgb(src.data(), actual.data(), channels, count);
+      expect_same(k.name, "decode_srgb", expected, actual, channels, count);
+
+      std::vector<float> floats = random_floats(count * channels);
+      std::vector<uint8_t> encoded(count * channels), actual_encoded(encoded);
+      ref.encode_srgb(floats.data(), encoded.data(), channels, count);
+      k.encode_srgb(floats.data(), actual_encoded.data(), channels, count);
+      expect_same(k.name, "encode_srgb", encoded, actual_encoded, channels,
+                  count);
+
+      float exposure = std::exp2(
+          std::uniform_real_distribution<float>(-4.0f, 4.0f)(rng));
+      ref.tone_map(floats.data(), encoded.data(), channels, count, exposure);
+      k.tone_map(floats.data(), actual_encoded.data(), channels, count,
+                 exposure);
+      expect_same(k.name, "tone_map", encoded, actual_encoded, channels,
+                  count);
+    }
+
+    {
+      std::vector<float> src = random_floats(count * 4);
+      float float_opacity = static_cast<float>(opacity) / 255.0f;
+      for (int32_t mode = 0; mode < BLEND_MODE_COUNT; mode++) {
+        std::vector<float> expected = random_floats(count * 4);
+        std::vector<float> actual = expected;
+        ref.composite_float(expected.data(), src.data(), count,
+                            float_opacity, static_cast<BlendMode>(mode));
+        k.composite_float(actual.data(), src.data(), count, float_opacity,
+                          static_cast<BlendMode>(mode));
+        expect_same(k.name, "composite_float", expected, actual, 4, count);
+      }
+    }
+  }
+}
+
+/*
+ * Blends random colors over random pixels, transparent ones among them,
+ * and compares with source-over worked out in floats from the 8 bit alphas
+ * the kernels mix by. Linear blends are only checked for alpha, and for
+ * keeping the color over transparency.
+ */
+static void test_source_over(const PixelKernels &k, bool linear) {
+  const char *kernel = linear ? "blend_linear" : "blend";
+  auto blend = linear ? k.blend_linear : k.blend;
+
+  // half a red dab on nothing is red.
+  Color red = {.r = 255, .g = 0, .b = 0, .a = 255};
+  Color pixel = {.r = 0, .g = 0, .b = 0, .a = 0};
+  uint8_t full = 255;
+  blend(&pixel, &red, &full, 1, 128);
+  if (255 != pixel.r || 0 != pixel.g || 0 != pixel.b || 128 != pixel.a) {
+    std::fprintf(stderr,
+                 "%s: %s of half red over nothing is %d %d %d %d\n",
+                 k.name, kernel, pixel.r, pixel.g, pixel.b, pixel.a);
+    failures++;
+  }
+
+  size_t count = TEST_MAX_COUNT;
+  std::vector<Color> src = random_colors(count);
+  std::vector<Color> dst = random_colors(count);
+  std::vector<uint8_t> coverage = random_bytes(count);
+  for (size_t i = 0; i < count; i += 3) {
+    dst[i].a = 0;
+  }
+  std::vector<Color> out = dst;
+  uint8_t opacity = 200;
+  blend(out.data(), src.data(), coverage.data(), count, opacity);
+
+  size_t wrong = 0;
+  for (size_t i = 0; i < count; i++) {
+    auto to_u8 = [](float value) { return std::round(value / 255.0f); };
+    float a = to_u8(to_u8(static_cast<float>(src[i].a * opacity)) *
+                    static_cast<float>(coverage[i]));
+    float kept = to_u8(static_cast<float>(dst[i].a) * (255.0f - a));
+    float covered = a + kept;
+    bool bad = covered != static_cast<float>(out[i].a);
+    const uint8_t *s = &src[i].r, *d = &dst[i].r, *o = &out[i].r;
+    for (size_t c = 0; c < 3 && 0 < out[i].a; c++) {
+      float expected =
+          (static_cast<float>(s[c]) * a + static_cast<float>(d[c]) * kept) /
+          covered;
+      if (!linear) {
+        bad |= 0.5f < std::fabs(expected - static_cast<float>(o[c]));
+      } else if (0 == dst[i].a) {
+        bad |= s[c] != o[c];
+      }
+    }
+    wrong += bad;
+  }
+  if (0 < wrong) {
+    std::fprintf(stderr, "%s: %s isn't source-over at %zu of %zu pixels\n",
+                 k.name, kernel, wrong, count);
+    failures++;
+  }
+}
+
+/*
+ * Same for blending one pixel of a wider format.
+ */
+template <typename T> static void test_format_source_over(const char *name) {
+  using Format = PixelFormat<T, 4>;
+  T pixel[4] = {};
+  Format::blend(pixel, Color{.r = 255, .g = 0, .b = 0, .a = 255}, 0.5f,
+                false);
+  Color color = Format::load(pixel);
+  if (255 != color.r || 0 != color.g || 0 != color.b ||
+      1 < std::abs(128 - color.a)) {
+    std::fprintf(stderr,
+                 "PixelFormat<%s, 4>: half red over nothing is %d %d %d %d\n",
+                 name, color.r, color.g, color.b, color.a);
+    failures++;
+  }
+}
+
+int main() {
+  nhlog_init(NHLOG_WARN, stderr);
+  std::vector<const PixelKernels *> variants = supported_pixel_kernels();
+  for (const PixelKernels *kernels : variants) {
+    test_source_over(*kernels, false);
+    test_source_over(*kernels, true);
+  }
+  test_format_source_over<uint8_t>("uint8_t");
+  test_format_source_over<uint16_t>("uint16_t");
+  test_format_source_over<float>("float");
+  for (size_t i = 1; i < variants.size(); i++) {
+    int before = failures;
+    test_variant(*variants[0], *variants[i]);
+    std::printf("%s: %s\n", variants[i]->name,
+                before == failures ? "same as scalar" : "differs");
+  }
+  if (1 == variants.size()) {
+    std::printf("only the scalar kernels are supported, nothing to compare\n");
+  }
+  return 0 == failures ? 0 : 1;
+}